@@ -0,0 +1,943 @@
+#include "batch.h"
+
+#include <deque>
+#include <functional>
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QTimer>
+
+#include "filesource.h"
+#include "networksource.h"
+#include "signalsource.h"
+
+
+static const uint32_t RMS_PEAK_HOLD_MSEC = 3200;
+static const char FFT_MAGIC[8] = {'S', 'G', 'F', 'F', 'T', '0', '0', '1'};
+static const char RMS_HEADER[] = "t_usec,window_msec,rms,peak\n";
+
+static std::unique_ptr<std::ofstream> open_output(
+        const QString &path,
+        std::ios::openmode mode,
+        const BatchOptions &options)
+{
+    auto out = std::make_unique<std::ofstream>(path.toStdString(),
+                                               mode | std::ios::trunc);
+    if (!*out) {
+        throw std::runtime_error("failed to open output files in "+
+                                 options.output_dir.toStdString());
+    }
+    return out;
+}
+
+
+/* BatchJob */
+
+BatchJob::BatchJob(std::unique_ptr<VirtualAudioSource> &&source,
+                   const QString &name,
+                   const BatchOptions &options,
+                   QObject *parent):
+    QObject(parent),
+    m_name(name),
+    m_duration_msec(options.duration_msec),
+    m_rms_windows(options.rms_windows),
+    m_have_origin(false),
+    m_network_sink(options.network_sink),
+    m_finished(false)
+{
+    const QDir dir(options.output_dir);
+    // the downmix comes first, so that output(i) of the bank stays the
+    // downmix of size i
+    ChannelSelection channels = DOWNMIX_ONLY;
+    const uint32_t channel_count = source->channel_count();
+    if (options.per_channel && channel_count > 1) {
+        for (uint32_t c = 0; c < channel_count; ++c) {
+            channels.push_back(c);
+            m_channel_rms_outs.emplace_back(open_output(
+                    dir.filePath(QString("%1.ch%2.rms.csv").arg(name).arg(c)),
+                    std::ios::out, options));
+            *m_channel_rms_outs.back() << RMS_HEADER;
+        }
+    }
+
+    std::vector<FFTResolution> resolutions;
+    for (const uint32_t size: options.fft_sizes) {
+        resolutions.emplace_back(FFTResolution{size, options.fft_period_msec});
+        const QString path = dir.filePath(QString("%1.%2.fft").arg(name).arg(size));
+        m_fft_outs.emplace_back(open_output(path, std::ios::binary, options));
+        m_fft_outs.back()->write(FFT_MAGIC, sizeof(FFT_MAGIC));
+        for (uint32_t c = 0; c < m_channel_rms_outs.size(); ++c) {
+            m_channel_fft_outs.emplace_back(open_output(
+                    dir.filePath(QString("%1.%2.ch%3.fft").arg(name).arg(size).arg(c)),
+                    std::ios::binary, options));
+            m_channel_fft_outs.back()->write(FFT_MAGIC, sizeof(FFT_MAGIC));
+        }
+        if (options.record_spectrogram) {
+            m_spectrogram_outs.emplace_back(std::make_unique<SpectrogramWriter>(
+                    dir.filePath(QString("%1.%2.sgspec").arg(name).arg(size)),
+                    options.spectrogram_encoding));
+            // sources which follow no clock wait for the disk, through the
+            // throttle of the pipe; live ones drop, which ok() reports
+            m_spectrogram_outs.back()->set_blocking(!source->is_realtime());
+        }
+    }
+    m_rms_out = open_output(dir.filePath(name + ".rms.csv"), std::ios::out, options);
+    *m_rms_out << RMS_HEADER;
+
+    // connected before the processors exist so that the origin is known
+    // before any of them receives the first block
+    connect(&m_engine, &Engine::samples_available,
+            this, [this](std::shared_ptr<const SampleBlock> block){
+                if (!m_have_origin.load(std::memory_order_relaxed)) {
+                    m_origin = block->t;
+                    m_have_origin.store(true, std::memory_order_release);
+                }
+            },
+            Qt::DirectConnection);
+
+    m_rms_calc = std::make_unique<RootMeanSquare>(m_engine.stream(), m_rms_windows,
+                                                  channels);
+    m_fft_bank = std::make_unique<FFTBank>(m_engine.stream(), resolutions,
+                                           options.rigor, channels);
+
+    // the writers run in the processor threads; each stream has exactly one
+    // writer, FFT files are written by the lane of their resolution
+    connect(&m_rms_calc->processor(), &RMSProcessor::result_available,
+            this, [this](std::shared_ptr<const RMSBlock> block){
+                if (block->channel == SampleBlock::DOWNMIX) {
+                    write_rms(*m_rms_out, *block);
+                } else {
+                    write_rms(*m_channel_rms_outs[block->channel], *block);
+                }
+            },
+            Qt::DirectConnection);
+    for (std::size_t i = 0; i < m_fft_outs.size(); ++i) {
+        std::ofstream *out = m_fft_outs[i].get();
+        SpectrogramWriter *spectrogram = m_spectrogram_outs.empty() ?
+                    nullptr : m_spectrogram_outs[i].get();
+        connect(&m_fft_bank->processor().output(i), &FFTBankOutput::result_available,
+                this, [this, out, spectrogram](std::shared_ptr<const RealFFTBlock> block){
+                    write_fft(*out, *block);
+                    if (spectrogram) {
+                        spectrogram->push(*block);
+                    }
+                },
+                Qt::DirectConnection);
+        for (std::size_t c = 0; c < m_channel_rms_outs.size(); ++c) {
+            std::ofstream *channel_out =
+                    m_channel_fft_outs[i * m_channel_rms_outs.size() + c].get();
+            connect(&m_fft_bank->processor().output(i, c + 1),
+                    &FFTBankOutput::result_available,
+                    this, [this, channel_out](std::shared_ptr<const RealFFTBlock> block){
+                        write_fft(*channel_out, *block);
+                    },
+                    Qt::DirectConnection);
+        }
+    }
+
+    // averages run in the lanes as well, right behind the raw frames
+    for (std::size_t i = 0; i < options.fft_sizes.size(); ++i) {
+        for (const AveragingConfig &config: options.averages) {
+            QString average = QString("%1%2")
+                    .arg(averaging_mode_name(config.mode)).arg(config.frames);
+            if (config.output_period_msec > 0) {
+                average += QString("_%1ms").arg(config.output_period_msec);
+            }
+            const QString path = dir.filePath(
+                        QString("%1.%2.%3.fft")
+                        .arg(name).arg(options.fft_sizes[i]).arg(average));
+            m_average_outs.emplace_back(open_output(path, std::ios::binary, options));
+            std::ofstream *out = m_average_outs.back().get();
+            out->write(FFT_MAGIC, sizeof(FFT_MAGIC));
+
+            m_averagers.emplace_back(std::make_unique<SpectralAverager>(
+                                         m_fft_bank->processor().output(i), config));
+            connect(m_averagers.back().get(), &SpectralAverager::result_available,
+                    this, [this, out](std::shared_ptr<const RealFFTBlock> block){
+                        write_fft(*out, *block);
+                    },
+                    Qt::DirectConnection);
+        }
+    }
+
+    if (options.detect_peaks) {
+        PeakDetectorConfig config = PeakDetector::DEFAULT_CONFIG;
+        config.threshold_db = options.peak_threshold_db;
+        for (std::size_t i = 0; i < options.fft_sizes.size(); ++i) {
+            const QString path = dir.filePath(
+                        QString("%1.%2.peaks.csv").arg(name).arg(options.fft_sizes[i]));
+            m_peak_outs.emplace_back(open_output(path, std::ios::out, options));
+            std::ofstream *out = m_peak_outs.back().get();
+            *out << "t_usec,frequency,level_db,floor_db,group,harmonic\n";
+
+            m_peak_detectors.emplace_back(std::make_unique<PeakDetector>(
+                                              m_fft_bank->processor().output(i), config));
+            connect(m_peak_detectors.back().get(), &PeakDetector::result_available,
+                    this, [this, out](std::shared_ptr<const PeakListBlock> block){
+                        write_peaks(*out, *block);
+                    },
+                    Qt::DirectConnection);
+        }
+    }
+
+    for (const ZoomBand &band: options.zoom_bands) {
+        m_zoom_outs.emplace_back(open_output(
+                dir.filePath(QString("%1.zoom%2.%3.%4.%5.fft")
+                             .arg(name).arg(band.center_hz).arg(band.decimation)
+                             .arg(band.size).arg(band.period_msec)),
+                std::ios::binary, options));
+        std::ofstream *out = m_zoom_outs.back().get();
+        out->write(FFT_MAGIC, sizeof(FFT_MAGIC));
+
+        m_zoom_ffts.emplace_back(std::make_unique<ZoomFFT>(m_engine.stream(), band,
+                                                           options.rigor));
+        connect(&m_zoom_ffts.back()->processor(), &ZoomFFTProcessor::result_available,
+                this, [this, out](std::shared_ptr<const RealFFTBlock> block){
+                    write_fft(*out, *block);
+                },
+                Qt::DirectConnection);
+    }
+
+    if (m_network_sink) {
+        for (std::size_t i = 0; i < options.fft_sizes.size(); ++i) {
+            m_network_sink->add_fft_source(m_fft_bank->processor().output(i),
+                                           QString("%1.%2").arg(name).arg(options.fft_sizes[i]));
+        }
+        m_network_sink->add_rms_source(m_rms_calc->processor(), name + ".rms");
+    }
+
+    connect(&m_engine, &Engine::end_of_stream,
+            this, &BatchJob::finish,
+            Qt::QueuedConnection);
+
+    m_engine.set_source(std::move(source));
+}
+
+BatchJob::~BatchJob()
+{
+    if (m_engine.is_running()) {
+        m_engine.stop();
+    }
+}
+
+int64_t BatchJob::relative_usecs(const global_clock::time_point &t) const
+{
+    if (!m_have_origin.load(std::memory_order_acquire)) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                t - m_origin).count();
+}
+
+void BatchJob::write_fft(std::ofstream &out, const RealFFTBlock &block)
+{
+    const int64_t t = relative_usecs(block.t);
+    const uint32_t bins = block.fft.size();
+    out.write(reinterpret_cast<const char*>(&t), sizeof(t));
+    out.write(reinterpret_cast<const char*>(&bins), sizeof(bins));
+    out.write(reinterpret_cast<const char*>(&block.fmax), sizeof(block.fmax));
+    out.write(reinterpret_cast<const char*>(block.fft.data()),
+              bins * sizeof(float));
+}
+
+void BatchJob::write_rms(std::ofstream &out, const RMSBlock &block)
+{
+    out << relative_usecs(block.t) << ','
+              << m_rms_windows[block.window].window_msec << ','
+              << block.curr << ','
+              << block.recent_peak << '\n';
+}
+
+void BatchJob::write_peaks(std::ofstream &out, const PeakListBlock &block)
+{
+    const int64_t t = relative_usecs(block.t);
+    for (const Peak &peak: block.peaks) {
+        out << t << ','
+            << peak.frequency << ','
+            << peak.level_db << ','
+            << peak.floor_db << ','
+            << peak.group << ','
+            << peak.harmonic << '\n';
+    }
+}
+
+bool BatchJob::ok() const
+{
+    if (!m_finished || !m_rms_out->good()) {
+        return false;
+    }
+    for (const auto &out: m_fft_outs) {
+        if (!out->good()) {
+            return false;
+        }
+    }
+    for (const auto &out: m_channel_fft_outs) {
+        if (!out->good()) {
+            return false;
+        }
+    }
+    for (const auto &out: m_channel_rms_outs) {
+        if (!out->good()) {
+            return false;
+        }
+    }
+    for (const auto &out: m_average_outs) {
+        if (!out->good()) {
+            return false;
+        }
+    }
+    for (const auto &out: m_peak_outs) {
+        if (!out->good()) {
+            return false;
+        }
+    }
+    for (const auto &out: m_zoom_outs) {
+        if (!out->good()) {
+            return false;
+        }
+    }
+    for (const auto &out: m_spectrogram_outs) {
+        if (!out->ok() || out->dropped_chunks() > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BatchJob::start()
+{
+    m_engine.start();
+    if (m_duration_msec > 0) {
+        QTimer::singleShot(m_duration_msec, this, &BatchJob::finish);
+    }
+}
+
+void BatchJob::finish()
+{
+    if (m_finished) {
+        return;
+    }
+    m_finished = true;
+
+    if (m_engine.is_running()) {
+        m_engine.stop();
+    }
+    // the pipe is gone, so nothing new reaches the processors; wait for
+    // what is still queued before touching the streams
+    m_rms_calc->drain();
+    m_fft_bank->drain();
+    for (auto &zoom: m_zoom_ffts) {
+        zoom->drain();
+    }
+    for (auto &out: m_fft_outs) {
+        out->flush();
+    }
+    for (auto &out: m_channel_fft_outs) {
+        out->flush();
+    }
+    for (auto &out: m_channel_rms_outs) {
+        out->flush();
+    }
+    for (auto &out: m_average_outs) {
+        out->flush();
+    }
+    for (auto &out: m_peak_outs) {
+        out->flush();
+    }
+    for (auto &out: m_zoom_outs) {
+        out->flush();
+    }
+    for (auto &out: m_spectrogram_outs) {
+        out->close();
+    }
+    m_rms_out->flush();
+    if (m_network_sink) {
+        m_network_sink->flush();
+    }
+
+    emit finished();
+}
+
+
+namespace {
+
+struct BatchInput
+{
+    QString name;
+    std::function<std::unique_ptr<VirtualAudioSource>()> make_source;
+};
+
+
+class BatchRunner
+{
+public:
+    BatchRunner(const BatchOptions &options, uint32_t max_jobs):
+        m_options(options),
+        m_max_jobs(max_jobs),
+        m_running(0),
+        m_failures(0)
+    {
+
+    }
+
+private:
+    const BatchOptions m_options;
+    const uint32_t m_max_jobs;
+    std::deque<BatchInput> m_pending;
+    uint32_t m_running;
+    uint32_t m_failures;
+
+private:
+    void job_finished(BatchJob *job)
+    {
+        if (!job->ok()) {
+            std::cerr << job->name().toStdString()
+                      << ": failed to write results" << std::endl;
+            ++m_failures;
+        }
+        job->deleteLater();
+        --m_running;
+        launch();
+        if (done()) {
+            QCoreApplication::exit(exit_code());
+        }
+    }
+
+public:
+    void add(BatchInput &&input)
+    {
+        m_pending.emplace_back(std::move(input));
+    }
+
+    void launch()
+    {
+        while (m_running < m_max_jobs && !m_pending.empty()) {
+            BatchInput input = std::move(m_pending.front());
+            m_pending.pop_front();
+
+            BatchJob *job = nullptr;
+            try {
+                job = new BatchJob(input.make_source(), input.name, m_options);
+                QObject::connect(job, &BatchJob::finished,
+                                 QCoreApplication::instance(),
+                                 [this, job](){ job_finished(job); });
+                job->start();
+            } catch (const std::exception &exc) {
+                std::cerr << input.name.toStdString() << ": "
+                          << exc.what() << std::endl;
+                delete job;
+                ++m_failures;
+                continue;
+            }
+            ++m_running;
+        }
+    }
+
+    inline bool done() const
+    {
+        return m_running == 0 && m_pending.empty();
+    }
+
+    inline int exit_code() const
+    {
+        return m_failures > 0 ? 1 : 0;
+    }
+
+};
+
+
+bool parse_rigor(const QString &name, FFTPlannerRigor &rigor)
+{
+    if (name == "estimate") {
+        rigor = FFTPlannerRigor::ESTIMATE;
+    } else if (name == "measure") {
+        rigor = FFTPlannerRigor::MEASURE;
+    } else if (name == "patient") {
+        rigor = FFTPlannerRigor::PATIENT;
+    } else if (name == "exhaustive") {
+        rigor = FFTPlannerRigor::EXHAUSTIVE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_spectrogram_encoding(const QString &name, SpectrogramEncoding &encoding)
+{
+    if (name == "float32") {
+        encoding = SpectrogramEncoding::FLOAT32;
+    } else if (name == "float16") {
+        encoding = SpectrogramEncoding::FLOAT16_DB;
+    } else if (name == "uint16") {
+        encoding = SpectrogramEncoding::UINT16_DB;
+    } else if (name == "uint8") {
+        encoding = SpectrogramEncoding::UINT8_DB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// rate:channels:type, with type one of s8, u8, s16, u16, s24, u24, s32, u32
+// or f32
+bool parse_raw_format(const QString &spec, QAudioFormat &format)
+{
+    const QStringList parts = spec.split(":");
+    if (parts.size() != 3) {
+        return false;
+    }
+
+    bool rate_ok, channels_ok;
+    const int rate = parts[0].toInt(&rate_ok);
+    const int channels = parts[1].toInt(&channels_ok);
+    if (!rate_ok || !channels_ok || rate <= 0 || channels <= 0) {
+        return false;
+    }
+
+    const QString type = parts[2].toLower();
+    if (type.size() < 2) {
+        return false;
+    }
+    bool bits_ok;
+    const int bits = type.mid(1).toInt(&bits_ok);
+    if (!bits_ok) {
+        return false;
+    }
+    if (type.startsWith("s")) {
+        format.setSampleType(QAudioFormat::SignedInt);
+    } else if (type.startsWith("u")) {
+        format.setSampleType(QAudioFormat::UnSignedInt);
+    } else if (type.startsWith("f") && bits == 32) {
+        format.setSampleType(QAudioFormat::Float);
+    } else {
+        return false;
+    }
+
+    format.setSampleRate(rate);
+    format.setChannelCount(channels);
+    format.setSampleSize(bits);
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    format.setCodec("audio/pcm");
+    return true;
+}
+
+// window[:hop] in milliseconds, the hop defaults to the window
+bool parse_rms_window(const QString &value, RMSWindow &window)
+{
+    const QStringList parts = value.split(":");
+    if (parts.size() > 2) {
+        return false;
+    }
+    bool ok;
+    window.window_msec = parts[0].toUInt(&ok);
+    if (!ok || window.window_msec == 0) {
+        return false;
+    }
+    window.hop_msec = window.window_msec;
+    if (parts.size() == 2) {
+        window.hop_msec = parts[1].toUInt(&ok);
+        if (!ok || window.hop_msec == 0) {
+            return false;
+        }
+    }
+    window.peak_hold_msec = std::max<uint32_t>(RMS_PEAK_HOLD_MSEC,
+                                               window.window_msec);
+    return true;
+}
+
+// udp:port:format, rtp:port:format or tcp:host:port:format with the format
+// as for parse_raw_format; RTP payloads are taken as big endian
+bool parse_network_source(const QString &value, NetworkSourceSpec &spec)
+{
+    QStringList parts = value.split(":");
+    if (parts.size() < 5) {
+        return false;
+    }
+    const QString transport = parts.takeFirst().toLower();
+    if (transport == "udp") {
+        spec.transport = NetworkTransport::UDP;
+    } else if (transport == "rtp") {
+        spec.transport = NetworkTransport::RTP;
+    } else if (transport == "tcp") {
+        spec.transport = NetworkTransport::TCP;
+        spec.host = parts.takeFirst();
+    } else {
+        return false;
+    }
+    if (parts.size() != 4) {
+        return false;
+    }
+    bool ok;
+    const uint32_t port = parts.takeFirst().toUInt(&ok);
+    if (!ok || port == 0 || port > 65535) {
+        return false;
+    }
+    spec.port = port;
+    if (!parse_raw_format(parts.join(":"), spec.format)) {
+        return false;
+    }
+    if (spec.transport == NetworkTransport::RTP) {
+        spec.format.setByteOrder(QAudioFormat::BigEndian);
+    }
+    return true;
+}
+
+QString file_name_of(const QString &device_name)
+{
+    return QString(device_name).replace(QRegularExpression("[^A-Za-z0-9_.-]"), "_");
+}
+
+int usage_error(const QCommandLineParser &parser, const std::string &message)
+{
+    std::cerr << message << std::endl << std::endl
+              << parser.helpText().toStdString();
+    return 2;
+}
+
+}
+
+
+int run_batch(QCoreApplication &app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+                "Analyses audio without the GUI and writes FFT frames and RMS "
+                "levels of every input to the output directory.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "WAV, RF64 or raw files to analyse.",
+                                 "[files...]");
+
+    const QCommandLineOption batch_option(
+                "batch", "Run headless.");
+    const QCommandLineOption output_dir_option(
+                QStringList{"o", "output-dir"},
+                "Directory the results are written to.", "dir", ".");
+    const QCommandLineOption fft_size_option(
+                "fft-size",
+                "FFT size in samples; may be given several times.",
+                "samples", "4096");
+    const QCommandLineOption fft_period_option(
+                "fft-period", "Time between FFT frames.", "msecs", "25");
+    const QCommandLineOption rms_window_option(
+                "rms-window",
+                "RMS window and optionally hop, e.g. 300:10; may be given "
+                "several times.",
+                "msecs[:msecs]", "100");
+    const QCommandLineOption per_channel_option(
+                "per-channel",
+                "Also write FFT frames and RMS levels of every channel of "
+                "multi-channel inputs.");
+    const QCommandLineOption average_option(
+                "fft-average",
+                "Also write an average of every FFT size: exp, linear, welch, "
+                "max or min over a number of frames, optionally emitted every "
+                "msecs, e.g. welch:8:100; may be given several times.",
+                "mode:frames[:msecs]");
+    const QCommandLineOption zoom_option(
+                "zoom",
+                "Also write a zoom FFT of the band around a center frequency, "
+                "decimated by a factor and transformed with a size, optionally "
+                "every msecs instead of the FFT period, e.g. 1000:64:1024; may "
+                "be given several times.",
+                "hz:decimation:size[:msecs]");
+    const QCommandLineOption peaks_option(
+                "peaks", "Also write the peaks found in every FFT size.");
+    const QCommandLineOption peak_threshold_option(
+                "peak-threshold",
+                "How far above the noise floor a peak has to be.", "dB", "10");
+    const QCommandLineOption spectrogram_option(
+                "spectrogram",
+                "Also record every FFT size to a spectrogram file encoded as "
+                "float32, float16, uint16 or uint8.",
+                "encoding");
+    const QCommandLineOption stream_port_option(
+                "stream-port",
+                "Also stream every FFT size and the RMS levels to TCP clients "
+                "connecting to this port.",
+                "port");
+    const QCommandLineOption stream_udp_option(
+                "stream-udp",
+                "Also stream every FFT size and the RMS levels as datagrams "
+                "to this address.",
+                "host:port");
+    const QCommandLineOption planner_option(
+                "planner",
+                "FFTW planner rigor: estimate, measure, patient or exhaustive.",
+                "rigor", "measure");
+    const QCommandLineOption jobs_option(
+                QStringList{"j", "jobs"},
+                "Number of inputs analysed in parallel.", "count",
+                QString::number(std::max(1, QThread::idealThreadCount())));
+    const QCommandLineOption raw_option(
+                "raw",
+                "Read the files as headerless little endian samples, "
+                "e.g. 48000:2:s16.",
+                "rate:channels:type");
+    const QCommandLineOption device_option(
+                "device", "Also capture from the named input device.", "name");
+    const QCommandLineOption generate_option(
+                "generate",
+                "Also analyse a generated signal, e.g. sine:48000:2:1000, "
+                "chirp:2000000:1:100:500000[:sweep msecs] or noise:48000:2; "
+                "may be given several times, requires --duration.",
+                "waveform:rate:channels[:args]");
+    const QCommandLineOption receive_option(
+                "receive",
+                "Also analyse samples received from the network, e.g. "
+                "rtp:5004:48000:2:s16, udp:7355:2000000:2:f32 or "
+                "tcp:sdr.local:1234:2048000:2:u8; may be given several "
+                "times, requires --duration.",
+                "transport:[host:]port:rate:channels:type");
+    const QCommandLineOption jitter_option(
+                "jitter",
+                "How long received samples are held back for reordering.",
+                "msecs", QString::number(NetworkSource::DEFAULT_JITTER_MSEC));
+    const QCommandLineOption duration_option(
+                "duration",
+                "Stop every input after this time; required with --device.",
+                "secs");
+    parser.addOptions({batch_option, output_dir_option,
+                       fft_size_option, fft_period_option, rms_window_option,
+                       per_channel_option, average_option, zoom_option,
+                       peaks_option, peak_threshold_option,
+                       spectrogram_option, stream_port_option, stream_udp_option,
+                       planner_option,
+                       jobs_option, raw_option,
+                       device_option, generate_option,
+                       receive_option, jitter_option, duration_option});
+    parser.process(app);
+
+    BatchOptions options;
+    options.output_dir = parser.value(output_dir_option);
+    options.duration_msec = 0;
+
+    bool ok;
+    for (const QString &value: parser.values(fft_size_option)) {
+        const uint32_t size = value.toUInt(&ok);
+        if (!ok || size < 2) {
+            return usage_error(parser, "invalid FFT size");
+        }
+        options.fft_sizes.push_back(size);
+    }
+    options.fft_period_msec = parser.value(fft_period_option).toUInt(&ok);
+    if (!ok || options.fft_period_msec == 0) {
+        return usage_error(parser, "invalid FFT period");
+    }
+    for (const QString &value: parser.values(rms_window_option)) {
+        RMSWindow window;
+        if (!parse_rms_window(value, window)) {
+            return usage_error(parser, "invalid RMS window");
+        }
+        options.rms_windows.push_back(window);
+    }
+    options.per_channel = parser.isSet(per_channel_option);
+    for (const QString &value: parser.values(average_option)) {
+        AveragingConfig config;
+        if (!parse_averaging_config(value, config)) {
+            return usage_error(parser, "invalid FFT average");
+        }
+        // they would end up in the same file
+        for (const AveragingConfig &other: options.averages) {
+            if (other.mode == config.mode && other.frames == config.frames &&
+                    other.output_period_msec == config.output_period_msec)
+            {
+                return usage_error(parser, "duplicate FFT average "+value.toStdString());
+            }
+        }
+        options.averages.push_back(config);
+    }
+    for (const QString &value: parser.values(zoom_option)) {
+        ZoomBand band;
+        if (!parse_zoom_band(value, options.fft_period_msec, band)) {
+            return usage_error(parser, "invalid zoom band "+value.toStdString());
+        }
+        // they would end up in the same file
+        for (const ZoomBand &other: options.zoom_bands) {
+            if (other.center_hz == band.center_hz && other.decimation == band.decimation &&
+                    other.size == band.size && other.period_msec == band.period_msec)
+            {
+                return usage_error(parser, "duplicate zoom band "+value.toStdString());
+            }
+        }
+        options.zoom_bands.push_back(band);
+    }
+    options.detect_peaks = parser.isSet(peaks_option);
+    options.peak_threshold_db = parser.value(peak_threshold_option).toFloat(&ok);
+    if (!ok || options.peak_threshold_db < 0) {
+        return usage_error(parser, "invalid peak threshold");
+    }
+    options.record_spectrogram = parser.isSet(spectrogram_option);
+    options.spectrogram_encoding = SpectrogramEncoding::UINT8_DB;
+    if (options.record_spectrogram &&
+            !parse_spectrogram_encoding(parser.value(spectrogram_option),
+                                        options.spectrogram_encoding))
+    {
+        return usage_error(parser, "invalid spectrogram encoding");
+    }
+    NetworkSinkConfig network_config = NetworkSink::DEFAULT_CONFIG;
+    if (parser.isSet(stream_port_option)) {
+        const uint32_t port = parser.value(stream_port_option).toUInt(&ok);
+        if (!ok || port == 0 || port > 65535) {
+            return usage_error(parser, "invalid stream port");
+        }
+        network_config.tcp_port = port;
+    }
+    if (parser.isSet(stream_udp_option)) {
+        const QString value = parser.value(stream_udp_option);
+        const int colon = value.lastIndexOf(":");
+        const uint32_t port = value.mid(colon + 1).toUInt(&ok);
+        if (colon <= 0 || !ok || port == 0 || port > 65535) {
+            return usage_error(parser, "invalid stream destination");
+        }
+        network_config.udp_host = value.left(colon);
+        network_config.udp_port = port;
+    }
+    if (!parse_rigor(parser.value(planner_option), options.rigor)) {
+        return usage_error(parser, "invalid planner rigor");
+    }
+    const uint32_t jobs = parser.value(jobs_option).toUInt(&ok);
+    if (!ok || jobs == 0) {
+        return usage_error(parser, "invalid job count");
+    }
+    if (parser.isSet(raw_option) &&
+            !parse_raw_format(parser.value(raw_option), options.raw_format))
+    {
+        return usage_error(parser, "invalid raw format");
+    }
+    if (parser.isSet(duration_option)) {
+        const double secs = parser.value(duration_option).toDouble(&ok);
+        if (!ok || secs <= 0) {
+            return usage_error(parser, "invalid duration");
+        }
+        options.duration_msec = std::max<int32_t>(1, secs * 1000);
+    }
+    if (parser.isSet(device_option) && options.duration_msec == 0) {
+        return usage_error(parser, "--device requires --duration");
+    }
+    std::vector<SignalSpec> signal_inputs;
+    for (const QString &value: parser.values(generate_option)) {
+        SignalSpec spec;
+        if (!parse_signal_spec(value, spec)) {
+            return usage_error(parser, "invalid signal "+value.toStdString());
+        }
+        signal_inputs.push_back(spec);
+    }
+    if (!signal_inputs.empty() && options.duration_msec == 0) {
+        return usage_error(parser, "--generate requires --duration");
+    }
+    const uint32_t jitter_msec = parser.value(jitter_option).toUInt(&ok);
+    if (!ok) {
+        return usage_error(parser, "invalid jitter");
+    }
+    std::vector<NetworkSourceSpec> network_inputs;
+    for (const QString &value: parser.values(receive_option)) {
+        NetworkSourceSpec spec;
+        if (!parse_network_source(value, spec)) {
+            return usage_error(parser, "invalid network source "+value.toStdString());
+        }
+        spec.jitter_msec = jitter_msec;
+        network_inputs.push_back(spec);
+    }
+    if (!network_inputs.empty() && options.duration_msec == 0) {
+        return usage_error(parser, "--receive requires --duration");
+    }
+    if (parser.positionalArguments().isEmpty() && !parser.isSet(device_option) &&
+            signal_inputs.empty() && network_inputs.empty())
+    {
+        return usage_error(parser, "no inputs given");
+    }
+    if (!QDir().mkpath(options.output_dir)) {
+        std::cerr << "failed to create " << options.output_dir.toStdString()
+                  << std::endl;
+        return 1;
+    }
+
+    // declared before the runner so that it outlives the jobs
+    std::unique_ptr<NetworkSink> network_sink;
+    options.network_sink = nullptr;
+    if (network_config.tcp_port != 0 || !network_config.udp_host.isEmpty()) {
+        network_sink = std::make_unique<NetworkSink>(network_config);
+        if (!network_sink->ok()) {
+            return 1;
+        }
+        options.network_sink = network_sink.get();
+    }
+
+    BatchRunner runner(options, jobs);
+
+    if (parser.isSet(device_option)) {
+        const QString device_name = parser.value(device_option);
+        QAudioDeviceInfo device;
+        for (const QAudioDeviceInfo &info:
+             QAudioDeviceInfo::availableDevices(QAudio::AudioInput))
+        {
+            if (info.deviceName() == device_name) {
+                device = info;
+                break;
+            }
+        }
+        if (device.isNull()) {
+            std::cerr << "no input device named "
+                      << device_name.toStdString() << std::endl;
+            return 1;
+        }
+
+        runner.add(BatchInput{
+                       file_name_of(device_name),
+                       [device](){
+                           QAudioFormat format = device.preferredFormat();
+                           format.setByteOrder(QAudioFormat::LittleEndian);
+                           format.setCodec("audio/pcm");
+                           return std::make_unique<AudioInputSource>(
+                                       device, format, 1.0f);
+                       }});
+    }
+
+    const QStringList signal_specs = parser.values(generate_option);
+    for (std::size_t i = 0; i < signal_inputs.size(); ++i) {
+        const SignalSpec spec = signal_inputs[i];
+        const uint64_t frames = (uint64_t)options.duration_msec * spec.sample_rate / 1000;
+        runner.add(BatchInput{
+                       file_name_of(signal_specs[i]),
+                       [spec, frames](){
+                           auto source = std::make_unique<SignalGeneratorSource>(spec);
+                           source->set_paced(false);
+                           source->set_duration_frames(frames);
+                           return source;
+                       }});
+    }
+
+    const QStringList network_specs = parser.values(receive_option);
+    for (std::size_t i = 0; i < network_inputs.size(); ++i) {
+        const NetworkSourceSpec spec = network_inputs[i];
+        runner.add(BatchInput{
+                       file_name_of(network_specs[i]),
+                       [spec](){
+                           return std::make_unique<NetworkSource>(spec);
+                       }});
+    }
+
+    for (const QString &path: parser.positionalArguments()) {
+        const QAudioFormat raw_format = options.raw_format;
+        runner.add(BatchInput{
+                       QFileInfo(path).completeBaseName(),
+                       [path, raw_format](){
+                           std::unique_ptr<FileSource> source;
+                           if (raw_format.isValid()) {
+                               source = std::make_unique<FileSource>(path, raw_format);
+                           } else {
+                               source = std::make_unique<FileSource>(path);
+                           }
+                           source->set_paced(false);
+                           return source;
+                       }});
+    }
+
+    runner.launch();
+    if (runner.done()) {
+        return runner.exit_code();
+    }
+    return app.exec();
+}
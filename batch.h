@@ -0,0 +1,147 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <fstream>
+
+#include <QCoreApplication>
+
+#include "engine.h"
+#include "fftbank.h"
+#include "networksink.h"
+#include "peakdetector.h"
+#include "spectralaverage.h"
+#include "spectrogram.h"
+#include "zoomfft.h"
+
+
+struct BatchOptions
+{
+    QString output_dir;
+    // one FFT file is written per size
+    std::vector<uint32_t> fft_sizes;
+    uint32_t fft_period_msec;
+    // each window adds its own rows to the RMS file
+    std::vector<RMSWindow> rms_windows;
+    // also write FFT frames and RMS levels of each channel of multi-channel
+    // sources
+    bool per_channel;
+    // each average of each FFT size goes to a file of its own
+    std::vector<AveragingConfig> averages;
+    // each band goes to a file of its own
+    std::vector<ZoomBand> zoom_bands;
+    // also write the peaks of each FFT size
+    bool detect_peaks;
+    float peak_threshold_db;
+    // also record each FFT size to a spectrogram file
+    bool record_spectrogram;
+    SpectrogramEncoding spectrogram_encoding;
+    // also stream every FFT size and the RMS levels to it unless null; must
+    // outlive the jobs
+    NetworkSink *network_sink;
+    FFTPlannerRigor rigor;
+    int32_t duration_msec;
+    // only used for headerless inputs; invalid for WAV/RF64
+    QAudioFormat raw_format;
+};
+
+
+// Analyses a single source and streams the results to
+// <output_dir>/<name>.<fft size>.fft and <output_dir>/<name>.rms.csv.
+//
+// Each .fft file starts with the 8 byte magic "SGFFT001" followed by records
+// of int64 t_usec, uint32 bins, float fmax and bins float magnitudes in host
+// byte order. The RMS file has one row per window and hop with the columns
+// t_usec, window_msec, rms and peak. t is relative to the first sample of the
+// source. Each average is written like the raw frames to
+// <output_dir>/<name>.<fft size>.<mode><frames>.fft, or
+// <output_dir>/<name>.<fft size>.<mode><frames>_<msecs>ms.fft if emitted
+// every msecs. With detect_peaks,
+// <output_dir>/<name>.<fft size>.peaks.csv gets one row per peak with the
+// columns t_usec, frequency, level_db, floor_db, group and harmonic. With
+// record_spectrogram, the frames of each size also go to
+// <output_dir>/<name>.<fft size>.sgspec (see spectrogram.h), whose times are
+// relative to the first frame. The frames of each zoom band are written like
+// the raw frames to <output_dir>/<name>.zoom<center>.<decimation>.<size>.<msecs>.fft
+// where fmax is the upper edge of the band, which lies symmetric around
+// center. With a network_sink, the frames of each size
+// are streamed as <name>.<fft size> and the RMS levels as <name>.rms. All of
+// these are taken from the downmix of the channels; with per_channel, the
+// frames and levels of each channel c of a multi-channel source also go to
+// <output_dir>/<name>.<fft size>.ch<c>.fft and <output_dir>/<name>.ch<c>.rms.csv.
+class BatchJob: public QObject
+{
+    Q_OBJECT
+
+public:
+    BatchJob(std::unique_ptr<VirtualAudioSource> &&source,
+             const QString &name,
+             const BatchOptions &options,
+             QObject *parent = nullptr);
+    BatchJob(const BatchJob &other) = delete;
+    BatchJob(BatchJob &&src) = delete;
+    BatchJob &operator=(const BatchJob &other) = delete;
+    BatchJob &operator=(BatchJob &&src) = delete;
+    ~BatchJob() override;
+
+private:
+    QString m_name;
+    int32_t m_duration_msec;
+    std::vector<RMSWindow> m_rms_windows;
+
+    Engine m_engine;
+    std::atomic<bool> m_have_origin;
+    global_clock::time_point m_origin;
+
+    std::vector<std::unique_ptr<std::ofstream> > m_fft_outs;
+    std::unique_ptr<std::ofstream> m_rms_out;
+    // empty unless per channel results are written; all channels of the
+    // first FFT size, then of the second, ...
+    std::vector<std::unique_ptr<std::ofstream> > m_channel_fft_outs;
+    // indexed by channel
+    std::vector<std::unique_ptr<std::ofstream> > m_channel_rms_outs;
+    // empty unless spectrograms are recorded, index matches m_fft_outs
+    std::vector<std::unique_ptr<SpectrogramWriter> > m_spectrogram_outs;
+    // outlive the bank whose lanes call into them
+    std::vector<std::unique_ptr<std::ofstream> > m_average_outs;
+    std::vector<std::unique_ptr<SpectralAverager> > m_averagers;
+    std::vector<std::unique_ptr<std::ofstream> > m_peak_outs;
+    std::vector<std::unique_ptr<PeakDetector> > m_peak_detectors;
+    std::vector<std::unique_ptr<std::ofstream> > m_zoom_outs;
+    NetworkSink *m_network_sink;
+
+    std::unique_ptr<RootMeanSquare> m_rms_calc;
+    std::unique_ptr<FFTBank> m_fft_bank;
+    std::vector<std::unique_ptr<ZoomFFT> > m_zoom_ffts;
+
+    bool m_finished;
+
+private:
+    int64_t relative_usecs(const global_clock::time_point &t) const;
+    void write_fft(std::ofstream &out, const RealFFTBlock &block);
+    void write_rms(std::ofstream &out, const RMSBlock &block);
+    void write_peaks(std::ofstream &out, const PeakListBlock &block);
+
+public:
+    inline const QString &name() const
+    {
+        return m_name;
+    }
+
+    // true if all results made it to disk
+    bool ok() const;
+
+public slots:
+    void start();
+    void finish();
+
+signals:
+    void finished();
+
+};
+
+
+// Runs the batch mode described by the command line of app and returns the
+// process exit code.
+int run_batch(QCoreApplication &app);
+
+#endif // BATCH_H
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QThread>
+
+#include "dsp.h"
+#include "engine.h"
+#include "signalsource.h"
+#include "peakdetector.h"
+#include "spectralaverage.h"
+#include "zoomfft.h"
+
+
+namespace {
+
+struct BenchOptions
+{
+    QString filter;
+    double min_seconds;
+    bool csv;
+};
+
+static constexpr uint32_t SAMPLE_RATE = 48000;
+static constexpr uint32_t BLOCK_FRAMES = 1024;
+static constexpr int WARMUP_CALLS = 16;
+static constexpr std::size_t MIN_CALLS = 64;
+
+
+bool selected(const BenchOptions &options, const std::string &name)
+{
+    return options.filter.isEmpty() ||
+            QString::fromStdString(name).contains(options.filter);
+}
+
+void print_header(const BenchOptions &options)
+{
+    if (options.csv) {
+        std::cout << "name,samples_per_sec,mean_usec,p50_usec,p99_usec,max_usec,blocks"
+                  << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(32) << "name" << std::right
+              << std::setw(14) << "Msamples/s"
+              << std::setw(11) << "mean us"
+              << std::setw(11) << "p50 us"
+              << std::setw(11) << "p99 us"
+              << std::setw(11) << "max us"
+              << std::setw(10) << "blocks" << std::endl;
+}
+
+// block_nsecs is sorted in place
+void report(const BenchOptions &options,
+            const std::string &name,
+            double samples_per_sec,
+            std::vector<double> &block_nsecs)
+{
+    if (block_nsecs.empty()) {
+        std::cerr << name << ": no blocks" << std::endl;
+        return;
+    }
+    std::sort(block_nsecs.begin(), block_nsecs.end());
+    double sum = 0;
+    for (double nsecs: block_nsecs) {
+        sum += nsecs;
+    }
+    const auto percentile = [&block_nsecs](double q){
+        const std::size_t index = std::min<std::size_t>(
+                    block_nsecs.size() - 1,
+                    std::ceil(q * block_nsecs.size()) - 1);
+        return block_nsecs[index] / 1000;
+    };
+    const double mean = sum / block_nsecs.size() / 1000;
+    const double max = block_nsecs.back() / 1000;
+
+    if (options.csv) {
+        std::cout << name << ',' << samples_per_sec << ','
+                  << mean << ',' << percentile(0.5) << ','
+                  << percentile(0.99) << ',' << max << ','
+                  << block_nsecs.size() << std::endl;
+        return;
+    }
+    std::cout << std::left << std::setw(32) << name << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(14) << samples_per_sec / 1e6
+              << std::setw(11) << mean
+              << std::setw(11) << percentile(0.5)
+              << std::setw(11) << percentile(0.99)
+              << std::setw(11) << max
+              << std::setw(10) << block_nsecs.size() << std::endl;
+}
+
+// Calls body until min_seconds worth of calls have been timed, counting each
+// call as one block of samples_per_block samples.
+void run_bench(const BenchOptions &options,
+               const std::string &name,
+               uint64_t samples_per_block,
+               const std::function<void()> &body)
+{
+    if (!selected(options, name)) {
+        return;
+    }
+
+    for (int i = 0; i < WARMUP_CALLS; ++i) {
+        body();
+    }
+
+    std::vector<double> block_nsecs;
+    double total_nsecs = 0;
+    while (total_nsecs < options.min_seconds * 1e9 || block_nsecs.size() < MIN_CALLS) {
+        const global_clock::time_point t0 = global_clock::now();
+        body();
+        const double nsecs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    global_clock::now() - t0).count();
+        block_nsecs.push_back(nsecs);
+        total_nsecs += nsecs;
+    }
+
+    report(options, name,
+           block_nsecs.size() * samples_per_block / (total_nsecs / 1e9),
+           block_nsecs);
+}
+
+std::vector<float> make_noise(std::size_t n)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+    std::vector<float> result(n);
+    for (float &sample: result) {
+        sample = dist(rng);
+    }
+    return result;
+}
+
+std::shared_ptr<SampleBlock> make_sample_block()
+{
+    auto block = std::make_shared<SampleBlock>();
+    block->t = global_clock::now();
+    block->source = Engine::PRIMARY_SOURCE;
+    block->sample_rate = SAMPLE_RATE;
+    block->set_layout(1, BLOCK_FRAMES);
+    const std::vector<float> noise = make_noise(BLOCK_FRAMES);
+    std::copy(noise.begin(), noise.end(), block->planar.begin());
+    return block;
+}
+
+// the processors only take their input through their (private) slot
+void feed(QObject &processor, std::shared_ptr<SampleBlock> &block)
+{
+    block->t += std::chrono::microseconds(
+                (uint64_t)BLOCK_FRAMES * 1000000 / SAMPLE_RATE);
+    block->published = global_clock::now();
+    QMetaObject::invokeMethod(
+                &processor, "process_samples", Qt::DirectConnection,
+                Q_ARG(std::shared_ptr<const SampleBlock>, block));
+}
+
+
+void bench_converters(const BenchOptions &options)
+{
+    struct Format
+    {
+        const char *name;
+        QAudioFormat::SampleType type;
+        uint32_t bits;
+    };
+    static const Format formats[] = {
+        {"s8", QAudioFormat::SignedInt, 8},
+        {"u8", QAudioFormat::UnSignedInt, 8},
+        {"s16", QAudioFormat::SignedInt, 16},
+        {"u16", QAudioFormat::UnSignedInt, 16},
+        {"s24", QAudioFormat::SignedInt, 24},
+        {"u24", QAudioFormat::UnSignedInt, 24},
+        {"s32", QAudioFormat::SignedInt, 32},
+        {"u32", QAudioFormat::UnSignedInt, 32},
+    };
+
+    const std::size_t samples = BLOCK_FRAMES * 2;
+    std::vector<uint8_t> raw(samples * sizeof(int32_t));
+    std::mt19937 rng(1);
+    for (uint8_t &byte: raw) {
+        byte = rng();
+    }
+    std::vector<float> dest(samples);
+
+    for (const Format &format: formats) {
+        std::unique_ptr<AbstractSampleConverter> converter =
+                AbstractSampleConverter::make_converter(format.type, format.bits);
+        run_bench(options, std::string("convert/") + format.name, samples,
+                  [&](){
+            converter->convert(raw.data(), samples, dest.data());
+        });
+    }
+}
+
+void bench_downmix(const BenchOptions &options)
+{
+    for (const uint32_t channels: {2u, 6u, 8u}) {
+        const std::vector<float> src = make_noise(BLOCK_FRAMES * channels);
+        std::vector<float> dest(BLOCK_FRAMES);
+        run_bench(options, "downmix/" + std::to_string(channels) + "ch",
+                  src.size(), [&](){
+            downmix(src.data(), dest.data(), BLOCK_FRAMES, channels);
+        });
+    }
+}
+
+void bench_deinterleave(const BenchOptions &options)
+{
+    for (const uint32_t channels: {1u, 2u, 6u}) {
+        const std::vector<float> src = make_noise(BLOCK_FRAMES * channels);
+        std::vector<float> dest(src.size());
+        run_bench(options, "deinterleave/" + std::to_string(channels) + "ch",
+                  src.size(), [&](){
+            deinterleave(src.data(), dest.data(), BLOCK_FRAMES, channels,
+                         BLOCK_FRAMES);
+        });
+    }
+}
+
+void bench_fft(const BenchOptions &options)
+{
+    const Engine engine;
+    for (const uint32_t size: {1024u, 4096u, 16384u}) {
+        for (const uint32_t hop_msec: {5u, 25u, 100u}) {
+            const std::string name = "fft/" + std::to_string(size) +
+                    "/hop" + std::to_string(hop_msec) + "ms";
+            if (!selected(options, name)) {
+                continue;
+            }
+            FFTProcessor processor(engine.stream(), size, hop_msec);
+            std::shared_ptr<SampleBlock> block = make_sample_block();
+            run_bench(options, name, BLOCK_FRAMES, [&](){
+                feed(processor, block);
+            });
+        }
+    }
+}
+
+void bench_rms(const BenchOptions &options)
+{
+    const Engine engine;
+    const std::vector<std::pair<std::string, std::vector<RMSWindow> > > configs{
+        {"rms/default", RMSProcessor::DEFAULT_WINDOWS},
+        {"rms/10-300-3000ms", {RMSWindow{10, 10, 3000},
+                               RMSWindow{300, 10, 3000},
+                               RMSWindow{3000, 10, 3000}}},
+    };
+    for (const auto &config: configs) {
+        if (!selected(options, config.first)) {
+            continue;
+        }
+        RMSProcessor processor(engine.stream(), config.second);
+        std::shared_ptr<SampleBlock> block = make_sample_block();
+        run_bench(options, config.first, BLOCK_FRAMES, [&](){
+            feed(processor, block);
+        });
+    }
+}
+
+void bench_zoom_fft(const BenchOptions &options)
+{
+    const Engine engine;
+    for (const uint32_t decimation: {8u, 64u, 512u}) {
+        const std::string name = "zoomfft/1000Hz/" + std::to_string(decimation) +
+                "/4096/hop25ms";
+        if (!selected(options, name)) {
+            continue;
+        }
+        ZoomFFTProcessor processor(engine.stream(), ZoomBand{1000.f, decimation, 4096, 25});
+        std::shared_ptr<SampleBlock> block = make_sample_block();
+        run_bench(options, name, BLOCK_FRAMES, [&](){
+            feed(processor, block);
+        });
+    }
+}
+
+// one block is one input frame; its bins count as samples
+void bench_average(const BenchOptions &options)
+{
+    const Engine engine;
+    const FFTProcessor source(engine.stream(), 1024, 25);
+    for (const uint32_t bins: {2049u, 8193u}) {
+        for (const char *spec: {"exp:8", "linear:8", "welch:8", "welch:64", "max:0"}) {
+            const std::string name = "average/" + std::to_string(bins) +
+                    "/" + spec;
+            if (!selected(options, name)) {
+                continue;
+            }
+            AveragingConfig config;
+            parse_averaging_config(spec, config);
+            SpectralAverager averager(source, config);
+            auto frame = std::make_shared<RealFFTBlock>();
+            frame->t = global_clock::now();
+            frame->channel = SampleBlock::DOWNMIX;
+            frame->fmin = 0;
+            frame->fmax = SAMPLE_RATE / 2;
+            frame->fft = make_noise(bins);
+            for (float &value: frame->fft) {
+                value = std::abs(value);
+            }
+            run_bench(options, name, bins, [&](){
+                frame->t += std::chrono::milliseconds(25);
+                averager.process_frame(frame);
+            });
+        }
+    }
+}
+
+// noise with a harmonic series on top; its bins count as samples
+void bench_peaks(const BenchOptions &options)
+{
+    const Engine engine;
+    const FFTProcessor source(engine.stream(), 1024, 25);
+    for (const uint32_t bins: {2049u, 8193u, 65537u}) {
+        const std::string name = "peaks/" + std::to_string(bins);
+        if (!selected(options, name)) {
+            continue;
+        }
+        PeakDetector detector(source);
+        auto frame = std::make_shared<RealFFTBlock>();
+        frame->t = global_clock::now();
+        frame->channel = SampleBlock::DOWNMIX;
+        frame->fmin = 0;
+        frame->fmax = SAMPLE_RATE / 2;
+        frame->fft = make_noise(bins);
+        for (float &value: frame->fft) {
+            value = std::abs(value) * 1e-4f;
+        }
+        for (uint32_t k = 1; k <= 10; ++k) {
+            frame->fft[k * bins / 40] = 0.1f / k;
+        }
+        run_bench(options, name, bins, [&](){
+            frame->t += std::chrono::milliseconds(25);
+            detector.process_frame(frame);
+        });
+    }
+}
+
+void bench_queue(const BenchOptions &options)
+{
+    // one block is a batch of pushes followed by one fetch, like a processor
+    // feeding a widget between two frames
+    static constexpr uint32_t BATCH = 32;
+    TimedDataQueue<std::shared_ptr<const RealFFTBlock> > queue(2 * BATCH);
+    std::vector<std::shared_ptr<const RealFFTBlock> > blocks;
+    global_clock::time_point t = global_clock::now();
+    for (uint32_t i = 0; i < BATCH; ++i) {
+        auto block = std::make_shared<RealFFTBlock>();
+        block->t = t;
+        blocks.emplace_back(std::move(block));
+    }
+    std::vector<std::shared_ptr<const RealFFTBlock> > fetched;
+    fetched.reserve(BATCH);
+
+    run_bench(options, "queue/push-fetch", BATCH, [&](){
+        for (const auto &block: blocks) {
+            std::shared_ptr<const RealFFTBlock> copy = block;
+            queue.push_block(std::move(copy));
+        }
+        queue.fetch_up_to(t, std::back_inserter(fetched));
+        fetched.clear();
+    });
+}
+
+
+void bench_generator(const BenchOptions &options)
+{
+    for (const char *spec_text: {"sine:48000:2:1000",
+                                 "chirp:2000000:1:100:500000",
+                                 "noise:10000000:8"})
+    {
+        const std::string name = std::string("generate/") + spec_text;
+        if (!selected(options, name)) {
+            continue;
+        }
+        SignalSpec spec;
+        parse_signal_spec(spec_text, spec);
+        SignalGeneratorSource source(spec);
+        source.set_paced(false);
+        source.set_period_frames(BLOCK_FRAMES);
+        source.start();
+        std::vector<float> dest;
+        // every UNPACED_BURST_PERIODS reads hand back to the event loop; the
+        // empty read is part of the cost
+        run_bench(options, name, BLOCK_FRAMES * spec.channels, [&](){
+            source.read_samples(dest);
+        });
+        source.stop();
+    }
+}
+
+// The full pipe with the processors of the GUI attached. Throughput is taken
+// from the wall time until the processors are drained; the per-block latency
+// is the time from a SampleBlock being published until a processor thread
+// picks it up.
+void bench_pipe(const BenchOptions &options,
+                QCoreApplication &app,
+                const std::string &spec_text)
+{
+    const std::string name = "pipe/" + spec_text;
+    if (!selected(options, name)) {
+        return;
+    }
+
+    SignalSpec spec;
+    parse_signal_spec(QString::fromStdString(spec_text), spec);
+    auto source = std::make_unique<SignalGeneratorSource>(spec);
+    const uint64_t frames = std::max<uint64_t>(
+                spec.sample_rate, 20 * options.min_seconds * SAMPLE_RATE);
+    source->set_paced(false);
+    source->set_period_frames(BLOCK_FRAMES);
+    source->set_duration_frames(frames);
+
+    Engine engine;
+    engine.set_source(std::move(source));
+    RootMeanSquare rms(engine.stream());
+    FFT fft(engine.stream(), 4096, 25);
+
+    QThread probe_thread;
+    QObject probe;
+    probe.moveToThread(&probe_thread);
+    probe_thread.start();
+    std::vector<double> block_nsecs;
+    QObject::connect(&engine, &Engine::samples_available,
+                     &probe, [&block_nsecs](std::shared_ptr<const SampleBlock> block){
+        block_nsecs.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                  global_clock::now() - block->published).count());
+    }, Qt::QueuedConnection);
+    QObject::connect(&engine, &Engine::end_of_stream,
+                     &app, &QCoreApplication::quit,
+                     Qt::QueuedConnection);
+
+    const global_clock::time_point t0 = global_clock::now();
+    engine.start();
+    app.exec();
+    engine.stop();
+    rms.drain();
+    fft.drain();
+    const double seconds = std::chrono::duration_cast<std::chrono::microseconds>(
+                global_clock::now() - t0).count() / 1e6;
+
+    probe_thread.exit();
+    probe_thread.wait();
+
+    report(options, name,
+           frames * spec.channels / seconds,
+           block_nsecs);
+}
+
+}
+
+
+int main(int argc, char *argv[])
+{
+    qRegisterMetaType<std::shared_ptr<const SampleBlock> >("std::shared_ptr<const SampleBlock>");
+    qRegisterMetaType<std::shared_ptr<const RMSBlock> >("std::shared_ptr<const RMSBlock>");
+    qRegisterMetaType<std::shared_ptr<const RealFFTBlock> >("std::shared_ptr<const RealFFTBlock>");
+
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(
+                "Benchmarks the hot paths of the engine. Samples/s count "
+                "interleaved input samples; a block is one call of the "
+                "measured code.");
+    parser.addHelpOption();
+    const QCommandLineOption filter_option(
+                "filter", "Only run benchmarks whose name contains text.", "text");
+    const QCommandLineOption min_time_option(
+                "min-time", "Minimum measured time per benchmark.", "secs", "0.5");
+    const QCommandLineOption csv_option(
+                "csv", "Write the results as CSV.");
+    parser.addOptions({filter_option, min_time_option, csv_option});
+    parser.process(app);
+
+    BenchOptions options;
+    options.filter = parser.value(filter_option);
+    options.csv = parser.isSet(csv_option);
+    bool ok;
+    options.min_seconds = parser.value(min_time_option).toDouble(&ok);
+    if (!ok || options.min_seconds <= 0) {
+        std::cerr << "invalid --min-time" << std::endl;
+        return 2;
+    }
+
+    print_header(options);
+    bench_converters(options);
+    bench_downmix(options);
+    bench_deinterleave(options);
+    bench_fft(options);
+    bench_zoom_fft(options);
+    bench_rms(options);
+    bench_average(options);
+    bench_peaks(options);
+    bench_queue(options);
+    bench_generator(options);
+    bench_pipe(options, app, "noise:48000:2");
+    bench_pipe(options, app, "noise:2000000:1");
+    return 0;
+}
@@ -0,0 +1,44 @@
+#-------------------------------------------------
+#
+# Benchmarks for the hot paths of the engine
+#
+#-------------------------------------------------
+
+QT       += core multimedia
+
+TARGET = sigalyze-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += bench.cpp \
+    ../engine.cpp \
+    ../dsp.cpp \
+    ../metrics.cpp \
+    ../signalsource.cpp \
+    ../fftbank.cpp \
+    ../spectralaverage.cpp \
+    ../zoomfft.cpp \
+    ../peakdetector.cpp \
+    ../threadpolicy.cpp \
+    ../latencyprofile.cpp
+
+HEADERS += ../engine.h \
+    ../ringbuffer.h \
+    ../blockpool.h \
+    ../dsp.h \
+    ../metrics.h \
+    ../signalsource.h \
+    ../fftbank.h \
+    ../spectralaverage.h \
+    ../zoomfft.h \
+    ../peakdetector.h \
+    ../threadpolicy.h \
+    ../latencyprofile.h
+
+QMAKE_CXXFLAGS += -std=c++14
+
+unix: CONFIG += link_pkgconfig
+unix: PKGCONFIG += fftw3f
@@ -0,0 +1,231 @@
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+
+struct BlockPoolStats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t in_use;
+};
+
+
+// Hands out shared_ptrs to recycled objects. Each object carries the storage
+// for its own shared_ptr control block, so acquire() does not allocate once
+// the pool is warm. An object goes back to the pool when the last reference
+// to it is dropped; its contents (including vector capacity) are kept.
+//
+// Objects may be released from any thread, but acquire() must only be called
+// from one thread at a time. With a single popping thread the lock-free free
+// list is not prone to ABA.
+template <typename T>
+class BlockPool
+{
+private:
+    static constexpr std::size_t CONTROL_BLOCK_SIZE = 64;
+
+    struct Node
+    {
+        Node():
+            value(),
+            next(nullptr)
+        {
+
+        }
+
+        T value;
+        alignas(std::max_align_t) unsigned char control_block[CONTROL_BLOCK_SIZE];
+        Node *next;
+    };
+
+    struct State
+    {
+        State():
+            free_list(nullptr),
+            hits(0),
+            misses(0),
+            in_use(0)
+        {
+
+        }
+
+        ~State()
+        {
+            Node *node = free_list.load(std::memory_order_acquire);
+            while (node) {
+                Node *next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+
+        std::atomic<Node*> free_list;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> in_use;
+
+        Node *pop()
+        {
+            Node *node = free_list.load(std::memory_order_acquire);
+            while (node && !free_list.compare_exchange_weak(
+                       node, node->next,
+                       std::memory_order_acquire,
+                       std::memory_order_acquire))
+            {
+
+            }
+            return node;
+        }
+
+        void push(Node *node)
+        {
+            node->next = free_list.load(std::memory_order_relaxed);
+            while (!free_list.compare_exchange_weak(
+                       node->next, node,
+                       std::memory_order_release,
+                       std::memory_order_relaxed))
+            {
+
+            }
+        }
+    };
+
+    // allocates the control block inside the node and returns the node to
+    // the pool once the control block is released
+    template <typename U>
+    struct NodeAllocator
+    {
+        typedef U value_type;
+
+        template <typename V>
+        struct rebind
+        {
+            typedef NodeAllocator<V> other;
+        };
+
+        NodeAllocator(const std::shared_ptr<State> &state, Node *node):
+            state(state),
+            node(node)
+        {
+
+        }
+
+        template <typename V>
+        NodeAllocator(const NodeAllocator<V> &other):
+            state(other.state),
+            node(other.node)
+        {
+
+        }
+
+        std::shared_ptr<State> state;
+        Node *node;
+
+        U *allocate(std::size_t n)
+        {
+            if (n * sizeof(U) <= CONTROL_BLOCK_SIZE &&
+                    alignof(U) <= alignof(std::max_align_t))
+            {
+                return reinterpret_cast<U*>(node->control_block);
+            }
+            return static_cast<U*>(::operator new(n * sizeof(U)));
+        }
+
+        void deallocate(U *ptr, std::size_t)
+        {
+            if (reinterpret_cast<unsigned char*>(ptr) != node->control_block) {
+                ::operator delete(ptr);
+            }
+            state->in_use.fetch_sub(1, std::memory_order_relaxed);
+            state->push(node);
+        }
+
+        template <typename V>
+        bool operator==(const NodeAllocator<V> &other) const
+        {
+            return node == other.node;
+        }
+
+        template <typename V>
+        bool operator!=(const NodeAllocator<V> &other) const
+        {
+            return node != other.node;
+        }
+    };
+
+    struct NoopDeleter
+    {
+        void operator()(T*) const
+        {
+
+        }
+    };
+
+public:
+    BlockPool():
+        m_state(std::make_shared<State>())
+    {
+
+    }
+
+    BlockPool(const BlockPool &other) = delete;
+    BlockPool(BlockPool &&src) = delete;
+    BlockPool &operator=(const BlockPool &other) = delete;
+    BlockPool &operator=(BlockPool &&src) = delete;
+
+private:
+    std::shared_ptr<State> m_state;
+
+public:
+    std::shared_ptr<T> acquire()
+    {
+        Node *node = m_state->pop();
+        if (node) {
+            m_state->hits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            m_state->misses.fetch_add(1, std::memory_order_relaxed);
+            node = new Node();
+        }
+
+        try {
+            m_state->in_use.fetch_add(1, std::memory_order_relaxed);
+            return std::shared_ptr<T>(&node->value,
+                                      NoopDeleter(),
+                                      NodeAllocator<T>(m_state, node));
+        } catch (...) {
+            m_state->in_use.fetch_sub(1, std::memory_order_relaxed);
+            m_state->push(node);
+            throw;
+        }
+    }
+
+    void reserve(std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i) {
+            m_state->push(new Node());
+        }
+    }
+
+    uint64_t in_use() const
+    {
+        return m_state->in_use.load(std::memory_order_relaxed);
+    }
+
+    BlockPoolStats stats() const
+    {
+        return BlockPoolStats{
+            m_state->hits.load(std::memory_order_relaxed),
+            m_state->misses.load(std::memory_order_relaxed),
+            m_state->in_use.load(std::memory_order_relaxed)
+        };
+    }
+
+};
+
+#endif // BLOCKPOOL_H
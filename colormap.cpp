@@ -0,0 +1,88 @@
+#include "colormap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+
+static inline float clamp01(float v)
+{
+    return std::min(std::max(v, 0.f), 1.f);
+}
+
+static void cubehelix(float v, float s, float r, float h, float *rgb)
+{
+    const float a = h*v*(1.f-v)/2.f;
+    const float phi = 2.f*M_PI*(s/3.f + r*v);
+
+    const float cos_phi = std::cos(phi);
+    const float sin_phi = std::sin(phi);
+
+    rgb[0] = clamp01(v + a*(-0.14861f*cos_phi + 1.78277f*sin_phi));
+    rgb[1] = clamp01(v + a*(-0.29227f*cos_phi - 0.90649f*sin_phi));
+    rgb[2] = clamp01(v + a*(1.97294f*cos_phi));
+}
+
+static void hot(float v, float *rgb)
+{
+    rgb[0] = clamp01(v*3.f);
+    rgb[1] = clamp01(v*3.f - 1.f);
+    rgb[2] = clamp01(v*3.f - 2.f);
+}
+
+static void jet(float v, float *rgb)
+{
+    rgb[0] = clamp01(1.5f - std::abs(4.f*v - 3.f));
+    rgb[1] = clamp01(1.5f - std::abs(4.f*v - 2.f));
+    rgb[2] = clamp01(1.5f - std::abs(4.f*v - 1.f));
+}
+
+const char *colormap_name(Colormap map)
+{
+    switch (map) {
+    case Colormap::CUBEHELIX:
+        return "Cubehelix";
+    case Colormap::GRAYSCALE:
+        return "Grayscale";
+    case Colormap::HOT:
+        return "Hot";
+    case Colormap::JET:
+        return "Jet";
+    }
+    throw std::logic_error("unknown colormap");
+}
+
+std::vector<uint8_t> make_colormap(Colormap map, std::size_t entries)
+{
+    std::vector<uint8_t> result(entries * 3);
+    for (std::size_t i = 0; i < entries; ++i) {
+        const float v = entries > 1 ? (float)i / (entries - 1) : 0.f;
+        float rgb[3];
+        switch (map) {
+        case Colormap::CUBEHELIX:
+        {
+            cubehelix(v, M_PI/12., -1.f, 1.f, rgb);
+            break;
+        }
+        case Colormap::GRAYSCALE:
+        {
+            rgb[0] = rgb[1] = rgb[2] = v;
+            break;
+        }
+        case Colormap::HOT:
+        {
+            hot(v, rgb);
+            break;
+        }
+        case Colormap::JET:
+        {
+            jet(v, rgb);
+            break;
+        }
+        }
+        for (unsigned int c = 0; c < 3; ++c) {
+            result[i*3+c] = std::lround(rgb[c] * 255.f);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef COLORMAP_H
+#define COLORMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+enum class Colormap
+{
+    CUBEHELIX,
+    GRAYSCALE,
+    HOT,
+    JET
+};
+
+static constexpr Colormap COLORMAPS[] = {
+    Colormap::CUBEHELIX,
+    Colormap::GRAYSCALE,
+    Colormap::HOT,
+    Colormap::JET
+};
+
+static constexpr std::size_t COLORMAP_ENTRIES = 256;
+
+const char *colormap_name(Colormap map);
+
+// entries RGB8 triplets for values from 0 to 1
+std::vector<uint8_t> make_colormap(Colormap map,
+                                   std::size_t entries = COLORMAP_ENTRIES);
+
+#endif // COLORMAP_H
@@ -0,0 +1,978 @@
+#include "dsp.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+
+void multiply(const float *a,
+              const float *b,
+              float *dest,
+              std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&dest[i], _mm_mul_ps(_mm_loadu_ps(&a[i]),
+                                           _mm_loadu_ps(&b[i])));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&dest[i], vmulq_f32(vld1q_f32(&a[i]), vld1q_f32(&b[i])));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = a[i] * b[i];
+    }
+}
+
+float sum_of_squares(const float *src, std::size_t n)
+{
+    std::size_t i = 0;
+    float result = 0.f;
+#if defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        const __m128 a = _mm_loadu_ps(&src[i]);
+        const __m128 b = _mm_loadu_ps(&src[i+4]);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.f);
+    float32x4_t acc1 = vdupq_n_f32(0.f);
+    for (; i + 8 <= n; i += 8) {
+        const float32x4_t a = vld1q_f32(&src[i]);
+        const float32x4_t b = vld1q_f32(&src[i+4]);
+        acc0 = vmlaq_f32(acc0, a, a);
+        acc1 = vmlaq_f32(acc1, b, b);
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) {
+        result += src[i]*src[i];
+    }
+    return result;
+}
+
+float dot_product(const float *a, const float *b, std::size_t n)
+{
+    std::size_t i = 0;
+    float result = 0.f;
+#if defined(__SSE2__)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(&a[i]), _mm_loadu_ps(&b[i])));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(&a[i+4]), _mm_loadu_ps(&b[i+4])));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.f);
+    float32x4_t acc1 = vdupq_n_f32(0.f);
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(&a[i]), vld1q_f32(&b[i]));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(&a[i+4]), vld1q_f32(&b[i+4]));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < n; ++i) {
+        result += a[i]*b[i];
+    }
+    return result;
+}
+
+// samples between two exact evaluations of the oscillator in mix_down
+static constexpr std::size_t NCO_RESYNC_SAMPLES = 256;
+
+void mix_down(const float *src,
+              float *re,
+              float *im,
+              std::size_t n,
+              double phase,
+              double step)
+{
+    for (std::size_t start = 0; start < n; start += NCO_RESYNC_SAMPLES) {
+        const std::size_t end = std::min(n, start + NCO_RESYNC_SAMPLES);
+        const double base = phase + start * step;
+        // four oscillators, one per lane, each advancing by 4*step
+        float c[4], s[4];
+        for (int k = 0; k < 4; ++k) {
+            c[k] = std::cos(base + k * step);
+            s[k] = -std::sin(base + k * step);
+        }
+        const float rc = std::cos(4 * step);
+        const float rs = -std::sin(4 * step);
+
+        std::size_t i = start;
+#if defined(__SSE2__)
+        __m128 vc = _mm_loadu_ps(c);
+        __m128 vs = _mm_loadu_ps(s);
+        const __m128 vrc = _mm_set1_ps(rc);
+        const __m128 vrs = _mm_set1_ps(rs);
+        for (; i + 4 <= end; i += 4) {
+            const __m128 x = _mm_loadu_ps(&src[i]);
+            _mm_storeu_ps(&re[i], _mm_mul_ps(x, vc));
+            _mm_storeu_ps(&im[i], _mm_mul_ps(x, vs));
+            const __m128 nc = _mm_sub_ps(_mm_mul_ps(vc, vrc), _mm_mul_ps(vs, vrs));
+            vs = _mm_add_ps(_mm_mul_ps(vc, vrs), _mm_mul_ps(vs, vrc));
+            vc = nc;
+        }
+        _mm_storeu_ps(c, vc);
+        _mm_storeu_ps(s, vs);
+#elif defined(__ARM_NEON)
+        float32x4_t vc = vld1q_f32(c);
+        float32x4_t vs = vld1q_f32(s);
+        for (; i + 4 <= end; i += 4) {
+            const float32x4_t x = vld1q_f32(&src[i]);
+            vst1q_f32(&re[i], vmulq_f32(x, vc));
+            vst1q_f32(&im[i], vmulq_f32(x, vs));
+            const float32x4_t nc = vmlsq_n_f32(vmulq_n_f32(vc, rc), vs, rs);
+            vs = vmlaq_n_f32(vmulq_n_f32(vs, rc), vc, rs);
+            vc = nc;
+        }
+        vst1q_f32(c, vc);
+        vst1q_f32(s, vs);
+#else
+        for (; i + 4 <= end; i += 4) {
+            for (int k = 0; k < 4; ++k) {
+                re[i+k] = src[i+k] * c[k];
+                im[i+k] = src[i+k] * s[k];
+                const float nc = c[k] * rc - s[k] * rs;
+                s[k] = c[k] * rs + s[k] * rc;
+                c[k] = nc;
+            }
+        }
+#endif
+        for (int k = 0; i < end; ++i, ++k) {
+            // the lanes continue where the vector loop stopped
+            re[i] = src[i] * c[k];
+            im[i] = src[i] * s[k];
+        }
+    }
+}
+
+void complex_magnitudes(const float *src,
+                        float *dest,
+                        std::size_t n,
+                        float scale)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 lo = _mm_loadu_ps(&src[2*i]);
+        const __m128 hi = _mm_loadu_ps(&src[2*i+4]);
+        const __m128 re = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 im = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        const __m128 sq = _mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im));
+        _mm_storeu_ps(&dest[i], _mm_mul_ps(_mm_sqrt_ps(sq), vscale));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4x2_t v = vld2q_f32(&src[2*i]);
+        const float32x4_t sq = vmlaq_f32(vmulq_f32(v.val[0], v.val[0]),
+                                         v.val[1], v.val[1]);
+        vst1q_f32(&dest[i], vmulq_n_f32(vsqrtq_f32(sq), scale));
+    }
+#endif
+    for (; i < n; ++i) {
+        const float re = src[2*i];
+        const float im = src[2*i+1];
+        dest[i] = std::sqrt(re*re + im*im) * scale;
+    }
+}
+
+
+template <typename int_t>
+struct int_to_float_mapping
+{
+    // maps [min, max] onto [-1, 1]
+    static constexpr float scale =
+            2.f / ((float)std::numeric_limits<int_t>::max() - (float)std::numeric_limits<int_t>::min());
+    static constexpr float offset =
+            -(float)std::numeric_limits<int_t>::min() * scale - 1.f;
+};
+
+template <typename int_t>
+static inline void convert_scalar(const unsigned char *src,
+                                  float *dest,
+                                  std::size_t i,
+                                  std::size_t n)
+{
+    for (; i < n; ++i) {
+        int_t value;
+        // memcpy keeps this well-defined when converting in place
+        std::memcpy(&value, &src[i*sizeof(int_t)], sizeof(int_t));
+        dest[i] = (float)value * int_to_float_mapping<int_t>::scale
+                + int_to_float_mapping<int_t>::offset;
+    }
+}
+
+void convert_s8(const void *src, float *dest, std::size_t n)
+{
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+#ifdef __SSE2__
+    const __m128 scale = _mm_set1_ps(int_to_float_mapping<int8_t>::scale);
+    const __m128 offset = _mm_set1_ps(int_to_float_mapping<int8_t>::offset);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&raw[i]));
+        const __m128i lo16 = _mm_srai_epi16(_mm_unpacklo_epi8(v8, v8), 8);
+        const __m128i hi16 = _mm_srai_epi16(_mm_unpackhi_epi8(v8, v8), 8);
+        const __m128i v32[4] = {
+            _mm_srai_epi32(_mm_unpacklo_epi16(lo16, lo16), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(lo16, lo16), 16),
+            _mm_srai_epi32(_mm_unpacklo_epi16(hi16, hi16), 16),
+            _mm_srai_epi32(_mm_unpackhi_epi16(hi16, hi16), 16),
+        };
+        for (unsigned int j = 0; j < 4; ++j) {
+            _mm_storeu_ps(&dest[i+4*j],
+                          _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v32[j]), scale),
+                                     offset));
+        }
+    }
+#endif
+    convert_scalar<int8_t>(raw, dest, i, n);
+}
+
+void convert_u8(const void *src, float *dest, std::size_t n)
+{
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(int_to_float_mapping<uint8_t>::scale);
+    const __m128 offset = _mm_set1_ps(int_to_float_mapping<uint8_t>::offset);
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&raw[i]));
+        const __m128i lo16 = _mm_unpacklo_epi8(v8, zero);
+        const __m128i hi16 = _mm_unpackhi_epi8(v8, zero);
+        const __m128i v32[4] = {
+            _mm_unpacklo_epi16(lo16, zero),
+            _mm_unpackhi_epi16(lo16, zero),
+            _mm_unpacklo_epi16(hi16, zero),
+            _mm_unpackhi_epi16(hi16, zero),
+        };
+        for (unsigned int j = 0; j < 4; ++j) {
+            _mm_storeu_ps(&dest[i+4*j],
+                          _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v32[j]), scale),
+                                     offset));
+        }
+    }
+#endif
+    convert_scalar<uint8_t>(raw, dest, i, n);
+}
+
+void convert_s16(const void *src, float *dest, std::size_t n)
+{
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(int_to_float_mapping<int16_t>::scale);
+    const __m128 offset = _mm_set1_ps(int_to_float_mapping<int16_t>::offset);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&raw[i*2]));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v16, v16), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v16, v16), 16);
+        _mm_storeu_ps(&dest[i],
+                      _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale), offset));
+        _mm_storeu_ps(&dest[i+4],
+                      _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale), offset));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t scale = vdupq_n_f32(int_to_float_mapping<int16_t>::scale);
+    const float32x4_t offset = vdupq_n_f32(int_to_float_mapping<int16_t>::offset);
+    for (; i + 8 <= n; i += 8) {
+        const int16x8_t v16 = vreinterpretq_s16_u8(vld1q_u8(&raw[i*2]));
+        const float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v16)));
+        const float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v16)));
+        vst1q_f32(&dest[i], vmlaq_f32(offset, lo, scale));
+        vst1q_f32(&dest[i+4], vmlaq_f32(offset, hi, scale));
+    }
+#endif
+    convert_scalar<int16_t>(raw, dest, i, n);
+}
+
+void convert_u16(const void *src, float *dest, std::size_t n)
+{
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(int_to_float_mapping<uint16_t>::scale);
+    const __m128 offset = _mm_set1_ps(int_to_float_mapping<uint16_t>::offset);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&raw[i*2]));
+        const __m128i lo = _mm_unpacklo_epi16(v16, zero);
+        const __m128i hi = _mm_unpackhi_epi16(v16, zero);
+        _mm_storeu_ps(&dest[i],
+                      _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), scale), offset));
+        _mm_storeu_ps(&dest[i+4],
+                      _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), scale), offset));
+    }
+#endif
+    convert_scalar<uint16_t>(raw, dest, i, n);
+}
+
+void convert_s24(const void *src, float *dest, std::size_t n)
+{
+    static constexpr float scale = 2.f / 16777215.f;
+    static constexpr float offset = 8388608.f * scale - 1.f;
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    for (std::size_t i = 0; i < n; ++i) {
+        const unsigned char *sample = &raw[i*3];
+        // shift into the top of an int32 to sign-extend
+        const int32_t value = (int32_t)(((uint32_t)sample[0] << 8) |
+                                        ((uint32_t)sample[1] << 16) |
+                                        ((uint32_t)sample[2] << 24)) >> 8;
+        dest[i] = (float)value * scale + offset;
+    }
+}
+
+void convert_u24(const void *src, float *dest, std::size_t n)
+{
+    static constexpr float scale = 2.f / 16777215.f;
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    for (std::size_t i = 0; i < n; ++i) {
+        const unsigned char *sample = &raw[i*3];
+        const uint32_t value = (uint32_t)sample[0] |
+                ((uint32_t)sample[1] << 8) |
+                ((uint32_t)sample[2] << 16);
+        dest[i] = (float)value * scale - 1.f;
+    }
+}
+
+void convert_s32(const void *src, float *dest, std::size_t n)
+{
+    const unsigned char *raw = static_cast<const unsigned char*>(src);
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(int_to_float_mapping<int32_t>::scale);
+    const __m128 offset = _mm_set1_ps(int_to_float_mapping<int32_t>::offset);
+    for (; i + 4 <= n; i += 4) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&raw[i*4]));
+        _mm_storeu_ps(&dest[i],
+                      _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(v), scale), offset));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t scale = vdupq_n_f32(int_to_float_mapping<int32_t>::scale);
+    const float32x4_t offset = vdupq_n_f32(int_to_float_mapping<int32_t>::offset);
+    for (; i + 4 <= n; i += 4) {
+        const int32x4_t v = vreinterpretq_s32_u8(vld1q_u8(&raw[i*4]));
+        vst1q_f32(&dest[i], vmlaq_f32(offset, vcvtq_f32_s32(v), scale));
+    }
+#endif
+    convert_scalar<int32_t>(raw, dest, i, n);
+}
+
+void convert_u32(const void *src, float *dest, std::size_t n)
+{
+    convert_scalar<uint32_t>(static_cast<const unsigned char*>(src), dest, 0, n);
+}
+
+void max_hold_halve(const float *src,
+                    float *dest,
+                    std::size_t n)
+{
+    const std::size_t out = (n + 1) / 2;
+    std::size_t i = 0;
+    // in place is fine: each step reads src[2i..2i+7] before writing
+    // dest[i..i+3]
+#if defined(__SSE2__)
+    for (; 2*i + 8 <= n; i += 4) {
+        const __m128 lo = _mm_loadu_ps(&src[2*i]);
+        const __m128 hi = _mm_loadu_ps(&src[2*i+4]);
+        const __m128 even = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        const __m128 odd = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm_storeu_ps(&dest[i], _mm_max_ps(even, odd));
+    }
+#elif defined(__ARM_NEON)
+    for (; 2*i + 8 <= n; i += 4) {
+        const float32x4x2_t v = vld2q_f32(&src[2*i]);
+        vst1q_f32(&dest[i], vmaxq_f32(v.val[0], v.val[1]));
+    }
+#endif
+    for (; i < out; ++i) {
+        dest[i] = 2*i + 1 < n ? std::max(src[2*i], src[2*i+1]) : src[2*i];
+    }
+}
+
+std::size_t max_hold_decimated_size(std::size_t n, std::size_t min_size)
+{
+    min_size = std::max<std::size_t>(min_size, 1);
+    while (n >= 2*min_size) {
+        n = (n + 1) / 2;
+    }
+    return n;
+}
+
+std::size_t max_hold_decimate(const float *src,
+                              std::size_t n,
+                              std::size_t min_size,
+                              std::vector<float> &dest)
+{
+    const std::size_t result = max_hold_decimated_size(n, min_size);
+    if (result == n) {
+        dest.assign(src, src + n);
+        return n;
+    }
+
+    dest.resize((n + 1) / 2);
+    max_hold_halve(src, dest.data(), n);
+    n = (n + 1) / 2;
+    while (n > result) {
+        max_hold_halve(dest.data(), dest.data(), n);
+        n = (n + 1) / 2;
+    }
+    dest.resize(n);
+    return n;
+}
+
+void exponential_average(const float *src,
+                         float *acc,
+                         std::size_t n,
+                         float alpha)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 valpha = _mm_set1_ps(alpha);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 a = _mm_loadu_ps(&acc[i]);
+        const __m128 d = _mm_sub_ps(_mm_loadu_ps(&src[i]), a);
+        _mm_storeu_ps(&acc[i], _mm_add_ps(a, _mm_mul_ps(d, valpha)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t a = vld1q_f32(&acc[i]);
+        const float32x4_t d = vsubq_f32(vld1q_f32(&src[i]), a);
+        vst1q_f32(&acc[i], vmlaq_n_f32(a, d, alpha));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc[i] += alpha * (src[i] - acc[i]);
+    }
+}
+
+void accumulate(const float *src,
+                float *acc,
+                std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&acc[i], _mm_add_ps(_mm_loadu_ps(&acc[i]),
+                                          _mm_loadu_ps(&src[i])));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&acc[i], vaddq_f32(vld1q_f32(&acc[i]), vld1q_f32(&src[i])));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc[i] += src[i];
+    }
+}
+
+void sliding_update(const float *add,
+                    const float *remove,
+                    float *acc,
+                    std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        const __m128 d = _mm_sub_ps(_mm_loadu_ps(&add[i]), _mm_loadu_ps(&remove[i]));
+        _mm_storeu_ps(&acc[i], _mm_add_ps(_mm_loadu_ps(&acc[i]), d));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t d = vsubq_f32(vld1q_f32(&add[i]), vld1q_f32(&remove[i]));
+        vst1q_f32(&acc[i], vaddq_f32(vld1q_f32(&acc[i]), d));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc[i] += add[i] - remove[i];
+    }
+}
+
+void max_hold(const float *src,
+              float *acc,
+              std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&acc[i], _mm_max_ps(_mm_loadu_ps(&acc[i]),
+                                          _mm_loadu_ps(&src[i])));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&acc[i], vmaxq_f32(vld1q_f32(&acc[i]), vld1q_f32(&src[i])));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc[i] = std::max(acc[i], src[i]);
+    }
+}
+
+void min_hold(const float *src,
+              float *acc,
+              std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&acc[i], _mm_min_ps(_mm_loadu_ps(&acc[i]),
+                                          _mm_loadu_ps(&src[i])));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&acc[i], vminq_f32(vld1q_f32(&acc[i]), vld1q_f32(&src[i])));
+    }
+#endif
+    for (; i < n; ++i) {
+        acc[i] = std::min(acc[i], src[i]);
+    }
+}
+
+void scale(const float *src,
+           float *dest,
+           std::size_t n,
+           float factor)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 vfactor = _mm_set1_ps(factor);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&dest[i], _mm_mul_ps(_mm_loadu_ps(&src[i]), vfactor));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&dest[i], vmulq_n_f32(vld1q_f32(&src[i]), factor));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = src[i] * factor;
+    }
+}
+
+void scaled_sqrt(const float *src,
+                 float *dest,
+                 std::size_t n,
+                 float factor)
+{
+    std::size_t i = 0;
+    // running sums can drift slightly below zero
+#if defined(__SSE2__)
+    const __m128 vfactor = _mm_set1_ps(factor);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&src[i]), vfactor), zero);
+        _mm_storeu_ps(&dest[i], _mm_sqrt_ps(v));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t zero = vdupq_n_f32(0.f);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t v = vmaxq_f32(vmulq_n_f32(vld1q_f32(&src[i]), factor), zero);
+        vst1q_f32(&dest[i], vsqrtq_f32(v));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = std::sqrt(std::max(src[i] * factor, 0.f));
+    }
+}
+
+// least squares fit of log2(1+t), t in [0, 1), exact at t = 0
+static constexpr float LOG2_C1 = 1.43863803f;
+static constexpr float LOG2_C2 = -0.67774327f;
+static constexpr float LOG2_C3 = 0.32187971f;
+static constexpr float LOG2_C4 = -0.08286070f;
+// 20*log10(2)
+static constexpr float DB_PER_OCTAVE = 6.0205999f;
+
+static inline float magnitude_to_db(float v)
+{
+    if (!(v >= MIN_MAGNITUDE)) {
+        v = MIN_MAGNITUDE;
+    }
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    const float e = (float)((int32_t)(bits >> 23) - 127);
+    bits = (bits & 0x007fffff) | 0x3f800000;
+    float m;
+    std::memcpy(&m, &bits, sizeof(m));
+    const float t = m - 1.f;
+    const float p = t*(LOG2_C1 + t*(LOG2_C2 + t*(LOG2_C3 + t*LOG2_C4)));
+    return (e + p) * DB_PER_OCTAVE;
+}
+
+// only valid for |v| < 65520, which holds for any dB value of a float
+static inline uint16_t float_to_half(float v)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t abs = bits & 0x7fffffff;
+    if (abs < 0x38800000) {
+        return sign;
+    }
+    // rebias the exponent and round to nearest even
+    return sign | ((abs - 0x38000000 + 0x0fff + ((abs >> 13) & 1)) >> 13);
+}
+
+#if defined(__SSE2__)
+static inline __m128 magnitude_to_db_sse2(__m128 v)
+{
+    // max returns the second operand for NaNs
+    v = _mm_max_ps(v, _mm_set1_ps(MIN_MAGNITUDE));
+    const __m128i bits = _mm_castps_si128(v);
+    const __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23),
+                                                   _mm_set1_epi32(127)));
+    const __m128 t = _mm_sub_ps(
+                _mm_castsi128_ps(
+                    _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                 _mm_set1_epi32(0x3f800000))),
+                _mm_set1_ps(1.f));
+    __m128 p = _mm_set1_ps(LOG2_C4);
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C3));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C2));
+    p = _mm_add_ps(_mm_mul_ps(p, t), _mm_set1_ps(LOG2_C1));
+    p = _mm_mul_ps(p, t);
+    return _mm_mul_ps(_mm_add_ps(e, p), _mm_set1_ps(DB_PER_OCTAVE));
+}
+
+// half float bit patterns in the low 16 bits of each lane
+static inline __m128i float_to_half_sse2(__m128 v)
+{
+    const __m128i bits = _mm_castps_si128(v);
+    const __m128i sign = _mm_and_si128(_mm_srli_epi32(bits, 16),
+                                       _mm_set1_epi32(0x8000));
+    const __m128i abs = _mm_and_si128(bits, _mm_set1_epi32(0x7fffffff));
+    const __m128i lsb = _mm_and_si128(_mm_srli_epi32(abs, 13),
+                                      _mm_set1_epi32(1));
+    __m128i h = _mm_srli_epi32(
+                _mm_add_epi32(_mm_sub_epi32(abs, _mm_set1_epi32(0x38000000 - 0x0fff)),
+                              lsb),
+                13);
+    h = _mm_and_si128(h, _mm_cmpgt_epi32(abs, _mm_set1_epi32(0x387fffff)));
+    return _mm_or_si128(h, sign);
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static inline float32x4_t magnitude_to_db_neon(float32x4_t v)
+{
+    v = vmaxnmq_f32(v, vdupq_n_f32(MIN_MAGNITUDE));
+    const uint32x4_t bits = vreinterpretq_u32_f32(v);
+    const float32x4_t e = vcvtq_f32_s32(
+                vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)),
+                          vdupq_n_s32(127)));
+    const float32x4_t t = vsubq_f32(
+                vreinterpretq_f32_u32(
+                    vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007fffff)),
+                              vdupq_n_u32(0x3f800000))),
+                vdupq_n_f32(1.f));
+    float32x4_t p = vdupq_n_f32(LOG2_C4);
+    p = vmlaq_f32(vdupq_n_f32(LOG2_C3), p, t);
+    p = vmlaq_f32(vdupq_n_f32(LOG2_C2), p, t);
+    p = vmlaq_f32(vdupq_n_f32(LOG2_C1), p, t);
+    p = vmulq_f32(p, t);
+    return vmulq_n_f32(vaddq_f32(e, p), DB_PER_OCTAVE);
+}
+#endif
+
+void magnitudes_to_db_half(const float *src,
+                           uint16_t *dest,
+                           std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // SSE2 has no unsigned saturating 32 -> 16 bit pack, so bias into the
+    // signed range and back
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= n; i += 8) {
+        const __m128i lo = float_to_half_sse2(magnitude_to_db_sse2(_mm_loadu_ps(&src[i])));
+        const __m128i hi = float_to_half_sse2(magnitude_to_db_sse2(_mm_loadu_ps(&src[i+4])));
+        const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(lo, bias32),
+                                               _mm_sub_epi32(hi, bias32));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]),
+                         _mm_xor_si128(packed, bias16));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t db = magnitude_to_db_neon(vld1q_f32(&src[i]));
+        vst1_u16(&dest[i], vreinterpret_u16_f16(vcvt_f16_f32(db)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = float_to_half(magnitude_to_db(src[i]));
+    }
+}
+
+void magnitudes_to_db(const float *src,
+                      float *dest,
+                      std::size_t n)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(&dest[i], magnitude_to_db_sse2(_mm_loadu_ps(&src[i])));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(&dest[i], magnitude_to_db_neon(vld1q_f32(&src[i])));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = magnitude_to_db(src[i]);
+    }
+}
+
+void quantize_u8(const float *src,
+                 uint8_t *dest,
+                 std::size_t n,
+                 float offset,
+                 float scale)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 voffset = _mm_set1_ps(offset);
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 16 <= n; i += 16) {
+        __m128i q[4];
+        for (int k = 0; k < 4; ++k) {
+            q[k] = _mm_cvtps_epi32(_mm_mul_ps(
+                                       _mm_sub_ps(_mm_loadu_ps(&src[i+4*k]), voffset),
+                                       vscale));
+        }
+        // both packs saturate, the last one to [0, 255]
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]),
+                                                _mm_packs_epi32(q[2], q[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), packed);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t voffset = vdupq_n_f32(offset);
+    for (; i + 8 <= n; i += 8) {
+        const uint32x4_t lo = vcvtnq_u32_f32(
+                    vmulq_n_f32(vsubq_f32(vld1q_f32(&src[i]), voffset), scale));
+        const uint32x4_t hi = vcvtnq_u32_f32(
+                    vmulq_n_f32(vsubq_f32(vld1q_f32(&src[i+4]), voffset), scale));
+        vst1_u8(&dest[i], vqmovn_u16(vcombine_u16(vqmovn_u32(lo), vqmovn_u32(hi))));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = (uint8_t)std::min(255.f, std::max(0.f, std::nearbyint((src[i] - offset) * scale)));
+    }
+}
+
+void quantize_u16(const float *src,
+                  uint16_t *dest,
+                  std::size_t n,
+                  float offset,
+                  float scale)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    // SSE2 only packs to signed 16 bit, so clamp first and pack with a bias
+    const __m128 voffset = _mm_set1_ps(offset);
+    const __m128 vscale = _mm_set1_ps(scale);
+    const __m128 lower = _mm_setzero_ps();
+    const __m128 upper = _mm_set1_ps(65535.f);
+    const __m128i bias32 = _mm_set1_epi32(32768);
+    const __m128i bias16 = _mm_set1_epi16(-32768);
+    for (; i + 8 <= n; i += 8) {
+        __m128i q[2];
+        for (int k = 0; k < 2; ++k) {
+            const __m128 v = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&src[i+4*k]), voffset),
+                                        vscale);
+            q[k] = _mm_sub_epi32(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lower), upper)),
+                                 bias32);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]),
+                         _mm_xor_si128(_mm_packs_epi32(q[0], q[1]), bias16));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t voffset = vdupq_n_f32(offset);
+    for (; i + 4 <= n; i += 4) {
+        const uint32x4_t q = vcvtnq_u32_f32(
+                    vmulq_n_f32(vsubq_f32(vld1q_f32(&src[i]), voffset), scale));
+        vst1_u16(&dest[i], vqmovn_u32(q));
+    }
+#endif
+    for (; i < n; ++i) {
+        dest[i] = (uint16_t)std::min(65535.f, std::max(0.f, std::nearbyint((src[i] - offset) * scale)));
+    }
+}
+
+void half_to_float(const uint16_t *src,
+                   float *dest,
+                   std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        const uint32_t h = src[i];
+        const uint32_t sign = (h & 0x8000) << 16;
+        const uint32_t exponent = (h >> 10) & 0x1f;
+        const uint32_t mantissa = h & 0x3ff;
+        uint32_t bits;
+        if (exponent == 0x1f) {
+            bits = sign | 0x7f800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+            bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        } else {
+            // zero or subnormal: exact as a float
+            const float value = mantissa * (1.f / (1 << 24));
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits |= sign;
+        }
+        std::memcpy(&dest[i], &bits, sizeof(bits));
+    }
+}
+
+std::size_t find_peaks(const float *src,
+                       const float *threshold,
+                       std::size_t n,
+                       uint32_t *dest)
+{
+    if (n < 3) {
+        return 0;
+    }
+    std::size_t count = 0;
+    std::size_t i = 1;
+#if defined(__SSE2__)
+    for (; i + 5 <= n; i += 4) {
+        const __m128 c = _mm_loadu_ps(&src[i]);
+        const __m128 hit = _mm_and_ps(
+                    _mm_and_ps(_mm_cmpgt_ps(c, _mm_loadu_ps(&src[i-1])),
+                               _mm_cmpge_ps(c, _mm_loadu_ps(&src[i+1]))),
+                    _mm_cmpgt_ps(c, _mm_loadu_ps(&threshold[i])));
+        int mask = _mm_movemask_ps(hit);
+        while (mask) {
+            dest[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    // most groups hold no peak, so only those that do are looked at bin by bin
+    for (; i + 5 <= n; i += 4) {
+        const float32x4_t c = vld1q_f32(&src[i]);
+        const uint32x4_t hit = vandq_u32(
+                    vandq_u32(vcgtq_f32(c, vld1q_f32(&src[i-1])),
+                              vcgeq_f32(c, vld1q_f32(&src[i+1]))),
+                    vcgtq_f32(c, vld1q_f32(&threshold[i])));
+        if (vmaxvq_u32(hit) == 0) {
+            continue;
+        }
+        uint32_t lanes[4];
+        vst1q_u32(lanes, hit);
+        for (uint32_t k = 0; k < 4; ++k) {
+            if (lanes[k]) {
+                dest[count++] = i + k;
+            }
+        }
+    }
+#endif
+    for (; i + 1 < n; ++i) {
+        if (src[i] > src[i-1] && src[i] >= src[i+1] && src[i] > threshold[i]) {
+            dest[count++] = i;
+        }
+    }
+    return count;
+}
+
+void downmix(const float *src,
+             float *dest,
+             std::size_t frames,
+             uint32_t channels)
+{
+    std::size_t i = 0;
+    if (channels == 2) {
+#if defined(__SSE2__)
+        for (; i + 4 <= frames; i += 4) {
+            const __m128 lo = _mm_loadu_ps(&src[2*i]);
+            const __m128 hi = _mm_loadu_ps(&src[2*i+4]);
+            _mm_storeu_ps(&dest[i],
+                          _mm_add_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+                                     _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 4 <= frames; i += 4) {
+            const float32x4x2_t v = vld2q_f32(&src[2*i]);
+            vst1q_f32(&dest[i], vaddq_f32(v.val[0], v.val[1]));
+        }
+#endif
+        for (; i < frames; ++i) {
+            dest[i] = src[2*i] + src[2*i+1];
+        }
+        return;
+    }
+
+    // channel-outer order keeps the inner loop over dest vectorisable
+    std::memset(dest, 0, frames * sizeof(float));
+    for (uint32_t j = 0; j < channels; ++j) {
+        for (i = 0; i < frames; ++i) {
+            dest[i] += src[i*channels+j];
+        }
+    }
+}
+
+void deinterleave(const float *src,
+                  float *dest,
+                  std::size_t frames,
+                  uint32_t channels,
+                  std::size_t stride)
+{
+    if (channels == 1) {
+        std::memcpy(dest, src, frames * sizeof(float));
+        return;
+    }
+
+    std::size_t i = 0;
+    if (channels == 2) {
+        float *left = dest;
+        float *right = dest + stride;
+#if defined(__SSE2__)
+        for (; i + 4 <= frames; i += 4) {
+            const __m128 lo = _mm_loadu_ps(&src[2*i]);
+            const __m128 hi = _mm_loadu_ps(&src[2*i+4]);
+            _mm_storeu_ps(&left[i], _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+            _mm_storeu_ps(&right[i], _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 4 <= frames; i += 4) {
+            const float32x4x2_t v = vld2q_f32(&src[2*i]);
+            vst1q_f32(&left[i], v.val[0]);
+            vst1q_f32(&right[i], v.val[1]);
+        }
+#endif
+        for (; i < frames; ++i) {
+            left[i] = src[2*i];
+            right[i] = src[2*i+1];
+        }
+        return;
+    }
+
+    for (uint32_t j = 0; j < channels; ++j) {
+        float *row = dest + j * stride;
+        for (i = 0; i < frames; ++i) {
+            row[i] = src[i*channels+j];
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+void multiply(const float *a,
+              const float *b,
+              float *dest,
+              std::size_t n);
+
+float sum_of_squares(const float *src, std::size_t n);
+
+float dot_product(const float *a, const float *b, std::size_t n);
+
+// Mixes real samples down by a numerically controlled oscillator:
+// re[i] + j*im[i] = src[i] * exp(-j*(phase + i*step)). The oscillator is
+// resynchronised from the exact phase every few hundred samples, so it does
+// not drift in amplitude or phase over long blocks.
+void mix_down(const float *src,
+              float *re,
+              float *im,
+              std::size_t n,
+              double phase,
+              double step);
+
+// src holds n interleaved (re, im) pairs
+void complex_magnitudes(const float *src,
+                        float *dest,
+                        std::size_t n,
+                        float scale);
+
+// Convert little-endian integer PCM to floats in [-1, 1]. src may point into
+// the storage of dest, as long as it ends where dest ends (that is, for
+// in-place conversion the raw samples are read into the tail of the float
+// buffer).
+void convert_s8(const void *src, float *dest, std::size_t n);
+void convert_u8(const void *src, float *dest, std::size_t n);
+void convert_s16(const void *src, float *dest, std::size_t n);
+void convert_u16(const void *src, float *dest, std::size_t n);
+void convert_s24(const void *src, float *dest, std::size_t n);
+void convert_u24(const void *src, float *dest, std::size_t n);
+void convert_s32(const void *src, float *dest, std::size_t n);
+void convert_u32(const void *src, float *dest, std::size_t n);
+
+// dest[i] = max(src[2i], src[2i+1]) for the (n+1)/2 outputs; dest may be src
+void max_hold_halve(const float *src,
+                    float *dest,
+                    std::size_t n);
+
+// Number of values left after halving n values with max_hold_halve until
+// fewer than 2*min_size remain (or n itself if n < 2*min_size).
+std::size_t max_hold_decimated_size(std::size_t n, std::size_t min_size);
+
+// Max-hold decimation pyramid, down to the level with
+// max_hold_decimated_size(n, min_size) values. Only the final level is kept
+// (in dest); returns its size.
+std::size_t max_hold_decimate(const float *src,
+                              std::size_t n,
+                              std::size_t min_size,
+                              std::vector<float> &dest);
+
+// In-place accumulation kernels for spectral averaging; acc is updated
+// from src element-wise.
+// acc += alpha * (src - acc)
+void exponential_average(const float *src,
+                         float *acc,
+                         std::size_t n,
+                         float alpha);
+// acc += src
+void accumulate(const float *src,
+                float *acc,
+                std::size_t n);
+// acc += add - remove, for running sums over a sliding window
+void sliding_update(const float *add,
+                    const float *remove,
+                    float *acc,
+                    std::size_t n);
+// acc = max(acc, src) and acc = min(acc, src)
+void max_hold(const float *src,
+              float *acc,
+              std::size_t n);
+void min_hold(const float *src,
+              float *acc,
+              std::size_t n);
+// dest = src * factor and dest = sqrt(max(src * factor, 0)); dest may be src
+void scale(const float *src,
+           float *dest,
+           std::size_t n,
+           float factor);
+void scaled_sqrt(const float *src,
+                 float *dest,
+                 std::size_t n,
+                 float factor);
+
+// 20*log10(src[i]) as IEEE half floats, for upload as R16F textures.
+// Magnitudes are floored at MIN_MAGNITUDE; log10 is approximated to within
+// about 0.001 dB. Results below the smallest normal half may be flushed to
+// zero.
+static constexpr float MIN_MAGNITUDE = 1e-20f;
+void magnitudes_to_db_half(const float *src,
+                           uint16_t *dest,
+                           std::size_t n);
+
+// 20*log10(src[i]) as floats, with the same floor and approximation as
+// magnitudes_to_db_half; dest may be src
+void magnitudes_to_db(const float *src,
+                      float *dest,
+                      std::size_t n);
+
+// dest[i] = (src[i] - offset) * scale, rounded to the nearest integer and
+// saturated to the range of the destination type
+void quantize_u8(const float *src,
+                 uint8_t *dest,
+                 std::size_t n,
+                 float offset,
+                 float scale);
+void quantize_u16(const float *src,
+                  uint16_t *dest,
+                  std::size_t n,
+                  float offset,
+                  float scale);
+
+// IEEE half floats to floats
+void half_to_float(const uint16_t *src,
+                   float *dest,
+                   std::size_t n);
+
+// Indices i of the local maxima src[i-1] < src[i] >= src[i+1] with
+// src[i] > threshold[i], for 0 < i < n-1, in ascending order. dest must have
+// room for n/2 indices; returns their number.
+std::size_t find_peaks(const float *src,
+                       const float *threshold,
+                       std::size_t n,
+                       uint32_t *dest);
+
+// sum the channels of each interleaved frame
+void downmix(const float *src,
+             float *dest,
+             std::size_t frames,
+             uint32_t channels);
+
+// split interleaved frames into one row per channel; row c starts at
+// dest + c * stride
+void deinterleave(const float *src,
+                  float *dest,
+                  std::size_t frames,
+                  uint32_t channels,
+                  std::size_t stride);
+
+#endif // DSP_H
@@ -1,68 +1,105 @@
 #include <ccomplex>
 #include "engine.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 #include <iostream>
-#include <thread>
+
+#include "dsp.h"
+#include "threadpolicy.h"
 
 #include <QAudioOutput>
+#include <QTimer>
 #include <QTimerEvent>
 
 
-template <typename int_t>
-struct sample_converter
+class IntToFloatConverter: public AbstractSampleConverter
 {
-    static constexpr float range =
-            ((float)std::numeric_limits<int_t>::max() - (float)std::numeric_limits<int_t>::min());
+public:
+    typedef void (*kernel_t)(const void *src, float *dest, std::size_t n);
 
-    static void convert(const std::vector<int_t> &in,
-                        std::vector<float> &out)
+    IntToFloatConverter(uint32_t bytes_per_sample, kernel_t kernel):
+        m_bytes_per_sample(bytes_per_sample),
+        m_kernel(kernel)
     {
-        out.resize(in.size());
-        for (typename std::vector<int_t>::size_type i = 0;
-             i < in.size();
-             ++i)
-        {
-            const int_t value = in[i];
-            out[i] = ((float)value - (float)std::numeric_limits<int_t>::min()) / range * 2.f - 1.f;
-        }
-    }
-};
 
+    }
 
-template <typename int_t>
-class IntToFloatConverter: public AbstractSampleConverter
-{
 private:
-    std::vector<int_t> m_buffer;
+    const uint32_t m_bytes_per_sample;
+    const kernel_t m_kernel;
 
 public:
+    uint32_t bytes_per_sample() const override
+    {
+        return m_bytes_per_sample;
+    }
+
+    void convert(const void *src,
+                 std::size_t samples,
+                 float *dest) override
+    {
+        m_kernel(src, dest, samples);
+    }
+
     bool read_and_convert(QIODevice *source,
                           uint32_t bytes_to_read,
                           std::vector<float> &dest) override
     {
-        assert(bytes_to_read % sizeof(int_t) == 0);
-        const uint32_t samples_to_read = (bytes_to_read / sizeof(int_t));
-        m_buffer.resize(samples_to_read);
+        assert(bytes_to_read % m_bytes_per_sample == 0);
+        const uint32_t samples_to_read = bytes_to_read / m_bytes_per_sample;
+        dest.resize(samples_to_read);
 
-        const uint32_t bytes_total = samples_to_read*sizeof(int_t);
+        // read the raw samples into the tail of dest and convert in place
+        char *raw = reinterpret_cast<char*>(dest.data())
+                + samples_to_read * (sizeof(float) - m_bytes_per_sample);
         const int64_t bytes_read = source->read(
-                    (char*)m_buffer.data(),
-                    bytes_total);
+                    raw,
+                    samples_to_read * m_bytes_per_sample);
         if (bytes_read == -1) {
             return false;
         }
 
-        assert(bytes_read % sizeof(int_t) == 0);
-        m_buffer.resize(bytes_read / sizeof(int_t));
-
-        sample_converter<int_t>::convert(m_buffer, dest);
+        assert(bytes_read % m_bytes_per_sample == 0);
+        const uint32_t samples_read = bytes_read / m_bytes_per_sample;
+        m_kernel(raw, dest.data(), samples_read);
+        dest.resize(samples_read);
         return true;
     }
 
 };
 
+/* SampleBlock */
+
+const ChannelSelection DOWNMIX_ONLY{SampleBlock::DOWNMIX};
+
+const float *SampleBlock::samples(int32_t selection) const
+{
+    if (selection == DOWNMIX) {
+        if (channels == 1) {
+            return channel(0);
+        }
+        if (channels == 0) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(m_mono_mutex);
+        if (!m_mono_ready) {
+            m_mono_samples.assign(channel(0), channel(0) + frames);
+            for (uint32_t c = 1; c < channels; ++c) {
+                accumulate(channel(c), m_mono_samples.data(), frames);
+            }
+            m_mono_ready = true;
+        }
+        return m_mono_samples.data();
+    }
+    if (selection < 0 || (uint32_t)selection >= channels) {
+        return nullptr;
+    }
+    return channel(selection);
+}
+
 /* VirtualAudioSource */
 
 bool VirtualAudioSource::is_seekable() const
@@ -80,6 +117,11 @@ uint64_t VirtualAudioSource::tell() const
     return 0;
 }
 
+bool VirtualAudioSource::is_realtime() const
+{
+    return true;
+}
+
 
 AbstractSampleConverter::~AbstractSampleConverter()
 {
@@ -95,13 +137,21 @@ std::unique_ptr<AbstractSampleConverter> AbstractSampleConverter::make_converter
     case QAudioFormat::SignedInt:
     {
         switch (bits) {
+        case 8:
+        {
+            return std::make_unique<IntToFloatConverter>(1, &convert_s8);
+        }
         case 16:
         {
-            return std::make_unique<IntToFloatConverter<int16_t> >();
+            return std::make_unique<IntToFloatConverter>(2, &convert_s16);
+        }
+        case 24:
+        {
+            return std::make_unique<IntToFloatConverter>(3, &convert_s24);
         }
         case 32:
         {
-            return std::make_unique<IntToFloatConverter<int32_t> >();
+            return std::make_unique<IntToFloatConverter>(4, &convert_s32);
         }
         default:
             throw std::runtime_error("unsupported sample format: s"+
@@ -111,13 +161,21 @@ std::unique_ptr<AbstractSampleConverter> AbstractSampleConverter::make_converter
     case QAudioFormat::UnSignedInt:
     {
         switch (bits) {
+        case 8:
+        {
+            return std::make_unique<IntToFloatConverter>(1, &convert_u8);
+        }
         case 16:
         {
-            return std::make_unique<IntToFloatConverter<uint16_t> >();
+            return std::make_unique<IntToFloatConverter>(2, &convert_u16);
+        }
+        case 24:
+        {
+            return std::make_unique<IntToFloatConverter>(3, &convert_u24);
         }
         case 32:
         {
-            return std::make_unique<IntToFloatConverter<uint32_t> >();
+            return std::make_unique<IntToFloatConverter>(4, &convert_u32);
         }
         default:
             throw std::runtime_error("unsupported sample format: u"+
@@ -147,11 +205,13 @@ std::unique_ptr<AbstractSampleConverter> AbstractSampleConverter::make_converter
 AudioInputSource::AudioInputSource(const QAudioDeviceInfo &device,
                                    const QAudioFormat &format,
                                    const float initial_volume,
+                                   uint32_t buffer_msecs,
                                    QObject *parent):
     VirtualAudioSource(parent),
     m_device(device),
     m_format(format),
     m_volume(initial_volume),
+    m_buffer_msecs(buffer_msecs),
     m_input(nullptr),
     m_source(nullptr),
     m_converter()
@@ -188,13 +248,16 @@ std::pair<bool, global_clock::time_point> AudioInputSource::read_samples(
     }
 
     const uint32_t channel_count = m_input->format().channelCount();
-    const int64_t frames_to_read = std::max(
-                dest.capacity() / channel_count,
-                m_input->periodSize() / sizeof(float) / channel_count
-                );
-    const int64_t bytes_to_read = frames_to_read * sizeof(float) * channel_count;
+    const int64_t bytes_per_frame = m_input->format().bytesPerFrame();
+    const int64_t bytes_to_read =
+            std::min(m_input->bytesReady(), m_input->periodSize())
+            / bytes_per_frame * bytes_per_frame;
     const global_clock::time_point t = time();
-    m_source->waitForReadyRead(-1);
+    if (bytes_to_read == 0) {
+        dest.clear();
+        return std::make_pair(true, t);
+    }
+
     if (m_converter) {
         if (!m_converter->read_and_convert(
                     m_source,
@@ -205,7 +268,7 @@ std::pair<bool, global_clock::time_point> AudioInputSource::read_samples(
         }
         assert(dest.size() % channel_count == 0);
     } else {
-        dest.resize(frames_to_read * channel_count);
+        dest.resize(bytes_to_read / sizeof(float));
         int64_t bytes_read = m_source->read(
                     (char*)dest.data(),
                     bytes_to_read);
@@ -224,10 +287,19 @@ void AudioInputSource::start()
 {
     m_input = std::make_unique<QAudioInput>(m_device, m_format, this);
     m_input->setVolume(m_volume);
+    if (m_buffer_msecs > 0) {
+        m_input->setBufferSize(m_buffer_msecs * m_format.sampleRate() / 1000
+                               * m_format.bytesPerFrame());
+    }
     m_converter = AbstractSampleConverter::make_converter(
                 m_input->format().sampleType(),
                 m_input->format().sampleSize());
     m_source = m_input->start();
+    if (!m_source) {
+        throw std::runtime_error("failed to open audio input");
+    }
+    connect(m_source, &QIODevice::readyRead,
+            this, &VirtualAudioSource::samples_ready);
     m_t0 = global_clock::now();
     m_buffer_delay = std::chrono::microseconds(
                 m_input->bufferSize() / sizeof(float) * 1000000 / m_input->format().sampleRate() / m_input->format().channelCount());
@@ -248,72 +320,191 @@ void AudioInputSource::stop()
 
 /* RMSProcessor */
 
-RMSProcessor::RMSProcessor(const Engine &engine):
-    m_backlog{0},
-    m_backlog_index(0)
+static uint32_t greatest_common_divisor(uint32_t a, uint32_t b)
 {
-    connect(&engine, &Engine::samples_available,
+    while (b != 0) {
+        const uint32_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+const std::vector<RMSWindow> RMSProcessor::DEFAULT_WINDOWS{
+    RMSWindow{100, 100, 3200}
+};
+
+RMSProcessor::RMSProcessor(const SampleStream &source,
+                           const std::vector<RMSWindow> &windows,
+                           const ChannelSelection &channels):
+    m_windows(windows),
+    m_channels(channels),
+    m_sample_rate(0),
+    m_chunk_samples(1),
+    m_chunk_fill(0),
+    m_chunk_sums(channels.size(), 0.f),
+    m_inputs(channels.size(), nullptr),
+    m_queue_delay(MetricsRegistry::global().histogram("rms.queue_delay_usecs"))
+{
+    if (m_windows.empty()) {
+        throw std::invalid_argument("no RMS windows given");
+    }
+    if (m_channels.empty()) {
+        throw std::invalid_argument("no RMS channels given");
+    }
+    for (const RMSWindow &window: m_windows) {
+        if (window.hop_msec == 0) {
+            throw std::invalid_argument("RMS hop must not be zero");
+        }
+    }
+
+    connect(&source, &SampleStream::samples_available,
             this, &RMSProcessor::process_samples,
             Qt::QueuedConnection);
 }
 
+void RMSProcessor::reset(uint32_t sample_rate)
+{
+    m_sample_rate = sample_rate;
+
+    std::vector<uint32_t> hop_samples;
+    uint32_t chunk = 0;
+    for (const RMSWindow &window: m_windows) {
+        const uint32_t hop = std::max<uint64_t>(
+                    1, (uint64_t)window.hop_msec * sample_rate / 1000);
+        hop_samples.push_back(hop);
+        chunk = greatest_common_divisor(chunk, hop);
+    }
+    m_chunk_samples = chunk;
+    m_chunk_fill = 0;
+    std::fill(m_chunk_sums.begin(), m_chunk_sums.end(), 0.f);
+
+    m_states.resize(m_windows.size() * m_channels.size());
+    for (std::size_t j = 0; j < m_states.size(); ++j) {
+        const std::size_t i = j % m_windows.size();
+        const RMSWindow &window = m_windows[i];
+        WindowState &state = m_states[j];
+        const std::size_t window_hops = std::max<uint32_t>(
+                    1, (window.window_msec + window.hop_msec / 2) / window.hop_msec);
+        const std::size_t hold_hops = std::max<uint32_t>(
+                    1, (window.peak_hold_msec + window.hop_msec - 1) / window.hop_msec);
+        state.hop_chunks = hop_samples[i] / chunk;
+        state.chunks_in_hop = 0;
+        state.hop_sum = 0.;
+        state.hop_sums.assign(window_hops, 0.);
+        state.hop_index = 0;
+        state.hops_filled = 0;
+        state.window_sum = 0.;
+        state.peaks.resize(hold_hops);
+        state.peaks_head = 0;
+        state.peaks_size = 0;
+        state.hops = 0;
+    }
+}
+
 void RMSProcessor::process_samples(std::shared_ptr<const SampleBlock> input_block)
 {
     const SampleBlock &data = *input_block;
-    if (m_sample_buffer.empty() || m_sample_rate != data.sample_rate) {
-        m_sample_rate = data.sample_rate;
-        m_sample_buffer = data.mono_samples;
-        m_t0 = data.t;
-        assert(data.t >= m_t0);
-    } else {
-        std::copy(data.mono_samples.begin(),
-                  data.mono_samples.end(),
-                  std::back_inserter(m_sample_buffer));
+    m_queue_delay.record_since(data.published);
+    if (m_sample_rate != data.sample_rate) {
+        reset(data.sample_rate);
     }
 
-    RMSBlock block;
-    const uint64_t per_block = m_sample_rate / 10;
-    uint64_t processed = 0;
-    while (m_sample_buffer.size() >= per_block) {
-        float rms = 0.f;
-        for (unsigned int i = 0; i < per_block; ++i) {
-            rms += m_sample_buffer[i]*m_sample_buffer[i];
+    // a channel the block does not have reads as silence
+    for (std::size_t c = 0; c < m_channels.size(); ++c) {
+        m_inputs[c] = data.samples(m_channels[c]);
+    }
+
+    const std::size_t size = data.frames;
+    std::size_t pos = 0;
+    while (pos < size) {
+        const std::size_t n = std::min<std::size_t>(size - pos,
+                                                    m_chunk_samples - m_chunk_fill);
+        for (std::size_t c = 0; c < m_channels.size(); ++c) {
+            if (m_inputs[c] != nullptr) {
+                m_chunk_sums[c] += sum_of_squares(&m_inputs[c][pos], n);
+            }
         }
-        rms /= per_block;
-        rms = std::sqrt(rms);
+        m_chunk_fill += n;
+        pos += n;
+        if (m_chunk_fill == m_chunk_samples) {
+            complete_chunk(data.t + std::chrono::microseconds(
+                               (uint64_t)pos * 1000000 / m_sample_rate));
+            m_chunk_fill = 0;
+            std::fill(m_chunk_sums.begin(), m_chunk_sums.end(), 0.f);
+        }
+    }
+}
 
-        auto tmp = std::chrono::microseconds(processed * 1000000 / m_sample_rate);
-        block.t = m_t0 + tmp;
-        block.curr = rms;
-        m_backlog[m_backlog_index] = rms;
-        m_backlog_index = (m_backlog_index+1) % m_backlog.size();
-        block.recent_peak = get_recent_peak();
-        result_available(block);
+void RMSProcessor::complete_chunk(const global_clock::time_point &chunk_end)
+{
+    for (std::size_t j = 0; j < m_states.size(); ++j) {
+        const std::size_t c = j / m_windows.size();
+        const std::size_t i = j % m_windows.size();
+        WindowState &state = m_states[j];
+        state.hop_sum += m_chunk_sums[c];
+        if (++state.chunks_in_hop < state.hop_chunks) {
+            continue;
+        }
 
-        m_sample_buffer.erase(m_sample_buffer.begin(),
-                              m_sample_buffer.begin()+per_block);
-        processed += per_block;
+        double &oldest = state.hop_sums[state.hop_index];
+        state.window_sum += state.hop_sum - oldest;
+        oldest = state.hop_sum;
+        state.hop_index = (state.hop_index + 1) % state.hop_sums.size();
+        state.hops_filled = std::min(state.hops_filled + 1, state.hop_sums.size());
+        state.hop_sum = 0.;
+        state.chunks_in_hop = 0;
+
+        // until the window is full the RMS is taken over what we have so far
+        const uint64_t window_samples =
+                (uint64_t)state.hops_filled * state.hop_chunks * m_chunk_samples;
+        const float rms = std::sqrt(std::max(0., state.window_sum) / window_samples);
+
+        std::shared_ptr<RMSBlock> block = m_pool.acquire();
+        // like FFT frames, an RMS block is stamped with its first sample
+        block->t = chunk_end - std::chrono::microseconds(
+                    window_samples * 1000000 / m_sample_rate);
+        block->window = i;
+        block->channel = m_channels[c];
+        block->curr = rms;
+        block->recent_peak = push_peak(state, rms);
+        block->published = global_clock::now();
+        emit result_available(std::move(block));
     }
-    auto tmp = std::chrono::microseconds(processed * 1000000 / m_sample_rate);
-    m_t0 += tmp;
 }
 
-float RMSProcessor::get_recent_peak()
+float RMSProcessor::push_peak(WindowState &state, float rms)
 {
-    float result = 0;
-    for (float sample: m_backlog) {
-        result = std::max(result, sample);
+    const std::size_t capacity = state.peaks.size();
+    const uint64_t hop = state.hops++;
+
+    while (state.peaks_size > 0 &&
+           state.peaks[(state.peaks_head + state.peaks_size - 1) % capacity].rms <= rms)
+    {
+        --state.peaks_size;
     }
-    return result;
+    while (state.peaks_size > 0 &&
+           state.peaks[state.peaks_head].hop + capacity <= hop)
+    {
+        state.peaks_head = (state.peaks_head + 1) % capacity;
+        --state.peaks_size;
+    }
+    state.peaks[(state.peaks_head + state.peaks_size) % capacity] = PeakEntry{hop, rms};
+    ++state.peaks_size;
+
+    return state.peaks[state.peaks_head].rms;
 }
 
 
 /* RootMeanSquare */
 
-RootMeanSquare::RootMeanSquare(const Engine &engine):
-    m_processor(engine)
+RootMeanSquare::RootMeanSquare(const SampleStream &source,
+                               const std::vector<RMSWindow> &windows,
+                               const ChannelSelection &channels):
+    m_processor(source, windows, channels)
 {
     setObjectName("RMS");
+    ThreadPolicies::global().attach(*this);
     start();
     m_processor.moveToThread(this);
 }
@@ -324,31 +515,139 @@ RootMeanSquare::~RootMeanSquare()
     wait();
 }
 
+void RootMeanSquare::drain()
+{
+    QMetaObject::invokeMethod(&m_processor, [](){}, Qt::BlockingQueuedConnection);
+}
+
+
+/* FFT wisdom and plans */
+
+static std::mutex fftw_planner_mutex;
+
+bool load_fft_wisdom(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+    return fftwf_import_wisdom_from_filename(path.c_str()) != 0;
+}
+
+bool save_fft_wisdom(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+    return fftwf_export_wisdom_to_filename(path.c_str()) != 0;
+}
+
+static unsigned int planner_flags(FFTPlannerRigor rigor)
+{
+    switch (rigor) {
+    case FFTPlannerRigor::ESTIMATE:
+        return FFTW_ESTIMATE;
+    case FFTPlannerRigor::MEASURE:
+        return FFTW_MEASURE;
+    case FFTPlannerRigor::PATIENT:
+        return FFTW_PATIENT;
+    case FFTPlannerRigor::EXHAUSTIVE:
+        return FFTW_EXHAUSTIVE;
+    }
+    throw std::logic_error("unknown planner rigor");
+}
+
+
+/* RealFFTPlan */
+
+RealFFTPlan::RealFFTPlan(uint32_t size, FFTPlannerRigor rigor):
+    m_size(size),
+    m_in(fftwf_alloc_real(size)),
+    m_out(fftwf_alloc_real(2*(size/2+1))),
+    m_plan(nullptr)
+{
+    if (!m_in || !m_out) {
+        throw std::bad_alloc();
+    }
+
+    {
+        // the fftw planner is not thread-safe
+        std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+        m_plan = fftwf_plan_dft_r2c_1d(
+                    size,
+                    m_in.get(),
+                    reinterpret_cast<fftwf_complex*>(m_out.get()),
+                    planner_flags(rigor));
+    }
+    if (!m_plan) {
+        throw std::runtime_error("failed to create fft plan");
+    }
+}
+
+RealFFTPlan::~RealFFTPlan()
+{
+    std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+    fftwf_destroy_plan(m_plan);
+}
+
+
+/* ComplexFFTPlan */
+
+ComplexFFTPlan::ComplexFFTPlan(uint32_t size, FFTPlannerRigor rigor):
+    m_size(size),
+    m_in(fftwf_alloc_real(2*size)),
+    m_out(fftwf_alloc_real(2*size)),
+    m_plan(nullptr)
+{
+    if (!m_in || !m_out) {
+        throw std::bad_alloc();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+        m_plan = fftwf_plan_dft_1d(
+                    size,
+                    reinterpret_cast<fftwf_complex*>(m_in.get()),
+                    reinterpret_cast<fftwf_complex*>(m_out.get()),
+                    FFTW_FORWARD,
+                    planner_flags(rigor));
+    }
+    if (!m_plan) {
+        throw std::runtime_error("failed to create fft plan");
+    }
+}
+
+ComplexFFTPlan::~ComplexFFTPlan()
+{
+    std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+    fftwf_destroy_plan(m_plan);
+}
+
 
 /* FFTProcessor */
 
-FFTProcessor::FFTProcessor(const Engine &engine,
+FFTProcessor::FFTProcessor(const SampleStream &source,
                            uint32_t size,
-                           uint32_t period_msec):
-    m_in(size),
-    m_out_buffer(size/2+1),
+                           uint32_t period_msec,
+                           FFTPlannerRigor rigor):
     m_size(size),
-    m_plan(fftw_plan_dft_r2c_1d(size, m_in.data(), reinterpret_cast<fftw_complex*>(m_out_buffer.data()), 0)),
+    m_plan(size, rigor),
     m_period_msec(period_msec),
+    m_samples_since_t(0),
     m_sample_rate(0),
     m_shift_remaining(0),
-    m_window(size)
+    m_fill(0),
+    m_in_buffer(size),
+    m_window(size),
+    m_queue_delay(MetricsRegistry::global().histogram("fft.queue_delay_usecs")),
+    m_compute_time(MetricsRegistry::global().histogram(
+                       "fft." + std::to_string(size) + ".compute_usecs"))
 {
-    connect(&engine, &Engine::samples_available,
+    connect(&source, &SampleStream::samples_available,
             this, &FFTProcessor::process_samples,
             Qt::QueuedConnection);
     make_window(m_window);
-    m_in = m_window;
-    fftw_execute(m_plan);
-    m_norm = std::abs(m_out_buffer[0]);
+    std::copy(m_window.begin(), m_window.end(), m_plan.input());
+    m_plan.execute();
+    m_norm = m_plan.output()[0];
 }
 
-void FFTProcessor::make_window(std::vector<double> &dest)
+void FFTProcessor::make_window(std::vector<float> &dest)
 {
     static constexpr float a0 = 0.3635819;
     static constexpr float a1 = 0.4891775;
@@ -363,71 +662,86 @@ void FFTProcessor::make_window(std::vector<double> &dest)
 void FFTProcessor::process_samples(std::shared_ptr<const SampleBlock> input_block)
 {
     const SampleBlock &data = *input_block;
+    m_queue_delay.record_since(data.published);
 
     if (m_sample_rate != data.sample_rate) {
-        m_in_buffer.clear();
         m_sample_rate = data.sample_rate;
-        m_t = data.t;
+        m_fill = 0;
         m_shift_remaining = 0;
     }
 
-    if (m_in_buffer.empty()) {
+    if (m_fill == 0) {
         // use the opportunity for a resync
         m_t = data.t;
+        m_samples_since_t = 0;
     }
 
-    if (m_shift_remaining > 0 and m_shift_remaining >= data.mono_samples.size()) {
-        m_shift_remaining -= data.mono_samples.size();
-        m_t += std::chrono::microseconds(data.mono_samples.size() * 1000000 / m_sample_rate);
+    const float *samples = data.samples(SampleBlock::DOWNMIX);
+    if (samples == nullptr) {
         return;
     }
 
-    m_in_buffer.reserve(m_in_buffer.size() + data.mono_samples.size() - m_shift_remaining);
-    std::copy(data.mono_samples.begin()+m_shift_remaining, data.mono_samples.end(),
-              std::back_inserter(m_in_buffer));
-    m_t += std::chrono::microseconds(m_shift_remaining * 1000000 / m_sample_rate);
-    m_shift_remaining = 0;
-
     const uint32_t shift = m_period_msec * m_sample_rate / 1000;
-    const float norm = m_norm;
 
-    while (m_in_buffer.size() >= m_size) {
-        for (unsigned int i = 0; i < m_size; ++i) {
-            m_in[i] = m_in_buffer[i] * m_window[i];
+    const float *iter = samples;
+    const float *const end = samples + data.frames;
+    while (iter != end) {
+        const uint32_t available = end - iter;
+        if (m_shift_remaining > 0) {
+            const uint32_t skip = std::min(m_shift_remaining, available);
+            m_shift_remaining -= skip;
+            m_samples_since_t += skip;
+            iter += skip;
+            continue;
         }
-        fftw_execute(m_plan);
-        m_out.t = m_t;
-        m_out.fmax = (float)m_sample_rate / 2;
-        m_out.fft.clear();
-
-        std::transform(m_out_buffer.begin(),
-                       m_out_buffer.end(),
-                       std::back_inserter(m_out.fft),
-                       [norm](const std::complex<double> &v){ return std::abs(v) / norm; });
 
-        emit result_available(m_out);
-
-        if (shift >= m_in_buffer.size()) {
-            m_shift_remaining = shift - m_in_buffer.size();
-            m_t += std::chrono::microseconds(m_in_buffer.size() * 1000000 / m_sample_rate);
-            m_in_buffer.clear();
-            return;
+        const uint32_t to_copy = std::min(m_size - m_fill, available);
+        m_in_buffer.append(iter, iter + to_copy);
+        m_fill += to_copy;
+        m_samples_since_t += to_copy;
+        iter += to_copy;
+        if (m_fill < m_size) {
+            break;
         }
 
-        m_in_buffer.erase(m_in_buffer.begin(),
-                          m_in_buffer.begin() + shift);
-
-        m_t += std::chrono::microseconds(shift * 1000000 / m_sample_rate);
+        const global_clock::time_point compute_start = global_clock::now();
+        multiply(m_in_buffer.window(), m_window.data(),
+                 m_plan.input(), m_size);
+        m_plan.execute();
+        std::shared_ptr<RealFFTBlock> block = m_pool.acquire();
+        block->t = m_t + std::chrono::microseconds(
+                    (m_samples_since_t - m_size) * 1000000 / m_sample_rate);
+        block->channel = SampleBlock::DOWNMIX;
+        block->fmin = 0;
+        block->fmax = (float)m_sample_rate / 2;
+        block->fft.resize(m_plan.bins());
+        complex_magnitudes(m_plan.output(), block->fft.data(),
+                           m_plan.bins(), 1.f / m_norm);
+        m_compute_time.record_since(compute_start);
+
+        block->published = global_clock::now();
+        emit result_available(std::move(block));
+
+        if (shift >= m_size) {
+            m_shift_remaining = shift - m_size;
+            m_fill = 0;
+        } else {
+            m_fill = m_size - shift;
+        }
     }
 }
 
 
 /* FFT */
 
-FFT::FFT(const Engine &engine, uint32_t size, uint32_t period_msec):
-    m_processor(engine, size, period_msec)
+FFT::FFT(const SampleStream &source,
+         uint32_t size,
+         uint32_t period_msec,
+         FFTPlannerRigor rigor):
+    m_processor(source, size, period_msec, rigor)
 {
     setObjectName(QString("FFT:%1:%2ms").arg(size).arg(period_msec));
+    ThreadPolicies::global().attach(*this);
     start();
     m_processor.moveToThread(this);
 }
@@ -438,6 +752,19 @@ FFT::~FFT()
     wait();
 }
 
+void FFT::drain()
+{
+    QMetaObject::invokeMethod(&m_processor, [](){}, Qt::BlockingQueuedConnection);
+}
+
+
+/* AbstractOutputDriver */
+
+void AbstractOutputDriver::source_ended()
+{
+
+}
+
 
 /* NullOutputDriver */
 
@@ -456,104 +783,289 @@ global_clock::time_point NullOutputDriver::time() const
     return global_clock::now() + m_latency;
 }
 
-void NullOutputDriver::write_samples(const std::vector<float> &)
+void NullOutputDriver::write_samples(const std::vector<float> &,
+                                     const global_clock::time_point &)
 {
 
 }
 
 
 
+/* LatencyEstimator */
+
+LatencyEstimator::LatencyEstimator():
+    m_valid(false),
+    m_latency(0),
+    m_have_drift(false),
+    m_drift_ppm(0),
+    m_window_drift_ppm(0),
+    m_anchor_latency(0)
+{
+
+}
+
+bool LatencyEstimator::update(const global_clock::time_point &now,
+                              const global_clock::time_point &playing,
+                              const std::chrono::microseconds &step_threshold)
+{
+    const std::chrono::microseconds measured =
+            std::chrono::duration_cast<std::chrono::microseconds>(now - playing);
+    const std::chrono::microseconds step = measured - m_latency;
+    if (!m_valid || step > step_threshold || step < -step_threshold) {
+        // a jump says nothing about the drift, start a new window
+        m_latency = measured;
+        m_valid = true;
+        m_anchor_t = now;
+        m_anchor_latency = m_latency;
+        return false;
+    }
+    m_latency += step / SMOOTHING;
+
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                now - m_anchor_t).count();
+    if (elapsed < DRIFT_WINDOW_USECS) {
+        return false;
+    }
+    m_window_drift_ppm = (double)(m_latency - m_anchor_latency).count() / elapsed * 1e6;
+    m_drift_ppm = m_have_drift ?
+                m_drift_ppm + (m_window_drift_ppm - m_drift_ppm) / 4 : m_window_drift_ppm;
+    m_have_drift = true;
+    m_anchor_t = now;
+    m_anchor_latency = m_latency;
+    return true;
+}
+
+
 /* AudioOutputDriver */
 
 AudioOutputDriver::AudioOutputDriver(
         const QAudioDeviceInfo &device,
         const QAudioFormat &format,
-        int32_t buffer_msecs,
-        uint32_t drop_msecs,
+        const LatencySettings &settings,
         QObject *parent):
     AbstractOutputDriver(parent),
     m_device(device),
     m_format(format),
-    m_buffer_msecs(buffer_msecs),
-    m_drop_msecs(drop_msecs),
+    m_settings(settings),
+    m_buffer_msecs(settings.buffer_msecs),
     m_output(nullptr),
     m_sink(nullptr),
-    m_samples_written(0),
-    m_drop_samples(m_drop_msecs * format.sampleRate() / 1000),
-    m_dropped(0),
-    m_outer_buffer_delay(0)
+    m_channel_count(0),
+    m_sample_rate(0),
+    m_drop_samples(0),
+    m_buffer_delay(0),
+    m_step_threshold(0),
+    m_output_generation(0),
+    m_source_ended(false),
+    m_correction_ppm(0),
+    m_slip(0),
+    m_latency_usecs(0),
+    m_dropped_samples(MetricsRegistry::global().counter("output.dropped_samples")),
+    m_underruns(MetricsRegistry::global().counter("output.underruns")),
+    m_slipped_frames(MetricsRegistry::global().counter("output.slipped_frames")),
+    m_latency_metric(MetricsRegistry::global().gauge("output.latency_usecs")),
+    m_buffer_metric(MetricsRegistry::global().gauge("output.buffer_usecs")),
+    m_drift_metric(MetricsRegistry::global().gauge("output.drift_ppm")),
+    m_correction_metric(MetricsRegistry::global().gauge("output.correction_ppm"))
 {
 
 }
 
-inline void AudioOutputDriver::update_buffer_delay()
+inline std::chrono::microseconds AudioOutputDriver::duration_of(uint64_t samples) const
 {
-    m_outer_buffer_delay = std::chrono::microseconds(m_outer_buffer.size() * 1000000 / m_output->format().sampleRate());
+    return std::chrono::microseconds(samples / m_channel_count * 1000000 / m_sample_rate);
 }
 
-void AudioOutputDriver::write_samples(const std::vector<float> &samples)
+void AudioOutputDriver::open_output()
 {
-    if (!m_outer_buffer.empty()) {
-        int64_t written = m_sink->write(
-                    (const char*)m_outer_buffer.data(),
-                    m_outer_buffer.size() * sizeof(float));
+    m_output = std::make_unique<QAudioOutput>(m_device, m_format, this);
+    uint32_t sample_rate = m_output->format().sampleRate();
+    uint32_t channel_count = m_output->format().channelCount();
+    m_output->setBufferSize(m_buffer_msecs * channel_count * sample_rate / 1000 * sizeof(float));
+    m_sink = m_output->start();
+    if (!m_sink) {
+        throw std::runtime_error("failed to open audio output");
+    }
+    // queued, the output must not be replaced from within its own signal
+    const uint64_t generation = ++m_output_generation;
+    connect(m_output.get(), &QAudioOutput::stateChanged,
+            this, [this, generation](QAudio::State state){
+                if (state == QAudio::IdleState) {
+                    handle_underrun(generation);
+                }
+            },
+            Qt::QueuedConnection);
+
+    sample_rate = m_output->format().sampleRate();
+    channel_count = m_output->format().channelCount();
+    assert(m_output->bufferSize() % (sizeof(float)*channel_count) == 0);
+    m_sample_rate = sample_rate;
+    m_channel_count = channel_count;
+    m_buffer_delay = duration_of(m_output->bufferSize() / sizeof(float));
+    // the device position moves in whole periods
+    m_step_threshold = std::max(std::chrono::microseconds(1000),
+                                2 * duration_of(m_output->periodSize() / sizeof(float)));
+    m_buffer_metric.set(m_buffer_delay.count());
+}
+
+void AudioOutputDriver::drain_outer_buffer()
+{
+    if (m_outer_buffer.empty()) {
+        return;
+    }
+    while (!m_outer_buffer.empty()) {
+        const float *data;
+        std::size_t count;
+        std::tie(data, count) = m_outer_buffer.peek();
+        const int64_t written = m_sink->write(
+                    (const char*)data,
+                    count * sizeof(float));
+        if (written <= 0) {
+            break;
+        }
         assert(written % sizeof(float) == 0);
-        m_outer_buffer.erase(m_outer_buffer.begin(),
-                             m_outer_buffer.begin()+written/sizeof(float));
+        m_outer_buffer.consume(written / sizeof(float));
+        if ((uint64_t)written < count * sizeof(float)) {
+            break;
+        }
+    }
+    m_device_end = m_outer_end - duration_of(m_outer_buffer.size());
+}
+
+inline void AudioOutputDriver::publish_latency()
+{
+    const global_clock::time_point now = global_clock::now();
+    const uint64_t queued = (m_output->bufferSize() - m_output->bytesFree()) / sizeof(float);
+    if (m_estimator.update(now, m_device_end - duration_of(queued), m_step_threshold)) {
+        // integrate what is left over, at half gain as the window is noisy
+        const double correction = m_correction_ppm + m_estimator.window_drift_ppm() / 2;
+        m_correction_ppm = correction > MAX_CORRECTION_PPM ? MAX_CORRECTION_PPM :
+                           correction < -MAX_CORRECTION_PPM ? -MAX_CORRECTION_PPM :
+                           correction;
+        m_correction_metric.set(std::lround(m_correction_ppm));
+    }
+    m_latency_usecs.store(m_estimator.latency().count(), std::memory_order_release);
+    m_latency_metric.set(m_estimator.latency().count());
+    m_drift_metric.set(std::lround(m_estimator.drift_ppm()));
+}
+
+const std::vector<float> &AudioOutputDriver::slip(const std::vector<float> &samples)
+{
+    const uint64_t frames = samples.size() / m_channel_count;
+    m_slip += frames * m_correction_ppm * 1e-6;
+    const int64_t whole = std::max<int64_t>(
+                std::min<int64_t>(m_slip, frames / 2), -(int64_t)(frames / 2));
+    if (whole == 0) {
+        return samples;
+    }
+    m_slip -= whole;
+    m_slipped_frames.add(std::abs(whole));
+
+    // spread over the block, one frame at a time
+    const uint64_t count = std::abs(whole);
+    m_slipped.clear();
+    m_slipped.reserve(samples.size() + count * m_channel_count);
+    uint64_t next = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        const uint64_t at = (i + 1) * frames / (count + 1);
+        m_slipped.insert(m_slipped.end(),
+                         samples.begin() + next * m_channel_count,
+                         samples.begin() + at * m_channel_count);
+        if (whole < 0) {
+            m_slipped.insert(m_slipped.end(),
+                             samples.begin() + at * m_channel_count,
+                             samples.begin() + (at + 1) * m_channel_count);
+            next = at;
+        } else {
+            next = at + 1;
+        }
+    }
+    m_slipped.insert(m_slipped.end(),
+                     samples.begin() + next * m_channel_count,
+                     samples.end());
+    return m_slipped;
+}
+
+void AudioOutputDriver::handle_underrun(uint64_t generation)
+{
+    if (generation != m_output_generation || m_source_ended ||
+            m_output->error() != QAudio::UnderrunError)
+    {
+        return;
     }
+    m_underruns.add();
+    if (!m_settings.adaptive || m_buffer_msecs >= m_settings.max_buffer_msecs) {
+        return;
+    }
+
+    // the device ran dry, so nothing queued gets lost by reopening it
+    m_buffer_msecs = std::min(m_buffer_msecs * 2, m_settings.max_buffer_msecs);
+    m_output->stop();
+    m_sink = nullptr;
+    m_output = nullptr;
+    open_output();
+    drain_outer_buffer();
+    publish_latency();
+}
 
+void AudioOutputDriver::write_samples(const std::vector<float> &source_samples,
+                                      const global_clock::time_point &t)
+{
+    drain_outer_buffer();
+
+    // off by the few frames slipped at most, and each block starts over
+    // at its own t
+    const std::vector<float> &samples = slip(source_samples);
+    const global_clock::time_point end = t + duration_of(samples.size());
     if (!m_outer_buffer.empty()) {
         const uint64_t total_samples = m_outer_buffer.size() + samples.size();
         if (total_samples >= m_drop_samples) {
             m_outer_buffer.clear();
-            std::lock_guard<std::shared_timed_mutex> lock(m_time_mutex);
-            m_dropped += std::chrono::microseconds(
-                        total_samples * 1000000 / m_output->format().sampleRate()
-                        );
-            m_outer_buffer_delay = std::chrono::microseconds(0);
-            std::cout << "dropped " << total_samples << " samples" << std::endl;
-            return;
+            m_dropped_samples.add(total_samples);
+        } else {
+            m_outer_buffer.write(samples.data(), samples.size());
+            m_outer_end = end;
         }
-        m_outer_buffer.reserve(m_outer_buffer.size() + samples.size());
-        std::copy(samples.begin(), samples.end(),
-                  std::back_inserter(m_outer_buffer));
-        std::lock_guard<std::shared_timed_mutex> lock(m_time_mutex);
-        update_buffer_delay();
+        publish_latency();
         return;
     }
 
     int64_t written = m_sink->write(
                 (const char*)samples.data(),
                 samples.size() * sizeof(float));
+    if (written < 0) {
+        written = 0;
+    }
     assert(written % sizeof(float) == 0);
-    int64_t to_rescue = samples.size() - written / sizeof(float);
+    m_device_end = t + duration_of(written / sizeof(float));
+    const std::size_t to_rescue = samples.size() - written / sizeof(float);
     if (to_rescue > 0) {
-        m_outer_buffer.reserve(to_rescue);
-        std::copy(samples.begin() + written/sizeof(float),
-                  samples.end(),
-                  std::back_inserter(m_outer_buffer));
+        const std::size_t rescued = m_outer_buffer.write(
+                    samples.data() + written / sizeof(float),
+                    to_rescue);
+        m_outer_end = m_device_end + duration_of(rescued);
+        if (rescued < to_rescue) {
+            m_dropped_samples.add(to_rescue - rescued);
+        }
     }
 
-    std::lock_guard<std::shared_timed_mutex> lock(m_time_mutex);
-    update_buffer_delay();
+    publish_latency();
 }
 
 void AudioOutputDriver::start()
 {
-    m_output = std::make_unique<QAudioOutput>(m_device, m_format, this);
-    uint32_t sample_rate = m_output->format().sampleRate();
-    uint32_t channel_count = m_output->format().channelCount();
-    m_output->setBufferSize(m_buffer_msecs * channel_count * sample_rate / 1000 * sizeof(float));
-    m_sink = m_output->start();
-    if (!m_sink) {
-        throw std::runtime_error("failed to open audio output");
-    }
-    m_t0 = global_clock::now();
-    sample_rate = m_output->format().sampleRate();
-    channel_count = m_output->format().channelCount();
-    assert(m_output->bufferSize() % (sizeof(float)*sample_rate*channel_count) == 0);
-    m_buffer_delay = std::chrono::microseconds(
-                m_output->bufferSize() / sizeof(float) * 1000000 / sample_rate / channel_count);
+    m_buffer_msecs = m_settings.buffer_msecs;
+    open_output();
+    m_drop_samples = m_settings.drop_msecs * m_sample_rate / 1000 * m_channel_count;
+    m_outer_buffer.reset(m_drop_samples);
+    m_estimator = LatencyEstimator();
+    // until the first samples arrive, expect a full device buffer
+    m_device_end = global_clock::now();
+    m_outer_end = m_device_end;
+    m_source_ended = false;
+    m_correction_ppm = 0;
+    m_slip = 0;
+    m_latency_usecs.store(m_buffer_delay.count(), std::memory_order_release);
 }
 
 void AudioOutputDriver::stop()
@@ -565,25 +1077,34 @@ void AudioOutputDriver::stop()
 
 global_clock::time_point AudioOutputDriver::time() const
 {
-    std::shared_lock<std::shared_timed_mutex> lock(m_time_mutex);
-    return m_t0 + std::chrono::microseconds(m_output->processedUSecs()) - m_buffer_delay - m_outer_buffer_delay + m_dropped;
+    return global_clock::now()
+            - std::chrono::microseconds(m_latency_usecs.load(std::memory_order_acquire));
+}
+
+void AudioOutputDriver::source_ended()
+{
+    // the source running dry is no reason to grow the buffer
+    m_source_ended = true;
 }
 
 
 /* AudioPipe */
 
 AudioPipe::AudioPipe(std::unique_ptr<VirtualAudioSource> &&source,
-                     std::unique_ptr<AbstractOutputDriver> &&sink):
+                     std::unique_ptr<AbstractOutputDriver> &&sink,
+                     uint32_t source_id):
+    m_source_id(source_id),
     m_terminated(false),
     m_new_source_thread(nullptr),
     m_source(std::move(source)),
     m_sink(std::move(sink)),
-    m_startup_done(false)
+    m_startup_done(false),
+    m_read_time(MetricsRegistry::global().histogram("source.read_usecs"))
 {
-    m_sample_sleep = std::chrono::microseconds(100 * 1000000 / m_source->sample_rate());
     m_source->moveToThread(this);
     m_sink->moveToThread(this);
     setObjectName("AudioPipe");
+    ThreadPolicies::global().attach(*this);
     start();
     {
         std::unique_lock<std::mutex> lock(m_startup_mutex);
@@ -604,61 +1125,76 @@ AudioPipe::~AudioPipe()
 {
     if (!m_terminated) {
         m_terminated = true;
+        exit();
         wait();
     }
 }
 
-void AudioPipe::downmix_to_mono(const std::vector<float> &src,
-                                std::vector<float> &dest,
-                                const uint32_t channels)
+void AudioPipe::pump_samples()
 {
-    assert(channels > 1);
-    dest.resize(src.size() / channels);
-    assert(src.size() % channels == 0);
-    for (uint32_t i = 0; i < src.size() / channels; ++i) {
-        float accum = 0.f;
-        for (uint32_t j = 0; j < channels; ++j) {
-            accum += src[i*channels+j];
-        }
-        dest[i] = accum;
-    }
-}
-
-void AudioPipe::run()
-{
-    m_source->start();
-    m_sink->start();
-    {
-        std::lock_guard<std::mutex> lock(m_startup_mutex);
-        m_startup_done = true;
-        m_startup_notify.notify_all();
-    }
+    const bool throttle = !m_source->is_realtime();
     while (!m_terminated) {
+        if (throttle && m_block_pool.in_use() >= MAX_BLOCKS_IN_FLIGHT) {
+            QTimer::singleShot(1, m_source.get(), [this](){ pump_samples(); });
+            return;
+        }
         bool success;
         global_clock::time_point t;
+        const global_clock::time_point read_start = global_clock::now();
         std::tie(success, t) = m_source->read_samples(m_sample_buffer);
         if (!success) {
             throw std::runtime_error("failed to read from source");
         }
         if (m_sample_buffer.size() == 0) {
-            std::this_thread::sleep_for(m_sample_sleep);
-            continue;
+            return;
         }
+        m_read_time.record_since(read_start);
         {
-            auto block = std::make_shared<SampleBlock>();
+            std::shared_ptr<SampleBlock> block = m_block_pool.acquire();
             block->t = t;
+            block->source = m_source_id;
             const uint32_t channels = m_source->channel_count();
-            if (channels > 1) {
-                downmix_to_mono(m_sample_buffer,
-                                block->mono_samples,
-                                channels);
-            }
+            assert(m_sample_buffer.size() % channels == 0);
+            const uint32_t frames = m_sample_buffer.size() / channels;
+            block->set_layout(channels, frames);
+            deinterleave(m_sample_buffer.data(), block->planar.data(),
+                         frames, channels, block->stride);
             block->sample_rate = m_source->sample_rate();
-            emit samples_available(block);
+            block->published = global_clock::now();
+            emit samples_available(std::move(block));
         }
-        m_sink->write_samples(m_sample_buffer);
+        m_sink->write_samples(m_sample_buffer, t);
         m_sample_buffer.clear();
     }
+}
+
+void AudioPipe::run()
+{
+    // queued, so that sources may announce more data from within
+    // read_samples without recursing into the pump
+    m_source_connection = connect(
+                m_source.get(), &VirtualAudioSource::samples_ready,
+                m_source.get(), [this](){ pump_samples(); },
+                Qt::QueuedConnection);
+    m_eos_connection = connect(
+                m_source.get(), &VirtualAudioSource::end_of_stream,
+                this, &AudioPipe::end_of_stream);
+    m_sink_eos_connection = connect(
+                m_source.get(), &VirtualAudioSource::end_of_stream,
+                m_sink.get(), [this](){ m_sink->source_ended(); });
+    m_source->start();
+    m_sink->start();
+    {
+        std::lock_guard<std::mutex> lock(m_startup_mutex);
+        m_startup_done = true;
+        m_startup_notify.notify_all();
+    }
+    if (!m_terminated) {
+        exec();
+    }
+    disconnect(m_source_connection);
+    disconnect(m_eos_connection);
+    disconnect(m_sink_eos_connection);
     if (m_new_source_thread) {
         m_source->stop();
         m_source->moveToThread(m_new_source_thread);
@@ -677,91 +1213,215 @@ std::unique_ptr<VirtualAudioSource> AudioPipe::stop(QThread &new_source_thread)
     }
     m_new_source_thread = &new_source_thread;
     m_terminated = true;
+    exit();
     wait();
     return std::move(m_source);
 }
 
 
 
+/* SampleStream */
+
+SampleStream::SampleStream(uint32_t id, QObject *parent):
+    QObject(parent),
+    m_id(id)
+{
+
+}
+
+
 /* Engine */
 
-Engine::Engine()
+Engine::Input::Input(uint32_t id):
+    stream(id),
+    ended(false)
 {
 
 }
 
+Engine::Engine():
+    m_running(false),
+    m_latency_profile(LatencyProfile::STANDARD)
+{
+    m_inputs.emplace_back(std::make_unique<Input>(PRIMARY_SOURCE));
+}
+
 Engine::~Engine()
 {
 
 }
 
-void Engine::rebuild_pipe()
+Engine::Input &Engine::input(uint32_t source) const
 {
+    if (source >= m_inputs.size()) {
+        throw std::out_of_range("no source " + std::to_string(source));
+    }
+    return *m_inputs[source];
+}
+
+AudioPipe &Engine::running_pipe(uint32_t source) const
+{
+    const Input &running = input(source);
+    if (!running.pipe) {
+        throw std::logic_error("source " + std::to_string(source) + " is not running");
+    }
+    return *running.pipe;
+}
+
+void Engine::rebuild_pipe(Input &input)
+{
+    const LatencySettings settings = latency_settings(m_latency_profile);
     std::unique_ptr<AbstractOutputDriver> sink = nullptr;
-    if (!m_output_device_info.isNull()) {
+    if (input.stream.id() == PRIMARY_SOURCE && !m_output_device_info.isNull()) {
         QAudioFormat fmt = m_output_device_info.preferredFormat();
         fmt.setSampleType(QAudioFormat::Float);
         fmt.setSampleSize(32);
-        fmt.setChannelCount(m_source_latch->channel_count());
+        fmt.setChannelCount(input.latch->channel_count());
         fmt.setCodec("audio/pcm");
         fmt.setByteOrder(QAudioFormat::LittleEndian);
-        fmt.setSampleRate(m_source_latch->sample_rate());
+        fmt.setSampleRate(input.latch->sample_rate());
         if (!m_output_device_info.isFormatSupported(fmt)) {
             throw std::runtime_error("format not supported by sink");
         }
 
         sink = std::make_unique<AudioOutputDriver>(
-                    m_output_device_info, fmt,
-                    1000,
-                    500);
+                    m_output_device_info, fmt, settings);
     } else {
-        sink = std::make_unique<NullOutputDriver>(std::chrono::milliseconds(1000));
+        sink = std::make_unique<NullOutputDriver>(
+                    std::chrono::milliseconds(settings.null_latency_msecs));
     }
 
-    m_audio_pipe = std::make_unique<AudioPipe>(
-                std::move(m_source_latch),
-                std::move(sink));
-    connect(m_audio_pipe.get(), &AudioPipe::samples_available,
+    input.ended = false;
+    input.pipe = std::make_unique<AudioPipe>(
+                std::move(input.latch),
+                std::move(sink),
+                input.stream.id());
+    connect(input.pipe.get(), &AudioPipe::samples_available,
             this, &Engine::samples_available);
+    connect(input.pipe.get(), &AudioPipe::samples_available,
+            &input.stream, &SampleStream::samples_available);
+    connect(input.pipe.get(), &AudioPipe::end_of_stream,
+            this, [this, &input](){ source_ended(input); });
+}
+
+void Engine::stop_pipe(Input &input)
+{
+    input.latch = input.pipe->stop(*thread());
+    input.pipe = nullptr;
+}
+
+void Engine::source_ended(Input &input)
+{
+    if (input.ended) {
+        return;
+    }
+    input.ended = true;
+    emit input.stream.end_of_stream();
+    for (const auto &other: m_inputs) {
+        if (other->pipe && !other->ended) {
+            return;
+        }
+    }
+    emit end_of_stream();
 }
 
 bool Engine::is_running() const
 {
-    return bool(m_audio_pipe);
+    return m_running;
+}
+
+bool Engine::is_running(uint32_t source) const
+{
+    return bool(input(source).pipe);
 }
 
 void Engine::start()
 {
-    if (m_audio_pipe) {
+    if (m_running) {
         throw std::logic_error("already running");
     }
-    if (!m_source_latch) {
+    const bool any_source = std::any_of(
+                m_inputs.begin(), m_inputs.end(),
+                [](const std::unique_ptr<Input> &input){ return bool(input->latch); });
+    if (!any_source) {
         throw std::logic_error("no source defined");
     }
-    rebuild_pipe();
+    for (auto &input: m_inputs) {
+        if (input->latch) {
+            rebuild_pipe(*input);
+        }
+    }
+    m_running = true;
 }
 
 void Engine::stop()
 {
-    if (!m_audio_pipe) {
+    if (!m_running) {
         throw std::logic_error("already stopped");
     }
-    m_source_latch = m_audio_pipe->stop(*thread());
-    m_audio_pipe = nullptr;
+    for (auto &input: m_inputs) {
+        if (input->pipe) {
+            stop_pipe(*input);
+        }
+    }
+    m_running = false;
 }
 
 void Engine::set_source(std::unique_ptr<VirtualAudioSource> &&source)
 {
-    if (m_audio_pipe) {
+    if (m_running) {
         throw std::logic_error("already running");
     }
-    m_source_latch = std::move(source);
+    m_inputs[PRIMARY_SOURCE]->latch = std::move(source);
+}
+
+uint32_t Engine::add_source(std::unique_ptr<VirtualAudioSource> &&source)
+{
+    if (!source) {
+        throw std::invalid_argument("no source given");
+    }
+    const uint32_t id = m_inputs.size();
+    m_inputs.emplace_back(std::make_unique<Input>(id));
+    Input &input = *m_inputs.back();
+    input.latch = std::move(source);
+    if (m_running) {
+        rebuild_pipe(input);
+    }
+    return id;
+}
+
+void Engine::remove_source(uint32_t source)
+{
+    Input &removed = input(source);
+    if (!removed.pipe) {
+        removed.latch = nullptr;
+        return;
+    }
+    stop_pipe(removed);
+    removed.latch = nullptr;
+    // as if it ended, so that consumers waiting for the end are released
+    source_ended(removed);
+    const bool any_pipe = std::any_of(
+                m_inputs.begin(), m_inputs.end(),
+                [](const std::unique_ptr<Input> &input){ return bool(input->pipe); });
+    if (!any_pipe) {
+        m_running = false;
+    }
 }
 
 void Engine::set_output_device(const QAudioDeviceInfo &device)
 {
-    if (m_audio_pipe) {
+    if (m_running) {
         throw std::logic_error("already running");
     }
     m_output_device_info = device;
 }
+
+void Engine::set_latency_profile(LatencyProfile profile)
+{
+    if (m_running) {
+        throw std::logic_error("already running");
+    }
+    m_latency_profile = profile;
+}
+
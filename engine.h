@@ -8,7 +8,6 @@
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
-#include <queue>
 #include <iostream>
 
 #include <QAudioInput>
@@ -18,31 +17,155 @@
 
 #include "fftw3.h"
 
+#include "blockpool.h"
+#include "latencyprofile.h"
+#include "metrics.h"
+#include "ringbuffer.h"
+
 typedef std::chrono::steady_clock global_clock;
 
 
 struct TimestampedData
 {
+    // stream time of the data
     global_clock::time_point t;
+    // wall time at which the producer emitted the block, for latency metrics
+    global_clock::time_point published;
 };
 
 
+inline const global_clock::time_point &timestamp_of(const TimestampedData &data)
+{
+    return data.t;
+}
+
+template <typename data_t>
+inline const global_clock::time_point &timestamp_of(const std::shared_ptr<data_t> &data)
+{
+    return data->t;
+}
+
+
+// Allocates storage starting on a multiple of alignment bytes.
+template <typename T, std::size_t alignment = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, alignment>&)
+    {
+
+    }
+
+    T *allocate(std::size_t n)
+    {
+        // the unaligned pointer is kept right in front of the aligned one
+        void *raw = ::operator new(n * sizeof(T) + alignment + sizeof(void*));
+        const uintptr_t aligned =
+                (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignment - 1)
+                & ~(uintptr_t)(alignment - 1);
+        reinterpret_cast<void**>(aligned)[-1] = raw;
+        return reinterpret_cast<T*>(aligned);
+    }
+
+    void deallocate(T *ptr, std::size_t)
+    {
+        ::operator delete(reinterpret_cast<void**>(ptr)[-1]);
+    }
+
+    template <typename U>
+    inline bool operator==(const AlignedAllocator<U, alignment>&) const
+    {
+        return true;
+    }
+
+    template <typename U>
+    inline bool operator!=(const AlignedAllocator<U, alignment>&) const
+    {
+        return false;
+    }
+};
+
+
+// Samples of all channels, channel-major: each channel is a row of its own
+// starting on a cache line, so per-channel consumers read contiguous memory
+// and nothing shares a line across channels.
 struct SampleBlock: public TimestampedData
 {
+    // selects the sum of all channels instead of a single one
+    static constexpr int32_t DOWNMIX = -1;
+    static constexpr uint32_t ROW_ALIGNMENT = 64 / sizeof(float);
+
+    // id of the Engine source the samples come from
+    uint32_t source;
     uint32_t sample_rate;
-    std::vector<float> mono_samples;
+    uint32_t channels;
+    uint32_t frames;
+    // floats from the start of one channel to the start of the next
+    uint32_t stride;
+    std::vector<float, AlignedAllocator<float> > planar;
+
+private:
+    // the sum of the channels, computed by the first consumer which asks
+    // for the DOWNMIX of a multi-channel block and shared by the others
+    mutable std::mutex m_mono_mutex;
+    mutable bool m_mono_ready = false;
+    mutable std::vector<float> m_mono_samples;
+
+public:
+    inline void set_layout(uint32_t channel_count, uint32_t frame_count)
+    {
+        channels = channel_count;
+        frames = frame_count;
+        stride = (frame_count + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+        planar.resize((std::size_t)stride * channel_count);
+        m_mono_ready = false;
+    }
+
+    inline const float *channel(uint32_t index) const
+    {
+        return planar.data() + (std::size_t)index * stride;
+    }
+
+    // frames samples of a channel or the DOWNMIX; nullptr if the block does
+    // not have the channel. Single channel blocks are their own downmix.
+    const float *samples(int32_t selection) const;
 };
 
 
+// channel indices and/or SampleBlock::DOWNMIX
+using ChannelSelection = std::vector<int32_t>;
+
+extern const ChannelSelection DOWNMIX_ONLY;
+
+
 struct RealFFTBlock: public TimestampedData
 {
-    std::vector<double> fft;
+    // the channel transformed, or SampleBlock::DOWNMIX
+    int32_t channel;
+    std::vector<float> fft;
+    // frequencies of the first and the last bin; fmin is 0 for transforms of
+    // the full band
+    float fmin;
     float fmax;
 };
 
 
 struct RMSBlock: public TimestampedData
 {
+    // index of the RMSWindow this block was measured with
+    uint32_t window;
+    // the channel measured, or SampleBlock::DOWNMIX
+    int32_t channel;
     float curr;
     float recent_peak;
 };
@@ -60,14 +183,23 @@ public:
     virtual bool is_seekable() const;
     virtual bool seek(const uint64_t to_frame);
     virtual uint64_t tell() const;
+    // false if the source produces samples as fast as they are consumed
+    // instead of following a clock
+    virtual bool is_realtime() const;
 
     virtual void start() = 0;
     virtual void stop() = 0;
 
 public:
+    // Must not block. Returning an empty dest means that no samples are
+    // available right now; samples_ready() is emitted once there are.
     virtual std::pair<bool, global_clock::time_point> read_samples(
             std::vector<float> &dest) = 0;
 
+signals:
+    void samples_ready();
+    void end_of_stream();
+
 };
 
 
@@ -77,6 +209,10 @@ public:
     virtual ~AbstractSampleConverter();
 
 public:
+    virtual uint32_t bytes_per_sample() const = 0;
+    virtual void convert(const void *src,
+                         std::size_t samples,
+                         float *dest) = 0;
     virtual bool read_and_convert(QIODevice *source,
                                   uint32_t bytes_to_read,
                                   std::vector<float> &dest) = 0;
@@ -93,9 +229,12 @@ class AudioInputSource: public VirtualAudioSource
     Q_OBJECT
 
 public:
+    // buffer_msecs of 0 leaves the capture buffer at the default of the
+    // device
     AudioInputSource(const QAudioDeviceInfo &device,
                      const QAudioFormat &format,
                      const float initial_volume,
+                     uint32_t buffer_msecs = 0,
                      QObject *parent = nullptr);
     ~AudioInputSource() override;
 
@@ -103,6 +242,7 @@ private:
     QAudioDeviceInfo m_device;
     QAudioFormat m_format;
     float m_volume;
+    uint32_t m_buffer_msecs;
 
     global_clock::time_point m_t0;
     std::chrono::microseconds m_buffer_delay;
@@ -125,42 +265,116 @@ public:
 };
 
 
+// Bounded queue of timestamp-ordered values, filled by one producer thread
+// and drained by one consumer thread without locks.
+//
+// The ring has room for twice max_blocks values. If it is full, push_block()
+// drops the new value. Before fetching, the consumer drops the oldest values
+// beyond max_blocks, which matches the old push-side overflow behaviour.
+// Both kinds of drop are counted.
+//
+// With a metrics_name, drops are also added to the <metrics_name>.dropped
+// counter of the global MetricsRegistry and the depth after each push is
+// published as the <metrics_name>.depth gauge.
 template <typename data_t>
 class TimedDataQueue
 {
 public:
-    TimedDataQueue(const uint32_t max_blocks):
-        m_max_blocks(max_blocks)
+    explicit TimedDataQueue(const uint32_t max_blocks,
+                            const std::string &metrics_name = std::string()):
+        m_max_blocks(max_blocks),
+        m_slots(2 * max_blocks),
+        m_head(0),
+        m_tail(0),
+        m_dropped_full(0),
+        m_dropped_overflow(0),
+        m_dropped_metric(nullptr),
+        m_depth_metric(nullptr)
     {
-
+        if (!metrics_name.empty()) {
+            MetricsRegistry &registry = MetricsRegistry::global();
+            m_dropped_metric = &registry.counter(metrics_name + ".dropped");
+            m_depth_metric = &registry.gauge(metrics_name + ".depth");
+        }
     }
 
+    TimedDataQueue(const TimedDataQueue &other) = delete;
+    TimedDataQueue &operator=(const TimedDataQueue &other) = delete;
+
 private:
-    uint32_t m_max_blocks;
-    std::queue<data_t> m_blocks;
+    const uint32_t m_max_blocks;
+    std::vector<data_t> m_slots;
+    // both only ever increase; positions are taken modulo the capacity
+    std::atomic<std::size_t> m_head;
+    std::atomic<std::size_t> m_tail;
+
+    std::atomic<uint64_t> m_dropped_full;
+    std::atomic<uint64_t> m_dropped_overflow;
+    MetricCounter *m_dropped_metric;
+    MetricGauge *m_depth_metric;
 
 public:
+    // consumer side
     template <typename OutputIterator>
     inline void fetch_up_to(const global_clock::time_point &t,
                             OutputIterator dest)
     {
-        while (!m_blocks.empty()) {
-            data_t &block = m_blocks.front();
-            if (block.t <= t) {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        const std::size_t tail = m_tail.load(std::memory_order_acquire);
+
+        if (tail - head > m_max_blocks) {
+            const std::size_t excess = tail - head - m_max_blocks;
+            for (std::size_t i = 0; i < excess; ++i) {
+                m_slots[head++ % m_slots.size()] = data_t();
+            }
+            m_dropped_overflow.fetch_add(excess, std::memory_order_relaxed);
+            if (m_dropped_metric) {
+                m_dropped_metric->add(excess);
+            }
+        }
+
+        while (head != tail) {
+            data_t &block = m_slots[head % m_slots.size()];
+            if (timestamp_of(block) <= t) {
                 *dest++ = std::move(block);
-                m_blocks.pop();
+                block = data_t();
+                ++head;
             } else {
                 break;
             }
         }
+
+        m_head.store(head, std::memory_order_release);
     }
 
-    inline void push_block(data_t &&block)
+    // producer side; returns false if the block was dropped
+    inline bool push_block(data_t &&block)
     {
-        if (m_blocks.size() >= m_max_blocks) {
-            m_blocks.pop();
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        const std::size_t head = m_head.load(std::memory_order_acquire);
+        if (tail - head >= m_slots.size()) {
+            m_dropped_full.fetch_add(1, std::memory_order_relaxed);
+            if (m_dropped_metric) {
+                m_dropped_metric->add();
+            }
+            return false;
         }
-        m_blocks.emplace(std::move(block));
+        m_slots[tail % m_slots.size()] = std::move(block);
+        m_tail.store(tail + 1, std::memory_order_release);
+        if (m_depth_metric) {
+            m_depth_metric->set(tail + 1 - head);
+        }
+        return true;
+    }
+
+    inline uint64_t dropped_full() const
+    {
+        return m_dropped_full.load(std::memory_order_relaxed);
+    }
+
+    inline uint64_t dropped_overflow() const
+    {
+        return m_dropped_overflow.load(std::memory_order_relaxed);
     }
 
 };
@@ -169,36 +383,124 @@ public:
 using SampleQueue = TimedDataQueue<SampleBlock>;
 
 
-class Engine;
+// The samples of one source of an Engine. Processors subscribe to the
+// stream of the source they analyse; the stream outlives restarts of the
+// source and keeps its id.
+class SampleStream: public QObject
+{
+    Q_OBJECT
+public:
+    explicit SampleStream(uint32_t id, QObject *parent = nullptr);
+
+private:
+    const uint32_t m_id;
+
+public:
+    inline uint32_t id() const
+    {
+        return m_id;
+    }
+
+signals:
+    void samples_available(std::shared_ptr<const SampleBlock> samples);
+    void end_of_stream();
+
+};
+
+
+// An RMS measured over window_msec, emitted every hop_msec, with the
+// maximum of the last peak_hold_msec worth of measurements as recent_peak.
+// window_msec is rounded to a whole number of hops.
+struct RMSWindow
+{
+    uint32_t window_msec;
+    uint32_t hop_msec;
+    uint32_t peak_hold_msec;
+};
 
 
+// Streaming RMS over any number of windows and channels at once. The
+// squares of the samples are summed once per chunk of the greatest common
+// hop; each window keeps a running sum over a ring of its hop sums and a
+// monotonic deque for the peak hold, so the cost per sample is fixed and
+// nothing is buffered. Each window of each channel yields its own blocks.
 class RMSProcessor: public QObject
 {
     Q_OBJECT
+public:
+    static const std::vector<RMSWindow> DEFAULT_WINDOWS;
+
 public:
     RMSProcessor() = delete;
-    explicit RMSProcessor(const Engine &engine);
+    explicit RMSProcessor(const SampleStream &source,
+                          const std::vector<RMSWindow> &windows = DEFAULT_WINDOWS,
+                          const ChannelSelection &channels = DOWNMIX_ONLY);
     RMSProcessor(const RMSProcessor &other) = delete;
     RMSProcessor(RMSProcessor &&src) = delete;
     RMSProcessor &operator=(const RMSProcessor &other) = delete;
     RMSProcessor &operator=(RMSProcessor &&src) = delete;
 
 private:
-    global_clock::time_point m_t0;
+    struct PeakEntry
+    {
+        uint64_t hop;
+        float rms;
+    };
+
+    struct WindowState
+    {
+        uint32_t hop_chunks;
+        uint32_t chunks_in_hop;
+        double hop_sum;
+
+        // ring of the sums of the last hops making up the window
+        std::vector<double> hop_sums;
+        std::size_t hop_index;
+        std::size_t hops_filled;
+        double window_sum;
+
+        // ring used as a deque of strictly decreasing rms values
+        std::vector<PeakEntry> peaks;
+        std::size_t peaks_head;
+        std::size_t peaks_size;
+        uint64_t hops;
+    };
+
+    const std::vector<RMSWindow> m_windows;
+    const ChannelSelection m_channels;
     uint32_t m_sample_rate;
-    std::vector<float> m_sample_buffer;
+    uint32_t m_chunk_samples;
+    uint32_t m_chunk_fill;
+    // per selected channel
+    std::vector<float> m_chunk_sums;
+    std::vector<const float*> m_inputs;
+    // all windows of the first selected channel, then of the second, ...
+    std::vector<WindowState> m_states;
 
-    std::array<float, 32> m_backlog;
-    decltype(m_backlog)::size_type m_backlog_index;
+    BlockPool<RMSBlock> m_pool;
+    LatencyHistogram &m_queue_delay;
 
 private slots:
     void process_samples(std::shared_ptr<const SampleBlock> input_block);
 
 private:
-    float get_recent_peak();
+    void reset(uint32_t sample_rate);
+    void complete_chunk(const global_clock::time_point &chunk_end);
+    float push_peak(WindowState &state, float rms);
+
+public:
+    inline const std::vector<RMSWindow> &windows() const
+    {
+        return m_windows;
+    }
+
+    inline const ChannelSelection &channels() const
+    {
+        return m_channels;
+    }
 
 signals:
-    void result_available(RMSBlock data);
+    void result_available(std::shared_ptr<const RMSBlock> data);
 
 };
 
@@ -209,7 +511,10 @@ class RootMeanSquare: public QThread
 
 public:
     RootMeanSquare() = delete;
-    explicit RootMeanSquare(const Engine &engine);
+    explicit RootMeanSquare(
+            const SampleStream &source,
+            const std::vector<RMSWindow> &windows = RMSProcessor::DEFAULT_WINDOWS,
+            const ChannelSelection &channels = DOWNMIX_ONLY);
     RootMeanSquare(const RootMeanSquare &other) = delete;
     RootMeanSquare(RootMeanSquare &&src) = delete;
     RootMeanSquare &operator=(const RootMeanSquare &other) = delete;
@@ -225,6 +530,119 @@ public:
         return m_processor;
     }
 
+    // block until everything queued to the processor so far is processed
+    void drain();
+
+};
+
+
+enum class FFTPlannerRigor
+{
+    ESTIMATE,
+    MEASURE,
+    PATIENT,
+    EXHAUSTIVE
+};
+
+
+bool load_fft_wisdom(const std::string &path);
+bool save_fft_wisdom(const std::string &path);
+
+
+struct FFTWFDeleter
+{
+    inline void operator()(void *ptr) const
+    {
+        fftwf_free(ptr);
+    }
+};
+
+
+class RealFFTPlan
+{
+public:
+    RealFFTPlan() = delete;
+    RealFFTPlan(uint32_t size, FFTPlannerRigor rigor);
+    RealFFTPlan(const RealFFTPlan &other) = delete;
+    RealFFTPlan(RealFFTPlan &&src) = delete;
+    RealFFTPlan &operator=(const RealFFTPlan &other) = delete;
+    RealFFTPlan &operator=(RealFFTPlan &&src) = delete;
+    ~RealFFTPlan();
+
+private:
+    const uint32_t m_size;
+    std::unique_ptr<float[], FFTWFDeleter> m_in;
+    std::unique_ptr<float[], FFTWFDeleter> m_out;
+    fftwf_plan m_plan;
+
+public:
+    inline uint32_t size() const
+    {
+        return m_size;
+    }
+
+    inline uint32_t bins() const
+    {
+        return m_size/2+1;
+    }
+
+    inline float *input()
+    {
+        return m_in.get();
+    }
+
+    inline const float *output() const
+    {
+        return m_out.get();
+    }
+
+    inline void execute()
+    {
+        fftwf_execute(m_plan);
+    }
+
+};
+
+
+// Forward transform of size interleaved (re, im) pairs.
+class ComplexFFTPlan
+{
+public:
+    ComplexFFTPlan() = delete;
+    ComplexFFTPlan(uint32_t size, FFTPlannerRigor rigor);
+    ComplexFFTPlan(const ComplexFFTPlan &other) = delete;
+    ComplexFFTPlan(ComplexFFTPlan &&src) = delete;
+    ComplexFFTPlan &operator=(const ComplexFFTPlan &other) = delete;
+    ComplexFFTPlan &operator=(ComplexFFTPlan &&src) = delete;
+    ~ComplexFFTPlan();
+
+private:
+    const uint32_t m_size;
+    std::unique_ptr<float[], FFTWFDeleter> m_in;
+    std::unique_ptr<float[], FFTWFDeleter> m_out;
+    fftwf_plan m_plan;
+
+public:
+    inline uint32_t size() const
+    {
+        return m_size;
+    }
+
+    inline float *input()
+    {
+        return m_in.get();
+    }
+
+    inline const float *output() const
+    {
+        return m_out.get();
+    }
+
+    inline void execute()
+    {
+        fftwf_execute(m_plan);
+    }
+
 };
 
 
@@ -233,37 +651,41 @@ class FFTProcessor: public QObject
     Q_OBJECT
 public:
     FFTProcessor() = delete;
-    explicit FFTProcessor(const Engine &engine,
+    explicit FFTProcessor(const SampleStream &source,
                           uint32_t size,
-                          uint32_t period_msec);
+                          uint32_t period_msec,
+                          FFTPlannerRigor rigor = FFTPlannerRigor::MEASURE);
     FFTProcessor(const FFTProcessor &other) = delete;
     FFTProcessor(FFTProcessor &&src) = delete;
     FFTProcessor &operator=(const FFTProcessor &other) = delete;
     FFTProcessor &operator=(FFTProcessor &&src) = delete;
 
 private:
-    std::vector<double> m_in;
-    std::vector<std::complex<double> > m_out_buffer;
     const uint32_t m_size;
-    fftw_plan m_plan;
+    RealFFTPlan m_plan;
     uint32_t m_period_msec;
     global_clock::time_point m_t;
+    uint64_t m_samples_since_t;
     uint32_t m_sample_rate;
     uint32_t m_shift_remaining;
-    double m_norm;
+    uint32_t m_fill;
+    float m_norm;
 
-    std::vector<double> m_in_buffer;
-    std::vector<double> m_window;
-    RealFFTBlock m_out;
+    MirroredRingBuffer<float> m_in_buffer;
+    std::vector<float> m_window;
+    BlockPool<RealFFTBlock> m_pool;
 
-private:
-    void make_window(std::vector<double> &dest);
+    LatencyHistogram &m_queue_delay;
+    LatencyHistogram &m_compute_time;
+
+public:
+    static void make_window(std::vector<float> &dest);
 
 private slots:
     void process_samples(std::shared_ptr<const SampleBlock> input_block);
 
 signals:
-    void result_available(RealFFTBlock data);
+    void result_available(std::shared_ptr<const RealFFTBlock> data);
 
 };
 
@@ -274,9 +696,10 @@ class FFT: public QThread
 
 public:
     FFT() = delete;
-    explicit FFT(const Engine &engine,
+    explicit FFT(const SampleStream &source,
                  uint32_t size,
-                 uint32_t period_msec);
+                 uint32_t period_msec,
+                 FFTPlannerRigor rigor = FFTPlannerRigor::MEASURE);
     FFT(const FFT &other) = delete;
     FFT(FFT &&src) = delete;
     FFT &operator=(const FFT &other) = delete;
@@ -292,6 +715,9 @@ public:
         return m_processor;
     }
 
+    // block until everything queued to the processor so far is processed
+    void drain();
+
 };
 
 
@@ -305,9 +731,13 @@ public:
     virtual void start() = 0;
     virtual void stop() = 0;
     virtual global_clock::time_point time() const = 0;
+    // called once the source has no more samples
+    virtual void source_ended();
 
 public:
-    virtual void write_samples(const std::vector<float> &samples) = 0;
+    // t is the source time of the first sample
+    virtual void write_samples(const std::vector<float> &samples,
+                               const global_clock::time_point &t) = 0;
 
 };
 
@@ -333,51 +763,145 @@ public:
     global_clock::time_point time() const override;
 
 public:
-    void write_samples(const std::vector<float> &samples) override;
+    void write_samples(const std::vector<float> &samples,
+                       const global_clock::time_point &t) override;
+
+};
+
+
+// Smoothed latency of an output: how far behind the wall clock the sample
+// being played is in the timeline of its source. Measurements are quantized
+// to device periods and are averaged over about SMOOTHING of them, while
+// steps beyond the threshold passed along (dropped backlog, underruns) are
+// taken over at once. The slope of the latency over DRIFT_WINDOW_USECS is
+// the drift between the clock of the source and that of the device, or
+// what is left of it after correction.
+class LatencyEstimator
+{
+public:
+    static constexpr int64_t SMOOTHING = 16;
+    static constexpr int64_t DRIFT_WINDOW_USECS = 10000000;
+
+public:
+    LatencyEstimator();
+
+private:
+    bool m_valid;
+    std::chrono::microseconds m_latency;
+    bool m_have_drift;
+    double m_drift_ppm;
+    double m_window_drift_ppm;
+    global_clock::time_point m_anchor_t;
+    std::chrono::microseconds m_anchor_latency;
+
+public:
+    // true if a drift window was completed
+    bool update(const global_clock::time_point &now,
+                const global_clock::time_point &playing,
+                const std::chrono::microseconds &step_threshold);
+
+    inline std::chrono::microseconds latency() const
+    {
+        return m_latency;
+    }
+
+    // positive if the latency grows, i.e. the device consumes slower than
+    // the source produces
+    inline double drift_ppm() const
+    {
+        return m_drift_ppm;
+    }
+
+    // of the window completed last, unsmoothed
+    inline double window_drift_ppm() const
+    {
+        return m_window_drift_ppm;
+    }
 
 };
 
 
+// Plays back through a QAudioOutput. The output time is derived from the
+// source times of what the device still has queued, so that it follows
+// the source even if the clocks of source and device drift apart. The drift
+// itself is corrected by slipping single frames, dropped if the device is
+// slower than the source and repeated if it is faster, at a rate which is
+// adjusted after each drift window; backlog beyond the drop threshold of
+// the settings is still dropped as a whole. With adaptive settings each
+// underrun before the end of the source doubles the device buffer up to its
+// bound.
 class AudioOutputDriver: public AbstractOutputDriver
 {
     Q_OBJECT
+public:
+    // bound of the drift correction
+    static constexpr double MAX_CORRECTION_PPM = 1000;
+
 public:
     explicit AudioOutputDriver(
             const QAudioDeviceInfo &device,
             const QAudioFormat &format,
-            int32_t buffer_msecs = 100,
-            uint32_t drop_msecs = 1000,
+            const LatencySettings &settings,
             QObject *parent = nullptr);
 
 private:
     QAudioDeviceInfo m_device;
     QAudioFormat m_format;
-    int32_t m_buffer_msecs;
-    uint32_t m_drop_msecs;
+    const LatencySettings m_settings;
+    uint32_t m_buffer_msecs;
 
     std::unique_ptr<QAudioOutput> m_output;
     QIODevice *m_sink;
-    int64_t m_samples_written;
+    uint32_t m_channel_count;
+    uint32_t m_sample_rate;
     uint32_t m_drop_samples;
-    global_clock::time_point m_t0;
-    std::vector<float> m_outer_buffer;
+    SPSCRingBuffer<float> m_outer_buffer;
     std::chrono::microseconds m_buffer_delay;
-
-    mutable std::shared_timed_mutex m_time_mutex;
-    std::chrono::microseconds m_dropped;
-    std::chrono::microseconds m_outer_buffer_delay;
+    std::chrono::microseconds m_step_threshold;
+    // source times of the ends of what the device and the outer buffer hold
+    global_clock::time_point m_device_end;
+    global_clock::time_point m_outer_end;
+    LatencyEstimator m_estimator;
+    // incremented with each device opened, to tell stale signals apart
+    uint64_t m_output_generation;
+    bool m_source_ended;
+
+    // frames to drop per million, negative to repeat
+    double m_correction_ppm;
+    // fractional frames of correction not applied yet
+    double m_slip;
+    std::vector<float> m_slipped;
+
+    // published by the audio thread so that time() never has to take a lock
+    std::atomic<int64_t> m_latency_usecs;
+
+    MetricCounter &m_dropped_samples;
+    MetricCounter &m_underruns;
+    MetricCounter &m_slipped_frames;
+    MetricGauge &m_latency_metric;
+    MetricGauge &m_buffer_metric;
+    MetricGauge &m_drift_metric;
+    MetricGauge &m_correction_metric;
 
 private:
-    void update_buffer_delay();
+    std::chrono::microseconds duration_of(uint64_t samples) const;
+    void open_output();
+    void drain_outer_buffer();
+    void publish_latency();
+    void handle_underrun(uint64_t generation);
+    // samples with the correction due for them applied
+    const std::vector<float> &slip(const std::vector<float> &samples);
 
 public:
-    void write_samples(const std::vector<float> &samples) override;
+    void write_samples(const std::vector<float> &samples,
+                       const global_clock::time_point &t) override;
 
     // AbstractOutputDriver interface
 public:
     void start() override;
     void stop() override;
     global_clock::time_point time() const override;
+    void source_ended() override;
 
 };
 
@@ -385,34 +909,44 @@ public:
 class AudioPipe: public QThread
 {
     Q_OBJECT
+public:
+    // non-realtime sources are throttled while this many blocks are still
+    // referenced by processors
+    static constexpr uint64_t MAX_BLOCKS_IN_FLIGHT = 64;
+
 public:
     AudioPipe(
             std::unique_ptr<VirtualAudioSource> &&source,
-            std::unique_ptr<AbstractOutputDriver> &&sink);
+            std::unique_ptr<AbstractOutputDriver> &&sink,
+            uint32_t source_id = 0);
     explicit AudioPipe(std::unique_ptr<VirtualAudioSource> &&source,
             const std::chrono::milliseconds &output_delay = std::chrono::milliseconds(100));
     ~AudioPipe() override;
 
 private:
+    const uint32_t m_source_id;
     std::atomic_bool m_terminated;
     QThread *m_new_source_thread;
-    std::chrono::microseconds m_sample_sleep;
 
     std::unique_ptr<VirtualAudioSource> m_source;
     std::unique_ptr<AbstractOutputDriver> m_sink;
+    QMetaObject::Connection m_source_connection;
+    QMetaObject::Connection m_eos_connection;
+    QMetaObject::Connection m_sink_eos_connection;
 
     std::mutex m_startup_mutex;
     std::condition_variable m_startup_notify;
     bool m_startup_done;
 
+    BlockPool<SampleBlock> m_block_pool;
+    LatencyHistogram &m_read_time;
+
 private: // for use from within the thread only!
     std::vector<float> m_sample_buffer;
 
 private:
-    void downmix_to_mono(const std::vector<float> &src,
-                         std::vector<float> &dest,
-                         uint32_t channels);
     std::shared_lock<std::shared_timed_mutex> wait_for_source_and_sink();
+    void pump_samples();
 
     // QThread interface
 protected:
@@ -424,48 +958,113 @@ public:
         return m_sink->time();
     }
 
+    inline BlockPoolStats sample_pool_stats() const
+    {
+        return m_block_pool.stats();
+    }
+
 public:
     std::unique_ptr<VirtualAudioSource> stop(QThread &new_source_thread);
 
 signals:
     void samples_available(std::shared_ptr<const SampleBlock> block);
+    void end_of_stream();
 
 };
 
 
+// Runs any number of sources at once, each in an AudioPipe of its own. The
+// blocks of all sources are emitted by samples_available tagged with their
+// source id, and by the SampleStream of each source. Only the primary source
+// is played back on the output device.
+//
+// Source ids are never reused, so streams handed out stay valid for the
+// lifetime of the engine.
 class Engine: public QObject
 {
     Q_OBJECT
 
+public:
+    static constexpr uint32_t PRIMARY_SOURCE = 0;
+
 public:
     Engine();
     ~Engine() override;
 
 private:
-    std::unique_ptr<VirtualAudioSource> m_source_latch;
-
-    std::unique_ptr<AudioPipe> m_audio_pipe;
+    struct Input
+    {
+        explicit Input(uint32_t id);
+
+        std::unique_ptr<VirtualAudioSource> latch;
+        std::unique_ptr<AudioPipe> pipe;
+        SampleStream stream;
+        bool ended;
+    };
+
+    // indexed by source id
+    std::vector<std::unique_ptr<Input> > m_inputs;
+    bool m_running;
+    LatencyProfile m_latency_profile;
     QAudioDeviceInfo m_output_device_info;
 
 private:
-    void rebuild_pipe();
+    Input &input(uint32_t source) const;
+    // throws std::logic_error if the source is not running
+    AudioPipe &running_pipe(uint32_t source) const;
+    void rebuild_pipe(Input &input);
+    void stop_pipe(Input &input);
+    void source_ended(Input &input);
 
 public:
-    inline global_clock::time_point sink_time() const
+    // of running sources only, see is_running(source)
+    inline global_clock::time_point sink_time(uint32_t source = PRIMARY_SOURCE) const
+    {
+        return running_pipe(source).sink_time();
+    }
+
+    inline BlockPoolStats sample_pool_stats(uint32_t source = PRIMARY_SOURCE) const
+    {
+        return running_pipe(source).sample_pool_stats();
+    }
+
+    inline const SampleStream &stream(uint32_t source = PRIMARY_SOURCE) const
+    {
+        return input(source).stream;
+    }
+
+    inline uint32_t source_count() const
+    {
+        return m_inputs.size();
+    }
+
+    inline LatencyProfile latency_profile() const
     {
-        return m_audio_pipe->sink_time();
+        return m_latency_profile;
     }
 
     bool is_running() const;
+    bool is_running(uint32_t source) const;
 
     void start();
     void stop();
 
+    // sets the primary source
     void set_source(std::unique_ptr<VirtualAudioSource> &&source);
+    // returns the id of the new source; it starts right away if the engine
+    // is running
+    uint32_t add_source(std::unique_ptr<VirtualAudioSource> &&source);
+    // stops and drops the source, which counts as its end of stream; its id
+    // stays valid but idle, and the engine stops with its last running source
+    void remove_source(uint32_t source);
     void set_output_device(const QAudioDeviceInfo &device);
+    // takes effect with the next start, STANDARD by default
+    void set_latency_profile(LatencyProfile profile);
 
 signals:
     void samples_available(std::shared_ptr<const SampleBlock> samples);
+    // once every running source has ended
+    void end_of_stream();
 
 };
 
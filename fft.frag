@@ -9,10 +9,10 @@ out vec4 colour;
 
 void main(void)
 {
+    // the texture holds dB values
     vec4 data = texture1D(data, frag_tc0.x);
     float v = max(data.x, data.y);
-    v = 20.f * log2(v) / log2(10.f) - dB_min;
-    v /= (dB_max - dB_min);
+    v = (v - dB_min) / (dB_max - dB_min);
 
     if (v < frag_tc0.y) {
         discard;
@@ -0,0 +1,328 @@
+#include "fftbank.h"
+
+#include "dsp.h"
+#include "threadpolicy.h"
+
+
+/* FFTBankProcessor::Lane */
+
+class FFTBankProcessor::Lane: public QRunnable
+{
+public:
+    Lane(FFTBankProcessor &bank,
+         const FFTResolution &resolution,
+         int32_t channel,
+         FFTPlannerRigor rigor):
+        m_bank(bank),
+        m_resolution(resolution),
+        m_channel(channel),
+        m_plan(resolution.size, rigor),
+        m_window(resolution.size),
+        m_shift(1),
+        m_scheduled(false),
+        m_next_start(0),
+        m_compute_time(MetricsRegistry::global().histogram(
+                           "fftbank." + std::to_string(resolution.size) +
+                           ".compute_usecs"))
+    {
+        setAutoDelete(false);
+        FFTProcessor::make_window(m_window);
+        std::copy(m_window.begin(), m_window.end(), m_plan.input());
+        m_plan.execute();
+        m_norm = m_plan.output()[0];
+    }
+
+    FFTBankProcessor &m_bank;
+    const FFTResolution m_resolution;
+    const int32_t m_channel;
+    RealFFTPlan m_plan;
+    std::vector<float> m_window;
+    float m_norm;
+    uint32_t m_shift;
+
+    BlockPool<RealFFTBlock> m_pool;
+    FFTBankOutput m_output;
+
+    std::atomic<bool> m_scheduled;
+    // absolute index of the first sample of the next frame; only advanced by
+    // the lane itself
+    std::atomic<uint64_t> m_next_start;
+    std::vector<HistoryEntry> m_pieces;
+
+    LatencyHistogram &m_compute_time;
+
+    inline bool is_due() const
+    {
+        return m_next_start.load(std::memory_order_relaxed) + m_resolution.size <=
+                m_bank.m_history_end.load();
+    }
+
+    void reset(uint32_t sample_rate)
+    {
+        m_shift = std::max<uint64_t>(
+                    1,
+                    (uint64_t)m_resolution.period_msec * sample_rate / 1000);
+        m_next_start.store(0, std::memory_order_relaxed);
+    }
+
+    void schedule()
+    {
+        if (is_due() && !m_scheduled.exchange(true)) {
+            m_bank.lane_scheduled();
+            shared_workers().start(this);
+        }
+    }
+
+    bool process_one()
+    {
+        const uint64_t start = m_next_start.load(std::memory_order_relaxed);
+        const uint32_t size = m_resolution.size;
+        {
+            std::lock_guard<std::mutex> lock(m_bank.m_history_mutex);
+            if (start + size > m_bank.m_history_end.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            auto iter = m_bank.m_history.cbegin();
+            const auto end = m_bank.m_history.cend();
+            while (iter->first_sample + iter->block->frames <= start) {
+                ++iter;
+            }
+            for (; iter != end && iter->first_sample < start + size; ++iter) {
+                m_pieces.push_back(*iter);
+            }
+        }
+
+        const uint32_t sample_rate = m_bank.m_sample_rate;
+        const HistoryEntry &first = m_pieces.front();
+        const global_clock::time_point t = first.block->t + std::chrono::microseconds(
+                    (start - first.first_sample) * 1000000 / sample_rate);
+
+        const global_clock::time_point compute_start = global_clock::now();
+        uint32_t filled = 0;
+        for (const HistoryEntry &piece: m_pieces) {
+            const float *samples = piece.block->samples(m_channel);
+            const uint64_t offset = start + filled - piece.first_sample;
+            const uint32_t n = std::min<uint64_t>(piece.block->frames - offset,
+                                                  size - filled);
+            if (samples != nullptr) {
+                multiply(&samples[offset], &m_window[filled],
+                         m_plan.input() + filled, n);
+            } else {
+                std::fill(m_plan.input() + filled, m_plan.input() + filled + n, 0.f);
+            }
+            filled += n;
+        }
+        m_pieces.clear();
+        m_plan.execute();
+
+        std::shared_ptr<RealFFTBlock> block = m_pool.acquire();
+        block->t = t;
+        block->channel = m_channel;
+        block->fmin = 0;
+        block->fmax = (float)sample_rate / 2;
+        block->fft.resize(m_plan.bins());
+        complex_magnitudes(m_plan.output(), block->fft.data(),
+                           m_plan.bins(), 1.f / m_norm);
+        m_compute_time.record_since(compute_start);
+
+        m_next_start.store(start + m_shift, std::memory_order_relaxed);
+        block->published = global_clock::now();
+        emit m_output.result_available(std::move(block));
+        return true;
+    }
+
+    void run() override
+    {
+        // the pool starts and retires its threads as it likes
+        static thread_local bool policy_applied = false;
+        if (!policy_applied) {
+            ThreadPolicies::global().apply("FFTWorker");
+            policy_applied = true;
+        }
+        while (true) {
+            while (process_one()) {
+
+            }
+            m_scheduled.store(false);
+            // a block may have arrived between the last check and clearing
+            // the flag
+            if (!is_due() || m_scheduled.exchange(true)) {
+                // last, the bank may be gone right after
+                m_bank.lane_done();
+                return;
+            }
+        }
+    }
+
+};
+
+
+/* FFTBankProcessor */
+
+FFTBankProcessor::FFTBankProcessor(const SampleStream &source,
+                                   const std::vector<FFTResolution> &resolutions,
+                                   FFTPlannerRigor rigor,
+                                   const ChannelSelection &channels):
+    m_history_end(0),
+    m_sample_rate(0),
+    m_channels(channels),
+    m_active_lanes(0),
+    m_queue_delay(MetricsRegistry::global().histogram("fftbank.queue_delay_usecs"))
+{
+    if (resolutions.empty()) {
+        throw std::invalid_argument("no resolutions given");
+    }
+    if (channels.empty()) {
+        throw std::invalid_argument("no channels given");
+    }
+    for (const FFTResolution &resolution: resolutions) {
+        for (const int32_t channel: channels) {
+            m_lanes.emplace_back(std::make_unique<Lane>(
+                                     *this, resolution, channel, rigor));
+        }
+    }
+
+    connect(&source, &SampleStream::samples_available,
+            this, &FFTBankProcessor::process_samples,
+            Qt::QueuedConnection);
+}
+
+FFTBankProcessor::~FFTBankProcessor()
+{
+    wait_for_lanes();
+}
+
+QThreadPool &FFTBankProcessor::shared_workers()
+{
+    static QThreadPool pool;
+    static std::once_flag configured;
+    std::call_once(configured, [](){
+        pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount()));
+    });
+    return pool;
+}
+
+void FFTBankProcessor::lane_scheduled()
+{
+    std::lock_guard<std::mutex> lock(m_active_mutex);
+    ++m_active_lanes;
+}
+
+void FFTBankProcessor::lane_done()
+{
+    std::lock_guard<std::mutex> lock(m_active_mutex);
+    if (--m_active_lanes == 0) {
+        m_active_done.notify_all();
+    }
+}
+
+void FFTBankProcessor::reset(uint32_t sample_rate)
+{
+    wait_for_lanes();
+
+    std::lock_guard<std::mutex> lock(m_history_mutex);
+    m_history.clear();
+    m_history_end.store(0);
+    m_sample_rate = sample_rate;
+    for (auto &lane: m_lanes) {
+        lane->reset(sample_rate);
+    }
+}
+
+void FFTBankProcessor::trim_history()
+{
+    uint64_t oldest_needed = m_history_end.load(std::memory_order_relaxed);
+    for (auto &lane: m_lanes) {
+        oldest_needed = std::min(oldest_needed,
+                                 lane->m_next_start.load(std::memory_order_relaxed));
+    }
+
+    std::lock_guard<std::mutex> lock(m_history_mutex);
+    while (!m_history.empty()) {
+        const HistoryEntry &front = m_history.front();
+        if (front.first_sample + front.block->frames > oldest_needed) {
+            break;
+        }
+        m_history.pop_front();
+    }
+}
+
+void FFTBankProcessor::process_samples(std::shared_ptr<const SampleBlock> input_block)
+{
+    m_queue_delay.record_since(input_block->published);
+    if (input_block->sample_rate != m_sample_rate) {
+        reset(input_block->sample_rate);
+    }
+
+    const uint64_t samples = input_block->frames;
+    if (samples == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_history_mutex);
+        const uint64_t first_sample = m_history_end.load(std::memory_order_relaxed);
+        m_history.emplace_back(HistoryEntry{first_sample, std::move(input_block)});
+        m_history_end.store(first_sample + samples);
+    }
+
+    for (auto &lane: m_lanes) {
+        lane->schedule();
+    }
+    trim_history();
+}
+
+std::size_t FFTBankProcessor::resolutions() const
+{
+    return m_lanes.size() / m_channels.size();
+}
+
+const FFTBankOutput &FFTBankProcessor::output(std::size_t resolution,
+                                              std::size_t channel) const
+{
+    return m_lanes[resolution * m_channels.size() + channel]->m_output;
+}
+
+FFTResolution FFTBankProcessor::resolution(std::size_t resolution) const
+{
+    return m_lanes[resolution * m_channels.size()]->m_resolution;
+}
+
+const ChannelSelection &FFTBankProcessor::channels() const
+{
+    return m_channels;
+}
+
+void FFTBankProcessor::wait_for_lanes()
+{
+    std::unique_lock<std::mutex> lock(m_active_mutex);
+    m_active_done.wait(lock, [this](){ return m_active_lanes == 0; });
+}
+
+
+/* FFTBank */
+
+FFTBank::FFTBank(const SampleStream &source,
+                 const std::vector<FFTResolution> &resolutions,
+                 FFTPlannerRigor rigor,
+                 const ChannelSelection &channels):
+    m_processor(source, resolutions, rigor, channels)
+{
+    setObjectName("FFTBank");
+    ThreadPolicies::global().attach(*this);
+    start();
+    m_processor.moveToThread(this);
+}
+
+FFTBank::~FFTBank()
+{
+    exit();
+    wait();
+}
+
+void FFTBank::drain()
+{
+    QMetaObject::invokeMethod(&m_processor, [this](){
+        m_processor.wait_for_lanes();
+    }, Qt::BlockingQueuedConnection);
+}
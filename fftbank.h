@@ -0,0 +1,133 @@
+#ifndef FFTBANK_H
+#define FFTBANK_H
+
+#include <deque>
+
+#include <QThreadPool>
+
+#include "engine.h"
+
+
+struct FFTResolution
+{
+    uint32_t size;
+    uint32_t period_msec;
+};
+
+
+class FFTBankOutput: public QObject
+{
+    Q_OBJECT
+public:
+    using QObject::QObject;
+
+signals:
+    void result_available(std::shared_ptr<const RealFFTBlock> data);
+
+};
+
+
+// Runs several FFTs of different sizes over the same input. The blocks
+// coming from the engine are kept by reference in a single history instead
+// of being copied per size or channel; each resolution of each selected
+// channel is a lane which is scheduled on a worker pool whenever a frame is
+// due, so the channels of a source are transformed in parallel. The pool is shared by all banks of
+// the process, so the transforms of any number of sources scale with the
+// cores rather than with the banks. A lane never runs on two workers at
+// once, so frames of one resolution are emitted in order.
+class FFTBankProcessor: public QObject
+{
+    Q_OBJECT
+public:
+    FFTBankProcessor() = delete;
+    explicit FFTBankProcessor(const SampleStream &source,
+                              const std::vector<FFTResolution> &resolutions,
+                              FFTPlannerRigor rigor = FFTPlannerRigor::MEASURE,
+                              const ChannelSelection &channels = DOWNMIX_ONLY);
+    FFTBankProcessor(const FFTBankProcessor &other) = delete;
+    FFTBankProcessor(FFTBankProcessor &&src) = delete;
+    FFTBankProcessor &operator=(const FFTBankProcessor &other) = delete;
+    FFTBankProcessor &operator=(FFTBankProcessor &&src) = delete;
+    ~FFTBankProcessor() override;
+
+private:
+    struct HistoryEntry
+    {
+        uint64_t first_sample;
+        std::shared_ptr<const SampleBlock> block;
+    };
+
+    class Lane;
+
+    // guards m_history; m_history_end is only written with it held
+    std::mutex m_history_mutex;
+    std::deque<HistoryEntry> m_history;
+    std::atomic<uint64_t> m_history_end;
+    // only changed while no lane is running
+    uint32_t m_sample_rate;
+
+    const ChannelSelection m_channels;
+    // all channels of the first resolution, then of the second, ...
+    std::vector<std::unique_ptr<Lane> > m_lanes;
+    // lanes scheduled or running on the shared pool
+    std::mutex m_active_mutex;
+    std::condition_variable m_active_done;
+    uint32_t m_active_lanes;
+
+    LatencyHistogram &m_queue_delay;
+
+private:
+    static QThreadPool &shared_workers();
+    void lane_scheduled();
+    void lane_done();
+    void reset(uint32_t sample_rate);
+    void trim_history();
+
+private slots:
+    void process_samples(std::shared_ptr<const SampleBlock> input_block);
+
+public:
+    std::size_t resolutions() const;
+    // channel is an index into channels()
+    const FFTBankOutput &output(std::size_t resolution,
+                                std::size_t channel = 0) const;
+    FFTResolution resolution(std::size_t resolution) const;
+    const ChannelSelection &channels() const;
+
+    // block until no lane is running
+    void wait_for_lanes();
+
+};
+
+
+class FFTBank: public QThread
+{
+    Q_OBJECT
+
+public:
+    FFTBank() = delete;
+    explicit FFTBank(const SampleStream &source,
+                     const std::vector<FFTResolution> &resolutions,
+                     FFTPlannerRigor rigor = FFTPlannerRigor::MEASURE,
+                     const ChannelSelection &channels = DOWNMIX_ONLY);
+    FFTBank(const FFTBank &other) = delete;
+    FFTBank(FFTBank &&src) = delete;
+    FFTBank &operator=(const FFTBank &other) = delete;
+    FFTBank &operator=(FFTBank &&src) = delete;
+    ~FFTBank() override;
+
+private:
+    FFTBankProcessor m_processor;
+
+public:
+    inline const FFTBankProcessor &processor() const
+    {
+        return m_processor;
+    }
+
+    // block until everything queued to the bank so far is transformed
+    void drain();
+
+};
+
+#endif // FFTBANK_H
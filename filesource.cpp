@@ -0,0 +1,331 @@
+#include "filesource.h"
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+
+static inline uint16_t read_le16(const unsigned char *p)
+{
+    return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static inline uint32_t read_le32(const unsigned char *p)
+{
+    return (uint32_t)read_le16(p) | ((uint32_t)read_le16(p+2) << 16);
+}
+
+static inline uint64_t read_le64(const unsigned char *p)
+{
+    return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p+4) << 32);
+}
+
+
+/* FileSource */
+
+FileSource::FileSource(const QString &path,
+                       QObject *parent):
+    VirtualAudioSource(parent),
+    m_file(path),
+    m_map(nullptr),
+    m_data(nullptr),
+    m_frames(0),
+    m_bytes_per_frame(0),
+    m_paced(true),
+    m_period_frames(DEFAULT_PERIOD_FRAMES),
+    m_position(0),
+    m_t0_frame(0),
+    m_burst_periods(0),
+    m_eos_emitted(false)
+{
+    map_file();
+    parse_riff_header();
+}
+
+FileSource::FileSource(const QString &path,
+                       const QAudioFormat &raw_format,
+                       QObject *parent):
+    VirtualAudioSource(parent),
+    m_file(path),
+    m_map(nullptr),
+    m_data(nullptr),
+    m_frames(0),
+    m_bytes_per_frame(0),
+    m_paced(true),
+    m_period_frames(DEFAULT_PERIOD_FRAMES),
+    m_position(0),
+    m_t0_frame(0),
+    m_burst_periods(0),
+    m_eos_emitted(false)
+{
+    map_file();
+    set_format(raw_format);
+    m_data = m_map;
+    m_frames = m_file.size() / m_bytes_per_frame;
+}
+
+FileSource::~FileSource()
+{
+    stop();
+    if (m_map) {
+        m_file.unmap(m_map);
+    }
+}
+
+void FileSource::map_file()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("failed to open "+m_file.fileName().toStdString()+
+                                 ": "+m_file.errorString().toStdString());
+    }
+    if (m_file.size() == 0) {
+        throw std::runtime_error("file is empty");
+    }
+    m_map = m_file.map(0, m_file.size());
+    if (!m_map) {
+        throw std::runtime_error("failed to map "+m_file.fileName().toStdString()+
+                                 ": "+m_file.errorString().toStdString());
+    }
+#ifdef Q_OS_UNIX
+    posix_madvise(m_map, m_file.size(), POSIX_MADV_SEQUENTIAL);
+#endif
+}
+
+void FileSource::parse_riff_header()
+{
+    static constexpr uint16_t WAVE_FORMAT_PCM = 0x0001;
+    static constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 0x0003;
+    static constexpr uint16_t WAVE_FORMAT_EXTENSIBLE = 0xFFFE;
+
+    const uint64_t file_size = m_file.size();
+    if (file_size < 12 ||
+            std::memcmp(&m_map[8], "WAVE", 4) != 0)
+    {
+        throw std::runtime_error("not a WAV file");
+    }
+
+    bool rf64;
+    if (std::memcmp(&m_map[0], "RIFF", 4) == 0) {
+        rf64 = false;
+    } else if (std::memcmp(&m_map[0], "RF64", 4) == 0) {
+        rf64 = true;
+    } else {
+        throw std::runtime_error("not a WAV file");
+    }
+
+    uint64_t ds64_data_size = 0;
+    bool have_format = false;
+    QAudioFormat format;
+    format.setByteOrder(QAudioFormat::LittleEndian);
+    format.setCodec("audio/pcm");
+
+    uint64_t offset = 12;
+    while (offset + 8 <= file_size) {
+        const unsigned char *chunk = &m_map[offset];
+        uint64_t chunk_size = read_le32(chunk+4);
+        const unsigned char *body = chunk + 8;
+        const uint64_t body_offset = offset + 8;
+
+        if (std::memcmp(chunk, "ds64", 4) == 0 && rf64) {
+            if (chunk_size < 16 || body_offset + 16 > file_size) {
+                throw std::runtime_error("truncated ds64 chunk");
+            }
+            ds64_data_size = read_le64(body+8);
+        } else if (std::memcmp(chunk, "fmt ", 4) == 0) {
+            if (chunk_size < 16 || body_offset + chunk_size > file_size) {
+                throw std::runtime_error("truncated fmt chunk");
+            }
+            uint16_t format_tag = read_le16(body);
+            const uint16_t bits = read_le16(body+14);
+            if (format_tag == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 40) {
+                // the first two bytes of the sub-format GUID are the tag
+                format_tag = read_le16(body+24);
+            }
+            switch (format_tag) {
+            case WAVE_FORMAT_PCM:
+            {
+                format.setSampleType(bits == 8 ? QAudioFormat::UnSignedInt
+                                               : QAudioFormat::SignedInt);
+                break;
+            }
+            case WAVE_FORMAT_IEEE_FLOAT:
+            {
+                format.setSampleType(QAudioFormat::Float);
+                break;
+            }
+            default:
+                throw std::runtime_error("unsupported WAV format tag: "+
+                                         std::to_string(format_tag));
+            }
+            format.setChannelCount(read_le16(body+2));
+            format.setSampleRate(read_le32(body+4));
+            format.setSampleSize(bits);
+            have_format = true;
+        } else if (std::memcmp(chunk, "data", 4) == 0) {
+            if (!have_format) {
+                throw std::runtime_error("data chunk before fmt chunk");
+            }
+            if (rf64 && chunk_size == 0xFFFFFFFFULL) {
+                chunk_size = ds64_data_size;
+            }
+            // tolerate truncated recordings
+            chunk_size = std::min(chunk_size, file_size - body_offset);
+
+            set_format(format);
+            m_data = body;
+            m_frames = chunk_size / m_bytes_per_frame;
+            return;
+        }
+
+        offset = body_offset + chunk_size + (chunk_size & 1);
+    }
+
+    throw std::runtime_error("no data chunk in WAV file");
+}
+
+void FileSource::set_format(const QAudioFormat &format)
+{
+    if (format.channelCount() <= 0 || format.sampleRate() <= 0 ||
+            format.sampleSize() <= 0 || format.sampleSize() % 8 != 0)
+    {
+        throw std::runtime_error("invalid sample format");
+    }
+    if (format.byteOrder() != QAudioFormat::LittleEndian) {
+        throw std::runtime_error("only little endian samples are supported");
+    }
+
+    m_converter = AbstractSampleConverter::make_converter(
+                format.sampleType(),
+                format.sampleSize());
+    m_format = format;
+    m_bytes_per_frame = format.channelCount() * format.sampleSize() / 8;
+}
+
+void FileSource::set_paced(bool paced)
+{
+    if (m_timer) {
+        throw std::logic_error("cannot change pacing while running");
+    }
+    m_paced = paced;
+}
+
+void FileSource::set_period_frames(uint32_t frames)
+{
+    if (frames == 0) {
+        throw std::invalid_argument("period must not be empty");
+    }
+    m_period_frames = frames;
+}
+
+uint32_t FileSource::channel_count() const
+{
+    return m_format.channelCount();
+}
+
+uint32_t FileSource::sample_rate() const
+{
+    return m_format.sampleRate();
+}
+
+bool FileSource::is_seekable() const
+{
+    return true;
+}
+
+bool FileSource::seek(const uint64_t to_frame)
+{
+    m_position = std::min(to_frame, m_frames);
+    m_t0 = global_clock::now();
+    m_t0_frame = m_position;
+    m_eos_emitted = false;
+    return true;
+}
+
+uint64_t FileSource::tell() const
+{
+    return m_position;
+}
+
+bool FileSource::is_realtime() const
+{
+    return m_paced;
+}
+
+void FileSource::start()
+{
+    m_t0 = global_clock::now();
+    m_t0_frame = m_position;
+    m_burst_periods = 0;
+    if (m_paced) {
+        m_timer = std::make_unique<QTimer>();
+        m_timer->setTimerType(Qt::PreciseTimer);
+        m_timer->setInterval(std::max<uint64_t>(
+                                 1,
+                                 (uint64_t)m_period_frames * 1000 / sample_rate()));
+        connect(m_timer.get(), &QTimer::timeout,
+                this, &VirtualAudioSource::samples_ready);
+        m_timer->start();
+    }
+    emit samples_ready();
+}
+
+void FileSource::stop()
+{
+    m_timer = nullptr;
+}
+
+std::pair<bool, global_clock::time_point> FileSource::read_samples(
+        std::vector<float> &dest)
+{
+    dest.clear();
+    if (!m_data) {
+        return std::make_pair(false, global_clock::time_point());
+    }
+
+    const uint32_t rate = sample_rate();
+    const global_clock::time_point t = m_t0 + std::chrono::microseconds(
+                (m_position - m_t0_frame) * 1000000 / rate);
+
+    if (m_position >= m_frames) {
+        if (!m_eos_emitted) {
+            m_eos_emitted = true;
+            if (m_timer) {
+                m_timer->stop();
+            }
+            emit end_of_stream();
+        }
+        return std::make_pair(true, t);
+    }
+
+    uint64_t frames = std::min<uint64_t>(m_period_frames, m_frames - m_position);
+    if (m_paced) {
+        const uint64_t elapsed_frames =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    global_clock::now() - m_t0).count() * rate / 1000000;
+        const uint64_t due_until = m_t0_frame + elapsed_frames;
+        if (due_until <= m_position) {
+            return std::make_pair(true, t);
+        }
+        frames = std::min(frames, due_until - m_position);
+    } else {
+        if (m_burst_periods >= UNPACED_BURST_PERIODS) {
+            // give the event loop a chance, then carry on
+            m_burst_periods = 0;
+            emit samples_ready();
+            return std::make_pair(true, t);
+        }
+        ++m_burst_periods;
+    }
+
+    const uint64_t samples = frames * channel_count();
+    dest.resize(samples);
+    if (m_converter) {
+        m_converter->convert(frame_data(m_position), samples, dest.data());
+    } else {
+        std::memcpy(dest.data(), frame_data(m_position), samples * sizeof(float));
+    }
+    m_position += frames;
+    return std::make_pair(true, t);
+}
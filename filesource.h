@@ -0,0 +1,98 @@
+#ifndef FILESOURCE_H
+#define FILESOURCE_H
+
+#include <QFile>
+#include <QTimer>
+
+#include "engine.h"
+
+
+class FileSource: public VirtualAudioSource
+{
+    Q_OBJECT
+public:
+    static constexpr uint32_t DEFAULT_PERIOD_FRAMES = 4096;
+    // number of periods read back-to-back before returning to the event loop
+    // when not paced
+    static constexpr uint32_t UNPACED_BURST_PERIODS = 16;
+
+public:
+    // WAV and RF64 files, format detected from the header
+    explicit FileSource(const QString &path,
+                        QObject *parent = nullptr);
+    // headerless interleaved little-endian PCM
+    FileSource(const QString &path,
+               const QAudioFormat &raw_format,
+               QObject *parent = nullptr);
+    ~FileSource() override;
+
+private:
+    QFile m_file;
+    uchar *m_map;
+    const unsigned char *m_data;
+    uint64_t m_frames;
+    uint32_t m_bytes_per_frame;
+
+    QAudioFormat m_format;
+    std::unique_ptr<AbstractSampleConverter> m_converter;
+
+    bool m_paced;
+    uint32_t m_period_frames;
+    std::unique_ptr<QTimer> m_timer;
+
+    uint64_t m_position;
+    global_clock::time_point m_t0;
+    uint64_t m_t0_frame;
+    uint32_t m_burst_periods;
+    bool m_eos_emitted;
+
+private:
+    void map_file();
+    void parse_riff_header();
+    void set_format(const QAudioFormat &format);
+
+public:
+    // when paced (the default), samples are handed out following the wall
+    // clock; otherwise as fast as the pipe takes them
+    void set_paced(bool paced);
+    void set_period_frames(uint32_t frames);
+
+    inline uint64_t frame_count() const
+    {
+        return m_frames;
+    }
+
+    inline const QAudioFormat &format() const
+    {
+        return m_format;
+    }
+
+    inline uint32_t bytes_per_frame() const
+    {
+        return m_bytes_per_frame;
+    }
+
+    // raw, still encoded frames straight from the mapping
+    inline const unsigned char *frame_data(uint64_t frame) const
+    {
+        return m_data + frame * m_bytes_per_frame;
+    }
+
+    // VirtualAudioSource interface
+public:
+    uint32_t channel_count() const override;
+    uint32_t sample_rate() const override;
+    bool is_seekable() const override;
+    bool seek(const uint64_t to_frame) override;
+    uint64_t tell() const override;
+    bool is_realtime() const override;
+
+    void start() override;
+    void stop() override;
+
+    std::pair<bool, global_clock::time_point> read_samples(
+            std::vector<float> &dest) override;
+
+};
+
+#endif // FILESOURCE_H
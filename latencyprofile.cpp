@@ -0,0 +1,34 @@
+#include "latencyprofile.h"
+
+#include <stdexcept>
+
+
+const char *latency_profile_name(LatencyProfile profile)
+{
+    switch (profile) {
+    case LatencyProfile::STANDARD:
+        return "Standard";
+    case LatencyProfile::BALANCED:
+        return "Balanced";
+    case LatencyProfile::LOW:
+        return "Low";
+    case LatencyProfile::MINIMAL:
+        return "Minimal";
+    }
+    throw std::logic_error("unknown latency profile");
+}
+
+LatencySettings latency_settings(LatencyProfile profile)
+{
+    switch (profile) {
+    case LatencyProfile::STANDARD:
+        return LatencySettings{1000, 1000, 500, 1000, 0, false};
+    case LatencyProfile::BALANCED:
+        return LatencySettings{100, 400, 200, 100, 20, true};
+    case LatencyProfile::LOW:
+        return LatencySettings{20, 160, 60, 20, 5, true};
+    case LatencyProfile::MINIMAL:
+        return LatencySettings{5, 80, 20, 5, 2, true};
+    }
+    throw std::logic_error("unknown latency profile");
+}
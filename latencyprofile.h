@@ -0,0 +1,45 @@
+#ifndef LATENCYPROFILE_H
+#define LATENCYPROFILE_H
+
+#include <cstdint>
+
+
+// How far behind the source the output, and thus every view, runs. STANDARD
+// is what the engine always used; the others trade safety margin for
+// latency and let the output buffer grow on underruns.
+enum class LatencyProfile
+{
+    STANDARD,
+    BALANCED,
+    LOW,
+    MINIMAL
+};
+
+static constexpr LatencyProfile LATENCY_PROFILES[] = {
+    LatencyProfile::STANDARD,
+    LatencyProfile::BALANCED,
+    LatencyProfile::LOW,
+    LatencyProfile::MINIMAL
+};
+
+struct LatencySettings
+{
+    // device buffer of the output at start
+    uint32_t buffer_msecs;
+    // bound for growing the device buffer on underruns
+    uint32_t max_buffer_msecs;
+    // backlog in front of the device beyond which it is dropped
+    uint32_t drop_msecs;
+    // lead over the wall clock of sources without an output device
+    uint32_t null_latency_msecs;
+    // capture buffer of audio inputs, 0 for the default of the device
+    uint32_t input_buffer_msecs;
+    // whether underruns grow the device buffer
+    bool adaptive;
+};
+
+const char *latency_profile_name(LatencyProfile profile);
+
+LatencySettings latency_settings(LatencyProfile profile);
+
+#endif // LATENCYPROFILE_H
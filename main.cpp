@@ -1,10 +1,69 @@
 #include "mainwindow.h"
 #include <QApplication>
+#include <QDir>
 #include <QSurfaceFormat>
 #include <QResource>
 #include <QFile>
+#include <QStandardPaths>
 
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "batch.h"
 #include "engine.h"
+#include "metrics.h"
+#include "peakdetector.h"
+#include "threadpolicy.h"
+
+static std::string fft_wisdom_path()
+{
+    const QString cache_dir = QStandardPaths::writableLocation(
+                QStandardPaths::CacheLocation);
+    QDir().mkpath(cache_dir);
+    return QDir(cache_dir).filePath("fftwf-wisdom").toStdString();
+}
+
+// SIGALYZE_METRICS=<path> enables the metrics exporter
+static std::unique_ptr<MetricsExporter> make_metrics_exporter()
+{
+    const char *path = std::getenv("SIGALYZE_METRICS");
+    if (!path || !*path) {
+        return nullptr;
+    }
+    return std::make_unique<MetricsExporter>(path);
+}
+
+// SIGALYZE_RT=<policies> sets the thread policies (see ThreadPolicies::parse),
+// SIGALYZE_MLOCK=1 locks the process memory
+static bool configure_realtime()
+{
+    const char *spec = std::getenv("SIGALYZE_RT");
+    if (spec && *spec) {
+        try {
+            ThreadPolicies::global().parse(spec);
+        } catch (const std::invalid_argument &exc) {
+            std::cerr << "invalid SIGALYZE_RT: " << exc.what() << std::endl;
+            return false;
+        }
+    }
+    const char *mlock = std::getenv("SIGALYZE_MLOCK");
+    if (mlock && std::strcmp(mlock, "1") == 0) {
+        // not fatal, the pipeline still works, only less predictably
+        lock_process_memory();
+    }
+    return true;
+}
+
+static bool has_argument(int argc, char *argv[], const char *arg)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], arg) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
 int main(int argc, char *argv[])
 {
@@ -13,6 +72,27 @@ int main(int argc, char *argv[])
     qRegisterMetaType<RMSBlock>("RMSBlock");
     qRegisterMetaType<std::shared_ptr<const RealFFTBlock> >("std::shared_ptr<const RealFFTBlock>");
     qRegisterMetaType<RealFFTBlock>("RealFFTBlock");
+    qRegisterMetaType<std::shared_ptr<const PeakListBlock> >("std::shared_ptr<const PeakListBlock>");
+
+    QThread::currentThread()->setObjectName("sigalyze [main]");
+
+    if (!configure_realtime()) {
+        return 2;
+    }
+
+    if (has_argument(argc, argv, "--batch")) {
+        QCoreApplication a(argc, argv);
+
+        const std::string wisdom_path = fft_wisdom_path();
+        load_fft_wisdom(wisdom_path);
+        int result;
+        {
+            const std::unique_ptr<MetricsExporter> exporter = make_metrics_exporter();
+            result = run_batch(a);
+        }
+        save_fft_wisdom(wisdom_path);
+        return result;
+    }
 
     QSurfaceFormat fmt;
     fmt.setAlphaBufferSize(8);
@@ -22,12 +102,20 @@ int main(int argc, char *argv[])
     fmt.setSamples(2);
     QSurfaceFormat::setDefaultFormat(fmt);
 
-    QThread::currentThread()->setObjectName("sigalyze [main]");
-
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
 
+    const std::string wisdom_path = fft_wisdom_path();
+    load_fft_wisdom(wisdom_path);
+
+    int result;
+    {
+        const std::unique_ptr<MetricsExporter> exporter = make_metrics_exporter();
+        MainWindow w;
+        w.show();
+
+        result = a.exec();
+    }
 
-    return a.exec();
+    save_fft_wisdom(wisdom_path);
+    return result;
 }
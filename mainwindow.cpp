@@ -2,13 +2,22 @@
 
 #include "mainwindow.h"
 
+#include <cmath>
 #include <iostream>
+#include <limits>
 
+#include <QActionGroup>
+#include <QApplication>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
 #include <QPaintEvent>
 #include <QPainter>
+#include <QScreen>
 #include <QVector2D>
 
+#include "dsp.h"
+
 
 
 template <typename T>
@@ -63,6 +72,16 @@ public:
 
 
 
+static std::size_t view_pixel_width(const QWidget *widget)
+{
+    return std::max<std::size_t>(
+                1, std::lround(widget->width() * widget->devicePixelRatioF()));
+}
+
+// marks that no history level has been drawn completely yet
+static constexpr uint32_t NO_LEVEL = std::numeric_limits<uint32_t>::max();
+
+
 float VisualisationContext::map_db(float dB) const
 {
     return std::min(std::max((dB - dB_min) / (dB_max - dB_min), 0.f), 1.f);
@@ -77,25 +96,38 @@ RMSWidget::RMSWidget(const Engine &engine,
     QWidget(parent),
     m_engine(engine),
     m_context(context),
-    m_queue(32)
+    m_source(Engine::PRIMARY_SOURCE),
+    m_queue(32, "view.rms"),
+    m_render_delay(MetricsRegistry::global().histogram("view.rms.render_delay_usecs"))
 {
     setMinimumWidth(128);
 }
 
-void RMSWidget::push_value(RMSBlock data)
+void RMSWidget::push_value(std::shared_ptr<const RMSBlock> data)
 {
+    // the meter shows the first window of the processor only
+    if (data->window != 0) {
+        return;
+    }
     m_queue.push_block(std::move(data));
-    update();
 }
 
 void RMSWidget::paintEvent(QPaintEvent*)
 {
-    if (m_engine.is_running()) {
-        m_queue.fetch_up_to(m_engine.sink_time(), OverrideIterator<RMSBlock>(&m_most_recent));
+    if (m_engine.is_running(m_source)) {
+        const RMSBlock *previous = m_most_recent.get();
+        m_queue.fetch_up_to(m_engine.sink_time(m_source), OverrideIterator<std::shared_ptr<const RMSBlock> >(&m_most_recent));
+        if (m_most_recent && m_most_recent.get() != previous) {
+            m_render_delay.record_since(m_most_recent->published);
+        }
     }
 
-    const float curr_db = m_context.map_db(20*std::log10(m_most_recent.curr));
-    const float peak_db = m_context.map_db(20*std::log10(m_most_recent.recent_peak));
+    if (!m_most_recent) {
+        return;
+    }
+
+    const float curr_db = m_context.map_db(20*std::log10(m_most_recent->curr));
+    const float peak_db = m_context.map_db(20*std::log10(m_most_recent->recent_peak));
 
     QPainter painter(this);
     painter.setRenderHint(QPainter::Antialiasing);
@@ -117,16 +149,17 @@ FFTWidget::FFTWidget(const Engine &engine,
     QOpenGLWidget(parent),
     m_engine(engine),
     m_context(context),
-    m_queue(128),
+    m_source(Engine::PRIMARY_SOURCE),
+    m_queue(128, "view.fft"),
+    m_render_delay(MetricsRegistry::global().histogram("view.fft.render_delay_usecs")),
     m_data(QOpenGLTexture::Target1D)
 {
     setMinimumHeight(250);
 }
 
-void FFTWidget::push_value(RealFFTBlock data)
+void FFTWidget::push_value(std::shared_ptr<const RealFFTBlock> data)
 {
     m_queue.push_block(std::move(data));
-    update();
 }
 
 void FFTWidget::initializeGL()
@@ -170,8 +203,12 @@ void FFTWidget::initializeGL()
 
 void FFTWidget::paintGL()
 {
-    if (m_engine.is_running()) {
-        m_queue.fetch_up_to(m_engine.sink_time(), OverrideIterator<RealFFTBlock>(&m_most_recent));
+    if (m_engine.is_running(m_source)) {
+        const RealFFTBlock *previous = m_most_recent.get();
+        m_queue.fetch_up_to(m_engine.sink_time(m_source), OverrideIterator<std::shared_ptr<const RealFFTBlock> >(&m_most_recent));
+        if (m_most_recent && m_most_recent.get() != previous) {
+            m_render_delay.record_since(m_most_recent->published);
+        }
     }
 
     glDisable(GL_DEPTH_TEST);
@@ -183,28 +220,32 @@ void FFTWidget::paintGL()
     m_shader.setUniformValue("dB_min", m_context.dB_min);
     m_shader.setUniformValue("dB_max", m_context.dB_max);
 
-    if (m_data.textureId() == 0 && m_most_recent.fft.size() != 0) {
-        m_data.create();
-        m_data.bind();
-        m_data.setSize(m_most_recent.fft.size());
-        m_data.setFormat(QOpenGLTexture::R32F);
-        m_data.allocateStorage();
-        m_data.setMagnificationFilter(QOpenGLTexture::Linear);
-        m_data.setMinificationFilter(QOpenGLTexture::Linear);
-    }
+    if (m_most_recent && m_most_recent->fft.size() != 0) {
+        // only upload the pyramid level matching the viewport, so that
+        // narrow peaks survive instead of being skipped by the filtering
+        const std::vector<float> &fft = m_most_recent->fft;
+        const std::size_t n = max_hold_decimate(fft.data(), fft.size(),
+                                                view_pixel_width(this),
+                                                m_decimated);
+        if (m_data.textureId() != 0 && (std::size_t)m_data.width() != n) {
+            m_data.destroy();
+        }
+        if (m_data.textureId() == 0) {
+            m_data.create();
+            m_data.bind();
+            m_data.setSize(n);
+            m_data.setFormat(QOpenGLTexture::R16F);
+            m_data.allocateStorage();
+            m_data.setMagnificationFilter(QOpenGLTexture::Linear);
+            m_data.setMinificationFilter(QOpenGLTexture::Linear);
+        }
 
-    if (m_data.textureId() != 0) {
+        m_db_buffer.resize(n);
+        magnitudes_to_db_half(m_decimated.data(), m_db_buffer.data(), n);
         m_data.bind();
-
-        m_buffer.clear();
-        m_buffer.reserve(m_most_recent.fft.size());
-        std::copy(m_most_recent.fft.begin(),
-                  m_most_recent.fft.end(),
-                  std::back_inserter(m_buffer));
-
-        glTexSubImage1D(GL_TEXTURE_1D, 0, 0, m_buffer.size(),
-                        GL_RED, GL_FLOAT,
-                        m_buffer.data());
+        glTexSubImage1D(GL_TEXTURE_1D, 0, 0, n,
+                        GL_RED, GL_HALF_FLOAT,
+                        m_db_buffer.data());
     }
 
 
@@ -220,53 +261,322 @@ WaterfallWidget::WaterfallWidget(const Engine &engine,
     QOpenGLWidget(parent),
     m_engine(engine),
     m_context(context),
-    m_queue(64),
+    m_source(Engine::PRIMARY_SOURCE),
+    m_queue(64, "view.waterfall"),
+    m_render_delay(MetricsRegistry::global().histogram("view.waterfall.render_delay_usecs")),
     m_data(QOpenGLTexture::Target2DArray),
-    m_last_block_rows(0)
+    m_colormap(QOpenGLTexture::Target1D),
+    m_uploaded_colormap(context.colormap),
+    m_head_layer(0),
+    m_layers_used(0),
+    m_last_block_rows(0),
+    m_tiles(QOpenGLTexture::Target2DArray),
+    m_frame_clock(0),
+    m_view_end(0),
+    m_frames_per_row(1),
+    m_bin_begin(0),
+    m_bin_end(1),
+    m_drawn_time_level(NO_LEVEL),
+    m_drawn_freq_level(NO_LEVEL)
 {
     setSizePolicy(QSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding));
     sizePolicy().setHorizontalStretch(1);
     sizePolicy().setVerticalStretch(1);
-    m_free_layers.reserve(MAX_LAYERS);
-    for (int32_t i = MAX_LAYERS-1; i >= 0; --i) {
-        m_free_layers.emplace_back(i);
-    }
+}
+
+WaterfallWidget::~WaterfallWidget()
+{
+    makeCurrent();
+    m_upload.destroy();
+    m_tiles.destroy();
+    m_tile_vao.destroy();
+    m_tile_geometry.destroy();
+    doneCurrent();
 }
 
 void WaterfallWidget::append_block()
 {
-    if (m_blocks.size() == MAX_LAYERS) {
-        m_free_layers.push_back(m_blocks.front().layer);
-        m_blocks.erase(m_blocks.begin());
+    if (m_layers_used > 0) {
+        m_head_layer = (m_head_layer + 1) % MAX_LAYERS;
     }
-
-    m_blocks.emplace_back();
-    m_blocks.back().layer = m_free_layers.back();
-    m_free_layers.erase(m_free_layers.end()-1);
+    m_layers_used = std::min(m_layers_used + 1, MAX_LAYERS);
     m_last_block_rows = 0;
 }
 
-void WaterfallWidget::append_row(const std::vector<float> &data)
+void WaterfallWidget::upload_colormap()
 {
-    if (m_blocks.empty() or m_last_block_rows == ROWS_PER_LAYER) {
-        append_block();
+    const std::vector<uint8_t> lut = make_colormap(m_context.colormap);
+    if (m_colormap.textureId() == 0) {
+        m_colormap.create();
+        m_colormap.bind(1);
+        m_colormap.setSize(lut.size() / 3);
+        m_colormap.setFormat(QOpenGLTexture::RGB8_UNorm);
+        m_colormap.allocateStorage();
+        m_colormap.setWrapMode(QOpenGLTexture::ClampToEdge);
+        m_colormap.setMagnificationFilter(QOpenGLTexture::Linear);
+        m_colormap.setMinificationFilter(QOpenGLTexture::Linear);
     }
-    const BlockPlacement &last = m_blocks.back();
-    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
-                    0, m_last_block_rows, last.layer,
-                    data.size(), 1, 1,
-                    GL_RED,
-                    GL_FLOAT,
-                    data.data());
-    m_last_block_rows += 1;
+    m_colormap.setData(QOpenGLTexture::RGB, QOpenGLTexture::UInt8, lut.data());
+    m_uploaded_colormap = m_context.colormap;
 }
 
-void WaterfallWidget::push_value(RealFFTBlock data)
+void WaterfallWidget::upload_rows(const std::shared_ptr<const RealFFTBlock> *rows,
+                                  std::size_t count)
 {
-    m_queue.push_block(std::move(data));
+    const uint32_t width = m_data.width();
+    const std::size_t row_size = width * sizeof(uint16_t);
+    // unused columns are padded with the dB floor
+    const float zero = 0;
+    uint16_t db_floor;
+    magnitudes_to_db_half(&zero, &db_floor, 1);
+
+    uint16_t *dest = static_cast<uint16_t*>(m_upload.map(count * row_size));
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::vector<float> &fft = rows[i]->fft;
+        const std::size_t n = std::min<std::size_t>(
+                    max_hold_decimate(fft.data(), fft.size(),
+                                      view_pixel_width(this), m_decimated),
+                    width);
+        magnitudes_to_db_half(m_decimated.data(), dest, n);
+        std::fill(dest + n, dest + width, db_floor);
+        dest += width;
+    }
+    const unsigned char *src = m_upload.unmap();
+
+    // rows are packed, and the width is usually odd
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+
+    // one upload per run of rows which ends up in the same layer
+    while (count > 0) {
+        if (m_layers_used == 0 || m_last_block_rows == ROWS_PER_LAYER) {
+            append_block();
+        }
+        const uint32_t span = std::min<std::size_t>(
+                    ROWS_PER_LAYER - m_last_block_rows, count);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+                        0, m_last_block_rows, m_head_layer,
+                        width, span, 1,
+                        GL_RED,
+                        GL_HALF_FLOAT,
+                        src);
+        m_last_block_rows += span;
+        src += span * row_size;
+        count -= span;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    m_upload.release();
+}
+
+void WaterfallWidget::clamp_view()
+{
+    const double frames = m_history->frame_count();
+    const double rows = std::max(1, height());
+    const double bins = m_history->bins();
+    const double width = std::max(1, this->width());
+
+    // from 16 pixels per frame to the whole recording in one row, and the
+    // same for the bins
+    m_frames_per_row = std::min(std::max(m_frames_per_row, 1. / 16), frames);
+    m_view_end = std::min(std::max(m_view_end, std::min(frames, rows * m_frames_per_row)),
+                          frames);
+    const double span = std::min(std::max(m_bin_end - m_bin_begin,
+                                          std::min(bins, width / 16)),
+                                 bins);
+    m_bin_begin = std::min(std::max(m_bin_begin, 0.), bins - span);
+    m_bin_end = m_bin_begin + span;
+}
+
+std::vector<WaterfallTileKey> WaterfallWidget::visible_tiles(uint32_t time_level,
+                                                             uint32_t freq_level) const
+{
+    const double tile_frames = (double)((uint64_t)WaterfallHistory::TILE_ROWS << time_level);
+    const double tile_bins = (double)((uint64_t)WaterfallHistory::TILE_COLUMNS << freq_level);
+    const double first_frame = std::max(0., m_view_end - height() * m_frames_per_row);
+    const uint64_t row_begin = first_frame / tile_frames;
+    const uint64_t row_end = std::ceil(m_view_end / tile_frames);
+    const uint32_t column_begin = m_bin_begin / tile_bins;
+    const uint32_t column_end = std::ceil(m_bin_end / tile_bins);
+
+    // the newest first, they are at the bottom where the eye starts
+    std::vector<WaterfallTileKey> keys;
+    for (uint64_t row = row_end; row-- > row_begin;) {
+        for (uint32_t column = column_begin; column < column_end; ++column) {
+            keys.emplace_back(WaterfallTileKey{time_level, freq_level, row, column});
+        }
+    }
+    return keys;
+}
+
+bool WaterfallWidget::make_resident(const std::vector<WaterfallTileKey> &keys,
+                                    uint32_t &uploads)
+{
+    bool complete = true;
+    for (const WaterfallTileKey &key: keys) {
+        auto iter = m_tile_layers.find(key);
+        if (iter != m_tile_layers.end()) {
+            m_layer_used[iter->second] = m_frame_clock;
+            continue;
+        }
+        if (uploads >= MAX_TILE_UPLOADS) {
+            complete = false;
+            continue;
+        }
+        const std::shared_ptr<const WaterfallTile> tile = m_history->find(key);
+        if (!tile) {
+            complete = false;
+            continue;
+        }
+
+        // the least recently drawn layer, but never one of this frame
+        auto victim = std::min_element(m_layer_used.begin(), m_layer_used.end());
+        if (*victim == m_frame_clock) {
+            complete = false;
+            continue;
+        }
+        const uint32_t layer = victim - m_layer_used.begin();
+        if (*victim != 0) {
+            m_tile_layers.erase(m_layer_keys[layer]);
+        }
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0,
+                        0, 0, layer,
+                        WaterfallHistory::TILE_COLUMNS, WaterfallHistory::TILE_ROWS, 1,
+                        GL_RED,
+                        GL_FLOAT,
+                        tile->db.data());
+        m_layer_used[layer] = m_frame_clock;
+        m_layer_keys[layer] = key;
+        m_tile_layers[key] = layer;
+        ++uploads;
+    }
+    return complete;
+}
+
+void WaterfallWidget::draw_tiles(const std::vector<WaterfallTileKey> &keys)
+{
+    const double span = m_bin_end - m_bin_begin;
+    for (const WaterfallTileKey &key: keys) {
+        auto iter = m_tile_layers.find(key);
+        if (iter == m_tile_layers.end()) {
+            continue;
+        }
+        const double tile_frames = (double)((uint64_t)WaterfallHistory::TILE_ROWS << key.time_level);
+        const double tile_bins = (double)((uint64_t)WaterfallHistory::TILE_COLUMNS << key.freq_level);
+        const double tile_end = (key.row + 1) * tile_frames;
+        const double left = -1 + 2 * (key.column * tile_bins - m_bin_begin) / span;
+        const double right = left + 2 * tile_bins / span;
+
+        m_shader.setUniformValue("row_scale", (float)(tile_frames / m_frames_per_row));
+        m_shader.setUniformValue("offset", (float)((m_view_end - tile_end) / m_frames_per_row));
+        m_shader.setUniformValue("x_transform",
+                                 QVector2D((right - left) / 2, (right + left) / 2));
+        m_shader.setUniformValue("layer", (int)iter->second);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+}
+
+void WaterfallWidget::paint_history()
+{
+    clamp_view();
+    ++m_frame_clock;
+    if (m_tiles.textureId() == 0) {
+        m_tiles.create();
+        m_tiles.bind(0);
+        m_tiles.setSize(WaterfallHistory::TILE_COLUMNS, WaterfallHistory::TILE_ROWS);
+        m_tiles.setLayers(HISTORY_LAYERS);
+        m_tiles.setFormat(QOpenGLTexture::R16F);
+        m_tiles.allocateStorage();
+        m_tiles.setWrapMode(QOpenGLTexture::ClampToEdge);
+        m_tiles.setMagnificationFilter(QOpenGLTexture::Linear);
+        m_tiles.setMinificationFilter(QOpenGLTexture::Linear);
+        m_layer_used.assign(HISTORY_LAYERS, 0);
+        m_layer_keys.resize(HISTORY_LAYERS);
+        m_tile_layers.clear();
+    }
+    m_tiles.bind(0);
+
+    // rows are only ever magnified, which bounds the tiles in view; columns
+    // may be minified by two, which the shader takes care of like for the
+    // live rows
+    const double bins_per_column = (m_bin_end - m_bin_begin) / view_pixel_width(this);
+    const uint32_t time_level = std::min<double>(
+                m_history->time_levels() - 1,
+                std::max(0., std::ceil(std::log2(m_frames_per_row))));
+    const uint32_t freq_level = std::min<double>(
+                m_history->freq_levels() - 1,
+                std::max(0., std::floor(std::log2(bins_per_column))));
+    const std::vector<WaterfallTileKey> wanted = visible_tiles(time_level, freq_level);
+
+    uint32_t uploads = 0;
+    const bool complete = make_resident(wanted, uploads);
+    std::vector<WaterfallTileKey> missing;
+    for (const WaterfallTileKey &key: wanted) {
+        if (m_tile_layers.count(key) == 0 && !m_history->find(key)) {
+            missing.push_back(key);
+        }
+    }
+    m_history->request(missing);
+
+    m_tile_vao.bind();
+    if (!complete && m_drawn_time_level != NO_LEVEL &&
+            (m_drawn_time_level != time_level || m_drawn_freq_level != freq_level))
+    {
+        // keep showing the levels drawn last, stretched to the view, below
+        // what is there already of the new ones
+        const std::vector<WaterfallTileKey> previous =
+                visible_tiles(m_drawn_time_level, m_drawn_freq_level);
+        make_resident(previous, uploads);
+        draw_tiles(previous);
+    }
+    draw_tiles(wanted);
+
+    if (complete) {
+        m_drawn_time_level = time_level;
+        m_drawn_freq_level = freq_level;
+    } else if (uploads >= MAX_TILE_UPLOADS) {
+        // more is cached than could be uploaded in this frame
+        update();
+    }
+}
+
+void WaterfallWidget::open_history(const QString &path)
+{
+    auto history = std::make_unique<WaterfallHistory>(path);
+    connect(history.get(), &WaterfallHistory::tile_ready,
+            this, [this](){ update(); },
+            Qt::QueuedConnection);
+
+    close_history();
+    m_history = std::move(history);
+    m_view_end = m_history->frame_count();
+    m_frames_per_row = m_view_end / std::max(1, height());
+    m_bin_begin = 0;
+    m_bin_end = m_history->bins();
+    m_drawn_time_level = NO_LEVEL;
+    m_drawn_freq_level = NO_LEVEL;
     update();
 }
 
+void WaterfallWidget::close_history()
+{
+    if (!m_history) {
+        return;
+    }
+    makeCurrent();
+    m_tiles.destroy();
+    doneCurrent();
+    m_tile_layers.clear();
+    m_layer_used.clear();
+    m_layer_keys.clear();
+    m_history = nullptr;
+    update();
+}
+
+void WaterfallWidget::push_value(std::shared_ptr<const RealFFTBlock> data)
+{
+    m_queue.push_block(std::move(data));
+}
+
 void WaterfallWidget::initializeGL()
 {
     if (!m_shader.addShaderFromSourceFile(QOpenGLShader::Vertex,
@@ -302,8 +612,36 @@ void WaterfallWidget::initializeGL()
     m_shader.setAttributeBuffer(attr_loc, GL_FLOAT, sizeof(QVector2D), 2, sizeof(Vertex));
 
     m_shader.setUniformValue("data", 0);
+    m_shader.setUniformValue("colormap", 1);
 
     m_vao.release();
+
+    // history tiles are stretched to their place by the transform uniforms
+    static const Vertex tile_data[] = {
+        {QVector2D(-1, 1), QVector2D(0, 0)},
+        {QVector2D(-1, 0), QVector2D(0, 1)},
+        {QVector2D(1, 1), QVector2D(1, 0)},
+        {QVector2D(1, 0), QVector2D(1, 1)},
+    };
+
+    m_tile_vao.create();
+    m_tile_vao.bind();
+
+    m_tile_geometry.create();
+    m_tile_geometry.bind();
+    m_tile_geometry.allocate(tile_data, sizeof(tile_data));
+
+    attr_loc = m_shader.attributeLocation("position");
+    m_shader.enableAttributeArray(attr_loc);
+    m_shader.setAttributeBuffer(attr_loc, GL_FLOAT, 0, 2, sizeof(Vertex));
+
+    attr_loc = m_shader.attributeLocation("tc0");
+    m_shader.enableAttributeArray(attr_loc);
+    m_shader.setAttributeBuffer(attr_loc, GL_FLOAT, sizeof(QVector2D), 2, sizeof(Vertex));
+
+    m_tile_vao.release();
+
+    upload_colormap();
 }
 
 void WaterfallWidget::paintGL()
@@ -311,32 +649,52 @@ void WaterfallWidget::paintGL()
     glDisable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
 
-    if (m_engine.is_running()) {
-        m_queue.fetch_up_to(m_engine.sink_time(),
+    if (m_uploaded_colormap != m_context.colormap) {
+        upload_colormap();
+    }
+    m_colormap.bind(1);
+
+    if (m_engine.is_running(m_source)) {
+        m_queue.fetch_up_to(m_engine.sink_time(m_source),
                             std::back_inserter(m_most_recent));
-        if (m_most_recent.size() > 0 and m_data.textureId() == 0) {
-            m_data.create();
-            m_data.bind();
-            m_data.setSize(
-                        m_most_recent[0].fft.size(),
-                    ROWS_PER_LAYER);
-            m_data.setLayers(MAX_LAYERS);
-            m_data.setFormat(QOpenGLTexture::R32F);
-            m_data.allocateStorage();
-            m_data.setMagnificationFilter(QOpenGLTexture::Linear);
-            m_data.setMinificationFilter(QOpenGLTexture::Linear);
-        } else if (m_data.textureId() != 0) {
-            m_data.bind();
+        if (m_most_recent.size() > 0) {
+            // rows are decimated to the viewport; a different level means
+            // starting over
+            const std::size_t width = max_hold_decimated_size(
+                        m_most_recent[0]->fft.size(),
+                        view_pixel_width(this));
+            if (m_data.textureId() != 0 && (std::size_t)m_data.width() != width) {
+                m_data.destroy();
+                m_upload.destroy();
+                m_layers_used = 0;
+                m_head_layer = 0;
+                m_last_block_rows = 0;
+            }
+            if (m_data.textureId() == 0) {
+                m_data.create();
+                m_data.bind(0);
+                m_data.setSize(width, ROWS_PER_LAYER);
+                m_data.setLayers(MAX_LAYERS);
+                m_data.setFormat(QOpenGLTexture::R16F);
+                m_data.allocateStorage();
+                m_data.setMagnificationFilter(QOpenGLTexture::Linear);
+                m_data.setMinificationFilter(QOpenGLTexture::Linear);
+                m_upload.create(UPLOAD_ROWS * width * sizeof(uint16_t));
+            }
+        }
+        if (m_data.textureId() != 0) {
+            m_data.bind(0);
+        }
+        for (const auto &block: m_most_recent) {
+            m_render_delay.record_since(block->published);
         }
-        for (const RealFFTBlock &row: m_most_recent) {
-            m_buffer.clear();
-            m_buffer.reserve(row.fft.size());
-            std::copy(row.fft.begin(),
-                      row.fft.end(),
-                      std::back_inserter(m_buffer));
-            append_row(m_buffer);
+        for (std::size_t i = 0; i < m_most_recent.size(); i += UPLOAD_ROWS) {
+            upload_rows(&m_most_recent[i],
+                        std::min<std::size_t>(UPLOAD_ROWS, m_most_recent.size() - i));
         }
         m_most_recent.clear();
+    } else if (m_data.textureId() != 0) {
+        m_data.bind(0);
     }
 
     m_shader.setUniformValue("dB_min", m_context.dB_min);
@@ -346,21 +704,65 @@ void WaterfallWidget::paintGL()
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     m_shader.bind();
-    m_vao.bind();
+    if (m_history) {
+        paint_history();
+        return;
+    }
 
+    m_vao.bind();
+    m_shader.setUniformValue("row_scale", 1.f);
+    m_shader.setUniformValue("x_transform", QVector2D(1, 0));
     float offset = (int32_t)m_last_block_rows - (int32_t)ROWS_PER_LAYER;
-    for (auto iter = m_blocks.crbegin();
-         iter != m_blocks.crend();
-         ++iter)
-    {
+    for (uint32_t i = 0; i < m_layers_used; ++i) {
+        const int layer = (m_head_layer + MAX_LAYERS - i) % MAX_LAYERS;
         m_shader.setUniformValue("offset", offset);
-        m_shader.setUniformValue("layer", iter->layer);
+        m_shader.setUniformValue("layer", layer);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
         offset += ROWS_PER_LAYER;
     }
 
 }
 
+void WaterfallWidget::wheelEvent(QWheelEvent *ev)
+{
+    if (!m_history) {
+        QOpenGLWidget::wheelEvent(ev);
+        return;
+    }
+
+    static constexpr double ZOOM_STEP = 1.25;
+    // in wheel steps of 15 degrees
+    const double steps_y = ev->angleDelta().y() / 120.;
+    const double steps_x = ev->angleDelta().x() / 120.;
+    const double rows = height();
+    const double span = m_bin_end - m_bin_begin;
+
+    if (ev->modifiers() & Qt::ControlModifier) {
+        // the frame under the cursor stays where it is
+        const double y = rows - ev->pos().y();
+        const double frame = m_view_end - y * m_frames_per_row;
+        m_frames_per_row *= std::pow(ZOOM_STEP, -steps_y);
+        m_frames_per_row = std::max(m_frames_per_row, 1. / 16);
+        m_view_end = frame + y * m_frames_per_row;
+    } else if (ev->modifiers() & Qt::ShiftModifier) {
+        // some platforms turn Shift+wheel into horizontal scrolling
+        const double steps = steps_y != 0 ? steps_y : steps_x;
+        const double x = (double)ev->pos().x() / std::max(1, width());
+        const double bin = m_bin_begin + x * span;
+        const double new_span = span * std::pow(ZOOM_STEP, -steps);
+        m_bin_begin = bin - x * new_span;
+        m_bin_end = m_bin_begin + new_span;
+    } else {
+        // a step moves a tenth of the view; up goes back in time
+        m_view_end -= steps_y * rows * m_frames_per_row / 10;
+        m_bin_begin -= steps_x * span / 10;
+        m_bin_end -= steps_x * span / 10;
+    }
+    clamp_view();
+    update();
+    ev->accept();
+}
+
 void WaterfallWidget::resizeGL(int w, int h)
 {
     QMatrix4x4 mat;
@@ -378,36 +780,123 @@ void WaterfallWidget::resizeGL(int w, int h)
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     m_latency_label(nullptr),
-    m_rms_calc(m_engine),
-    m_fft_calc(m_engine, 4096, 25)
+    m_view_source(Engine::PRIMARY_SOURCE),
+    m_source_menu(nullptr),
+    m_source_group(nullptr),
+    m_render_scheduler(m_engine)
 {
     ui.setupUi(this);
     m_engine.set_output_device(QAudioDeviceInfo::defaultOutputDevice());
     m_context.dB_min = -192;
     m_context.dB_max = 0;
+    m_context.colormap = Colormap::CUBEHELIX;
     m_stats_timer = startTimer(1000);
 
     m_latency_label = new QLabel(this);
     ui.statusBar->addPermanentWidget(m_latency_label);
 
     m_rms = new RMSWidget(m_engine, m_context, this);
-    connect(&m_rms_calc.processor(), &RMSProcessor::result_available,
-            m_rms, &RMSWidget::push_value,
-            Qt::QueuedConnection);
     ui.statusBar->addPermanentWidget(m_rms);
-
     m_fft = new FFTWidget(m_engine, m_context, this);
-    connect(&m_fft_calc.processor(), &FFTProcessor::result_available,
-            m_fft, &FFTWidget::push_value,
-            Qt::QueuedConnection);
-
     m_waterfall = new WaterfallWidget(m_engine, m_context, this);
-    connect(&m_fft_calc.processor(), &FFTProcessor::result_available,
-            m_waterfall, &WaterfallWidget::push_value,
-            Qt::QueuedConnection);
+    show_source(Engine::PRIMARY_SOURCE);
 
     centralWidget()->layout()->addWidget(m_waterfall);
     centralWidget()->layout()->addWidget(m_fft);
+
+    m_render_scheduler.add_view(m_rms);
+    m_render_scheduler.add_view(m_fft);
+    m_render_scheduler.add_view(m_waterfall);
+    if (QScreen *screen = QApplication::primaryScreen()) {
+        m_render_scheduler.set_refresh_rate(screen->refreshRate());
+    }
+
+    QMenu *view_menu = ui.menuBar->addMenu("&View");
+    QMenu *colormap_menu = view_menu->addMenu("&Colormap");
+    QActionGroup *colormap_group = new QActionGroup(this);
+    for (const Colormap map: COLORMAPS) {
+        QAction *action = colormap_menu->addAction(colormap_name(map));
+        action->setCheckable(true);
+        action->setChecked(map == m_context.colormap);
+        colormap_group->addAction(action);
+        connect(action, &QAction::triggered,
+                this, [this, map](){
+                    m_context.colormap = map;
+                    m_waterfall->update();
+                });
+    }
+
+    QMenu *latency_menu = view_menu->addMenu("&Latency");
+    QActionGroup *latency_group = new QActionGroup(this);
+    for (const LatencyProfile profile: LATENCY_PROFILES) {
+        QAction *action = latency_menu->addAction(latency_profile_name(profile));
+        action->setCheckable(true);
+        action->setChecked(profile == m_engine.latency_profile());
+        latency_group->addAction(action);
+        connect(action, &QAction::triggered,
+                this, [this, profile](){ set_latency_profile(profile); });
+    }
+
+    m_source_menu = view_menu->addMenu("&Source");
+    m_source_group = new QActionGroup(this);
+    add_source_action(Engine::PRIMARY_SOURCE, "Primary");
+}
+
+void MainWindow::show_source(uint32_t source)
+{
+    // the processors follow a single stream, so they are set up anew
+    m_rms_calc = nullptr;
+    m_fft_calc = nullptr;
+    m_rms_calc = std::make_unique<RootMeanSquare>(m_engine.stream(source));
+    m_fft_calc = std::make_unique<FFT>(m_engine.stream(source), 4096, 25);
+    connect(&m_rms_calc->processor(), &RMSProcessor::result_available,
+            m_rms, &RMSWidget::push_value,
+            Qt::DirectConnection);
+    connect(&m_fft_calc->processor(), &FFTProcessor::result_available,
+            m_fft, &FFTWidget::push_value,
+            Qt::DirectConnection);
+    connect(&m_fft_calc->processor(), &FFTProcessor::result_available,
+            m_waterfall, &WaterfallWidget::push_value,
+            Qt::DirectConnection);
+
+    m_view_source = source;
+    m_rms->set_source(source);
+    m_fft->set_source(source);
+    m_waterfall->set_source(source);
+}
+
+void MainWindow::add_source_action(uint32_t source, const QString &name)
+{
+    QAction *action = m_source_menu->addAction(QString("%1: %2").arg(source).arg(name));
+    action->setCheckable(true);
+    action->setChecked(source == m_view_source);
+    m_source_group->addAction(action);
+    connect(action, &QAction::triggered,
+            this, [this, source](){ show_source(source); });
+}
+
+void MainWindow::add_source(std::unique_ptr<VirtualAudioSource> &&source,
+                            const QString &name)
+{
+    const uint32_t id = m_engine.add_source(std::move(source));
+    if (!m_engine.is_running()) {
+        m_engine.start();
+    }
+    add_source_action(id, name);
+}
+
+void MainWindow::set_latency_profile(LatencyProfile profile)
+{
+    // the pipes are rebuilt with the new settings; audio inputs keep their
+    // capture buffer until they are opened again
+    const bool was_running = m_engine.is_running();
+    if (was_running) {
+        m_engine.stop();
+    }
+    m_engine.set_latency_profile(profile);
+    if (was_running) {
+        m_engine.start();
+    }
 }
 
 void MainWindow::on_action_open_audio_device_triggered()
@@ -423,17 +912,108 @@ void MainWindow::on_action_open_audio_device_triggered()
     m_engine.set_source(std::make_unique<AudioInputSource>(
                             m_audio_device_dialog.device(),
                             m_audio_device_dialog.format(),
-                            0.001));
+                            0.001,
+                            latency_settings(m_engine.latency_profile()).input_buffer_msecs));
     m_engine.start();
     m_context.dB_min = -std::log10(2ULL << (uint64_t)m_audio_device_dialog.format().sampleSize())*20;
 }
 
+void MainWindow::on_action_open_file_triggered()
+{
+    const QString path = QFileDialog::getOpenFileName(
+                this, "Open audio file", QString(),
+                "WAV files (*.wav *.rf64);;All files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    std::unique_ptr<FileSource> source;
+    try {
+        source = std::make_unique<FileSource>(path);
+    } catch (const std::runtime_error &exc) {
+        QMessageBox::critical(this, "Failed to open file",
+                              QString::fromStdString(exc.what()),
+                              QMessageBox::Ok, QMessageBox::NoButton);
+        return;
+    }
+
+    if (m_engine.is_running()) {
+        m_engine.stop();
+    }
+    const int sample_size = source->format().sampleSize();
+    m_engine.set_source(std::move(source));
+    m_engine.start();
+    m_context.dB_min = -std::log10(2ULL << (uint64_t)sample_size)*20;
+}
+
+void MainWindow::on_action_add_audio_device_triggered()
+{
+    m_audio_device_dialog.refresh();
+    if (m_audio_device_dialog.exec() != QDialog::Accepted) {
+        return;
+    }
+
+    add_source(std::make_unique<AudioInputSource>(
+                   m_audio_device_dialog.device(),
+                   m_audio_device_dialog.format(),
+                   0.001,
+                   latency_settings(m_engine.latency_profile()).input_buffer_msecs),
+               m_audio_device_dialog.device().deviceName());
+}
+
+void MainWindow::on_action_add_file_triggered()
+{
+    const QString path = QFileDialog::getOpenFileName(
+                this, "Add audio file", QString(),
+                "WAV files (*.wav *.rf64);;All files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    std::unique_ptr<FileSource> source;
+    try {
+        source = std::make_unique<FileSource>(path);
+    } catch (const std::runtime_error &exc) {
+        QMessageBox::critical(this, "Failed to open file",
+                              QString::fromStdString(exc.what()),
+                              QMessageBox::Ok, QMessageBox::NoButton);
+        return;
+    }
+    add_source(std::move(source), QFileInfo(path).fileName());
+}
+
+void MainWindow::on_action_open_spectrogram_triggered()
+{
+    const QString path = QFileDialog::getOpenFileName(
+                this, "Open spectrogram", QString(),
+                "Spectrograms (*.sgspec);;All files (*)");
+    if (path.isEmpty()) {
+        return;
+    }
+
+    try {
+        m_waterfall->open_history(path);
+    } catch (const std::exception &exc) {
+        QMessageBox::critical(this, "Failed to open spectrogram",
+                              QString::fromStdString(exc.what()),
+                              QMessageBox::Ok, QMessageBox::NoButton);
+    }
+}
+
+void MainWindow::on_action_show_live_triggered()
+{
+    m_waterfall->close_history();
+}
+
 void MainWindow::timerEvent(QTimerEvent *ev)
 {
     if (ev->timerId() == m_stats_timer) {
-        if (m_engine.is_running()) {
+        if (m_engine.is_running(Engine::PRIMARY_SOURCE)) {
+            const uint64_t dropped = m_rms->dropped_blocks() +
+                    m_fft->dropped_blocks() +
+                    m_waterfall->dropped_blocks();
             m_latency_label->setText(
-                        QString("Output latency: %1 ms").arg(std::chrono::duration_cast<std::chrono::duration<float, std::ratio<1, 1000> > >(global_clock::now() - m_engine.sink_time()).count())
+                        QString("Output latency: %1 ms, dropped: %2").arg(std::chrono::duration_cast<std::chrono::duration<float, std::ratio<1, 1000> > >(global_clock::now() - m_engine.sink_time()).count()).arg(dropped)
                         );
         } else {
             m_latency_label->setText("idle");
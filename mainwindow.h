@@ -3,6 +3,7 @@
 
 #include "ui_mainwindow.h"
 
+#include <QActionGroup>
 #include <QProgressBar>
 #include <QOpenGLWidget>
 #include <QOpenGLShaderProgram>
@@ -12,13 +13,19 @@
 
 #include "openaudiodevicedialog.h"
 
+#include "colormap.h"
 #include "engine.h"
+#include "filesource.h"
+#include "pixelupload.h"
+#include "renderscheduler.h"
+#include "waterfallhistory.h"
 
 
 struct VisualisationContext
 {
     float dB_min;
     float dB_max;
+    Colormap colormap;
 
     float map_db(float dB) const;
 };
@@ -36,11 +43,28 @@ public:
 private:
     const Engine &m_engine;
     const VisualisationContext &m_context;
-    TimedDataQueue<RMSBlock> m_queue;
-    RMSBlock m_most_recent;
+    uint32_t m_source;
+    TimedDataQueue<std::shared_ptr<const RMSBlock> > m_queue;
+    std::shared_ptr<const RMSBlock> m_most_recent;
+    LatencyHistogram &m_render_delay;
+
+public:
+    inline uint64_t dropped_blocks() const
+    {
+        return m_queue.dropped_full() + m_queue.dropped_overflow();
+    }
+
+    // the blocks are shown following the output clock of this source of
+    // the engine, the primary one by default
+    inline void set_source(uint32_t source)
+    {
+        m_source = source;
+    }
 
 public slots:
-    void push_value(RMSBlock data);
+    // may be called from one producer thread; the view is repainted by the
+    // RenderScheduler
+    void push_value(std::shared_ptr<const RMSBlock> data);
 
     // QWidget interface
 protected:
@@ -61,9 +85,12 @@ public:
 private:
     const Engine &m_engine;
     const VisualisationContext &m_context;
-    TimedDataQueue<RealFFTBlock> m_queue;
-    RealFFTBlock m_most_recent;
-    std::vector<float> m_buffer;
+    uint32_t m_source;
+    TimedDataQueue<std::shared_ptr<const RealFFTBlock> > m_queue;
+    std::shared_ptr<const RealFFTBlock> m_most_recent;
+    LatencyHistogram &m_render_delay;
+    std::vector<float> m_decimated;
+    std::vector<uint16_t> m_db_buffer;
 
     QOpenGLShaderProgram m_shader;
     QOpenGLBuffer m_geometry;
@@ -75,8 +102,23 @@ private:
         QVector2D tc;
     };
 
+public:
+    inline uint64_t dropped_blocks() const
+    {
+        return m_queue.dropped_full() + m_queue.dropped_overflow();
+    }
+
+    // the blocks are shown following the output clock of this source of
+    // the engine, the primary one by default
+    inline void set_source(uint32_t source)
+    {
+        m_source = source;
+    }
+
 public slots:
-    void push_value(RealFFTBlock data);
+    // may be called from one producer thread; the view is repainted by the
+    // RenderScheduler
+    void push_value(std::shared_ptr<const RealFFTBlock> data);
 
 protected:
     void initializeGL() override;
@@ -85,6 +127,11 @@ protected:
 };
 
 
+// Shows the live FFT frames as they are played back, or a recorded
+// spectrogram opened with open_history. The history is drawn from tiles of
+// a WaterfallHistory, of which at most HISTORY_LAYERS are kept on the GPU;
+// the wheel scrolls through time, with Ctrl it zooms in time and with Shift
+// in frequency, and horizontal scrolling pans in frequency.
 class WaterfallWidget: public QOpenGLWidget
 {
     Q_OBJECT
@@ -94,49 +141,112 @@ public:
     static constexpr uint32_t MAX_LAYERS = MAX_SIMULTANOUS_ROWS / ROWS_PER_LAYER;
     static_assert(MAX_LAYERS * ROWS_PER_LAYER == MAX_SIMULTANOUS_ROWS,
                   "invalid values for ROWS_PER_LAYER and MAX_SIMULTANOUS_ROWS");
+    // rows staged per upload segment
+    static constexpr uint32_t UPLOAD_ROWS = 32;
+    // 256 kB each; enough for the tiles of a 4k view plus some slack
+    static constexpr uint32_t HISTORY_LAYERS = 192;
+    // tile uploads per frame, so that a big jump does not stall the view
+    static constexpr uint32_t MAX_TILE_UPLOADS = 8;
 
 public:
     explicit WaterfallWidget(
             const Engine &engine,
             const VisualisationContext &context,
             QWidget *parent = nullptr);
+    ~WaterfallWidget() override;
 
 private:
     const Engine &m_engine;
     const VisualisationContext &m_context;
-    TimedDataQueue<RealFFTBlock> m_queue;
-    std::vector<float> m_buffer;
-    std::vector<RealFFTBlock> m_most_recent;
+    uint32_t m_source;
+    TimedDataQueue<std::shared_ptr<const RealFFTBlock> > m_queue;
+    std::vector<std::shared_ptr<const RealFFTBlock> > m_most_recent;
+    LatencyHistogram &m_render_delay;
+    std::vector<float> m_decimated;
 
     QOpenGLShaderProgram m_shader;
     QOpenGLBuffer m_geometry;
     QOpenGLVertexArrayObject m_vao;
     QOpenGLTexture m_data;
+    QOpenGLTexture m_colormap;
+    Colormap m_uploaded_colormap;
 
     struct Vertex {
         QVector2D pos;
         QVector2D tc;
     };
 
-    struct BlockPlacement {
-        int layer;
-    };
+    PixelUploadRing m_upload;
 
-    std::vector<BlockPlacement> m_blocks;
-    std::vector<int> m_free_layers;
+    // layers are used round-robin; m_head_layer is the one being filled
+    uint32_t m_head_layer;
+    uint32_t m_layers_used;
     uint32_t m_last_block_rows;
 
+    std::unique_ptr<WaterfallHistory> m_history;
+    QOpenGLTexture m_tiles;
+    // layer of each tile resident in m_tiles
+    std::map<WaterfallTileKey, uint32_t> m_tile_layers;
+    // per layer: the frame it was last drawn in, 0 if free
+    std::vector<uint64_t> m_layer_used;
+    std::vector<WaterfallTileKey> m_layer_keys;
+    uint64_t m_frame_clock;
+    // the view into the history: the frame boundary at the bottom edge and
+    // the frames per pixel row, the bins at the left and right edges
+    double m_view_end;
+    double m_frames_per_row;
+    double m_bin_begin;
+    double m_bin_end;
+    // the levels last drawn completely, drawn while those asked for load
+    uint32_t m_drawn_time_level;
+    uint32_t m_drawn_freq_level;
+    QOpenGLBuffer m_tile_geometry;
+    QOpenGLVertexArrayObject m_tile_vao;
+
 private:
     void append_block();
-    void append_row(const std::vector<float> &data);
+    void upload_colormap();
+    void upload_rows(const std::shared_ptr<const RealFFTBlock> *rows,
+                     std::size_t count);
+    void clamp_view();
+    std::vector<WaterfallTileKey> visible_tiles(uint32_t time_level,
+                                                uint32_t freq_level) const;
+    // uploads up to the upload budget of the tiles which are cached but
+    // not resident; true if all of them are resident afterwards
+    bool make_resident(const std::vector<WaterfallTileKey> &keys,
+                       uint32_t &uploads);
+    void draw_tiles(const std::vector<WaterfallTileKey> &keys);
+    void paint_history();
+
+public:
+    inline uint64_t dropped_blocks() const
+    {
+        return m_queue.dropped_full() + m_queue.dropped_overflow();
+    }
+
+    // the blocks are shown following the output clock of this source of
+    // the engine, the primary one by default
+    inline void set_source(uint32_t source)
+    {
+        m_source = source;
+    }
+
+    // shows the spectrogram file at path instead of the live frames, all
+    // of it at first; throws if it cannot be read
+    void open_history(const QString &path);
+    // back to the live frames
+    void close_history();
 
 public slots:
-    void push_value(RealFFTBlock data);
+    // may be called from one producer thread; the view is repainted by the
+    // RenderScheduler
+    void push_value(std::shared_ptr<const RealFFTBlock> data);
 
 protected:
     void initializeGL() override;
     void paintGL() override;
     void resizeGL(int w, int h) override;
+    void wheelEvent(QWheelEvent *ev) override;
 
 };
 
@@ -159,13 +269,32 @@ private:
     VisualisationContext m_context;
     OpenAudioDeviceDialog m_audio_device_dialog;
 
-    RootMeanSquare m_rms_calc;
-    FFT m_fft_calc;
+    // the views show the source m_view_source, which the processors follow
+    std::unique_ptr<RootMeanSquare> m_rms_calc;
+    std::unique_ptr<FFT> m_fft_calc;
+    uint32_t m_view_source;
+    QMenu *m_source_menu;
+    QActionGroup *m_source_group;
+
+    RenderScheduler m_render_scheduler;
 
     int m_stats_timer;
 
+private:
+    void set_latency_profile(LatencyProfile profile);
+    void show_source(uint32_t source);
+    void add_source_action(uint32_t source, const QString &name);
+    // runs source next to the others, starting the engine if needed
+    void add_source(std::unique_ptr<VirtualAudioSource> &&source,
+                    const QString &name);
+
 private slots:
+    void on_action_open_file_triggered();
     void on_action_open_audio_device_triggered();
+    void on_action_add_audio_device_triggered();
+    void on_action_add_file_triggered();
+    void on_action_open_spectrogram_triggered();
+    void on_action_show_live_triggered();
 
 
     // QObject interface
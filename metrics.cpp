@@ -0,0 +1,197 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+
+/* HistogramSnapshot */
+
+uint64_t HistogramSnapshot::percentile(double q) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    const uint64_t rank = std::max<uint64_t>(1, std::ceil(q * count));
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(LatencyHistogram::bucket_upper_bound(i), max);
+        }
+    }
+    return max;
+}
+
+double HistogramSnapshot::mean() const
+{
+    if (count == 0) {
+        return 0.;
+    }
+    return (double)sum / count;
+}
+
+
+/* LatencyHistogram */
+
+LatencyHistogram::LatencyHistogram():
+    m_sum(0),
+    m_max(0)
+{
+    for (auto &bucket: m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+unsigned int LatencyHistogram::bucket_of(uint64_t usecs)
+{
+    if (usecs < SUB_BUCKETS) {
+        return usecs;
+    }
+    unsigned int exponent = 63 - __builtin_clzll(usecs);
+    if (exponent > MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    const unsigned int sub = (usecs >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::bucket_upper_bound(unsigned int bucket)
+{
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    const unsigned int exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    const uint64_t sub = bucket % SUB_BUCKETS;
+    const unsigned int shift = exponent - SUB_BUCKET_BITS;
+    return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record_usecs(int64_t usecs)
+{
+    const uint64_t value = std::max<int64_t>(0, usecs);
+    m_buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t prev_max = m_max.load(std::memory_order_relaxed);
+    while (prev_max < value &&
+           !m_max.compare_exchange_weak(prev_max, value, std::memory_order_relaxed))
+    {
+
+    }
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const
+{
+    // not atomic as a whole; concurrent records may make count and the
+    // buckets disagree slightly
+    HistogramSnapshot result;
+    result.buckets.resize(BUCKETS);
+    result.count = 0;
+    for (unsigned int i = 0; i < BUCKETS; ++i) {
+        result.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        result.count += result.buckets[i];
+    }
+    result.sum = m_sum.load(std::memory_order_relaxed);
+    result.max = m_max.load(std::memory_order_relaxed);
+    return result;
+}
+
+
+/* MetricsRegistry */
+
+MetricsRegistry &MetricsRegistry::global()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+template <typename metric_t>
+static metric_t &find_or_create(
+        std::map<std::string, std::unique_ptr<metric_t> > &metrics,
+        const std::string &name)
+{
+    std::unique_ptr<metric_t> &slot = metrics[name];
+    if (!slot) {
+        slot = std::make_unique<metric_t>();
+    }
+    return *slot;
+}
+
+MetricCounter &MetricsRegistry::counter(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return find_or_create(m_counters, name);
+}
+
+MetricGauge &MetricsRegistry::gauge(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return find_or_create(m_gauges, name);
+}
+
+LatencyHistogram &MetricsRegistry::histogram(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return find_or_create(m_histograms, name);
+}
+
+void MetricsRegistry::write_text(std::ostream &out) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto &entry: m_counters) {
+        out << entry.first << ' ' << entry.second->value() << '\n';
+    }
+    for (const auto &entry: m_gauges) {
+        out << entry.first << ' ' << entry.second->value() << '\n';
+    }
+    for (const auto &entry: m_histograms) {
+        const HistogramSnapshot snapshot = entry.second->snapshot();
+        out << entry.first
+            << " count=" << snapshot.count
+            << " mean=" << (uint64_t)snapshot.mean()
+            << " p50=" << snapshot.percentile(0.5)
+            << " p90=" << snapshot.percentile(0.9)
+            << " p99=" << snapshot.percentile(0.99)
+            << " max=" << snapshot.max << '\n';
+    }
+}
+
+
+/* MetricsExporter */
+
+MetricsExporter::MetricsExporter(const std::string &path,
+                                 int interval_msec,
+                                 const MetricsRegistry &registry,
+                                 QObject *parent):
+    QObject(parent),
+    m_path(path),
+    m_registry(registry)
+{
+    connect(&m_timer, &QTimer::timeout,
+            this, &MetricsExporter::write);
+    m_timer.start(interval_msec);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    write();
+}
+
+void MetricsExporter::write()
+{
+    // readers never see a half-written file
+    const std::string tmp_path = m_path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        m_registry.write_text(out);
+        if (!out.good()) {
+            std::cerr << "failed to write metrics to " << tmp_path << std::endl;
+            return;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+        std::cerr << "failed to replace " << m_path << std::endl;
+    }
+}
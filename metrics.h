@@ -0,0 +1,202 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <QObject>
+#include <QTimer>
+
+
+class MetricCounter
+{
+public:
+    MetricCounter():
+        m_value(0)
+    {
+
+    }
+
+    MetricCounter(const MetricCounter &other) = delete;
+    MetricCounter &operator=(const MetricCounter &other) = delete;
+
+private:
+    std::atomic<uint64_t> m_value;
+
+public:
+    inline void add(uint64_t n = 1)
+    {
+        m_value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline uint64_t value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+};
+
+
+class MetricGauge
+{
+public:
+    MetricGauge():
+        m_value(0)
+    {
+
+    }
+
+    MetricGauge(const MetricGauge &other) = delete;
+    MetricGauge &operator=(const MetricGauge &other) = delete;
+
+private:
+    std::atomic<int64_t> m_value;
+
+public:
+    inline void set(int64_t value)
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    inline int64_t value() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+
+};
+
+
+struct HistogramSnapshot
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    std::vector<uint64_t> buckets;
+
+    // upper bound of the bucket holding the q-quantile, 0 <= q <= 1
+    uint64_t percentile(double q) const;
+    double mean() const;
+};
+
+
+// Log-linear histogram of microsecond durations in the style of HDR
+// histograms: every power of two is split into SUB_BUCKETS linear buckets,
+// which bounds the relative error to 1/SUB_BUCKETS. Values below
+// SUB_BUCKETS are exact and values beyond 2^MAX_EXPONENT usecs end up in the
+// last bucket. Recording is wait-free and may happen from any thread.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned int SUB_BUCKET_BITS = 3;
+    static constexpr unsigned int SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr unsigned int MAX_EXPONENT = 36;
+    static constexpr unsigned int BUCKETS =
+            (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+public:
+    LatencyHistogram();
+    LatencyHistogram(const LatencyHistogram &other) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &other) = delete;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+
+public:
+    static unsigned int bucket_of(uint64_t usecs);
+    // largest value which still falls into bucket
+    static uint64_t bucket_upper_bound(unsigned int bucket);
+
+    void record_usecs(int64_t usecs);
+
+    template <typename duration_t>
+    inline void record(const duration_t &duration)
+    {
+        record_usecs(std::chrono::duration_cast<std::chrono::microseconds>(
+                         duration).count());
+    }
+
+    template <typename time_point_t>
+    inline void record_since(const time_point_t &start)
+    {
+        record(time_point_t::clock::now() - start);
+    }
+
+    HistogramSnapshot snapshot() const;
+
+};
+
+
+// Process-wide set of named metrics. Looking a metric up takes a lock and
+// is meant to happen once, when a component is constructed; the returned
+// references stay valid until the process exits and updating them is
+// lock-free. Asking twice for the same name returns the same metric, so
+// parallel instances of a component share their metrics.
+class MetricsRegistry
+{
+public:
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry &other) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &other) = delete;
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::unique_ptr<MetricCounter> > m_counters;
+    std::map<std::string, std::unique_ptr<MetricGauge> > m_gauges;
+    std::map<std::string, std::unique_ptr<LatencyHistogram> > m_histograms;
+
+public:
+    static MetricsRegistry &global();
+
+    MetricCounter &counter(const std::string &name);
+    MetricGauge &gauge(const std::string &name);
+    LatencyHistogram &histogram(const std::string &name);
+
+    // one line per metric, sorted by name:
+    //   <name> <value>                      for counters and gauges
+    //   <name> count=.. mean=.. p50=.. p90=.. p99=.. max=..  for histograms,
+    //                                       all times in usecs
+    void write_text(std::ostream &out) const;
+
+};
+
+
+// Periodically replaces the file at path with the text form of the
+// registry, and once more when destroyed.
+class MetricsExporter: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr int DEFAULT_INTERVAL_MSEC = 1000;
+
+public:
+    MetricsExporter() = delete;
+    explicit MetricsExporter(const std::string &path,
+                             int interval_msec = DEFAULT_INTERVAL_MSEC,
+                             const MetricsRegistry &registry = MetricsRegistry::global(),
+                             QObject *parent = nullptr);
+    MetricsExporter(const MetricsExporter &other) = delete;
+    MetricsExporter(MetricsExporter &&src) = delete;
+    MetricsExporter &operator=(const MetricsExporter &other) = delete;
+    MetricsExporter &operator=(MetricsExporter &&src) = delete;
+    ~MetricsExporter() override;
+
+private:
+    const std::string m_path;
+    const MetricsRegistry &m_registry;
+    QTimer m_timer;
+
+public slots:
+    void write();
+
+};
+
+#endif // METRICS_H
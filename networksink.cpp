@@ -0,0 +1,467 @@
+#include "networksink.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+
+#include <QElapsedTimer>
+#include <QtEndian>
+
+#include "dsp.h"
+#include "threadpolicy.h"
+
+
+static const char MESSAGE_MAGIC[4] = {'S', 'G', 'N', '1'};
+static constexpr std::size_t MESSAGE_HEADER_SIZE = 12;
+// how long closing the sink waits for clients to take what was sent
+static constexpr int CLOSE_TIMEOUT_MSEC = 1000;
+
+template <typename T>
+static inline void append_le(std::vector<char> &dest, T value)
+{
+    value = qToLittleEndian(value);
+    const char *bytes = reinterpret_cast<const char*>(&value);
+    dest.insert(dest.end(), bytes, bytes + sizeof(T));
+}
+
+static inline void append_le(std::vector<char> &dest, float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    append_le(dest, bits);
+}
+
+template <typename T>
+static inline void patch_le(std::vector<char> &dest, std::size_t offset, T value)
+{
+    value = qToLittleEndian(value);
+    std::memcpy(&dest[offset], &value, sizeof(T));
+}
+
+static inline int64_t clock_usecs(const global_clock::time_point &t)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                t.time_since_epoch()).count();
+}
+
+// appends a message header and returns its offset for finish_message
+static std::size_t begin_message(std::vector<char> &dest,
+                                 NetworkMessageType type,
+                                 uint16_t stream)
+{
+    const std::size_t start = dest.size();
+    dest.insert(dest.end(), MESSAGE_MAGIC, MESSAGE_MAGIC + sizeof(MESSAGE_MAGIC));
+    append_le(dest, (uint8_t)type);
+    append_le(dest, (uint8_t)0);
+    append_le(dest, stream);
+    append_le(dest, (uint32_t)0);
+    return start;
+}
+
+static void finish_message(std::vector<char> &dest, std::size_t start)
+{
+    patch_le(dest, start + 8, (uint32_t)(dest.size() - start - MESSAGE_HEADER_SIZE));
+}
+
+
+/* NetworkSink::Server */
+
+class NetworkSink::Server: public QObject
+{
+public:
+    explicit Server(NetworkSink &sink);
+
+private:
+    NetworkSink &m_sink;
+    const std::size_t m_max_message_size;
+
+    std::unique_ptr<QTcpServer> m_tcp;
+    // owned by m_tcp
+    std::vector<QTcpSocket*> m_clients;
+    std::unique_ptr<QUdpSocket> m_udp;
+    QHostAddress m_udp_address;
+    std::unique_ptr<QTimer> m_batch_timer;
+    std::unique_ptr<QTimer> m_hello_timer;
+
+    std::vector<std::shared_ptr<const RealFFTBlock> > m_fft_batch;
+    std::vector<std::shared_ptr<const RMSBlock> > m_rms_batch;
+    std::vector<char> m_message;
+    std::vector<float> m_db;
+
+    MetricCounter &m_dropped_messages;
+    MetricCounter &m_sent_bytes;
+    MetricGauge &m_client_count;
+
+private:
+    void accept_clients();
+    void encode_hello();
+    void encode_fft(uint16_t stream);
+    void encode_rms(uint16_t stream);
+    void send(bool to_udp);
+
+public:
+    bool open();
+    void close();
+    void send_batches();
+    void send_hello();
+
+};
+
+NetworkSink::Server::Server(NetworkSink &sink):
+    m_sink(sink),
+    m_max_message_size(sink.m_config.udp_host.isEmpty() ?
+                           MAX_TCP_MESSAGE_SIZE : MAX_DATAGRAM_SIZE),
+    m_dropped_messages(MetricsRegistry::global().counter("net.dropped_messages")),
+    m_sent_bytes(MetricsRegistry::global().counter("net.sent_bytes")),
+    m_client_count(MetricsRegistry::global().gauge("net.clients"))
+{
+
+}
+
+bool NetworkSink::Server::open()
+{
+    const NetworkSinkConfig &config = m_sink.m_config;
+    bool result = true;
+
+    if (config.tcp_port != 0) {
+        m_tcp = std::make_unique<QTcpServer>();
+        connect(m_tcp.get(), &QTcpServer::newConnection,
+                this, [this](){ accept_clients(); });
+        if (!m_tcp->listen(QHostAddress::Any, config.tcp_port)) {
+            std::cerr << "network sink: failed to listen on port "
+                      << config.tcp_port << ": "
+                      << m_tcp->errorString().toStdString() << std::endl;
+            m_tcp = nullptr;
+            result = false;
+        }
+    }
+
+    if (!config.udp_host.isEmpty()) {
+        m_udp_address = QHostAddress(config.udp_host);
+        if (m_udp_address.isNull()) {
+            std::cerr << "network sink: invalid UDP address "
+                      << config.udp_host.toStdString() << std::endl;
+            result = false;
+        } else {
+            m_udp = std::make_unique<QUdpSocket>();
+            m_hello_timer = std::make_unique<QTimer>();
+            m_hello_timer->setInterval(HELLO_INTERVAL_MSEC);
+            connect(m_hello_timer.get(), &QTimer::timeout,
+                    this, [this](){ send_hello(); });
+            m_hello_timer->start();
+        }
+    }
+
+    m_batch_timer = std::make_unique<QTimer>();
+    m_batch_timer->setInterval(std::max<uint32_t>(1, config.batch_msec));
+    connect(m_batch_timer.get(), &QTimer::timeout,
+            this, [this](){ send_batches(); });
+    m_batch_timer->start();
+    return result;
+}
+
+void NetworkSink::Server::close()
+{
+    m_batch_timer = nullptr;
+    m_hello_timer = nullptr;
+
+    QElapsedTimer elapsed;
+    elapsed.start();
+    for (QTcpSocket *client: m_clients) {
+        while (client->bytesToWrite() > 0 &&
+               elapsed.elapsed() < CLOSE_TIMEOUT_MSEC &&
+               client->waitForBytesWritten(CLOSE_TIMEOUT_MSEC - elapsed.elapsed()))
+        {
+        }
+    }
+    m_clients.clear();
+    m_tcp = nullptr;
+    m_udp = nullptr;
+    m_client_count.set(0);
+}
+
+void NetworkSink::Server::accept_clients()
+{
+    while (m_tcp->hasPendingConnections()) {
+        QTcpSocket *client = m_tcp->nextPendingConnection();
+        client->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        connect(client, &QAbstractSocket::disconnected,
+                this, [this, client](){
+                    m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client),
+                                    m_clients.end());
+                    m_client_count.set(m_clients.size());
+                    client->deleteLater();
+                });
+
+        m_message.clear();
+        encode_hello();
+        client->write(m_message.data(), m_message.size());
+        m_clients.push_back(client);
+        m_client_count.set(m_clients.size());
+    }
+}
+
+void NetworkSink::Server::encode_hello()
+{
+    std::lock_guard<std::mutex> lock(m_sink.m_streams_mutex);
+    const std::size_t start = begin_message(m_message, NetworkMessageType::HELLO, 0);
+    append_le(m_message, (uint32_t)(m_sink.m_fft_streams.size() +
+                                    m_sink.m_rms_streams.size()));
+    const auto append_stream = [this](uint16_t id, NetworkMessageType type,
+                                      const QString &name){
+        const QByteArray utf8 = name.toUtf8();
+        const std::size_t size = std::min<std::size_t>(utf8.size(), 255);
+        append_le(m_message, id);
+        append_le(m_message, (uint8_t)type);
+        append_le(m_message, (uint8_t)size);
+        m_message.insert(m_message.end(), utf8.constData(), utf8.constData() + size);
+    };
+    for (const auto &stream: m_sink.m_fft_streams) {
+        append_stream(stream->id, NetworkMessageType::FFT, stream->name);
+    }
+    for (const auto &stream: m_sink.m_rms_streams) {
+        append_stream(stream->id, NetworkMessageType::RMS, stream->name);
+    }
+    finish_message(m_message, start);
+}
+
+void NetworkSink::Server::send_hello()
+{
+    m_message.clear();
+    encode_hello();
+    send(true);
+}
+
+void NetworkSink::Server::send(bool to_udp)
+{
+    if (m_message.empty()) {
+        return;
+    }
+    for (QTcpSocket *client: m_clients) {
+        if (client->bytesToWrite() > MAX_CLIENT_BACKLOG) {
+            m_dropped_messages.add();
+            continue;
+        }
+        client->write(m_message.data(), m_message.size());
+        m_sent_bytes.add(m_message.size());
+    }
+    if (to_udp && m_udp) {
+        if (m_message.size() > MAX_DATAGRAM_SIZE) {
+            m_dropped_messages.add();
+        } else if (m_udp->writeDatagram(m_message.data(), m_message.size(),
+                                        m_udp_address, m_sink.m_config.udp_port) < 0)
+        {
+            // the socket buffer is full or the network is unreachable
+            m_dropped_messages.add();
+        } else {
+            m_sent_bytes.add(m_message.size());
+        }
+    }
+}
+
+void NetworkSink::Server::encode_fft(uint16_t stream)
+{
+    const NetworkSinkConfig &config = m_sink.m_config;
+    const float scale = 255.f / (config.db_max - config.db_min);
+
+    std::size_t i = 0;
+    while (i < m_fft_batch.size()) {
+        const RealFFTBlock &first = *m_fft_batch[i];
+        const uint32_t bins = first.fft.size();
+
+        m_message.clear();
+        const std::size_t start = begin_message(m_message, NetworkMessageType::FFT, stream);
+        append_le(m_message, clock_usecs(first.t));
+        append_le(m_message, first.fmin);
+        append_le(m_message, first.fmax);
+        append_le(m_message, config.db_min);
+        append_le(m_message, config.db_max);
+        append_le(m_message, bins);
+        const std::size_t frames_offset = m_message.size();
+        append_le(m_message, (uint32_t)0);
+
+        uint32_t frames = 0;
+        int64_t prev_t = clock_usecs(first.t);
+        for (; i < m_fft_batch.size(); ++i) {
+            const RealFFTBlock &frame = *m_fft_batch[i];
+            const int64_t t = clock_usecs(frame.t);
+            const int64_t dt = t - prev_t;
+            const bool same_shape = frame.fft.size() == bins &&
+                    frame.fmin == first.fmin && frame.fmax == first.fmax;
+            const bool fits = m_message.size() + sizeof(uint32_t) + bins <=
+                    m_max_message_size;
+            if (frames > 0 && (!same_shape || !fits || dt < 0 ||
+                               dt > std::numeric_limits<uint32_t>::max()))
+            {
+                break;
+            }
+
+            append_le(m_message, (uint32_t)dt);
+            m_db.resize(bins);
+            magnitudes_to_db(frame.fft.data(), m_db.data(), bins);
+            const std::size_t offset = m_message.size();
+            m_message.resize(offset + bins);
+            quantize_u8(m_db.data(), reinterpret_cast<uint8_t*>(&m_message[offset]),
+                        bins, config.db_min, scale);
+            prev_t = t;
+            ++frames;
+        }
+        patch_le(m_message, frames_offset, frames);
+        finish_message(m_message, start);
+        send(true);
+    }
+}
+
+void NetworkSink::Server::encode_rms(uint16_t stream)
+{
+    static constexpr std::size_t RECORD_SIZE = 16;
+
+    std::size_t i = 0;
+    while (i < m_rms_batch.size()) {
+        m_message.clear();
+        const std::size_t start = begin_message(m_message, NetworkMessageType::RMS, stream);
+        int64_t prev_t = clock_usecs(m_rms_batch[i]->t);
+        append_le(m_message, prev_t);
+        const std::size_t records_offset = m_message.size();
+        append_le(m_message, (uint32_t)0);
+
+        uint32_t records = 0;
+        for (; i < m_rms_batch.size(); ++i) {
+            const RMSBlock &block = *m_rms_batch[i];
+            const int64_t t = clock_usecs(block.t);
+            const int64_t dt = t - prev_t;
+            if (records > 0 && (m_message.size() + RECORD_SIZE > m_max_message_size ||
+                                dt < 0 || dt > std::numeric_limits<uint32_t>::max()))
+            {
+                break;
+            }
+            append_le(m_message, (uint32_t)dt);
+            append_le(m_message, (uint16_t)block.window);
+            append_le(m_message, (uint16_t)0);
+            append_le(m_message, block.curr);
+            append_le(m_message, block.recent_peak);
+            prev_t = t;
+            ++records;
+        }
+        patch_le(m_message, records_offset, records);
+        finish_message(m_message, start);
+        send(true);
+    }
+}
+
+void NetworkSink::Server::send_batches()
+{
+    std::vector<FFTStream*> fft_streams;
+    std::vector<RMSStream*> rms_streams;
+    {
+        std::lock_guard<std::mutex> lock(m_sink.m_streams_mutex);
+        for (const auto &stream: m_sink.m_fft_streams) {
+            fft_streams.push_back(stream.get());
+        }
+        for (const auto &stream: m_sink.m_rms_streams) {
+            rms_streams.push_back(stream.get());
+        }
+    }
+
+    // the queues are drained even without listeners, so that nothing stale
+    // goes out when one connects
+    const bool listening = !m_clients.empty() || m_udp;
+    for (FFTStream *stream: fft_streams) {
+        m_fft_batch.clear();
+        stream->queue.fetch_up_to(global_clock::time_point::max(),
+                                  std::back_inserter(m_fft_batch));
+        if (listening) {
+            encode_fft(stream->id);
+        }
+    }
+    for (RMSStream *stream: rms_streams) {
+        m_rms_batch.clear();
+        stream->queue.fetch_up_to(global_clock::time_point::max(),
+                                  std::back_inserter(m_rms_batch));
+        if (listening) {
+            encode_rms(stream->id);
+        }
+    }
+    m_fft_batch.clear();
+    m_rms_batch.clear();
+}
+
+
+/* NetworkSink */
+
+const NetworkSinkConfig NetworkSink::DEFAULT_CONFIG{0, QString(), 0, 50, -160.f, 20.f};
+
+NetworkSink::FFTStream::FFTStream(uint16_t id, const QString &name):
+    id(id),
+    name(name),
+    queue(MAX_QUEUED_FRAMES, "net." + name.toStdString())
+{
+
+}
+
+NetworkSink::RMSStream::RMSStream(uint16_t id, const QString &name):
+    id(id),
+    name(name),
+    queue(MAX_QUEUED_FRAMES, "net." + name.toStdString())
+{
+
+}
+
+NetworkSink::NetworkSink(const NetworkSinkConfig &config):
+    m_config(config),
+    m_next_stream(1),
+    m_server(std::make_unique<Server>(*this)),
+    m_ok(false)
+{
+    if (!(config.db_max > config.db_min)) {
+        throw std::invalid_argument("empty dB range");
+    }
+    setObjectName("NetworkSink");
+    ThreadPolicies::global().attach(*this);
+    start();
+    m_server->moveToThread(this);
+    QMetaObject::invokeMethod(m_server.get(), [this](){ m_ok = m_server->open(); },
+                              Qt::BlockingQueuedConnection);
+}
+
+NetworkSink::~NetworkSink()
+{
+    QMetaObject::invokeMethod(m_server.get(), [this](){ m_server->close(); },
+                              Qt::BlockingQueuedConnection);
+    exit();
+    wait();
+}
+
+NetworkSink::FFTStream &NetworkSink::add_fft_stream(const QString &name)
+{
+    std::lock_guard<std::mutex> lock(m_streams_mutex);
+    m_fft_streams.emplace_back(std::make_unique<FFTStream>(m_next_stream++, name));
+    return *m_fft_streams.back();
+}
+
+void NetworkSink::add_rms_source(const RMSProcessor &source, const QString &name)
+{
+    RMSStream *stream;
+    {
+        std::lock_guard<std::mutex> lock(m_streams_mutex);
+        m_rms_streams.emplace_back(std::make_unique<RMSStream>(m_next_stream++, name));
+        stream = m_rms_streams.back().get();
+    }
+    connect(&source, &RMSProcessor::result_available,
+            this, [stream](std::shared_ptr<const RMSBlock> block){
+                stream->queue.push_block(std::move(block));
+            },
+            Qt::DirectConnection);
+}
+
+bool NetworkSink::ok() const
+{
+    return m_ok;
+}
+
+void NetworkSink::flush()
+{
+    QMetaObject::invokeMethod(m_server.get(), [this](){ m_server->send_batches(); },
+                              Qt::BlockingQueuedConnection);
+}
@@ -0,0 +1,144 @@
+#ifndef NETWORKSINK_H
+#define NETWORKSINK_H
+
+#include <QHostAddress>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUdpSocket>
+
+#include "engine.h"
+
+
+// Wire format of the network sink. All values are little endian.
+//
+//   message header, 12 bytes:
+//     char[4] "SGN1", uint8 type, uint8 reserved, uint16 stream,
+//     uint32 payload size
+//   HELLO payload, sent to each TCP client on connect and to the UDP
+//   destination every HELLO_INTERVAL_MSEC:
+//     uint32 stream count, per stream {uint16 stream, uint8 type,
+//     uint8 name size, name as UTF-8}
+//   FFT payload:
+//     int64 t (usecs on global_clock), float fmin, float fmax, float db_min,
+//     float db_max, uint32 bins, uint32 frames, per frame
+//     {uint32 usecs since the previous frame (0 for the first),
+//      bins uint8 dB quantized linearly between db_min and db_max}
+//   RMS payload:
+//     int64 t (usecs on global_clock), uint32 records, per record
+//     {uint32 usecs since the previous record (0 for the first),
+//      uint16 window index, uint16 reserved, float rms, float peak}
+//
+// A message only holds frames of one shape; over UDP each message is one
+// datagram.
+enum class NetworkMessageType: uint8_t
+{
+    HELLO = 0,
+    FFT = 1,
+    RMS = 2
+};
+
+
+struct NetworkSinkConfig
+{
+    // 0 to not listen for TCP clients
+    uint16_t tcp_port;
+    // empty to not send datagrams
+    QString udp_host;
+    uint16_t udp_port;
+    // frames are collected for this long before they are sent
+    uint32_t batch_msec;
+    float db_min;
+    float db_max;
+};
+
+
+// Streams FFT frames and RMS values to remote clients. Producers only push
+// shared pointers into a bounded queue per stream, so they never wait for the
+// network; a thread of the sink's own encodes the queued frames every
+// batch_msec. A client whose socket has more than MAX_CLIENT_BACKLOG bytes
+// pending misses messages until it catches up, which keeps a slow client from
+// growing the send buffers without bound. Drops are counted in metrics.
+class NetworkSink: public QThread
+{
+    Q_OBJECT
+
+public:
+    static constexpr uint32_t MAX_QUEUED_FRAMES = 256;
+    static constexpr int64_t MAX_CLIENT_BACKLOG = 4 << 20;
+    static constexpr std::size_t MAX_DATAGRAM_SIZE = 65000;
+    static constexpr std::size_t MAX_TCP_MESSAGE_SIZE = 1 << 20;
+    static constexpr int HELLO_INTERVAL_MSEC = 1000;
+    static const NetworkSinkConfig DEFAULT_CONFIG;
+
+public:
+    NetworkSink() = delete;
+    explicit NetworkSink(const NetworkSinkConfig &config = DEFAULT_CONFIG);
+    NetworkSink(const NetworkSink &other) = delete;
+    NetworkSink(NetworkSink &&src) = delete;
+    NetworkSink &operator=(const NetworkSink &other) = delete;
+    NetworkSink &operator=(NetworkSink &&src) = delete;
+    ~NetworkSink() override;
+
+private:
+    struct FFTStream
+    {
+        FFTStream(uint16_t id, const QString &name);
+
+        const uint16_t id;
+        const QString name;
+        TimedDataQueue<std::shared_ptr<const RealFFTBlock> > queue;
+    };
+
+    struct RMSStream
+    {
+        RMSStream(uint16_t id, const QString &name);
+
+        const uint16_t id;
+        const QString name;
+        TimedDataQueue<std::shared_ptr<const RMSBlock> > queue;
+    };
+
+    // lives in the sink thread
+    class Server;
+
+    const NetworkSinkConfig m_config;
+
+    // guards the stream lists; producers keep pointers to their streams
+    std::mutex m_streams_mutex;
+    std::vector<std::unique_ptr<FFTStream> > m_fft_streams;
+    std::vector<std::unique_ptr<RMSStream> > m_rms_streams;
+    uint16_t m_next_stream;
+
+    std::unique_ptr<Server> m_server;
+    bool m_ok;
+
+private:
+    FFTStream &add_fft_stream(const QString &name);
+
+public:
+    // source is anything emitting
+    // result_available(std::shared_ptr<const RealFFTBlock>); it must not
+    // emit after the sink is destroyed
+    template <typename source_t>
+    void add_fft_source(const source_t &source, const QString &name)
+    {
+        FFTStream *stream = &add_fft_stream(name);
+        connect(&source, &source_t::result_available,
+                this, [stream](std::shared_ptr<const RealFFTBlock> block){
+                    stream->queue.push_block(std::move(block));
+                },
+                Qt::DirectConnection);
+    }
+
+    void add_rms_source(const RMSProcessor &source, const QString &name);
+
+    // false if the TCP port could not be bound or the UDP host is invalid
+    bool ok() const;
+
+    // block until everything pushed so far is sent
+    void flush();
+
+};
+
+#endif // NETWORKSINK_H
@@ -0,0 +1,398 @@
+#include "networksource.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+static constexpr std::size_t RTP_HEADER_SIZE = 12;
+
+static inline uint32_t read_be32(const char *src)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(src);
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+            ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+}
+
+// in place, whole samples only
+static void swap_sample_bytes(char *data, std::size_t size, uint32_t bytes_per_sample)
+{
+    char *const end = data + size / bytes_per_sample * bytes_per_sample;
+    for (; data < end; data += bytes_per_sample) {
+        std::reverse(data, data + bytes_per_sample);
+    }
+}
+
+
+/* NetworkSource */
+
+NetworkSource::NetworkSource(const NetworkSourceSpec &spec,
+                             QObject *parent):
+    VirtualAudioSource(parent),
+    m_spec(spec),
+    m_channels(std::max(0, spec.format.channelCount())),
+    m_sample_rate(std::max(0, spec.format.sampleRate())),
+    m_bytes_per_sample(std::max(0, spec.format.sampleSize()) / 8),
+    m_bytes_per_frame(m_bytes_per_sample * m_channels),
+    m_converter(AbstractSampleConverter::make_converter(
+                    spec.format.sampleType(), spec.format.sampleSize())),
+    m_period_frames(DEFAULT_PERIOD_FRAMES),
+    m_jitter_frames(0),
+    m_packet_fill(0),
+    m_ring_frames(0),
+    m_read_frame(0),
+    m_write_frame(0),
+    m_synced(false),
+    m_rtp_ssrc(0),
+    m_rtp_first_timestamp(0),
+    m_rtp_last_frame(0),
+    m_started(false),
+    m_eos_emitted(false),
+    m_late_packets(MetricsRegistry::global().counter(
+                       "netsource." + std::to_string(spec.port) + ".late_packets")),
+    m_overrun_frames(MetricsRegistry::global().counter(
+                         "netsource." + std::to_string(spec.port) + ".overrun_frames")),
+    m_resyncs(MetricsRegistry::global().counter(
+                  "netsource." + std::to_string(spec.port) + ".resyncs")),
+    m_jitter(MetricsRegistry::global().histogram(
+                 "netsource." + std::to_string(spec.port) + ".jitter_usecs"))
+{
+    if (m_sample_rate == 0 || m_channels == 0) {
+        throw std::invalid_argument("network source needs a sample rate and channels");
+    }
+    if (m_spec.transport == NetworkTransport::TCP && m_spec.host.isEmpty()) {
+        throw std::invalid_argument("TCP source needs a host");
+    }
+    allocate_ring();
+    if (m_spec.transport != NetworkTransport::TCP) {
+        bind_udp();
+    }
+}
+
+NetworkSource::~NetworkSource()
+{
+
+}
+
+void NetworkSource::allocate_ring()
+{
+    m_jitter_frames = (int64_t)m_spec.jitter_msec * m_sample_rate / 1000;
+    // room for the jitter window, a few periods of slack for the pipe and
+    // the largest datagram
+    m_ring_frames = m_jitter_frames + 4 * (int64_t)m_period_frames +
+            MAX_DATAGRAM_SIZE / m_bytes_per_frame + 1;
+    m_ring.assign(m_ring_frames * m_channels, 0.f);
+    m_synced = false;
+}
+
+void NetworkSource::bind_udp()
+{
+    // a child, so that it moves along with the source to the pipe's thread
+    m_udp = std::make_unique<QUdpSocket>(this);
+    const QHostAddress address = m_spec.host.isEmpty() ?
+                QHostAddress(QHostAddress::Any) : QHostAddress(m_spec.host);
+    if (!m_udp->bind(address, m_spec.port)) {
+        const std::string error = m_udp->errorString().toStdString();
+        m_udp = nullptr;
+        throw std::runtime_error("failed to bind UDP port " +
+                                 std::to_string(m_spec.port) + ": " + error);
+    }
+}
+
+void NetworkSource::set_period_frames(uint32_t frames)
+{
+    if (m_started) {
+        throw std::logic_error("cannot change the period while running");
+    }
+    if (frames == 0) {
+        throw std::invalid_argument("period must not be empty");
+    }
+    m_period_frames = frames;
+    allocate_ring();
+}
+
+void NetworkSource::resync(int64_t frame)
+{
+    m_read_frame = frame;
+    m_write_frame = frame;
+    m_synced = true;
+}
+
+bool NetworkSource::parse_rtp(const char *&payload, std::size_t &size, int64_t &frame)
+{
+    if (size < RTP_HEADER_SIZE || ((unsigned char)payload[0] >> 6) != 2) {
+        return false;
+    }
+    const unsigned char flags = payload[0];
+    std::size_t header = RTP_HEADER_SIZE + 4 * (flags & 0x0f);
+    if (flags & 0x10) {
+        // header extension: 16 bit profile, 16 bit length in words
+        if (size < header + 4) {
+            return false;
+        }
+        header += 4 + 4 * (read_be32(payload + header) & 0xffff);
+    }
+    std::size_t padding = 0;
+    if (flags & 0x20) {
+        padding = (unsigned char)payload[size - 1];
+    }
+    if (size < header + padding) {
+        return false;
+    }
+
+    const uint32_t timestamp = read_be32(payload + 4);
+    const uint32_t ssrc = read_be32(payload + 8);
+    payload += header;
+    size -= header + padding;
+
+    const int64_t delta = (int32_t)(timestamp - (uint32_t)(m_rtp_first_timestamp +
+                                                           m_rtp_last_frame));
+    if (!m_synced || ssrc != m_rtp_ssrc ||
+            delta > m_ring_frames || delta < -m_ring_frames)
+    {
+        // a new sender or one that restarted; carry on where we are
+        if (m_synced) {
+            m_resyncs.add();
+        }
+        m_rtp_ssrc = ssrc;
+        m_rtp_first_timestamp = timestamp - (uint32_t)m_write_frame;
+        m_synced = false;
+        frame = m_write_frame;
+    } else {
+        frame = m_rtp_last_frame + delta;
+    }
+    m_rtp_last_frame = frame;
+    return true;
+}
+
+void NetworkSource::ingest(const char *payload, std::size_t size, int64_t frame,
+                           const global_clock::time_point &arrival)
+{
+    const int64_t frames = size / m_bytes_per_frame;
+    if (frames == 0) {
+        return;
+    }
+    const bool first = !m_synced;
+    if (first) {
+        resync(frame);
+    }
+
+    const int64_t end = frame + frames;
+    if (end <= m_read_frame) {
+        m_late_packets.add();
+        return;
+    }
+    if (end - m_read_frame > m_ring_frames) {
+        // the pipe does not keep up; the oldest samples go
+        m_overrun_frames.add(end - m_ring_frames - m_read_frame);
+        m_read_frame = end - m_ring_frames;
+    }
+    int64_t begin = frame;
+    if (begin < m_read_frame) {
+        // partly handed out already
+        m_late_packets.add();
+        begin = m_read_frame;
+    }
+
+    // what is still missing in front of the datagram stays silent unless a
+    // reordered datagram fills it in
+    for (int64_t f = std::max(m_write_frame, m_read_frame); f < begin; ) {
+        const int64_t offset = f % m_ring_frames;
+        const int64_t n = std::min(begin - f, m_ring_frames - offset);
+        std::fill_n(&m_ring[offset * m_channels], n * m_channels, 0.f);
+        f += n;
+    }
+
+    const char *src = payload + (begin - frame) * m_bytes_per_frame;
+    for (int64_t f = begin; f < end; ) {
+        const int64_t offset = f % m_ring_frames;
+        const int64_t n = std::min(end - f, m_ring_frames - offset);
+        float *dest = &m_ring[offset * m_channels];
+        if (m_converter) {
+            m_converter->convert(src, n * m_channels, dest);
+        } else {
+            std::memcpy(dest, src, n * m_bytes_per_frame);
+        }
+        src += n * m_bytes_per_frame;
+        f += n;
+    }
+    m_write_frame = std::max(m_write_frame, end);
+
+    // the earliest the stream can have started if the last frame of this
+    // datagram was sent just now
+    const global_clock::time_point candidate = arrival - std::chrono::microseconds(
+                end * 1000000 / m_sample_rate);
+    if (first) {
+        m_t0 = candidate;
+    } else {
+        const global_clock::time_point latest = m_t0 +
+                (arrival - m_last_arrival) * MAX_DRIFT_PPM / 1000000;
+        m_t0 = std::min(candidate, latest);
+    }
+    m_jitter.record(candidate - m_t0);
+    m_last_arrival = arrival;
+}
+
+void NetworkSource::receive_datagrams()
+{
+    const bool big_endian = m_spec.format.byteOrder() == QAudioFormat::BigEndian &&
+            m_bytes_per_sample > 1;
+    while (m_udp->hasPendingDatagrams()) {
+        const int64_t received = m_udp->readDatagram(m_packet.data(), m_packet.size());
+        if (received <= 0) {
+            continue;
+        }
+        const global_clock::time_point arrival = global_clock::now();
+
+        const char *payload = m_packet.data();
+        std::size_t size = received;
+        int64_t frame = m_write_frame;
+        if (m_spec.transport == NetworkTransport::RTP &&
+                !parse_rtp(payload, size, frame))
+        {
+            continue;
+        }
+        if (big_endian) {
+            swap_sample_bytes(m_packet.data() + (payload - m_packet.data()), size,
+                              m_bytes_per_sample);
+        }
+        ingest(payload, size, frame, arrival);
+    }
+    if (m_synced && m_write_frame - m_read_frame >= m_jitter_frames + m_period_frames) {
+        emit samples_ready();
+    }
+}
+
+void NetworkSource::receive_stream()
+{
+    const bool big_endian = m_spec.format.byteOrder() == QAudioFormat::BigEndian &&
+            m_bytes_per_sample > 1;
+    for (;;) {
+        const int64_t received = m_tcp->read(m_packet.data() + m_packet_fill,
+                                             m_packet.size() - m_packet_fill);
+        if (received <= 0) {
+            break;
+        }
+        const std::size_t begin = m_packet_fill / m_bytes_per_sample * m_bytes_per_sample;
+        m_packet_fill += received;
+        if (big_endian) {
+            // a sample split across reads is swapped once it is complete
+            swap_sample_bytes(m_packet.data() + begin, m_packet_fill - begin,
+                              m_bytes_per_sample);
+        }
+
+        const std::size_t whole = m_packet_fill / m_bytes_per_frame * m_bytes_per_frame;
+        ingest(m_packet.data(), whole, m_write_frame, global_clock::now());
+        std::memmove(m_packet.data(), m_packet.data() + whole, m_packet_fill - whole);
+        m_packet_fill -= whole;
+    }
+    if (m_synced && m_write_frame - m_read_frame >= m_jitter_frames + m_period_frames) {
+        emit samples_ready();
+    }
+}
+
+uint32_t NetworkSource::channel_count() const
+{
+    return m_channels;
+}
+
+uint32_t NetworkSource::sample_rate() const
+{
+    return m_sample_rate;
+}
+
+uint64_t NetworkSource::tell() const
+{
+    return m_read_frame;
+}
+
+bool NetworkSource::is_realtime() const
+{
+    return true;
+}
+
+void NetworkSource::start()
+{
+    m_packet.resize(std::max<std::size_t>(MAX_DATAGRAM_SIZE, 2 * m_bytes_per_frame));
+    m_packet_fill = 0;
+    m_synced = false;
+    m_started = true;
+    m_eos_emitted = false;
+
+    const int buffer_bytes = std::min<int64_t>(
+                m_ring_frames * m_bytes_per_frame, 1 << 26);
+    if (m_spec.transport == NetworkTransport::TCP) {
+        m_tcp = std::make_unique<QTcpSocket>();
+        m_tcp->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption,
+                               buffer_bytes);
+        connect(m_tcp.get(), &QIODevice::readyRead,
+                this, &NetworkSource::receive_stream);
+        connect(m_tcp.get(), &QAbstractSocket::stateChanged,
+                this, [this](QAbstractSocket::SocketState state){
+                    if (state == QAbstractSocket::UnconnectedState && !m_eos_emitted) {
+                        m_eos_emitted = true;
+                        emit end_of_stream();
+                    }
+                });
+        m_tcp->connectToHost(m_spec.host, m_spec.port);
+    } else {
+        // the socket of the constructor is gone if the source was stopped
+        // before; bind failures end the stream, as this runs on the pipe's
+        // thread
+        if (!m_udp) {
+            try {
+                bind_udp();
+            } catch (const std::runtime_error &exc) {
+                std::cerr << "network source: " << exc.what() << std::endl;
+                m_eos_emitted = true;
+                emit end_of_stream();
+                return;
+            }
+        }
+        m_udp->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption,
+                               buffer_bytes);
+        connect(m_udp.get(), &QIODevice::readyRead,
+                this, &NetworkSource::receive_datagrams);
+        // datagrams which came in since the port was bound
+        if (m_udp->hasPendingDatagrams()) {
+            receive_datagrams();
+        }
+    }
+}
+
+void NetworkSource::stop()
+{
+    m_started = false;
+    if (m_tcp) {
+        // closing the socket is not an end of the stream
+        m_tcp->disconnect(this);
+    }
+    m_udp = nullptr;
+    m_tcp = nullptr;
+}
+
+std::pair<bool, global_clock::time_point> NetworkSource::read_samples(
+        std::vector<float> &dest)
+{
+    dest.clear();
+    if (!m_synced ||
+            m_write_frame - m_read_frame < m_jitter_frames + m_period_frames)
+    {
+        return std::make_pair(true, global_clock::time_point());
+    }
+
+    const global_clock::time_point t = m_t0 + std::chrono::microseconds(
+                m_read_frame * 1000000 / m_sample_rate);
+    dest.resize((std::size_t)m_period_frames * m_channels);
+    float *out = dest.data();
+    const int64_t end = m_read_frame + m_period_frames;
+    for (int64_t f = m_read_frame; f < end; ) {
+        const int64_t offset = f % m_ring_frames;
+        const int64_t n = std::min(end - f, m_ring_frames - offset);
+        std::memcpy(out, &m_ring[offset * m_channels], n * m_channels * sizeof(float));
+        out += n * m_channels;
+        f += n;
+    }
+    m_read_frame = end;
+    return std::make_pair(true, t);
+}
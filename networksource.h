@@ -0,0 +1,134 @@
+#ifndef NETWORKSOURCE_H
+#define NETWORKSOURCE_H
+
+#include <QTcpSocket>
+#include <QUdpSocket>
+
+#include "engine.h"
+
+
+enum class NetworkTransport
+{
+    // one datagram after the other, without any header
+    UDP,
+    // RTP datagrams; the RTP timestamp counts frames
+    RTP,
+    // a raw byte stream from a server
+    TCP
+};
+
+
+struct NetworkSourceSpec
+{
+    NetworkTransport transport;
+    // the server to connect to for TCP, the address to bind to otherwise;
+    // empty binds to any address
+    QString host;
+    uint16_t port;
+    // interleaved PCM; RTP L16 payloads are big endian
+    QAudioFormat format;
+    // how long samples are held back so that reordered datagrams still make
+    // it in time
+    uint32_t jitter_msec;
+};
+
+
+// Receives PCM from the network, e.g. RTP/UDP feeds or raw sample streams of
+// SDR daemons.
+//
+// Incoming samples are converted straight into a preallocated ring of frames
+// indexed by their position in the stream, so a datagram arriving out of
+// order lands in its place as long as it is within the jitter window; gaps
+// that are still open when they are handed out stay silent. Samples go out
+// in batches of period_frames once more than the jitter window is buffered.
+//
+// The sender's clock is mapped onto global_clock by the least delayed
+// arrival: t0 follows the earliest possible start time of the stream and may
+// only creep later by MAX_DRIFT_PPM, so the timestamps are free of network
+// jitter but follow a slowly drifting sender. A stream restarting or jumping
+// by more than the ring starts over.
+//
+// UDP and RTP sources bind their port when they are constructed, so that a
+// port in use is reported to the caller.
+class NetworkSource: public VirtualAudioSource
+{
+    Q_OBJECT
+public:
+    static constexpr uint32_t DEFAULT_PERIOD_FRAMES = 1024;
+    static constexpr uint32_t DEFAULT_JITTER_MSEC = 40;
+    static constexpr std::size_t MAX_DATAGRAM_SIZE = 65536;
+    static constexpr uint32_t MAX_DRIFT_PPM = 500;
+
+public:
+    explicit NetworkSource(const NetworkSourceSpec &spec,
+                           QObject *parent = nullptr);
+    ~NetworkSource() override;
+
+private:
+    const NetworkSourceSpec m_spec;
+    const uint32_t m_channels;
+    const uint32_t m_sample_rate;
+    const uint32_t m_bytes_per_sample;
+    const uint32_t m_bytes_per_frame;
+    std::unique_ptr<AbstractSampleConverter> m_converter;
+
+    uint32_t m_period_frames;
+    int64_t m_jitter_frames;
+
+    std::unique_ptr<QUdpSocket> m_udp;
+    std::unique_ptr<QTcpSocket> m_tcp;
+    // one datagram, or the stream bytes not yet making up a whole frame
+    std::vector<char> m_packet;
+    std::size_t m_packet_fill;
+
+    std::vector<float> m_ring;
+    int64_t m_ring_frames;
+    // stream positions in frames
+    int64_t m_read_frame;
+    int64_t m_write_frame;
+    bool m_synced;
+
+    uint32_t m_rtp_ssrc;
+    uint32_t m_rtp_first_timestamp;
+    int64_t m_rtp_last_frame;
+
+    global_clock::time_point m_t0;
+    global_clock::time_point m_last_arrival;
+    bool m_started;
+    bool m_eos_emitted;
+
+    MetricCounter &m_late_packets;
+    MetricCounter &m_overrun_frames;
+    MetricCounter &m_resyncs;
+    LatencyHistogram &m_jitter;
+
+private:
+    void allocate_ring();
+    // throws if the port cannot be bound
+    void bind_udp();
+    void resync(int64_t frame);
+    void receive_datagrams();
+    void receive_stream();
+    bool parse_rtp(const char *&payload, std::size_t &size, int64_t &frame);
+    void ingest(const char *payload, std::size_t size, int64_t frame,
+                const global_clock::time_point &arrival);
+
+public:
+    void set_period_frames(uint32_t frames);
+
+    // VirtualAudioSource interface
+public:
+    uint32_t channel_count() const override;
+    uint32_t sample_rate() const override;
+    uint64_t tell() const override;
+    bool is_realtime() const override;
+
+    void start() override;
+    void stop() override;
+
+    std::pair<bool, global_clock::time_point> read_samples(
+            std::vector<float> &dest) override;
+
+};
+
+#endif // NETWORKSOURCE_H
@@ -98,10 +98,6 @@ void OpenAudioDeviceDialog::device_list_selection_model_current_changed(
 
     preferred_index = -1;
     for (int bits: device.supportedSampleSizes()) {
-        if (bits == 24) {
-            // we do not support 24 bit samples atm.
-            continue;
-        }
         if (bits == preferred.sampleSize()) {
             preferred_index = ui.sample_size->model()->rowCount();
         }
@@ -0,0 +1,143 @@
+#include "peakdetector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "dsp.h"
+
+
+static constexpr uint32_t NO_GROUP = std::numeric_limits<uint32_t>::max();
+
+
+/* PeakDetector */
+
+const PeakDetectorConfig PeakDetector::DEFAULT_CONFIG{10.f, 32, 1.f};
+
+PeakDetector::PeakDetector(const PeakDetectorConfig &config):
+    m_config(config),
+    m_compute_time(MetricsRegistry::global().histogram("peaks.compute_usecs"))
+{
+
+}
+
+float PeakDetector::estimate_floor(std::size_t n)
+{
+    const std::size_t segments = (n + FLOOR_SEGMENT_BINS - 1) / FLOOR_SEGMENT_BINS;
+    m_segment_floors.resize(segments);
+    for (std::size_t s = 0; s < segments; ++s) {
+        const auto first = m_db.begin() + s * FLOOR_SEGMENT_BINS;
+        const auto last = m_db.begin() + std::min(n, (s + 1) * FLOOR_SEGMENT_BINS);
+        m_segment.assign(first, last);
+        const auto median = m_segment.begin() + m_segment.size() / 2;
+        std::nth_element(m_segment.begin(), median, m_segment.end());
+        m_segment_floors[s] = *median;
+    }
+
+    // linear between the segment centers, flat beyond the outer ones
+    m_threshold.resize(n);
+    const float half = FLOOR_SEGMENT_BINS / 2.f;
+    for (std::size_t i = 0; i < n; ++i) {
+        const float u = std::max(0.f, (i - half) / FLOOR_SEGMENT_BINS);
+        const std::size_t s = std::min<std::size_t>(u, segments - 1);
+        const float floor = s + 1 < segments ?
+                    m_segment_floors[s] + (u - s) * (m_segment_floors[s+1] - m_segment_floors[s]) :
+                    m_segment_floors[s];
+        m_threshold[i] = floor + m_config.threshold_db;
+    }
+
+    m_segment.assign(m_segment_floors.begin(), m_segment_floors.end());
+    const auto median = m_segment.begin() + m_segment.size() / 2;
+    std::nth_element(m_segment.begin(), median, m_segment.end());
+    return *median;
+}
+
+void PeakDetector::group_harmonics(std::vector<Peak> &peaks, float bin_width) const
+{
+    const float tolerance = m_config.harmonic_tolerance_bins * bin_width;
+    for (Peak &peak: peaks) {
+        peak.group = NO_GROUP;
+        peak.harmonic = 1;
+    }
+
+    // the lowest peak not yet claimed is the next fundamental
+    uint32_t groups = 0;
+    for (std::size_t i = 0; i < peaks.size(); ++i) {
+        if (peaks[i].group != NO_GROUP) {
+            continue;
+        }
+        const float f0 = peaks[i].frequency;
+        peaks[i].group = groups;
+        if (f0 > 4 * tolerance) {
+            for (std::size_t j = i + 1; j < peaks.size(); ++j) {
+                if (peaks[j].group != NO_GROUP) {
+                    continue;
+                }
+                const long k = std::lround(peaks[j].frequency / f0);
+                // the error of f0 adds up with the order
+                if (k >= 2 && std::abs(peaks[j].frequency - k * f0) <=
+                        std::min(k * tolerance, f0 / 4))
+                {
+                    peaks[j].group = groups;
+                    peaks[j].harmonic = k;
+                }
+            }
+        }
+        ++groups;
+    }
+}
+
+void PeakDetector::process_frame(std::shared_ptr<const RealFFTBlock> input_block)
+{
+    const RealFFTBlock &data = *input_block;
+    const global_clock::time_point compute_start = global_clock::now();
+
+    std::shared_ptr<PeakListBlock> block = m_pool.acquire();
+    block->t = data.t;
+    block->peaks.clear();
+
+    const std::size_t n = data.fft.size();
+    m_db.resize(n);
+    magnitudes_to_db(data.fft.data(), m_db.data(), n);
+    if (n < 3) {
+        block->floor_db = n > 0 ? m_db[0] : 0.f;
+    } else {
+        block->floor_db = estimate_floor(n);
+
+        m_candidates.resize(n / 2);
+        const std::size_t count = find_peaks(m_db.data(), m_threshold.data(), n,
+                                             m_candidates.data());
+        const float bin_width = (data.fmax - data.fmin) / (n - 1);
+        for (std::size_t c = 0; c < count; ++c) {
+            const uint32_t i = m_candidates[c];
+            const float a = m_db[i-1];
+            const float b = m_db[i];
+            const float d = m_db[i+1];
+            const float curvature = a - 2*b + d;
+            const float p = curvature < 0 ? 0.5f * (a - d) / curvature : 0.f;
+            block->peaks.emplace_back(Peak{data.fmin + (i + p) * bin_width,
+                                           b - 0.25f * (a - d) * p,
+                                           m_threshold[i] - m_config.threshold_db,
+                                           NO_GROUP, 1});
+        }
+
+        if (block->peaks.size() > m_config.max_peaks) {
+            std::nth_element(block->peaks.begin(),
+                             block->peaks.begin() + m_config.max_peaks,
+                             block->peaks.end(),
+                             [](const Peak &a, const Peak &b){
+                return a.level_db > b.level_db;
+            });
+            block->peaks.resize(m_config.max_peaks);
+            std::sort(block->peaks.begin(), block->peaks.end(),
+                      [](const Peak &a, const Peak &b){
+                return a.frequency < b.frequency;
+            });
+        }
+        group_harmonics(block->peaks, bin_width);
+    }
+    m_compute_time.record_since(compute_start);
+
+    block->published = global_clock::now();
+    emit result_available(std::move(block));
+}
@@ -0,0 +1,106 @@
+#ifndef PEAKDETECTOR_H
+#define PEAKDETECTOR_H
+
+#include "engine.h"
+
+
+struct Peak
+{
+    // parabolically interpolated between the bins around the maximum
+    float frequency;
+    float level_db;
+    // the noise floor at the peak
+    float floor_db;
+    // peaks sharing a fundamental share the group; harmonic is the multiple
+    // of the fundamental, 1 for the fundamental itself
+    uint32_t group;
+    uint32_t harmonic;
+};
+
+
+struct PeakListBlock: public TimestampedData
+{
+    // ascending in frequency
+    std::vector<Peak> peaks;
+    // median level over the whole frame
+    float floor_db;
+};
+
+
+struct PeakDetectorConfig
+{
+    // how far above the local noise floor a maximum has to be
+    float threshold_db;
+    // the strongest peaks are kept if there are more
+    uint32_t max_peaks;
+    // tolerance for a peak to count as a harmonic, in bins
+    float harmonic_tolerance_bins;
+};
+
+
+// Finds tones in FFT frames. The noise floor is the median level of
+// segments of FLOOR_SEGMENT_BINS bins, interpolated between their centers,
+// so it follows sloped spectra; the maxima above it are found with a vector
+// scan and refined by parabolic interpolation over the dB levels. Each frame
+// yields one PeakListBlock, empty if there is no peak.
+//
+// Like SpectralAverager, the detector is connected directly to its source
+// and runs in the thread producing the frames.
+class PeakDetector: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr uint32_t FLOOR_SEGMENT_BINS = 64;
+    static const PeakDetectorConfig DEFAULT_CONFIG;
+
+public:
+    PeakDetector() = delete;
+    // source is anything emitting
+    // result_available(std::shared_ptr<const RealFFTBlock>)
+    template <typename source_t>
+    PeakDetector(const source_t &source,
+                 const PeakDetectorConfig &config = DEFAULT_CONFIG):
+        PeakDetector(config)
+    {
+        connect(&source, &source_t::result_available,
+                this, &PeakDetector::process_frame,
+                Qt::DirectConnection);
+    }
+    PeakDetector(const PeakDetector &other) = delete;
+    PeakDetector(PeakDetector &&src) = delete;
+    PeakDetector &operator=(const PeakDetector &other) = delete;
+    PeakDetector &operator=(PeakDetector &&src) = delete;
+
+private:
+    const PeakDetectorConfig m_config;
+
+    std::vector<float> m_db;
+    std::vector<float> m_threshold;
+    std::vector<float> m_segment;
+    std::vector<float> m_segment_floors;
+    std::vector<uint32_t> m_candidates;
+
+    BlockPool<PeakListBlock> m_pool;
+    LatencyHistogram &m_compute_time;
+
+private:
+    explicit PeakDetector(const PeakDetectorConfig &config);
+    float estimate_floor(std::size_t n);
+    void group_harmonics(std::vector<Peak> &peaks, float bin_width) const;
+
+public slots:
+    // called from one thread at a time
+    void process_frame(std::shared_ptr<const RealFFTBlock> input_block);
+
+public:
+    inline const PeakDetectorConfig &config() const
+    {
+        return m_config;
+    }
+
+signals:
+    void result_available(std::shared_ptr<const PeakListBlock> data);
+
+};
+
+#endif // PEAKDETECTOR_H
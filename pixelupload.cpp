@@ -0,0 +1,122 @@
+#include "pixelupload.h"
+
+#include <stdexcept>
+
+
+/* PixelUploadRing */
+
+PixelUploadRing::PixelUploadRing():
+    m_buffer(0),
+    m_segment_size(0),
+    m_persistent(false),
+    m_persistent_map(nullptr),
+    m_fences{},
+    m_current(0)
+{
+
+}
+
+PixelUploadRing::~PixelUploadRing()
+{
+    destroy();
+}
+
+void PixelUploadRing::create(std::size_t segment_size)
+{
+    destroy();
+
+    const GLsizeiptr total_size = segment_size * SEGMENTS;
+    m_segment_size = segment_size;
+    m_persistent = epoxy_gl_version() >= 44 ||
+            epoxy_has_gl_extension("GL_ARB_buffer_storage");
+
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    if (m_persistent) {
+        static constexpr GLbitfield flags =
+                GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, total_size, nullptr, flags);
+        m_persistent_map = static_cast<unsigned char*>(
+                    glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total_size, flags));
+        if (!m_persistent_map) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            destroy();
+            throw std::runtime_error("failed to map pixel upload buffer");
+        }
+    } else {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, total_size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void PixelUploadRing::destroy()
+{
+    for (GLsync &fence: m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (m_buffer) {
+        if (m_persistent_map) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            m_persistent_map = nullptr;
+        }
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+    m_segment_size = 0;
+    m_current = 0;
+}
+
+void *PixelUploadRing::map(std::size_t size)
+{
+    if (size > m_segment_size) {
+        throw std::logic_error("upload does not fit in a segment");
+    }
+    m_current = (m_current + 1) % SEGMENTS;
+
+    GLsync &fence = m_fences[m_current];
+    if (fence) {
+        GLenum status;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    const std::size_t offset = m_current * m_segment_size;
+    if (m_persistent) {
+        return m_persistent_map + offset;
+    }
+
+    // the fence already guarantees that the segment is no longer read
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    void *result = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+                                    GL_MAP_WRITE_BIT |
+                                    GL_MAP_INVALIDATE_RANGE_BIT |
+                                    GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!result) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        throw std::runtime_error("failed to map pixel upload buffer");
+    }
+    return result;
+}
+
+const unsigned char *PixelUploadRing::unmap()
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    if (!m_persistent) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    return reinterpret_cast<const unsigned char*>(m_current * m_segment_size);
+}
+
+void PixelUploadRing::release()
+{
+    m_fences[m_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
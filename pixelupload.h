@@ -0,0 +1,67 @@
+#ifndef PIXELUPLOAD_H
+#define PIXELUPLOAD_H
+
+#include <array>
+#include <cstddef>
+
+#include "epoxy/gl.h"
+
+
+// Stages pixel data for texture uploads in a pixel unpack buffer which is
+// split into SEGMENTS parts, so that the CPU can fill one part while the
+// driver still copies from the others. Each part is guarded by a fence.
+// Where GL_ARB_buffer_storage is available the buffer is mapped once,
+// persistently; otherwise each part is mapped unsynchronised for every use.
+//
+// All methods must be called with the owning context current.
+class PixelUploadRing
+{
+public:
+    static constexpr std::size_t SEGMENTS = 3;
+
+public:
+    PixelUploadRing();
+    PixelUploadRing(const PixelUploadRing &other) = delete;
+    PixelUploadRing(PixelUploadRing &&src) = delete;
+    PixelUploadRing &operator=(const PixelUploadRing &other) = delete;
+    PixelUploadRing &operator=(PixelUploadRing &&src) = delete;
+    ~PixelUploadRing();
+
+private:
+    GLuint m_buffer;
+    std::size_t m_segment_size;
+    bool m_persistent;
+    unsigned char *m_persistent_map;
+
+    std::array<GLsync, SEGMENTS> m_fences;
+    std::size_t m_current;
+
+public:
+    inline bool is_created() const
+    {
+        return m_buffer != 0;
+    }
+
+    inline std::size_t segment_size() const
+    {
+        return m_segment_size;
+    }
+
+    void create(std::size_t segment_size);
+    void destroy();
+
+    // Returns memory for up to segment_size() bytes in the next segment,
+    // waiting for the GPU to release it first if necessary.
+    void *map(std::size_t size);
+
+    // Finishes writing and leaves the buffer bound to
+    // GL_PIXEL_UNPACK_BUFFER. The result is the offset of the mapped memory
+    // to be passed as the pixel pointer to glTex(Sub)Image calls.
+    const unsigned char *unmap();
+
+    // To be called after all uploads from the segment have been issued.
+    void release();
+
+};
+
+#endif // PIXELUPLOAD_H
@@ -0,0 +1,48 @@
+#include "renderscheduler.h"
+
+#include <cmath>
+
+
+/* RenderScheduler */
+
+RenderScheduler::RenderScheduler(const Engine &engine,
+                                 QObject *parent):
+    QObject(parent),
+    m_engine(engine),
+    m_was_running(false)
+{
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout,
+            this, &RenderScheduler::tick);
+    set_refresh_rate(DEFAULT_REFRESH_RATE);
+    m_timer.start();
+}
+
+void RenderScheduler::tick()
+{
+    const bool running = m_engine.is_running();
+    // one more frame after stopping so that the views settle
+    if (!running && !m_was_running) {
+        return;
+    }
+    m_was_running = running;
+
+    for (const auto &view: m_views) {
+        if (view) {
+            view->update();
+        }
+    }
+}
+
+void RenderScheduler::add_view(QWidget *view)
+{
+    m_views.emplace_back(view);
+}
+
+void RenderScheduler::set_refresh_rate(double hz)
+{
+    if (!(hz > 0)) {
+        hz = DEFAULT_REFRESH_RATE;
+    }
+    m_timer.setInterval(std::max<int>(1, std::lround(1000 / hz)));
+}
@@ -0,0 +1,42 @@
+#ifndef RENDERSCHEDULER_H
+#define RENDERSCHEDULER_H
+
+#include <vector>
+
+#include <QPointer>
+#include <QTimer>
+#include <QWidget>
+
+#include "engine.h"
+
+
+// Repaints all registered views from a single timer running at the display
+// refresh rate. Results are pushed into the views' queues directly from the
+// processor threads, so the GUI thread does a constant amount of work per
+// frame no matter how often results arrive.
+class RenderScheduler: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr double DEFAULT_REFRESH_RATE = 60;
+
+public:
+    explicit RenderScheduler(const Engine &engine,
+                             QObject *parent = nullptr);
+
+private:
+    const Engine &m_engine;
+    QTimer m_timer;
+    std::vector<QPointer<QWidget> > m_views;
+    bool m_was_running;
+
+private slots:
+    void tick();
+
+public:
+    void add_view(QWidget *view);
+    void set_refresh_rate(double hz);
+
+};
+
+#endif // RENDERSCHEDULER_H
@@ -0,0 +1,162 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+
+// Fixed-capacity sliding window. Every value is stored twice (at i and
+// i+capacity), so the last capacity() values are always contiguous.
+template <typename T>
+class MirroredRingBuffer
+{
+public:
+    explicit MirroredRingBuffer(const std::size_t capacity):
+        m_capacity(capacity),
+        m_storage(capacity * 2),
+        m_write_pos(0)
+    {
+        assert(capacity > 0);
+    }
+
+private:
+    const std::size_t m_capacity;
+    std::vector<T> m_storage;
+    std::size_t m_write_pos;
+
+public:
+    inline std::size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    template <typename InputIterator>
+    void append(InputIterator first, InputIterator last)
+    {
+        std::size_t n = std::distance(first, last);
+        if (n > m_capacity) {
+            std::advance(first, n - m_capacity);
+            n = m_capacity;
+        }
+
+        while (n > 0) {
+            const std::size_t chunk = std::min(n, m_capacity - m_write_pos);
+            InputIterator chunk_end = first;
+            std::advance(chunk_end, chunk);
+            std::copy(first, chunk_end, &m_storage[m_write_pos]);
+            std::copy(first, chunk_end, &m_storage[m_write_pos + m_capacity]);
+            m_write_pos = (m_write_pos + chunk) % m_capacity;
+            first = chunk_end;
+            n -= chunk;
+        }
+    }
+
+    // oldest of the last capacity() values; valid until the next append()
+    inline const T *window() const
+    {
+        return &m_storage[m_write_pos];
+    }
+
+};
+
+
+// Bounded single-producer/single-consumer FIFO. write() may only be called
+// from one thread and peek()/consume()/clear() only from one (possibly
+// different) thread. The capacity is at least 1, so that positions can be
+// taken modulo it.
+template <typename T>
+class SPSCRingBuffer
+{
+public:
+    explicit SPSCRingBuffer(const std::size_t capacity = 0):
+        m_storage(std::max<std::size_t>(capacity, 1)),
+        m_head(0),
+        m_tail(0)
+    {
+
+    }
+
+    SPSCRingBuffer(const SPSCRingBuffer &other) = delete;
+    SPSCRingBuffer &operator=(const SPSCRingBuffer &other) = delete;
+
+private:
+    std::vector<T> m_storage;
+    // both only ever increase; positions are taken modulo the capacity
+    std::atomic<std::size_t> m_head;
+    std::atomic<std::size_t> m_tail;
+
+public:
+    inline std::size_t capacity() const
+    {
+        return m_storage.size();
+    }
+
+    inline std::size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) -
+                m_head.load(std::memory_order_acquire);
+    }
+
+    inline bool empty() const
+    {
+        return size() == 0;
+    }
+
+    // not thread-safe; only call while neither side is active
+    void reset(const std::size_t capacity)
+    {
+        m_storage.resize(std::max<std::size_t>(capacity, 1));
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    // producer side; returns the number of values actually written
+    std::size_t write(const T *data, std::size_t n)
+    {
+        const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        const std::size_t head = m_head.load(std::memory_order_acquire);
+        n = std::min(n, capacity() - (tail - head));
+
+        const std::size_t pos = tail % capacity();
+        const std::size_t first_chunk = std::min(n, capacity() - pos);
+        std::copy(data, data + first_chunk, &m_storage[pos]);
+        std::copy(data + first_chunk, data + n, m_storage.data());
+
+        m_tail.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // consumer side: the longest contiguous run of readable values
+    std::pair<const T*, std::size_t> peek() const
+    {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        const std::size_t tail = m_tail.load(std::memory_order_acquire);
+        if (tail == head) {
+            return std::make_pair(nullptr, 0);
+        }
+        const std::size_t pos = head % capacity();
+        return std::make_pair(&m_storage[pos],
+                              std::min(tail - head, capacity() - pos));
+    }
+
+    void consume(std::size_t n)
+    {
+        const std::size_t head = m_head.load(std::memory_order_relaxed);
+        assert(n <= m_tail.load(std::memory_order_acquire) - head);
+        m_head.store(head + n, std::memory_order_release);
+    }
+
+    void clear()
+    {
+        m_head.store(m_tail.load(std::memory_order_acquire),
+                     std::memory_order_release);
+    }
+
+};
+
+#endif // RINGBUFFER_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui multimedia widgets
+QT       += core gui multimedia network widgets
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -15,11 +15,49 @@ TEMPLATE = app
 SOURCES += main.cpp\
         mainwindow.cpp \
     openaudiodevicedialog.cpp \
-    engine.cpp
+    engine.cpp \
+    dsp.cpp \
+    filesource.cpp \
+    batch.cpp \
+    fftbank.cpp \
+    pixelupload.cpp \
+    colormap.cpp \
+    renderscheduler.cpp \
+    metrics.cpp \
+    signalsource.cpp \
+    spectrogram.cpp \
+    spectralaverage.cpp \
+    zoomfft.cpp \
+    peakdetector.cpp \
+    networksink.cpp \
+    networksource.cpp \
+    threadpolicy.cpp \
+    waterfallhistory.cpp \
+    latencyprofile.cpp
 
 HEADERS  += mainwindow.h \
     openaudiodevicedialog.h \
-    engine.h
+    engine.h \
+    ringbuffer.h \
+    blockpool.h \
+    dsp.h \
+    filesource.h \
+    batch.h \
+    fftbank.h \
+    pixelupload.h \
+    colormap.h \
+    renderscheduler.h \
+    metrics.h \
+    signalsource.h \
+    spectrogram.h \
+    spectralaverage.h \
+    zoomfft.h \
+    peakdetector.h \
+    networksink.h \
+    networksource.h \
+    threadpolicy.h \
+    waterfallhistory.h \
+    latencyprofile.h
 
 FORMS    += mainwindow.ui \
     openaudiodevicedialog.ui
@@ -27,7 +65,7 @@ FORMS    += mainwindow.ui \
 QMAKE_CXXFLAGS += -std=c++14
 
 unix: CONFIG += link_pkgconfig
-unix: PKGCONFIG += fftw3
+unix: PKGCONFIG += fftw3f
 
 DISTFILES += \
     fft.frag \
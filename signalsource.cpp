@@ -0,0 +1,285 @@
+#include "signalsource.h"
+
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include <QStringList>
+
+
+static const float DEFAULT_AMPLITUDE = 0.5f;
+static const uint32_t DEFAULT_SWEEP_MSEC = 1000;
+
+
+/* SignalGeneratorSource */
+
+SignalGeneratorSource::SignalGeneratorSource(const SignalSpec &spec,
+                                             QObject *parent):
+    VirtualAudioSource(parent),
+    m_spec(spec),
+    m_table_frames(0),
+    m_paced(true),
+    m_period_frames(DEFAULT_PERIOD_FRAMES),
+    m_duration_frames(0),
+    m_position(0),
+    m_burst_periods(0),
+    m_eos_emitted(false)
+{
+    if (m_spec.sample_rate == 0 || m_spec.channels == 0) {
+        throw std::invalid_argument("signal needs a sample rate and channels");
+    }
+    build_table();
+}
+
+SignalGeneratorSource::~SignalGeneratorSource()
+{
+
+}
+
+void SignalGeneratorSource::build_table()
+{
+    const uint32_t channels = m_spec.channels;
+    const uint32_t rate = m_spec.sample_rate;
+    const uint64_t max_frames = std::max<uint64_t>(MIN_TABLE_FRAMES,
+                                                   MAX_TABLE_SAMPLES / channels);
+    const auto table_frames_for = [max_frames](uint64_t frames){
+        return (uint32_t)std::min<uint64_t>(
+                    std::max<uint64_t>(frames, MIN_TABLE_FRAMES),
+                    max_frames);
+    };
+
+    std::vector<float> wave;
+    switch (m_spec.waveform) {
+    case Waveform::SINE:
+    {
+        // a second of signal gives 1 Hz resolution where the table allows
+        const uint32_t n = table_frames_for(rate);
+        const uint64_t cycles = std::min<uint64_t>(
+                    n / 2,
+                    std::max<int64_t>(1, std::llround((double)m_spec.frequency * n / rate)));
+        m_spec.frequency = (double)cycles * rate / n;
+        wave.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            // reduced per index, so that there is no drift along the table
+            const double phase = (double)((cycles * i) % n) / n;
+            wave[i] = m_spec.amplitude * std::sin(2 * M_PI * phase);
+        }
+        break;
+    }
+    case Waveform::CHIRP:
+    {
+        const uint32_t n = table_frames_for((uint64_t)m_spec.sweep_msec * rate / 1000);
+        m_spec.sweep_msec = std::max<uint64_t>(1, (uint64_t)n * 1000 / rate);
+        const double f0 = m_spec.frequency;
+        const int64_t cycles = std::max<int64_t>(
+                    1, std::llround((f0 + m_spec.end_frequency) / 2 * n / rate));
+        const double f1 = 2. * cycles * rate / n - f0;
+        m_spec.end_frequency = f1;
+        wave.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            const double phase = (f0 * i + (f1 - f0) * i * i / (2. * n)) / rate;
+            wave[i] = m_spec.amplitude * std::sin(
+                        2 * M_PI * (phase - std::floor(phase)));
+        }
+        break;
+    }
+    case Waveform::NOISE:
+    {
+        const uint32_t n = table_frames_for(rate);
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> dist(-m_spec.amplitude,
+                                                   m_spec.amplitude);
+        wave.resize(n);
+        for (float &sample: wave) {
+            sample = dist(rng);
+        }
+        break;
+    }
+    }
+
+    m_table_frames = wave.size();
+    m_table.resize((std::size_t)m_table_frames * channels);
+    for (uint32_t channel = 0; channel < channels; ++channel) {
+        const uint64_t offset = (uint64_t)channel * m_table_frames / channels;
+        for (uint32_t i = 0; i < m_table_frames; ++i) {
+            m_table[(std::size_t)i * channels + channel] =
+                    wave[(i + offset) % m_table_frames];
+        }
+    }
+}
+
+void SignalGeneratorSource::set_paced(bool paced)
+{
+    if (m_timer) {
+        throw std::logic_error("cannot change pacing while running");
+    }
+    m_paced = paced;
+}
+
+void SignalGeneratorSource::set_period_frames(uint32_t frames)
+{
+    if (frames == 0) {
+        throw std::invalid_argument("period must not be empty");
+    }
+    m_period_frames = frames;
+}
+
+void SignalGeneratorSource::set_duration_frames(uint64_t frames)
+{
+    m_duration_frames = frames;
+    m_eos_emitted = false;
+}
+
+uint32_t SignalGeneratorSource::channel_count() const
+{
+    return m_spec.channels;
+}
+
+uint32_t SignalGeneratorSource::sample_rate() const
+{
+    return m_spec.sample_rate;
+}
+
+uint64_t SignalGeneratorSource::tell() const
+{
+    return m_position;
+}
+
+bool SignalGeneratorSource::is_realtime() const
+{
+    return m_paced;
+}
+
+void SignalGeneratorSource::start()
+{
+    m_t0 = global_clock::now() - std::chrono::microseconds(
+                m_position * 1000000 / m_spec.sample_rate);
+    m_burst_periods = 0;
+    if (m_paced) {
+        m_timer = std::make_unique<QTimer>();
+        m_timer->setTimerType(Qt::PreciseTimer);
+        m_timer->setInterval(std::max<uint64_t>(
+                                 1,
+                                 (uint64_t)m_period_frames * 1000 / m_spec.sample_rate));
+        connect(m_timer.get(), &QTimer::timeout,
+                this, &VirtualAudioSource::samples_ready);
+        m_timer->start();
+    }
+    emit samples_ready();
+}
+
+void SignalGeneratorSource::stop()
+{
+    m_timer = nullptr;
+}
+
+std::pair<bool, global_clock::time_point> SignalGeneratorSource::read_samples(
+        std::vector<float> &dest)
+{
+    dest.clear();
+
+    const uint32_t rate = m_spec.sample_rate;
+    const global_clock::time_point t = m_t0 + std::chrono::microseconds(
+                m_position * 1000000 / rate);
+
+    if (m_duration_frames > 0 && m_position >= m_duration_frames) {
+        if (!m_eos_emitted) {
+            m_eos_emitted = true;
+            if (m_timer) {
+                m_timer->stop();
+            }
+            emit end_of_stream();
+        }
+        return std::make_pair(true, t);
+    }
+
+    uint64_t frames = m_period_frames;
+    if (m_duration_frames > 0) {
+        frames = std::min(frames, m_duration_frames - m_position);
+    }
+    if (m_paced) {
+        const uint64_t due_until =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    global_clock::now() - m_t0).count() * rate / 1000000;
+        if (due_until <= m_position) {
+            return std::make_pair(true, t);
+        }
+        frames = std::min(frames, due_until - m_position);
+    } else {
+        if (m_burst_periods >= UNPACED_BURST_PERIODS) {
+            // give the event loop a chance, then carry on
+            m_burst_periods = 0;
+            emit samples_ready();
+            return std::make_pair(true, t);
+        }
+        ++m_burst_periods;
+    }
+
+    const uint32_t channels = m_spec.channels;
+    dest.resize(frames * channels);
+    float *out = dest.data();
+    uint64_t index = m_position % m_table_frames;
+    uint64_t remaining = frames;
+    while (remaining > 0) {
+        const uint64_t n = std::min<uint64_t>(remaining, m_table_frames - index);
+        std::memcpy(out, &m_table[index * channels], n * channels * sizeof(float));
+        out += n * channels;
+        remaining -= n;
+        index = 0;
+    }
+    m_position += frames;
+    return std::make_pair(true, t);
+}
+
+
+bool parse_signal_spec(const QString &text, SignalSpec &spec)
+{
+    const QStringList parts = text.split(":");
+    if (parts.size() < 3) {
+        return false;
+    }
+
+    bool rate_ok, channels_ok;
+    spec.sample_rate = parts[1].toUInt(&rate_ok);
+    spec.channels = parts[2].toUInt(&channels_ok);
+    if (!rate_ok || !channels_ok || spec.sample_rate == 0 || spec.channels == 0) {
+        return false;
+    }
+    spec.amplitude = DEFAULT_AMPLITUDE;
+    spec.frequency = 0;
+    spec.end_frequency = 0;
+    spec.sweep_msec = DEFAULT_SWEEP_MSEC;
+
+    const float nyquist = spec.sample_rate / 2.f;
+    const auto parse_frequency = [nyquist](const QString &value, float &dest){
+        bool ok;
+        dest = value.toFloat(&ok);
+        return ok && dest >= 0 && dest <= nyquist;
+    };
+
+    const QString waveform = parts[0].toLower();
+    if (waveform == "sine") {
+        spec.waveform = Waveform::SINE;
+        return parts.size() == 4 && parse_frequency(parts[3], spec.frequency);
+    } else if (waveform == "chirp") {
+        spec.waveform = Waveform::CHIRP;
+        if (parts.size() != 5 && parts.size() != 6) {
+            return false;
+        }
+        if (!parse_frequency(parts[3], spec.frequency) ||
+                !parse_frequency(parts[4], spec.end_frequency))
+        {
+            return false;
+        }
+        if (parts.size() == 6) {
+            bool ok;
+            spec.sweep_msec = parts[5].toUInt(&ok);
+            return ok && spec.sweep_msec > 0;
+        }
+        return true;
+    } else if (waveform == "noise") {
+        spec.waveform = Waveform::NOISE;
+        return parts.size() == 3;
+    }
+    return false;
+}
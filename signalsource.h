@@ -0,0 +1,111 @@
+#ifndef SIGNALSOURCE_H
+#define SIGNALSOURCE_H
+
+#include <QTimer>
+
+#include "engine.h"
+
+
+enum class Waveform
+{
+    SINE,
+    CHIRP,
+    NOISE
+};
+
+
+struct SignalSpec
+{
+    Waveform waveform;
+    uint32_t sample_rate;
+    uint32_t channels;
+    float amplitude;
+    // tone frequency, or the start of the sweep of a chirp
+    float frequency;
+    // chirps only: linear sweep from frequency to end_frequency, then
+    // starting over
+    float end_frequency;
+    uint32_t sweep_msec;
+};
+
+
+// Sine, linear chirp or white noise at any rate and channel count, for load
+// testing without hardware.
+//
+// The waveform is rendered once into a table of interleaved frames which is
+// looped seamlessly, so reading is a plain copy. To make the loop seamless
+// the tone frequency is rounded to a whole number of cycles per table (and
+// the end of a sweep so that the sweep ends on a whole cycle); spec() tells
+// what is actually generated. Channels read the table at evenly spread
+// offsets.
+class SignalGeneratorSource: public VirtualAudioSource
+{
+    Q_OBJECT
+public:
+    static constexpr uint32_t DEFAULT_PERIOD_FRAMES = 4096;
+    // number of periods read back-to-back before returning to the event loop
+    // when not paced
+    static constexpr uint32_t UNPACED_BURST_PERIODS = 16;
+    static constexpr uint32_t MIN_TABLE_FRAMES = 1 << 16;
+    // the table never holds more samples than this, all channels together
+    static constexpr uint32_t MAX_TABLE_SAMPLES = 1 << 22;
+
+public:
+    explicit SignalGeneratorSource(const SignalSpec &spec,
+                                   QObject *parent = nullptr);
+    ~SignalGeneratorSource() override;
+
+private:
+    SignalSpec m_spec;
+    uint32_t m_table_frames;
+    std::vector<float> m_table;
+
+    bool m_paced;
+    uint32_t m_period_frames;
+    uint64_t m_duration_frames;
+    std::unique_ptr<QTimer> m_timer;
+
+    uint64_t m_position;
+    global_clock::time_point m_t0;
+    uint32_t m_burst_periods;
+    bool m_eos_emitted;
+
+private:
+    void build_table();
+
+public:
+    // when paced (the default), samples are handed out following the wall
+    // clock; otherwise as fast as the pipe takes them
+    void set_paced(bool paced);
+    void set_period_frames(uint32_t frames);
+    // 0, the default, generates forever
+    void set_duration_frames(uint64_t frames);
+
+    inline const SignalSpec &spec() const
+    {
+        return m_spec;
+    }
+
+    // VirtualAudioSource interface
+public:
+    uint32_t channel_count() const override;
+    uint32_t sample_rate() const override;
+    uint64_t tell() const override;
+    bool is_realtime() const override;
+
+    void start() override;
+    void stop() override;
+
+    std::pair<bool, global_clock::time_point> read_samples(
+            std::vector<float> &dest) override;
+
+};
+
+
+// Parses waveform:rate:channels[:arguments], e.g.
+//   sine:48000:2:1000                   1 kHz tone
+//   chirp:2000000:1:100:500000[:1000]   100 Hz to 500 kHz every 1000 ms
+//   noise:10000000:8                    white noise
+bool parse_signal_spec(const QString &text, SignalSpec &spec);
+
+#endif // SIGNALSOURCE_H
@@ -0,0 +1,248 @@
+#include "spectralaverage.h"
+
+#include <cstring>
+
+#include <QStringList>
+
+#include "dsp.h"
+
+
+static inline bool is_sliding(SpectralAveraging mode)
+{
+    return mode == SpectralAveraging::LINEAR || mode == SpectralAveraging::WELCH;
+}
+
+
+/* SpectralAverager */
+
+SpectralAverager::SpectralAverager(const AveragingConfig &config):
+    m_config(config),
+    m_bins(0),
+    m_fmin(0),
+    m_fmax(0),
+    m_count(0),
+    m_history_index(0),
+    m_since_resum(0),
+    m_have_output_t(false),
+    m_reset_requested(false),
+    m_compute_time(MetricsRegistry::global().histogram(
+                       std::string("average.") + averaging_mode_name(config.mode) +
+                       ".compute_usecs"))
+{
+    if (m_config.frames == 0 &&
+            m_config.mode != SpectralAveraging::MAX_HOLD &&
+            m_config.mode != SpectralAveraging::MIN_HOLD)
+    {
+        throw std::invalid_argument("averaging needs at least one frame");
+    }
+}
+
+SpectralAverager::SpectralAverager(const FFTProcessor &source,
+                                   const AveragingConfig &config):
+    SpectralAverager(config)
+{
+    connect(&source, &FFTProcessor::result_available,
+            this, &SpectralAverager::process_frame,
+            Qt::DirectConnection);
+}
+
+SpectralAverager::SpectralAverager(const FFTBankOutput &source,
+                                   const AveragingConfig &config):
+    SpectralAverager(config)
+{
+    connect(&source, &FFTBankOutput::result_available,
+            this, &SpectralAverager::process_frame,
+            Qt::DirectConnection);
+}
+
+void SpectralAverager::restart(const RealFFTBlock &block)
+{
+    const uint32_t bins = block.fft.size();
+    m_bins = bins;
+    m_fmin = block.fmin;
+    m_fmax = block.fmax;
+    m_count = 0;
+    m_acc.assign(bins, 0.f);
+    if (is_sliding(m_config.mode)) {
+        m_history.assign((std::size_t)m_config.frames * bins, 0.f);
+        m_history_index = 0;
+        m_since_resum = 0;
+    }
+    if (m_config.mode == SpectralAveraging::WELCH) {
+        m_scratch.resize(bins);
+    }
+    m_have_output_t = false;
+}
+
+void SpectralAverager::add_sliding(const float *frame)
+{
+    float *slot = &m_history[(std::size_t)m_history_index * m_bins];
+    if (m_count == m_config.frames) {
+        sliding_update(frame, slot, m_acc.data(), m_bins);
+    } else {
+        accumulate(frame, m_acc.data(), m_bins);
+        ++m_count;
+    }
+    std::memcpy(slot, frame, m_bins * sizeof(float));
+    m_history_index = (m_history_index + 1) % m_config.frames;
+
+    // the running sum picks up rounding errors with every frame that leaves
+    // it; summing afresh once per window length bounds them at O(bins) per
+    // frame
+    ++m_since_resum;
+    if (m_count == m_config.frames && m_since_resum >= m_config.frames) {
+        resum();
+    }
+}
+
+void SpectralAverager::resum()
+{
+    std::fill(m_acc.begin(), m_acc.end(), 0.f);
+    for (uint32_t i = 0; i < m_count; ++i) {
+        accumulate(&m_history[(std::size_t)i * m_bins], m_acc.data(), m_bins);
+    }
+    m_since_resum = 0;
+}
+
+void SpectralAverager::emit_average(const RealFFTBlock &input)
+{
+    std::shared_ptr<RealFFTBlock> block = m_pool.acquire();
+    block->t = input.t;
+    block->channel = input.channel;
+    block->fmin = m_fmin;
+    block->fmax = m_fmax;
+    block->fft.resize(m_bins);
+    switch (m_config.mode) {
+    case SpectralAveraging::LINEAR:
+        scale(m_acc.data(), block->fft.data(), m_bins, 1.f / m_count);
+        break;
+    case SpectralAveraging::WELCH:
+        scaled_sqrt(m_acc.data(), block->fft.data(), m_bins, 1.f / m_count);
+        break;
+    case SpectralAveraging::EXPONENTIAL:
+    case SpectralAveraging::MAX_HOLD:
+    case SpectralAveraging::MIN_HOLD:
+        std::copy(m_acc.begin(), m_acc.end(), block->fft.begin());
+        break;
+    }
+    block->published = global_clock::now();
+    emit result_available(std::move(block));
+}
+
+void SpectralAverager::process_frame(std::shared_ptr<const RealFFTBlock> input_block)
+{
+    const RealFFTBlock &data = *input_block;
+    const global_clock::time_point compute_start = global_clock::now();
+
+    if (m_reset_requested.exchange(false, std::memory_order_acquire) ||
+            data.fft.size() != m_bins || data.fmin != m_fmin || data.fmax != m_fmax)
+    {
+        restart(data);
+    }
+
+    const float *frame = data.fft.data();
+    switch (m_config.mode) {
+    case SpectralAveraging::EXPONENTIAL:
+        if (m_count == 0) {
+            std::copy(data.fft.begin(), data.fft.end(), m_acc.begin());
+            m_count = 1;
+        } else {
+            exponential_average(frame, m_acc.data(), m_bins,
+                                2.f / (m_config.frames + 1));
+        }
+        break;
+    case SpectralAveraging::LINEAR:
+        add_sliding(frame);
+        break;
+    case SpectralAveraging::WELCH:
+        multiply(frame, frame, m_scratch.data(), m_bins);
+        add_sliding(m_scratch.data());
+        break;
+    case SpectralAveraging::MAX_HOLD:
+    case SpectralAveraging::MIN_HOLD:
+        if (m_config.frames > 0 && m_count == m_config.frames) {
+            m_count = 0;
+        }
+        if (m_count == 0) {
+            std::copy(data.fft.begin(), data.fft.end(), m_acc.begin());
+        } else if (m_config.mode == SpectralAveraging::MAX_HOLD) {
+            max_hold(frame, m_acc.data(), m_bins);
+        } else {
+            min_hold(frame, m_acc.data(), m_bins);
+        }
+        ++m_count;
+        break;
+    }
+    m_compute_time.record_since(compute_start);
+
+    if (!m_have_output_t ||
+            data.t - m_output_t >= std::chrono::milliseconds(m_config.output_period_msec))
+    {
+        m_have_output_t = true;
+        m_output_t = data.t;
+        emit_average(data);
+    }
+}
+
+void SpectralAverager::reset()
+{
+    m_reset_requested.store(true, std::memory_order_release);
+}
+
+
+bool parse_averaging_config(const QString &text, AveragingConfig &config)
+{
+    const QStringList parts = text.split(":");
+    if (parts.size() != 2 && parts.size() != 3) {
+        return false;
+    }
+
+    const QString mode = parts[0].toLower();
+    if (mode == "exp") {
+        config.mode = SpectralAveraging::EXPONENTIAL;
+    } else if (mode == "linear") {
+        config.mode = SpectralAveraging::LINEAR;
+    } else if (mode == "welch") {
+        config.mode = SpectralAveraging::WELCH;
+    } else if (mode == "max") {
+        config.mode = SpectralAveraging::MAX_HOLD;
+    } else if (mode == "min") {
+        config.mode = SpectralAveraging::MIN_HOLD;
+    } else {
+        return false;
+    }
+
+    bool ok;
+    config.frames = parts[1].toUInt(&ok);
+    if (!ok || (config.frames == 0 &&
+                config.mode != SpectralAveraging::MAX_HOLD &&
+                config.mode != SpectralAveraging::MIN_HOLD))
+    {
+        return false;
+    }
+    config.output_period_msec = 0;
+    if (parts.size() == 3) {
+        config.output_period_msec = parts[2].toUInt(&ok);
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *averaging_mode_name(SpectralAveraging mode)
+{
+    switch (mode) {
+    case SpectralAveraging::EXPONENTIAL:
+        return "exp";
+    case SpectralAveraging::LINEAR:
+        return "linear";
+    case SpectralAveraging::WELCH:
+        return "welch";
+    case SpectralAveraging::MAX_HOLD:
+        return "max";
+    case SpectralAveraging::MIN_HOLD:
+        return "min";
+    }
+    return "unknown";
+}
@@ -0,0 +1,108 @@
+#ifndef SPECTRALAVERAGE_H
+#define SPECTRALAVERAGE_H
+
+#include "engine.h"
+#include "fftbank.h"
+
+
+enum class SpectralAveraging
+{
+    // exponential moving average with the smoothing of a frames-long mean
+    EXPONENTIAL,
+    // mean of the magnitudes of the last frames
+    LINEAR,
+    // root of the mean power of the last frames; over the overlapping
+    // windowed frames of the FFT this is Welch's method
+    WELCH,
+    // maximum and minimum since the last restart of the hold
+    MAX_HOLD,
+    MIN_HOLD
+};
+
+
+struct AveragingConfig
+{
+    SpectralAveraging mode;
+    // averaging length; for the holds the number of frames after which the
+    // hold restarts, 0 to hold until reset()
+    uint32_t frames;
+    // stream time between emitted frames, 0 to emit for every input frame
+    uint32_t output_period_msec;
+};
+
+
+// Averages the frames of an FFT. The processor is connected directly to its
+// source and runs in the thread emitting the frames, so the averaging costs
+// O(bins) per input frame on the FFT worker and only the decimated output is
+// queued to its consumers. A change of the bin count or the band restarts
+// the average.
+class SpectralAverager: public QObject
+{
+    Q_OBJECT
+public:
+    SpectralAverager() = delete;
+    SpectralAverager(const FFTProcessor &source, const AveragingConfig &config);
+    SpectralAverager(const FFTBankOutput &source, const AveragingConfig &config);
+    SpectralAverager(const SpectralAverager &other) = delete;
+    SpectralAverager(SpectralAverager &&src) = delete;
+    SpectralAverager &operator=(const SpectralAverager &other) = delete;
+    SpectralAverager &operator=(SpectralAverager &&src) = delete;
+
+private:
+    const AveragingConfig m_config;
+
+    uint32_t m_bins;
+    float m_fmin;
+    float m_fmax;
+    // frames in the current average; for the sliding modes at most
+    // m_config.frames
+    uint32_t m_count;
+    std::vector<float> m_acc;
+
+    // ring of the last frames (squared for WELCH) for the sliding modes
+    std::vector<float> m_history;
+    uint32_t m_history_index;
+    // frames added since m_acc was last summed from scratch
+    uint32_t m_since_resum;
+    std::vector<float> m_scratch;
+
+    bool m_have_output_t;
+    global_clock::time_point m_output_t;
+    std::atomic<bool> m_reset_requested;
+
+    BlockPool<RealFFTBlock> m_pool;
+    LatencyHistogram &m_compute_time;
+
+private:
+    explicit SpectralAverager(const AveragingConfig &config);
+    void restart(const RealFFTBlock &block);
+    void add_sliding(const float *frame);
+    void resum();
+    void emit_average(const RealFFTBlock &input);
+
+public slots:
+    // called from one thread at a time, in stream order
+    void process_frame(std::shared_ptr<const RealFFTBlock> input_block);
+
+public:
+    // drops the average before the next frame; may be called from any thread
+    void reset();
+
+    inline const AveragingConfig &config() const
+    {
+        return m_config;
+    }
+
+signals:
+    void result_available(std::shared_ptr<const RealFFTBlock> data);
+
+};
+
+
+// mode:frames[:output msecs] with mode one of exp, linear, welch, max or
+// min, e.g. welch:8:100
+bool parse_averaging_config(const QString &text, AveragingConfig &config);
+// the mode as accepted by parse_averaging_config
+const char *averaging_mode_name(SpectralAveraging mode);
+
+#endif // SPECTRALAVERAGE_H
@@ -0,0 +1,611 @@
+#include "spectrogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "dsp.h"
+
+
+static const char FILE_MAGIC[8] = {'S', 'G', 'S', 'P', 'E', 'C', '0', '1'};
+static const char CHUNK_MAGIC[8] = {'S', 'G', 'C', 'H', 'U', 'N', 'K', '1'};
+static const char INDEX_MAGIC[8] = {'S', 'G', 'S', 'P', 'I', 'D', 'X', '1'};
+static constexpr std::size_t CHUNK_HEADER_SIZE = 64;
+static constexpr std::size_t INDEX_ENTRY_SIZE = 32;
+static constexpr std::size_t TRAILER_SIZE = 16;
+
+static inline uint64_t align_up(uint64_t n)
+{
+    return (n + SPECTROGRAM_ALIGNMENT - 1) / SPECTROGRAM_ALIGNMENT * SPECTROGRAM_ALIGNMENT;
+}
+
+static inline uint64_t chunk_size(uint32_t capacity, uint32_t bins,
+                                  SpectrogramEncoding encoding)
+{
+    return align_up(CHUNK_HEADER_SIZE + (uint64_t)capacity * sizeof(int64_t) +
+                    (uint64_t)capacity * bins * bytes_per_value(encoding));
+}
+
+template <typename T>
+static inline void put(char *dest, std::size_t offset, const T &value)
+{
+    std::memcpy(dest + offset, &value, sizeof(T));
+}
+
+template <typename T>
+static inline T get(const uchar *src, std::size_t offset)
+{
+    T value;
+    std::memcpy(&value, src + offset, sizeof(T));
+    return value;
+}
+
+uint32_t bytes_per_value(SpectrogramEncoding encoding)
+{
+    switch (encoding) {
+    case SpectrogramEncoding::FLOAT32:
+        return 4;
+    case SpectrogramEncoding::FLOAT16_DB:
+    case SpectrogramEncoding::UINT16_DB:
+        return 2;
+    case SpectrogramEncoding::UINT8_DB:
+        return 1;
+    }
+    throw std::invalid_argument("unknown spectrogram encoding");
+}
+
+
+/* SpectrogramWriter::Chunk */
+
+SpectrogramWriter::Chunk::Chunk(std::size_t capacity_bytes):
+    storage(new char[capacity_bytes + SPECTROGRAM_ALIGNMENT]),
+    data(reinterpret_cast<char*>(align_up(reinterpret_cast<uintptr_t>(storage.get())))),
+    capacity_bytes(capacity_bytes),
+    size(0),
+    frames(0),
+    capacity(0),
+    bins(0),
+    fmin(0),
+    fmax(0),
+    t_first(0),
+    t_last(0)
+{
+
+}
+
+int64_t *SpectrogramWriter::Chunk::times()
+{
+    return reinterpret_cast<int64_t*>(data + CHUNK_HEADER_SIZE);
+}
+
+char *SpectrogramWriter::Chunk::values()
+{
+    return data + CHUNK_HEADER_SIZE + (std::size_t)capacity * sizeof(int64_t);
+}
+
+
+/* SpectrogramWriter */
+
+SpectrogramWriter::SpectrogramWriter(const QString &path,
+                                     SpectrogramEncoding encoding,
+                                     uint32_t frames_per_chunk,
+                                     float db_min,
+                                     float db_max):
+    m_encoding(encoding),
+    m_frames_per_chunk(frames_per_chunk),
+    m_db_min(db_min),
+    m_db_max(db_max),
+    m_have_origin(false),
+    m_dropped_metric(MetricsRegistry::global().counter("spectrogram.dropped_chunks")),
+    m_blocking(false),
+    m_closing(false),
+    m_dropped_chunks(0),
+    m_failed(false),
+    m_file(path),
+    m_offset(SPECTROGRAM_ALIGNMENT),
+    m_closed(false)
+{
+    bytes_per_value(encoding);
+    if (frames_per_chunk == 0) {
+        throw std::invalid_argument("chunks must hold at least one frame");
+    }
+    if (!(db_max > db_min)) {
+        throw std::invalid_argument("empty dB range");
+    }
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        throw std::runtime_error("failed to open "+path.toStdString());
+    }
+
+    std::vector<char> header(SPECTROGRAM_ALIGNMENT, 0);
+    std::memcpy(header.data(), FILE_MAGIC, sizeof(FILE_MAGIC));
+    put(header.data(), 8, (uint32_t)encoding);
+    put(header.data(), 12, db_min);
+    put(header.data(), 16, db_max);
+    put(header.data(), 24, (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    if (m_file.write(header.data(), header.size()) != (int64_t)header.size()) {
+        throw std::runtime_error("failed to write "+path.toStdString());
+    }
+
+    m_thread = std::thread([this](){ write_loop(); });
+}
+
+SpectrogramWriter::~SpectrogramWriter()
+{
+    close();
+}
+
+std::unique_ptr<SpectrogramWriter::Chunk> SpectrogramWriter::acquire_chunk(uint32_t bins)
+{
+    const uint64_t size = chunk_size(m_frames_per_chunk, bins, m_encoding);
+    std::unique_ptr<Chunk> result;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto iter = m_free.begin(); iter != m_free.end(); ++iter) {
+            if ((*iter)->capacity_bytes >= size) {
+                result = std::move(*iter);
+                m_free.erase(iter);
+                break;
+            }
+        }
+    }
+    if (!result) {
+        result = std::make_unique<Chunk>(size);
+    }
+
+    std::memset(result->data, 0, size);
+    result->size = size;
+    result->frames = 0;
+    result->capacity = m_frames_per_chunk;
+    result->bins = bins;
+    return result;
+}
+
+void SpectrogramWriter::submit_current()
+{
+    std::unique_ptr<Chunk> chunk = std::move(m_current);
+
+    if (chunk->frames < chunk->capacity) {
+        // shrink the last chunk before a format change or the end
+        const std::size_t values_size = (std::size_t)chunk->frames * chunk->bins *
+                bytes_per_value(m_encoding);
+        const char *values = chunk->values();
+        chunk->capacity = chunk->frames;
+        std::memmove(chunk->values(), values, values_size);
+        const uint64_t used = chunk->values() + values_size - chunk->data;
+        chunk->size = chunk_size(chunk->capacity, chunk->bins, m_encoding);
+        std::memset(chunk->data + used, 0, chunk->size - used);
+    }
+
+    char *header = chunk->data;
+    std::memcpy(header, CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+    put(header, 8, chunk->size);
+    put(header, 16, chunk->frames);
+    put(header, 20, chunk->capacity);
+    put(header, 24, chunk->bins);
+    put(header, 28, chunk->fmax);
+    put(header, 32, chunk->t_first);
+    put(header, 40, chunk->t_last);
+    put(header, 48, chunk->fmin);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_blocking) {
+        m_space.wait(lock, [this](){ return m_pending.size() < MAX_PENDING_CHUNKS; });
+    }
+    if (m_pending.size() >= MAX_PENDING_CHUNKS) {
+        ++m_dropped_chunks;
+        m_dropped_metric.add();
+        m_free.emplace_back(std::move(chunk));
+        return;
+    }
+    m_pending.emplace_back(std::move(chunk));
+    m_wakeup.notify_one();
+}
+
+void SpectrogramWriter::encode(const RealFFTBlock &block, char *dest)
+{
+    const std::size_t n = block.fft.size();
+    switch (m_encoding) {
+    case SpectrogramEncoding::FLOAT32:
+    {
+        std::memcpy(dest, block.fft.data(), n * sizeof(float));
+        return;
+    }
+    case SpectrogramEncoding::FLOAT16_DB:
+    {
+        magnitudes_to_db_half(block.fft.data(), reinterpret_cast<uint16_t*>(dest), n);
+        return;
+    }
+    case SpectrogramEncoding::UINT16_DB:
+    case SpectrogramEncoding::UINT8_DB:
+    {
+        m_db_buffer.resize(n);
+        magnitudes_to_db(block.fft.data(), m_db_buffer.data(), n);
+        if (m_encoding == SpectrogramEncoding::UINT16_DB) {
+            quantize_u16(m_db_buffer.data(), reinterpret_cast<uint16_t*>(dest), n,
+                         m_db_min, 65535.f / (m_db_max - m_db_min));
+        } else {
+            quantize_u8(m_db_buffer.data(), reinterpret_cast<uint8_t*>(dest), n,
+                        m_db_min, 255.f / (m_db_max - m_db_min));
+        }
+        return;
+    }
+    }
+}
+
+void SpectrogramWriter::push(const RealFFTBlock &block)
+{
+    if (m_closed) {
+        throw std::logic_error("spectrogram already closed");
+    }
+    if (!m_have_origin) {
+        m_origin = block.t;
+        m_have_origin = true;
+    }
+    const int64_t t = std::chrono::duration_cast<std::chrono::microseconds>(
+                block.t - m_origin).count();
+    const uint32_t bins = block.fft.size();
+
+    if (m_current && (m_current->bins != bins || m_current->fmin != block.fmin ||
+                      m_current->fmax != block.fmax))
+    {
+        submit_current();
+    }
+    if (!m_current) {
+        m_current = acquire_chunk(bins);
+        m_current->fmin = block.fmin;
+        m_current->fmax = block.fmax;
+        m_current->t_first = t;
+    }
+
+    Chunk &chunk = *m_current;
+    chunk.times()[chunk.frames] = t;
+    chunk.t_last = t;
+    encode(block, chunk.values() +
+           (std::size_t)chunk.frames * bins * bytes_per_value(m_encoding));
+    ++chunk.frames;
+    if (chunk.frames == chunk.capacity) {
+        submit_current();
+    }
+}
+
+void SpectrogramWriter::set_blocking(bool blocking)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_blocking = blocking;
+}
+
+void SpectrogramWriter::close()
+{
+    if (m_closed) {
+        return;
+    }
+    if (m_current && m_current->frames > 0) {
+        submit_current();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+        m_wakeup.notify_one();
+    }
+    m_thread.join();
+    m_closed = true;
+}
+
+void SpectrogramWriter::write_loop()
+{
+    while (true) {
+        std::unique_ptr<Chunk> chunk;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this](){ return !m_pending.empty() || m_closing; });
+            if (m_pending.empty()) {
+                break;
+            }
+            chunk = std::move(m_pending.front());
+            m_pending.pop_front();
+        }
+        m_space.notify_one();
+
+        const bool success = write_chunk(*chunk);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failed = m_failed || !success;
+        m_free.emplace_back(std::move(chunk));
+    }
+
+    const bool success = write_index();
+    m_file.close();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_failed = m_failed || !success;
+}
+
+bool SpectrogramWriter::write_chunk(const Chunk &chunk)
+{
+    if (m_file.write(chunk.data, chunk.size) != (int64_t)chunk.size) {
+        return false;
+    }
+    m_index.emplace_back(IndexEntry{m_offset, chunk.t_first, chunk.t_last,
+                                    chunk.frames, chunk.bins});
+    m_offset += chunk.size;
+    return true;
+}
+
+bool SpectrogramWriter::write_index()
+{
+    std::vector<char> index(m_index.size() * INDEX_ENTRY_SIZE + TRAILER_SIZE);
+    char *dest = index.data();
+    for (const IndexEntry &entry: m_index) {
+        put(dest, 0, entry.offset);
+        put(dest, 8, entry.t_first);
+        put(dest, 16, entry.t_last);
+        put(dest, 24, entry.frames);
+        put(dest, 28, entry.bins);
+        dest += INDEX_ENTRY_SIZE;
+    }
+    put(dest, 0, m_offset);
+    std::memcpy(dest + 8, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    return m_file.write(index.data(), index.size()) == (int64_t)index.size() &&
+            m_file.flush();
+}
+
+bool SpectrogramWriter::ok() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_failed;
+}
+
+uint64_t SpectrogramWriter::dropped_chunks() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped_chunks;
+}
+
+
+/* SpectrogramReader */
+
+SpectrogramReader::SpectrogramReader(const QString &path):
+    m_file(path),
+    m_map(nullptr),
+    m_size(0),
+    m_frames(0)
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        throw std::runtime_error("failed to open "+path.toStdString());
+    }
+    m_size = m_file.size();
+    if (m_size < SPECTROGRAM_ALIGNMENT) {
+        throw std::runtime_error("not a spectrogram file: "+path.toStdString());
+    }
+    m_map = m_file.map(0, m_size);
+    if (!m_map) {
+        throw std::runtime_error("failed to map "+path.toStdString());
+    }
+    if (std::memcmp(m_map, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+        throw std::runtime_error("not a spectrogram file: "+path.toStdString());
+    }
+    m_encoding = (SpectrogramEncoding)get<uint32_t>(m_map, 8);
+    bytes_per_value(m_encoding);
+    m_db_min = get<float>(m_map, 12);
+    m_db_max = get<float>(m_map, 16);
+
+    if (!read_index()) {
+        scan_chunks();
+    }
+}
+
+SpectrogramReader::~SpectrogramReader()
+{
+    if (m_map) {
+        m_file.unmap(m_map);
+    }
+}
+
+bool SpectrogramReader::read_index()
+{
+    if (m_size < SPECTROGRAM_ALIGNMENT + TRAILER_SIZE ||
+            std::memcmp(m_map + m_size - 8, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+    {
+        return false;
+    }
+    const uint64_t index_offset = get<uint64_t>(m_map, m_size - TRAILER_SIZE);
+    if (index_offset < SPECTROGRAM_ALIGNMENT ||
+            index_offset > m_size - TRAILER_SIZE ||
+            (m_size - TRAILER_SIZE - index_offset) % INDEX_ENTRY_SIZE != 0)
+    {
+        return false;
+    }
+
+    const uint64_t entries = (m_size - TRAILER_SIZE - index_offset) / INDEX_ENTRY_SIZE;
+    for (uint64_t i = 0; i < entries; ++i) {
+        const uint64_t offset = get<uint64_t>(m_map, index_offset + i * INDEX_ENTRY_SIZE);
+        uint64_t size;
+        if (!add_chunk(offset, index_offset, size)) {
+            m_chunks.clear();
+            m_frames = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+void SpectrogramReader::scan_chunks()
+{
+    uint64_t offset = SPECTROGRAM_ALIGNMENT;
+    uint64_t size;
+    while (add_chunk(offset, m_size, size)) {
+        offset += size;
+    }
+}
+
+bool SpectrogramReader::add_chunk(uint64_t offset, uint64_t end, uint64_t &size)
+{
+    if (offset % SPECTROGRAM_ALIGNMENT != 0 || offset + CHUNK_HEADER_SIZE > end) {
+        return false;
+    }
+    const uchar *header = m_map + offset;
+    if (std::memcmp(header, CHUNK_MAGIC, sizeof(CHUNK_MAGIC)) != 0) {
+        return false;
+    }
+
+    ChunkInfo chunk;
+    chunk.offset = offset;
+    chunk.first_frame = m_frames;
+    size = get<uint64_t>(header, 8);
+    chunk.frames = get<uint32_t>(header, 16);
+    chunk.capacity = get<uint32_t>(header, 20);
+    chunk.bins = get<uint32_t>(header, 24);
+    chunk.fmax = get<float>(header, 28);
+    chunk.t_first = get<int64_t>(header, 32);
+    chunk.t_last = get<int64_t>(header, 40);
+    chunk.fmin = get<float>(header, 48);
+    if (chunk.frames > chunk.capacity ||
+            size != chunk_size(chunk.capacity, chunk.bins, m_encoding) ||
+            size > end - offset)
+    {
+        return false;
+    }
+
+    if (chunk.frames > 0) {
+        m_chunks.push_back(chunk);
+        m_frames += chunk.frames;
+    }
+    return true;
+}
+
+const SpectrogramReader::ChunkInfo &SpectrogramReader::chunk_of(uint64_t frame) const
+{
+    if (frame >= m_frames) {
+        throw std::out_of_range("frame out of range");
+    }
+    auto iter = std::upper_bound(
+                m_chunks.begin(), m_chunks.end(), frame,
+                [](uint64_t frame, const ChunkInfo &chunk){
+        return frame < chunk.first_frame;
+    });
+    return *(iter - 1);
+}
+
+const char *SpectrogramReader::values_of(const ChunkInfo &chunk, uint64_t frame) const
+{
+    return reinterpret_cast<const char*>(m_map) + chunk.offset + CHUNK_HEADER_SIZE +
+            (uint64_t)chunk.capacity * sizeof(int64_t) +
+            (frame - chunk.first_frame) * chunk.bins * bytes_per_value(m_encoding);
+}
+
+int64_t SpectrogramReader::frame_time(uint64_t frame) const
+{
+    const ChunkInfo &chunk = chunk_of(frame);
+    return get<int64_t>(m_map, chunk.offset + CHUNK_HEADER_SIZE +
+                        (frame - chunk.first_frame) * sizeof(int64_t));
+}
+
+uint32_t SpectrogramReader::frame_bins(uint64_t frame) const
+{
+    return chunk_of(frame).bins;
+}
+
+float SpectrogramReader::frame_fmin(uint64_t frame) const
+{
+    return chunk_of(frame).fmin;
+}
+
+float SpectrogramReader::frame_fmax(uint64_t frame) const
+{
+    return chunk_of(frame).fmax;
+}
+
+uint64_t SpectrogramReader::find_frame(int64_t t_usec) const
+{
+    // find the chunk by its time range first, then the frame within it
+    auto iter = std::lower_bound(
+                m_chunks.begin(), m_chunks.end(), t_usec,
+                [](const ChunkInfo &chunk, int64_t t){
+        return chunk.t_last < t;
+    });
+    if (iter == m_chunks.end()) {
+        return m_frames;
+    }
+    uint64_t lo = iter->first_frame;
+    uint64_t hi = iter->first_frame + iter->frames;
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        const int64_t t = get<int64_t>(m_map, iter->offset + CHUNK_HEADER_SIZE +
+                                       (mid - iter->first_frame) * sizeof(int64_t));
+        if (t < t_usec) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void SpectrogramReader::read_db(uint64_t frame, float *dest) const
+{
+    read_db(frame, 0, frame_bins(frame), dest);
+}
+
+void SpectrogramReader::read_db(uint64_t frame, uint32_t first_bin, uint32_t count,
+                                float *dest) const
+{
+    const ChunkInfo &chunk = chunk_of(frame);
+    if ((uint64_t)first_bin + count > chunk.bins) {
+        throw std::out_of_range("bins out of range");
+    }
+    const char *values = values_of(chunk, frame) +
+            (std::size_t)first_bin * bytes_per_value(m_encoding);
+    const std::size_t n = count;
+    switch (m_encoding) {
+    case SpectrogramEncoding::FLOAT32:
+    {
+        std::memcpy(dest, values, n * sizeof(float));
+        magnitudes_to_db(dest, dest, n);
+        return;
+    }
+    case SpectrogramEncoding::FLOAT16_DB:
+    {
+        half_to_float(reinterpret_cast<const uint16_t*>(values), dest, n);
+        return;
+    }
+    case SpectrogramEncoding::UINT16_DB:
+    {
+        const float step = (m_db_max - m_db_min) / 65535.f;
+        const uint16_t *src = reinterpret_cast<const uint16_t*>(values);
+        for (std::size_t i = 0; i < n; ++i) {
+            dest[i] = m_db_min + src[i] * step;
+        }
+        return;
+    }
+    case SpectrogramEncoding::UINT8_DB:
+    {
+        const float step = (m_db_max - m_db_min) / 255.f;
+        const uint8_t *src = reinterpret_cast<const uint8_t*>(values);
+        for (std::size_t i = 0; i < n; ++i) {
+            dest[i] = m_db_min + src[i] * step;
+        }
+        return;
+    }
+    }
+}
+
+void SpectrogramReader::read_frame(uint64_t frame, RealFFTBlock &dest) const
+{
+    const ChunkInfo &chunk = chunk_of(frame);
+    dest.t = global_clock::time_point(std::chrono::microseconds(frame_time(frame)));
+    dest.published = global_clock::now();
+    // spectrograms are written from the downmix
+    dest.channel = SampleBlock::DOWNMIX;
+    dest.fmin = chunk.fmin;
+    dest.fmax = chunk.fmax;
+    dest.fft.resize(chunk.bins);
+    if (m_encoding == SpectrogramEncoding::FLOAT32) {
+        std::memcpy(dest.fft.data(), values_of(chunk, frame), chunk.bins * sizeof(float));
+        return;
+    }
+    read_db(frame, dest.fft.data());
+    for (float &value: dest.fft) {
+        // 10^(dB/20)
+        value = std::exp2(value * 0.16609640474f);
+    }
+}
@@ -0,0 +1,243 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <condition_variable>
+#include <deque>
+#include <thread>
+
+#include <QFile>
+
+#include "engine.h"
+
+
+enum class SpectrogramEncoding: uint32_t
+{
+    // linear magnitudes as they come from the FFT
+    FLOAT32 = 0,
+    // dB as IEEE half floats
+    FLOAT16_DB = 1,
+    // dB quantized linearly between db_min and db_max
+    UINT16_DB = 2,
+    UINT8_DB = 3
+};
+
+uint32_t bytes_per_value(SpectrogramEncoding encoding);
+
+
+// On-disk layout of spectrogram files. All values are in host byte order,
+// like the .fft files of the batch mode.
+//
+//   file header, SPECTROGRAM_ALIGNMENT bytes:
+//     char[8] "SGSPEC01", uint32 encoding, float db_min, float db_max,
+//     uint32 reserved, int64 created (usecs since the Unix epoch)
+//   chunks, each starting at a multiple of SPECTROGRAM_ALIGNMENT:
+//     chunk header, 64 bytes:
+//       char[8] "SGCHUNK1", uint64 size (including header and padding),
+//       uint32 frames, uint32 capacity, uint32 bins, float fmax,
+//       int64 t_first, int64 t_last, float fmin, zero padding
+//     int64 t[capacity], the time of each frame
+//     capacity * bins encoded values
+//     zero padding up to the next multiple of SPECTROGRAM_ALIGNMENT
+//   index, written when the file is closed:
+//     chunk count times {uint64 offset, int64 t_first, int64 t_last,
+//                        uint32 frames, uint32 bins}
+//     uint64 index offset, char[8] "SGSPIDX1"
+//
+// Times are usecs relative to the origin of the recording. Files without
+// an index (e.g. because the writer crashed) are read by walking the chunks.
+static constexpr std::size_t SPECTROGRAM_ALIGNMENT = 4096;
+
+
+// Appends FFT frames to a spectrogram file. Frames are encoded by the
+// caller into the current chunk; full chunks are written by a background
+// thread with one large aligned write each. If the disk cannot keep up,
+// chunks beyond MAX_PENDING_CHUNKS are dropped and counted, or, for
+// recordings of sources which can wait, push blocks until there is room.
+class SpectrogramWriter
+{
+public:
+    static constexpr uint32_t DEFAULT_FRAMES_PER_CHUNK = 256;
+    static constexpr std::size_t MAX_PENDING_CHUNKS = 16;
+    static constexpr float DEFAULT_DB_MIN = -160.f;
+    static constexpr float DEFAULT_DB_MAX = 20.f;
+
+public:
+    SpectrogramWriter() = delete;
+    SpectrogramWriter(const QString &path,
+                      SpectrogramEncoding encoding,
+                      uint32_t frames_per_chunk = DEFAULT_FRAMES_PER_CHUNK,
+                      float db_min = DEFAULT_DB_MIN,
+                      float db_max = DEFAULT_DB_MAX);
+    SpectrogramWriter(const SpectrogramWriter &other) = delete;
+    SpectrogramWriter(SpectrogramWriter &&src) = delete;
+    SpectrogramWriter &operator=(const SpectrogramWriter &other) = delete;
+    SpectrogramWriter &operator=(SpectrogramWriter &&src) = delete;
+    ~SpectrogramWriter();
+
+private:
+    struct Chunk
+    {
+        explicit Chunk(std::size_t capacity_bytes);
+
+        std::unique_ptr<char[]> storage;
+        // SPECTROGRAM_ALIGNMENT aligned view into storage
+        char *data;
+        std::size_t capacity_bytes;
+
+        uint64_t size;
+        uint32_t frames;
+        uint32_t capacity;
+        uint32_t bins;
+        float fmin;
+        float fmax;
+        int64_t t_first;
+        int64_t t_last;
+
+        int64_t *times();
+        char *values();
+    };
+
+    struct IndexEntry
+    {
+        uint64_t offset;
+        int64_t t_first;
+        int64_t t_last;
+        uint32_t frames;
+        uint32_t bins;
+    };
+
+    const SpectrogramEncoding m_encoding;
+    const uint32_t m_frames_per_chunk;
+    const float m_db_min;
+    const float m_db_max;
+
+    // producer side
+    bool m_have_origin;
+    global_clock::time_point m_origin;
+    std::unique_ptr<Chunk> m_current;
+    std::vector<float> m_db_buffer;
+    MetricCounter &m_dropped_metric;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_space;
+    std::deque<std::unique_ptr<Chunk> > m_pending;
+    bool m_blocking;
+    std::vector<std::unique_ptr<Chunk> > m_free;
+    bool m_closing;
+    uint64_t m_dropped_chunks;
+    bool m_failed;
+
+    // writer thread only
+    QFile m_file;
+    uint64_t m_offset;
+    std::vector<IndexEntry> m_index;
+
+    std::thread m_thread;
+    bool m_closed;
+
+private:
+    std::unique_ptr<Chunk> acquire_chunk(uint32_t bins);
+    void submit_current();
+    void encode(const RealFFTBlock &block, char *dest);
+    void write_loop();
+    bool write_chunk(const Chunk &chunk);
+    bool write_index();
+
+public:
+    // whether push waits for the disk instead of dropping chunks; off by
+    // default, for live sources which must not be held up
+    void set_blocking(bool blocking);
+    // called from one thread at a time; frames must be in time order
+    void push(const RealFFTBlock &block);
+    // writes what is buffered and the index and closes the file; called
+    // from the pushing thread
+    void close();
+
+    // false once a write has failed
+    bool ok() const;
+    uint64_t dropped_chunks() const;
+
+    inline SpectrogramEncoding encoding() const
+    {
+        return m_encoding;
+    }
+
+};
+
+
+// Memory maps a spectrogram file for random access to its frames.
+class SpectrogramReader
+{
+public:
+    SpectrogramReader() = delete;
+    explicit SpectrogramReader(const QString &path);
+    SpectrogramReader(const SpectrogramReader &other) = delete;
+    SpectrogramReader(SpectrogramReader &&src) = delete;
+    SpectrogramReader &operator=(const SpectrogramReader &other) = delete;
+    SpectrogramReader &operator=(SpectrogramReader &&src) = delete;
+    ~SpectrogramReader();
+
+private:
+    struct ChunkInfo
+    {
+        uint64_t offset;
+        uint64_t first_frame;
+        uint32_t frames;
+        uint32_t capacity;
+        uint32_t bins;
+        float fmin;
+        float fmax;
+        int64_t t_first;
+        int64_t t_last;
+    };
+
+    QFile m_file;
+    uchar *m_map;
+    uint64_t m_size;
+
+    SpectrogramEncoding m_encoding;
+    float m_db_min;
+    float m_db_max;
+    std::vector<ChunkInfo> m_chunks;
+    uint64_t m_frames;
+
+private:
+    bool read_index();
+    void scan_chunks();
+    // appends the chunk at offset if it is valid and ends before end
+    bool add_chunk(uint64_t offset, uint64_t end, uint64_t &size);
+    const ChunkInfo &chunk_of(uint64_t frame) const;
+    const char *values_of(const ChunkInfo &chunk, uint64_t frame) const;
+
+public:
+    inline SpectrogramEncoding encoding() const
+    {
+        return m_encoding;
+    }
+
+    inline uint64_t frame_count() const
+    {
+        return m_frames;
+    }
+
+    int64_t frame_time(uint64_t frame) const;
+    uint32_t frame_bins(uint64_t frame) const;
+    float frame_fmin(uint64_t frame) const;
+    float frame_fmax(uint64_t frame) const;
+
+    // index of the first frame at or after t, frame_count() if none
+    uint64_t find_frame(int64_t t_usec) const;
+
+    // dest must hold frame_bins(frame) values
+    void read_db(uint64_t frame, float *dest) const;
+    // only count bins from first_bin on; the range must be within the frame
+    void read_db(uint64_t frame, uint32_t first_bin, uint32_t count,
+                 float *dest) const;
+    // linear magnitudes like those of the FFT processors; t counts from the
+    // epoch of global_clock by the recorded usecs
+    void read_frame(uint64_t frame, RealFFTBlock &dest) const;
+
+};
+
+#endif // SPECTROGRAM_H
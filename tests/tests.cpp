@@ -0,0 +1,630 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+
+#include "dsp.h"
+#include "engine.h"
+#include "ringbuffer.h"
+#include "spectrogram.h"
+
+
+namespace {
+
+// odd lengths and lengths just around the vector widths, so that both the
+// vectorised loops and the scalar tails run
+static const std::size_t LENGTHS[] = {0, 1, 3, 4, 5, 7, 8, 15, 16, 17, 31, 33, 100, 1027};
+
+int failures = 0;
+
+void fail(const std::string &test, const std::string &what)
+{
+    std::cerr << "FAIL " << test << ": " << what << std::endl;
+    ++failures;
+}
+
+bool near(float a, float b, float tolerance)
+{
+    return std::fabs(a - b) <= tolerance * std::max(1.f, std::fabs(b));
+}
+
+void check_near(const std::string &test,
+                const std::vector<float> &actual,
+                const std::vector<float> &expected,
+                float tolerance)
+{
+    if (actual.size() != expected.size()) {
+        fail(test, "size " + std::to_string(actual.size()) +
+             " != " + std::to_string(expected.size()));
+        return;
+    }
+    for (std::size_t i = 0; i < actual.size(); ++i) {
+        if (!near(actual[i], expected[i], tolerance)) {
+            fail(test, "at " + std::to_string(i) + ": " +
+                 std::to_string(actual[i]) + " != " + std::to_string(expected[i]));
+            return;
+        }
+    }
+}
+
+std::vector<float> random_floats(std::mt19937 &rng, std::size_t n,
+                                 float min, float max)
+{
+    std::uniform_real_distribution<float> dist(min, max);
+    std::vector<float> result(n);
+    for (float &v: result) {
+        v = dist(rng);
+    }
+    return result;
+}
+
+std::string with_size(const char *name, std::size_t n)
+{
+    return std::string(name) + "/" + std::to_string(n);
+}
+
+
+/* DSP kernels against scalar references */
+
+void test_elementwise(std::mt19937 &rng)
+{
+    for (std::size_t n: LENGTHS) {
+        const std::vector<float> a = random_floats(rng, n, -2, 2);
+        const std::vector<float> b = random_floats(rng, n, -2, 2);
+        std::vector<float> actual(n);
+        std::vector<float> expected(n);
+
+        multiply(a.data(), b.data(), actual.data(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = a[i] * b[i];
+        }
+        check_near(with_size("multiply", n), actual, expected, 1e-6f);
+
+        double sum = 0;
+        double dot = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            sum += a[i] * a[i];
+            dot += a[i] * b[i];
+        }
+        check_near(with_size("sum_of_squares", n),
+                   {sum_of_squares(a.data(), n)}, {(float)sum}, 1e-5f);
+        check_near(with_size("dot_product", n),
+                   {dot_product(a.data(), b.data(), n)}, {(float)dot}, 1e-4f);
+
+        scale(a.data(), actual.data(), n, 0.25f);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = a[i] * 0.25f;
+        }
+        check_near(with_size("scale", n), actual, expected, 1e-6f);
+
+        scaled_sqrt(a.data(), actual.data(), n, 3.f);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = std::sqrt(std::max(a[i] * 3.f, 0.f));
+        }
+        check_near(with_size("scaled_sqrt", n), actual, expected, 1e-6f);
+    }
+}
+
+void test_accumulators(std::mt19937 &rng)
+{
+    for (std::size_t n: LENGTHS) {
+        const std::vector<float> src = random_floats(rng, n, -1, 1);
+        const std::vector<float> remove = random_floats(rng, n, -1, 1);
+        const std::vector<float> initial = random_floats(rng, n, -1, 1);
+        std::vector<float> actual;
+        std::vector<float> expected;
+
+        actual = expected = initial;
+        exponential_average(src.data(), actual.data(), n, 0.1f);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] += 0.1f * (src[i] - expected[i]);
+        }
+        check_near(with_size("exponential_average", n), actual, expected, 1e-6f);
+
+        actual = expected = initial;
+        accumulate(src.data(), actual.data(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] += src[i];
+        }
+        check_near(with_size("accumulate", n), actual, expected, 1e-6f);
+
+        actual = expected = initial;
+        sliding_update(src.data(), remove.data(), actual.data(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] += src[i] - remove[i];
+        }
+        check_near(with_size("sliding_update", n), actual, expected, 1e-6f);
+
+        actual = expected = initial;
+        max_hold(src.data(), actual.data(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = std::max(expected[i], src[i]);
+        }
+        check_near(with_size("max_hold", n), actual, expected, 0);
+
+        actual = expected = initial;
+        min_hold(src.data(), actual.data(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = std::min(expected[i], src[i]);
+        }
+        check_near(with_size("min_hold", n), actual, expected, 0);
+
+        actual.assign((n + 1) / 2, 0.f);
+        expected.assign((n + 1) / 2, 0.f);
+        max_hold_halve(src.data(), actual.data(), n);
+        for (std::size_t i = 0; i < expected.size(); ++i) {
+            expected[i] = 2*i + 1 < n ? std::max(src[2*i], src[2*i+1]) : src[2*i];
+        }
+        check_near(with_size("max_hold_halve", n), actual, expected, 0);
+    }
+}
+
+void test_complex(std::mt19937 &rng)
+{
+    for (std::size_t n: LENGTHS) {
+        const std::vector<float> src = random_floats(rng, 2 * n, -3, 3);
+        std::vector<float> actual(n);
+        std::vector<float> expected(n);
+        complex_magnitudes(src.data(), actual.data(), n, 0.5f);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = std::hypot(src[2*i], src[2*i+1]) * 0.5f;
+        }
+        check_near(with_size("complex_magnitudes", n), actual, expected, 1e-6f);
+
+        const std::vector<float> real = random_floats(rng, n, -1, 1);
+        std::vector<float> re(n);
+        std::vector<float> im(n);
+        std::vector<float> expected_im(n);
+        const double phase = 0.3;
+        const double step = 0.01;
+        mix_down(real.data(), re.data(), im.data(), n, phase, step);
+        for (std::size_t i = 0; i < n; ++i) {
+            const double angle = phase + i * step;
+            expected[i] = real[i] * std::cos(angle);
+            expected_im[i] = -real[i] * std::sin(angle);
+        }
+        check_near(with_size("mix_down/re", n), re, expected, 1e-5f);
+        check_near(with_size("mix_down/im", n), im, expected_im, 1e-5f);
+    }
+}
+
+template <typename int_t>
+void test_converter(std::mt19937 &rng, const char *name,
+                    void (*convert)(const void*, float*, std::size_t))
+{
+    std::uniform_int_distribution<int64_t> dist(std::numeric_limits<int_t>::min(),
+                                                std::numeric_limits<int_t>::max());
+    const double range = (double)std::numeric_limits<int_t>::max() -
+            (double)std::numeric_limits<int_t>::min();
+    for (std::size_t n: LENGTHS) {
+        std::vector<int_t> src(n);
+        for (int_t &v: src) {
+            v = (int_t)dist(rng);
+        }
+        // the extremes must map onto the ends of [-1, 1]
+        if (n >= 2) {
+            src[0] = std::numeric_limits<int_t>::min();
+            src[n-1] = std::numeric_limits<int_t>::max();
+        }
+        std::vector<float> actual(n);
+        std::vector<float> expected(n);
+        convert(src.data(), actual.data(), n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = (float)(((double)src[i] - std::numeric_limits<int_t>::min())
+                                  * 2 / range - 1);
+        }
+        check_near(with_size(name, n), actual, expected, 1e-6f);
+    }
+}
+
+void test_converters(std::mt19937 &rng)
+{
+    test_converter<int8_t>(rng, "convert_s8", convert_s8);
+    test_converter<uint8_t>(rng, "convert_u8", convert_u8);
+    test_converter<int16_t>(rng, "convert_s16", convert_s16);
+    test_converter<uint16_t>(rng, "convert_u16", convert_u16);
+    test_converter<int32_t>(rng, "convert_s32", convert_s32);
+    test_converter<uint32_t>(rng, "convert_u32", convert_u32);
+
+    // in place, with the raw samples in the tail of the float buffer
+    const std::size_t n = 37;
+    std::vector<int16_t> raw(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        raw[i] = (int16_t)(i * 1771 - 32768);
+    }
+    std::vector<float> expected(n);
+    convert_s16(raw.data(), expected.data(), n);
+    std::vector<float> buffer(n);
+    char *tail = reinterpret_cast<char*>(buffer.data()) + n * (sizeof(float) - sizeof(int16_t));
+    std::memcpy(tail, raw.data(), n * sizeof(int16_t));
+    convert_s16(tail, buffer.data(), n);
+    check_near("convert_s16/in_place", buffer, expected, 0);
+}
+
+void test_db(std::mt19937 &rng)
+{
+    for (std::size_t n: LENGTHS) {
+        std::vector<float> src(n);
+        std::uniform_real_distribution<float> exponent(-25, 6);
+        for (float &v: src) {
+            v = std::pow(10.f, exponent(rng));
+        }
+        if (n >= 3) {
+            src[0] = 0;
+            src[1] = -1;
+            src[2] = MIN_MAGNITUDE / 10;
+        }
+        std::vector<float> expected(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            expected[i] = 20 * std::log10(std::max(src[i], MIN_MAGNITUDE));
+        }
+
+        std::vector<float> actual(n);
+        magnitudes_to_db(src.data(), actual.data(), n);
+        std::vector<float> error(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            error[i] = actual[i] - expected[i];
+        }
+        check_near(with_size("magnitudes_to_db", n), error,
+                   std::vector<float>(n, 0.f), 0.002f);
+
+        // halves have 11 significant bits
+        std::vector<uint16_t> half(n);
+        magnitudes_to_db_half(src.data(), half.data(), n);
+        half_to_float(half.data(), actual.data(), n);
+        check_near(with_size("magnitudes_to_db_half", n), actual, expected, 2e-3f);
+    }
+}
+
+void test_quantize(std::mt19937 &rng)
+{
+    for (std::size_t n: LENGTHS) {
+        // some values outside of the range, so that saturation is covered
+        const std::vector<float> src = random_floats(rng, n, -200, 50);
+        const float offset = -160;
+        const float scale_u8 = 255.f / 180;
+        const float scale_u16 = 65535.f / 180;
+
+        std::vector<uint8_t> u8(n);
+        std::vector<uint16_t> u16(n);
+        quantize_u8(src.data(), u8.data(), n, offset, scale_u8);
+        quantize_u16(src.data(), u16.data(), n, offset, scale_u16);
+        for (std::size_t i = 0; i < n; ++i) {
+            const float q8 = std::min(255.f, std::max(0.f, std::nearbyint(
+                                                          (src[i] - offset) * scale_u8)));
+            const float q16 = std::min(65535.f, std::max(0.f, std::nearbyint(
+                                                             (src[i] - offset) * scale_u16)));
+            if (std::fabs(u8[i] - q8) > 1) {
+                fail(with_size("quantize_u8", n), "at " + std::to_string(i));
+                break;
+            }
+            if (std::fabs(u16[i] - q16) > 1) {
+                fail(with_size("quantize_u16", n), "at " + std::to_string(i));
+                break;
+            }
+        }
+    }
+}
+
+void test_peaks(std::mt19937 &rng)
+{
+    for (std::size_t n: LENGTHS) {
+        std::vector<float> src = random_floats(rng, n, 0, 1);
+        // plateaus count once, at their left end
+        if (n >= 8) {
+            src[4] = src[5] = 2;
+        }
+        const std::vector<float> threshold(n, 0.3f);
+        std::vector<uint32_t> actual(n / 2 + 1);
+        actual.resize(find_peaks(src.data(), threshold.data(), n, actual.data()));
+        std::vector<uint32_t> expected;
+        for (std::size_t i = 1; i + 1 < n; ++i) {
+            if (src[i-1] < src[i] && src[i] >= src[i+1] && src[i] > threshold[i]) {
+                expected.push_back(i);
+            }
+        }
+        if (actual != expected) {
+            fail(with_size("find_peaks", n), "different peaks");
+        }
+    }
+}
+
+void test_channels(std::mt19937 &rng)
+{
+    for (uint32_t channels = 1; channels <= 8; ++channels) {
+        for (std::size_t frames: LENGTHS) {
+            const std::vector<float> src = random_floats(rng, frames * channels, -1, 1);
+            const std::string name = std::to_string(channels) + "ch/" + std::to_string(frames);
+
+            std::vector<float> actual(frames);
+            std::vector<float> expected(frames);
+            downmix(src.data(), actual.data(), frames, channels);
+            for (std::size_t i = 0; i < frames; ++i) {
+                float sum = 0;
+                for (uint32_t c = 0; c < channels; ++c) {
+                    sum += src[i*channels + c];
+                }
+                expected[i] = sum;
+            }
+            check_near("downmix/" + name, actual, expected, 1e-5f);
+
+            const std::size_t stride = frames + 3;
+            actual.assign(channels * stride, 0.f);
+            expected.assign(channels * stride, 0.f);
+            deinterleave(src.data(), actual.data(), frames, channels, stride);
+            for (std::size_t i = 0; i < frames; ++i) {
+                for (uint32_t c = 0; c < channels; ++c) {
+                    expected[c*stride + i] = src[i*channels + c];
+                }
+            }
+            check_near("deinterleave/" + name, actual, expected, 0);
+        }
+    }
+}
+
+
+/* SampleBlock */
+
+void test_sample_block(std::mt19937 &rng)
+{
+    for (uint32_t channels = 1; channels <= 4; ++channels) {
+        const std::size_t frames = 37;
+        const std::vector<float> src = random_floats(rng, frames * channels, -1, 1);
+        SampleBlock block;
+        block.set_layout(channels, frames);
+        deinterleave(src.data(), block.planar.data(), frames, channels, block.stride);
+
+        std::vector<float> expected(frames);
+        downmix(src.data(), expected.data(), frames, channels);
+        const float *mono = block.samples(SampleBlock::DOWNMIX);
+        const std::string name = "sample_block/" + std::to_string(channels) + "ch";
+        if (mono == nullptr) {
+            fail(name, "no downmix");
+            continue;
+        }
+        check_near(name, std::vector<float>(mono, mono + frames), expected, 1e-5f);
+        if (block.samples(channels) != nullptr) {
+            fail(name, "channel beyond the last");
+        }
+    }
+}
+
+
+/* SPSCRingBuffer */
+
+void test_spsc_ring()
+{
+    SPSCRingBuffer<int> ring(7);
+    int next_write = 0;
+    int next_read = 0;
+    // chunk sizes which do not divide the capacity, so the positions wrap
+    // at every offset
+    for (int round = 0; round < 100; ++round) {
+        std::vector<int> chunk(round % 5 + 1);
+        for (int &v: chunk) {
+            v = next_write++;
+        }
+        const std::size_t written = ring.write(chunk.data(), chunk.size());
+        next_write -= (int)(chunk.size() - written);
+        if (ring.size() > ring.capacity()) {
+            fail("spsc_ring", "size beyond capacity");
+            return;
+        }
+
+        std::size_t to_read = round % 3 + 1;
+        while (to_read > 0 && !ring.empty()) {
+            const std::pair<const int*, std::size_t> run = ring.peek();
+            const std::size_t take = std::min(to_read, run.second);
+            for (std::size_t i = 0; i < take; ++i) {
+                if (run.first[i] != next_read++) {
+                    fail("spsc_ring", "out of order at round " + std::to_string(round));
+                    return;
+                }
+            }
+            ring.consume(take);
+            to_read -= take;
+        }
+    }
+
+    // a capacity of 0 is raised to 1
+    SPSCRingBuffer<int> tiny(0);
+    const int values[] = {1, 2, 3};
+    if (tiny.capacity() != 1 || tiny.write(values, 3) != 1 ||
+            tiny.peek().second != 1 || *tiny.peek().first != 1) {
+        fail("spsc_ring", "capacity 0");
+    }
+    tiny.reset(0);
+    if (tiny.capacity() != 1 || !tiny.empty()) {
+        fail("spsc_ring", "reset to capacity 0");
+    }
+}
+
+
+/* Spectrogram files */
+
+static constexpr uint32_t SPECTROGRAM_BINS = 65;
+static constexpr uint32_t SPECTROGRAM_FRAMES = 100;
+static constexpr uint32_t FRAMES_PER_CHUNK = 16;
+static constexpr int64_t FRAME_USECS = 10000;
+
+std::vector<RealFFTBlock> make_frames(std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> exponent(-7, 1);
+    const global_clock::time_point origin = global_clock::now();
+    std::vector<RealFFTBlock> frames(SPECTROGRAM_FRAMES);
+    for (uint32_t k = 0; k < SPECTROGRAM_FRAMES; ++k) {
+        RealFFTBlock &frame = frames[k];
+        frame.t = origin + std::chrono::microseconds(k * FRAME_USECS);
+        frame.channel = SampleBlock::DOWNMIX;
+        frame.fmin = 0;
+        frame.fmax = 24000;
+        frame.fft.resize(SPECTROGRAM_BINS);
+        for (float &v: frame.fft) {
+            v = std::pow(10.f, exponent(rng));
+        }
+    }
+    return frames;
+}
+
+void check_spectrogram(const std::string &test,
+                       const QString &path,
+                       SpectrogramEncoding encoding,
+                       const std::vector<RealFFTBlock> &frames)
+{
+    const SpectrogramReader reader(path);
+    if (reader.encoding() != encoding) {
+        fail(test, "wrong encoding");
+        return;
+    }
+    if (reader.frame_count() != frames.size()) {
+        fail(test, "read " + std::to_string(reader.frame_count()) + " frames");
+        return;
+    }
+
+    const float db_step = (SpectrogramWriter::DEFAULT_DB_MAX - SpectrogramWriter::DEFAULT_DB_MIN) /
+            (encoding == SpectrogramEncoding::UINT8_DB ? 255 : 65535);
+    std::vector<float> db(SPECTROGRAM_BINS);
+    for (uint32_t k = 0; k < frames.size(); ++k) {
+        const std::string frame_test = test + "/frame " + std::to_string(k);
+        if (reader.frame_time(k) != k * FRAME_USECS ||
+                reader.find_frame(k * FRAME_USECS) != k ||
+                reader.find_frame(k * FRAME_USECS - 1) != k) {
+            fail(frame_test, "wrong time");
+            return;
+        }
+        if (reader.frame_bins(k) != SPECTROGRAM_BINS ||
+                reader.frame_fmin(k) != frames[k].fmin ||
+                reader.frame_fmax(k) != frames[k].fmax) {
+            fail(frame_test, "wrong bins");
+            return;
+        }
+
+        std::vector<float> expected_db(SPECTROGRAM_BINS);
+        for (uint32_t i = 0; i < SPECTROGRAM_BINS; ++i) {
+            expected_db[i] = 20 * std::log10(frames[k].fft[i]);
+        }
+        reader.read_db(k, db.data());
+        switch (encoding) {
+        case SpectrogramEncoding::FLOAT32:
+        {
+            RealFFTBlock block;
+            reader.read_frame(k, block);
+            check_near(frame_test, block.fft, frames[k].fft, 0);
+            check_near(frame_test + "/db", db, expected_db, 2e-3f);
+            break;
+        }
+        case SpectrogramEncoding::FLOAT16_DB:
+            check_near(frame_test, db, expected_db, 2e-3f);
+            break;
+        case SpectrogramEncoding::UINT16_DB:
+        case SpectrogramEncoding::UINT8_DB:
+            for (uint32_t i = 0; i < SPECTROGRAM_BINS; ++i) {
+                if (std::fabs(db[i] - expected_db[i]) > db_step / 2 + 0.01f) {
+                    fail(frame_test, "bin " + std::to_string(i) + " off by " +
+                         std::to_string(db[i] - expected_db[i]) + " dB");
+                    return;
+                }
+            }
+            break;
+        }
+
+        std::vector<float> part(7);
+        reader.read_db(k, 20, part.size(), part.data());
+        check_near(frame_test + "/range", part,
+                   std::vector<float>(db.begin() + 20, db.begin() + 27), 0);
+    }
+    if (reader.find_frame(frames.size() * FRAME_USECS) != frames.size()) {
+        fail(test, "found a frame after the end");
+    }
+}
+
+void test_spectrogram(std::mt19937 &rng)
+{
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        fail("spectrogram", "no temporary directory");
+        return;
+    }
+    const std::vector<RealFFTBlock> frames = make_frames(rng);
+    const std::pair<SpectrogramEncoding, const char*> encodings[] = {
+        {SpectrogramEncoding::FLOAT32, "float32"},
+        {SpectrogramEncoding::FLOAT16_DB, "float16_db"},
+        {SpectrogramEncoding::UINT16_DB, "uint16_db"},
+        {SpectrogramEncoding::UINT8_DB, "uint8_db"},
+    };
+    for (const auto &encoding: encodings) {
+        const std::string test = std::string("spectrogram/") + encoding.second;
+        const QString path = QDir(dir.path()).filePath(encoding.second);
+        {
+            SpectrogramWriter writer(path, encoding.first, FRAMES_PER_CHUNK);
+            writer.set_blocking(true);
+            for (const RealFFTBlock &frame: frames) {
+                writer.push(frame);
+            }
+            writer.close();
+            if (!writer.ok() || writer.dropped_chunks() != 0) {
+                fail(test, "write failed");
+                continue;
+            }
+        }
+        check_spectrogram(test, path, encoding.first, frames);
+
+        // cut off the index, as if the writer had crashed, so the reader
+        // has to walk the chunks
+        QFile file(path);
+        if (!file.open(QIODevice::ReadWrite)) {
+            fail(test, "cannot reopen");
+            continue;
+        }
+        uint64_t index_offset;
+        file.seek(file.size() - 16);
+        file.read(reinterpret_cast<char*>(&index_offset), sizeof(index_offset));
+        file.resize(index_offset);
+        file.close();
+        check_spectrogram(test + "/unindexed", path, encoding.first, frames);
+    }
+}
+
+}
+
+
+int main()
+{
+    std::mt19937 rng(1);
+
+    const std::pair<const char*, std::function<void()> > tests[] = {
+        {"elementwise", [&rng](){ test_elementwise(rng); }},
+        {"accumulators", [&rng](){ test_accumulators(rng); }},
+        {"complex", [&rng](){ test_complex(rng); }},
+        {"converters", [&rng](){ test_converters(rng); }},
+        {"db", [&rng](){ test_db(rng); }},
+        {"quantize", [&rng](){ test_quantize(rng); }},
+        {"peaks", [&rng](){ test_peaks(rng); }},
+        {"channels", [&rng](){ test_channels(rng); }},
+        {"sample_block", [&rng](){ test_sample_block(rng); }},
+        {"spsc_ring", test_spsc_ring},
+        {"spectrogram", [&rng](){ test_spectrogram(rng); }},
+    };
+    for (const auto &test: tests) {
+        const int before = failures;
+        try {
+            test.second();
+        } catch (const std::exception &e) {
+            fail(test.first, e.what());
+        }
+        std::cout << (failures == before ? "ok   " : "FAIL ") << test.first << std::endl;
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " failures" << std::endl;
+        return 1;
+    }
+    return 0;
+}
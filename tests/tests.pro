@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# Unit tests for the DSP kernels, the ring buffers and the spectrogram
+# file format; "make check" runs them
+#
+#-------------------------------------------------
+
+QT       += core multimedia
+
+TARGET = sigalyze-tests
+TEMPLATE = app
+CONFIG += console testcase
+CONFIG -= app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += tests.cpp \
+    ../engine.cpp \
+    ../dsp.cpp \
+    ../metrics.cpp \
+    ../spectrogram.cpp \
+    ../threadpolicy.cpp \
+    ../latencyprofile.cpp
+
+HEADERS += ../engine.h \
+    ../ringbuffer.h \
+    ../blockpool.h \
+    ../dsp.h \
+    ../metrics.h \
+    ../spectrogram.h \
+    ../threadpolicy.h \
+    ../latencyprofile.h
+
+QMAKE_CXXFLAGS += -std=c++14
+
+unix: CONFIG += link_pkgconfig
+unix: PKGCONFIG += fftw3f
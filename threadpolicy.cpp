@@ -0,0 +1,240 @@
+#include "threadpolicy.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef Q_OS_UNIX
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+#include "metrics.h"
+
+
+// CPU_SETSIZE of glibc
+static constexpr int MAX_CPU = 1023;
+
+static std::vector<std::string> split(const std::string &value, char separator)
+{
+    std::vector<std::string> result;
+    std::size_t begin = 0;
+    while (true) {
+        const std::size_t end = value.find(separator, begin);
+        result.emplace_back(value.substr(begin, end - begin));
+        if (end == std::string::npos) {
+            return result;
+        }
+        begin = end + 1;
+    }
+}
+
+static int parse_int(const std::string &value, int min, int max)
+{
+    std::size_t used = 0;
+    int result;
+    try {
+        result = std::stoi(value, &used);
+    } catch (const std::exception&) {
+        throw std::invalid_argument("not a number: " + value);
+    }
+    if (used != value.size() || result < min || result > max) {
+        throw std::invalid_argument("out of range: " + value);
+    }
+    return result;
+}
+
+static std::vector<int> parse_cpus(const std::string &value)
+{
+    std::vector<int> cpus;
+    for (const std::string &item: split(value, ',')) {
+        const std::size_t dash = item.find('-');
+        if (dash == std::string::npos) {
+            cpus.push_back(parse_int(item, 0, MAX_CPU));
+            continue;
+        }
+        const int first = parse_int(item.substr(0, dash), 0, MAX_CPU);
+        const int last = parse_int(item.substr(dash + 1), first, MAX_CPU);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+
+/* ThreadPolicies */
+
+ThreadPolicies &ThreadPolicies::global()
+{
+    static ThreadPolicies policies;
+    return policies;
+}
+
+std::string ThreadPolicies::role_of(const QString &thread_name)
+{
+    const std::string name = thread_name.toStdString();
+    return name.substr(0, name.find(':'));
+}
+
+void ThreadPolicies::parse(const std::string &spec)
+{
+    for (const std::string &item: split(spec, ';')) {
+        if (item.empty()) {
+            continue;
+        }
+        const std::size_t equals = item.find('=');
+        if (equals == std::string::npos || equals == 0) {
+            throw std::invalid_argument("expected role=policy: " + item);
+        }
+        const std::string role = item.substr(0, equals);
+        std::string rest = item.substr(equals + 1);
+
+        ThreadPolicy policy{SchedulingClass::DEFAULT, 0, {}};
+        const std::size_t at = rest.find('@');
+        if (at != std::string::npos) {
+            policy.cpus = parse_cpus(rest.substr(at + 1));
+            rest.resize(at);
+        }
+
+        const std::size_t colon = rest.find(':');
+        const std::string name = rest.substr(0, colon);
+        if (name == "fifo") {
+            policy.scheduling = SchedulingClass::FIFO;
+        } else if (name == "rr") {
+            policy.scheduling = SchedulingClass::ROUND_ROBIN;
+        } else if (name == "other") {
+            policy.scheduling = SchedulingClass::NORMAL;
+        } else if (!name.empty()) {
+            throw std::invalid_argument("unknown scheduling class: " + name);
+        }
+        if (colon != std::string::npos) {
+            if (policy.scheduling != SchedulingClass::FIFO &&
+                    policy.scheduling != SchedulingClass::ROUND_ROBIN)
+            {
+                throw std::invalid_argument("priority without fifo or rr: " + item);
+            }
+            policy.priority = parse_int(rest.substr(colon + 1), 1, 99);
+        } else if (policy.scheduling == SchedulingClass::FIFO ||
+                   policy.scheduling == SchedulingClass::ROUND_ROBIN)
+        {
+            throw std::invalid_argument("missing priority: " + item);
+        }
+        set(role, policy);
+    }
+}
+
+void ThreadPolicies::set(const std::string &role, const ThreadPolicy &policy)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_policies[role] = policy;
+    m_reported.erase(role);
+}
+
+bool ThreadPolicies::has(const std::string &role) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_policies.count(role) > 0;
+}
+
+void ThreadPolicies::report_failure(const std::string &role, const std::string &what)
+{
+    MetricsRegistry::global().counter("rt.policy_failures").add();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool &reported = m_reported[role];
+        if (reported) {
+            return;
+        }
+        reported = true;
+    }
+    std::cerr << "failed to apply thread policy of " << role << ": "
+              << what << std::endl;
+}
+
+bool ThreadPolicies::apply(const std::string &role)
+{
+    ThreadPolicy policy;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_policies.find(role);
+        if (iter == m_policies.end()) {
+            return false;
+        }
+        policy = iter->second;
+    }
+
+#ifdef Q_OS_LINUX
+    bool ok = true;
+    const pthread_t self = pthread_self();
+    if (!policy.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (const int cpu: policy.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        const int error = pthread_setaffinity_np(self, sizeof(set), &set);
+        if (error != 0) {
+            report_failure(role, std::string("affinity: ") + std::strerror(error));
+            ok = false;
+        }
+    }
+
+    if (policy.scheduling != SchedulingClass::DEFAULT) {
+        sched_param param{};
+        int native = SCHED_OTHER;
+        switch (policy.scheduling) {
+        case SchedulingClass::FIFO:
+            native = SCHED_FIFO;
+            param.sched_priority = policy.priority;
+            break;
+        case SchedulingClass::ROUND_ROBIN:
+            native = SCHED_RR;
+            param.sched_priority = policy.priority;
+            break;
+        default:
+            break;
+        }
+        const int error = pthread_setschedparam(self, native, &param);
+        if (error != 0) {
+            report_failure(role, std::string("scheduling: ") + std::strerror(error));
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        MetricsRegistry::global().counter("rt.policies_applied").add();
+    }
+    return ok;
+#else
+    report_failure(role, "not supported on this platform");
+    return false;
+#endif
+}
+
+void ThreadPolicies::attach(QThread &thread)
+{
+    const std::string role = role_of(thread.objectName());
+    // started is emitted from within the new thread, before its event loop
+    QObject::connect(&thread, &QThread::started,
+                     &thread, [this, role](){ apply(role); },
+                     Qt::DirectConnection);
+}
+
+
+bool lock_process_memory()
+{
+#ifdef Q_OS_UNIX
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        std::cerr << "failed to lock memory: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    MetricsRegistry::global().gauge("rt.memory_locked").set(1);
+    return true;
+#else
+    std::cerr << "locking memory is not supported on this platform" << std::endl;
+    return false;
+#endif
+}
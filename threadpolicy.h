@@ -0,0 +1,88 @@
+#ifndef THREADPOLICY_H
+#define THREADPOLICY_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <QThread>
+
+
+enum class SchedulingClass
+{
+    // leave the thread with the scheduler it inherited
+    DEFAULT,
+    NORMAL,
+    FIFO,
+    ROUND_ROBIN
+};
+
+
+struct ThreadPolicy
+{
+    SchedulingClass scheduling;
+    // only used for FIFO and ROUND_ROBIN
+    int priority;
+    // cores the thread may run on; empty for any
+    std::vector<int> cpus;
+};
+
+
+// Scheduling and placement of the pipeline threads by role. The role of a
+// thread is its object name up to the first ':', e.g. AudioPipe, FFT, RMS,
+// FFTBank, ZoomFFT or NetworkSink; the workers of the shared FFT pool use
+// FFTWorker. A thread without a policy of its own is left alone.
+//
+// Policies are applied by the threads themselves when they start, so they
+// must be set before the pipeline is built. A policy the process may not
+// apply (typically SCHED_FIFO without CAP_SYS_NICE or an RLIMIT_RTPRIO) is
+// reported once per role and counted in rt.policy_failures; the thread runs
+// on with what it had.
+class ThreadPolicies
+{
+public:
+    ThreadPolicies() = default;
+    ThreadPolicies(const ThreadPolicies &other) = delete;
+    ThreadPolicies &operator=(const ThreadPolicies &other) = delete;
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<std::string, ThreadPolicy> m_policies;
+    std::map<std::string, bool> m_reported;
+
+private:
+    void report_failure(const std::string &role, const std::string &what);
+
+public:
+    static ThreadPolicies &global();
+
+    static std::string role_of(const QString &thread_name);
+
+    // role=class[:priority][@cpus], separated by ';', with class one of
+    // fifo, rr, other or empty and cpus a list like 2,4-7, e.g.
+    // AudioPipe=fifo:80@2;FFT=fifo:60@3-5;RMS=@1; throws
+    // std::invalid_argument if the spec is malformed
+    void parse(const std::string &spec);
+
+    void set(const std::string &role, const ThreadPolicy &policy);
+    bool has(const std::string &role) const;
+
+    // applies the policy of role to the calling thread; false if there is
+    // none or it could not be applied
+    bool apply(const std::string &role);
+
+    // makes thread apply the policy of its role as it starts; call after
+    // naming the thread and before starting it
+    void attach(QThread &thread);
+
+};
+
+
+// mlockall() of everything mapped now and later, so that pages of the
+// sample and frame pools are never paged out under memory pressure.
+// Returns false and tells why on stderr if the process may not lock,
+// usually because of RLIMIT_MEMLOCK.
+bool lock_process_memory();
+
+#endif // THREADPOLICY_H
@@ -2,6 +2,9 @@
 
 uniform mat4 proj;
 uniform float offset;
+// rows to pixels, and the horizontal scale and offset for history tiles
+uniform float row_scale;
+uniform vec2 x_transform;
 
 in vec2 position;
 in vec2 tc0;
@@ -10,6 +13,8 @@ out vec2 frag_tc0;
 
 void main(void)
 {
-    gl_Position = proj * vec4(position + vec2(0, offset), 0, 1);
+    vec2 pos = vec2(position.x * x_transform.x + x_transform.y,
+                    position.y * row_scale + offset);
+    gl_Position = proj * vec4(pos, 0, 1);
     frag_tc0 = tc0;
 }
@@ -0,0 +1,196 @@
+#include "waterfallhistory.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "dsp.h"
+
+
+// number of levels until n items fit into one tile of size items
+static uint32_t levels_for(uint64_t n, uint64_t size)
+{
+    uint32_t levels = 1;
+    while (n > size) {
+        n = (n + 1) / 2;
+        ++levels;
+    }
+    return levels;
+}
+
+static uint32_t first_frame_bins(const SpectrogramReader &reader)
+{
+    if (reader.frame_count() == 0) {
+        throw std::runtime_error("spectrogram has no frames");
+    }
+    return reader.frame_bins(0);
+}
+
+
+/* WaterfallHistory */
+
+WaterfallHistory::WaterfallHistory(const QString &path, QObject *parent):
+    QObject(parent),
+    m_reader(path),
+    m_bins(first_frame_bins(m_reader)),
+    m_time_levels(levels_for(m_reader.frame_count(), TILE_ROWS)),
+    m_freq_levels(levels_for(m_bins, TILE_COLUMNS)),
+    m_floor_db(20.f * std::log10(MIN_MAGNITUDE)),
+    m_use_clock(0),
+    m_terminated(false),
+    m_built_metric(MetricsRegistry::global().counter("history.built_tiles")),
+    m_build_time(MetricsRegistry::global().histogram("history.build_usecs"))
+{
+    auto empty = std::make_shared<WaterfallTile>();
+    empty->db.assign((std::size_t)TILE_ROWS * TILE_COLUMNS, m_floor_db);
+    m_empty = std::move(empty);
+
+    m_thread = std::thread([this](){ work_loop(); });
+}
+
+WaterfallHistory::~WaterfallHistory()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_terminated = true;
+        m_wanted.clear();
+    }
+    m_wakeup.notify_all();
+    m_thread.join();
+}
+
+std::shared_ptr<const WaterfallTile> WaterfallHistory::cached(const WaterfallTileKey &key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_cache.find(key);
+    if (iter == m_cache.end()) {
+        return nullptr;
+    }
+    iter->second.last_used = ++m_use_clock;
+    return iter->second.tile;
+}
+
+void WaterfallHistory::insert(const WaterfallTileKey &key,
+                              std::shared_ptr<const WaterfallTile> tile)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_cache.size() >= MAX_CACHED_TILES) {
+        auto oldest = std::min_element(
+                    m_cache.begin(), m_cache.end(),
+                    [](const std::pair<const WaterfallTileKey, CacheEntry> &a,
+                       const std::pair<const WaterfallTileKey, CacheEntry> &b){
+            return a.second.last_used < b.second.last_used;
+        });
+        m_cache.erase(oldest);
+    }
+    m_cache[key] = CacheEntry{std::move(tile), ++m_use_clock};
+}
+
+std::shared_ptr<const WaterfallTile> WaterfallHistory::build(const WaterfallTileKey &key)
+{
+    const uint64_t first_frame = key.row * TILE_ROWS << key.time_level;
+    const uint64_t first_bin = (uint64_t)key.column * TILE_COLUMNS << key.freq_level;
+    if (first_frame >= m_reader.frame_count() || first_bin >= m_bins) {
+        return m_empty;
+    }
+    std::shared_ptr<const WaterfallTile> result = cached(key);
+    if (result) {
+        return result;
+    }
+
+    auto tile = std::make_shared<WaterfallTile>();
+    tile->db.resize((std::size_t)TILE_ROWS * TILE_COLUMNS);
+    if (key.time_level == 0) {
+        const global_clock::time_point build_start = global_clock::now();
+        build_from_frames(key, *tile);
+        m_build_time.record_since(build_start);
+    } else {
+        build_from_children(key, *tile);
+    }
+    m_built_metric.add();
+    insert(key, tile);
+    return tile;
+}
+
+void WaterfallHistory::build_from_frames(const WaterfallTileKey &key, WaterfallTile &tile)
+{
+    const uint32_t group = 1u << key.freq_level;
+    const uint64_t first_bin = (uint64_t)key.column * TILE_COLUMNS * group;
+    for (uint32_t r = 0; r < TILE_ROWS; ++r) {
+        float *dest = &tile.db[(std::size_t)r * TILE_COLUMNS];
+        const uint64_t frame = key.row * TILE_ROWS + r;
+        const uint32_t bins = frame < m_reader.frame_count() ?
+                    m_reader.frame_bins(frame) : 0;
+        if (first_bin >= bins) {
+            std::fill(dest, dest + TILE_COLUMNS, m_floor_db);
+            continue;
+        }
+
+        // only the bins of this column of tiles are decoded
+        const uint32_t count = std::min<uint64_t>(bins - first_bin,
+                                                  (uint64_t)TILE_COLUMNS * group);
+        m_row.resize(count);
+        m_reader.read_db(frame, first_bin, count, m_row.data());
+        for (uint32_t c = 0; c < TILE_COLUMNS; ++c) {
+            const uint32_t begin = c * group;
+            if (begin >= count) {
+                std::fill(dest + c, dest + TILE_COLUMNS, m_floor_db);
+                break;
+            }
+            const uint32_t end = std::min(begin + group, count);
+            dest[c] = *std::max_element(&m_row[begin], &m_row[0] + end);
+        }
+    }
+}
+
+void WaterfallHistory::build_from_children(const WaterfallTileKey &key, WaterfallTile &tile)
+{
+    static constexpr uint32_t HALF = TILE_ROWS / 2;
+    for (uint32_t half = 0; half < 2; ++half) {
+        const WaterfallTileKey child_key{key.time_level - 1, key.freq_level,
+                                         key.row * 2 + half, key.column};
+        const std::shared_ptr<const WaterfallTile> child = build(child_key);
+        for (uint32_t r = 0; r < HALF; ++r) {
+            float *dest = &tile.db[(std::size_t)(half * HALF + r) * TILE_COLUMNS];
+            const float *src = &child->db[(std::size_t)2 * r * TILE_COLUMNS];
+            std::copy(src, src + TILE_COLUMNS, dest);
+            max_hold(src + TILE_COLUMNS, dest, TILE_COLUMNS);
+        }
+    }
+}
+
+void WaterfallHistory::work_loop()
+{
+    while (true) {
+        WaterfallTileKey key;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeup.wait(lock, [this](){ return m_terminated || !m_wanted.empty(); });
+            if (m_terminated) {
+                return;
+            }
+            key = m_wanted.front();
+            m_wanted.pop_front();
+        }
+        build(key);
+        emit tile_ready();
+    }
+}
+
+std::shared_ptr<const WaterfallTile> WaterfallHistory::find(const WaterfallTileKey &key)
+{
+    const uint64_t first_frame = key.row * TILE_ROWS << key.time_level;
+    const uint64_t first_bin = (uint64_t)key.column * TILE_COLUMNS << key.freq_level;
+    if (first_frame >= m_reader.frame_count() || first_bin >= m_bins) {
+        return m_empty;
+    }
+    return cached(key);
+}
+
+void WaterfallHistory::request(const std::vector<WaterfallTileKey> &keys)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_wanted.assign(keys.begin(), keys.end());
+    }
+    m_wakeup.notify_all();
+}
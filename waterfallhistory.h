@@ -0,0 +1,152 @@
+#ifndef WATERFALLHISTORY_H
+#define WATERFALLHISTORY_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <thread>
+#include <tuple>
+
+#include "spectrogram.h"
+
+
+struct WaterfallTileKey
+{
+    // each row of the tile holds the max-hold of 2^time_level frames and
+    // each column that of 2^freq_level bins
+    uint32_t time_level;
+    uint32_t freq_level;
+    // position in whole tiles of that level
+    uint64_t row;
+    uint32_t column;
+
+    inline bool operator<(const WaterfallTileKey &other) const
+    {
+        return std::tie(time_level, freq_level, row, column) <
+                std::tie(other.time_level, other.freq_level, other.row, other.column);
+    }
+
+    inline bool operator==(const WaterfallTileKey &other) const
+    {
+        return time_level == other.time_level && freq_level == other.freq_level &&
+                row == other.row && column == other.column;
+    }
+};
+
+
+struct WaterfallTile
+{
+    // TILE_ROWS rows of TILE_COLUMNS dB values, oldest row first; what lies
+    // beyond the recording is at the dB floor
+    std::vector<float> db;
+};
+
+
+// Serves a recorded spectrogram as tiles of a time and frequency pyramid,
+// for views scrolling and zooming through hours of history.
+//
+// Level 0 tiles are read straight from the memory mapped file; a tile of a
+// higher time level is the max-hold of the two tiles below it, so each level
+// costs half of the one below and narrow events stay visible when zoomed
+// out. Tiles are built on a thread of their own in the order the view asks
+// for them and kept in a cache of at most MAX_CACHED_TILES, least recently
+// used first out.
+class WaterfallHistory: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr uint32_t TILE_ROWS = 256;
+    static constexpr uint32_t TILE_COLUMNS = 512;
+    // 512 kB each
+    static constexpr std::size_t MAX_CACHED_TILES = 256;
+
+public:
+    WaterfallHistory() = delete;
+    explicit WaterfallHistory(const QString &path, QObject *parent = nullptr);
+    WaterfallHistory(const WaterfallHistory &other) = delete;
+    WaterfallHistory(WaterfallHistory &&src) = delete;
+    WaterfallHistory &operator=(const WaterfallHistory &other) = delete;
+    WaterfallHistory &operator=(WaterfallHistory &&src) = delete;
+    ~WaterfallHistory() override;
+
+private:
+    struct CacheEntry
+    {
+        std::shared_ptr<const WaterfallTile> tile;
+        uint64_t last_used;
+    };
+
+    const SpectrogramReader m_reader;
+    const uint32_t m_bins;
+    const uint32_t m_time_levels;
+    const uint32_t m_freq_levels;
+    const float m_floor_db;
+    // for tiles entirely outside of the recording
+    std::shared_ptr<const WaterfallTile> m_empty;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::map<WaterfallTileKey, CacheEntry> m_cache;
+    uint64_t m_use_clock;
+    std::deque<WaterfallTileKey> m_wanted;
+    bool m_terminated;
+
+    // worker thread only
+    std::vector<float> m_row;
+
+    MetricCounter &m_built_metric;
+    LatencyHistogram &m_build_time;
+
+    std::thread m_thread;
+
+private:
+    std::shared_ptr<const WaterfallTile> cached(const WaterfallTileKey &key);
+    void insert(const WaterfallTileKey &key, std::shared_ptr<const WaterfallTile> tile);
+    std::shared_ptr<const WaterfallTile> build(const WaterfallTileKey &key);
+    void build_from_frames(const WaterfallTileKey &key, WaterfallTile &tile);
+    void build_from_children(const WaterfallTileKey &key, WaterfallTile &tile);
+    void work_loop();
+
+public:
+    inline uint64_t frame_count() const
+    {
+        return m_reader.frame_count();
+    }
+
+    // of the first frame; frames with other sizes are shown bin by bin
+    inline uint32_t bins() const
+    {
+        return m_bins;
+    }
+
+    // the highest level holds the whole recording in a single tile
+    inline uint32_t time_levels() const
+    {
+        return m_time_levels;
+    }
+
+    // the highest level holds all bins in a single tile
+    inline uint32_t freq_levels() const
+    {
+        return m_freq_levels;
+    }
+
+    inline float floor_db() const
+    {
+        return m_floor_db;
+    }
+
+    // the tile if it is cached, nullptr otherwise; from any thread
+    std::shared_ptr<const WaterfallTile> find(const WaterfallTileKey &key);
+
+    // replaces whatever is still waiting to be built by keys, first come
+    // first built
+    void request(const std::vector<WaterfallTileKey> &keys);
+
+signals:
+    // from the worker thread after each requested tile got cached
+    void tile_ready();
+
+};
+
+#endif // WATERFALLHISTORY_H
@@ -0,0 +1,248 @@
+#include "zoomfft.h"
+
+#include <cmath>
+
+#include <QStringList>
+
+#include "dsp.h"
+#include "threadpolicy.h"
+
+
+/* ZoomFFTProcessor */
+
+ZoomFFTProcessor::ZoomFFTProcessor(const SampleStream &source,
+                                   const ZoomBand &band,
+                                   FFTPlannerRigor rigor):
+    m_band(band),
+    m_plan(band.size, rigor),
+    m_sample_rate(0),
+    m_t_sample(0),
+    m_input_samples(0),
+    m_nco_step(0),
+    m_history_re((std::size_t)TAPS_PER_PHASE * std::max<uint32_t>(band.decimation, 1)),
+    m_history_im((std::size_t)TAPS_PER_PHASE * std::max<uint32_t>(band.decimation, 1)),
+    m_decimation_phase(0),
+    m_in_buffer(2 * std::max<uint32_t>(band.size, 1)),
+    m_outputs(0),
+    m_fill(0),
+    m_shift_remaining(0),
+    m_queue_delay(MetricsRegistry::global().histogram("zoomfft.queue_delay_usecs")),
+    m_compute_time(MetricsRegistry::global().histogram(
+                       "zoomfft." + std::to_string(band.size) + ".compute_usecs"))
+{
+    if (band.decimation == 0) {
+        throw std::invalid_argument("decimation must be at least 1");
+    }
+    if (band.size < 2 || band.size % 2 != 0) {
+        throw std::invalid_argument("zoom FFT size must be even");
+    }
+
+    connect(&source, &SampleStream::samples_available,
+            this, &ZoomFFTProcessor::process_samples,
+            Qt::QueuedConnection);
+
+    make_lowpass(m_taps, band.decimation);
+
+    std::vector<float> window(band.size);
+    FFTProcessor::make_window(window);
+    m_norm = 0;
+    m_window.resize(2 * band.size);
+    for (uint32_t i = 0; i < band.size; ++i) {
+        m_window[2*i] = window[i];
+        m_window[2*i+1] = window[i];
+        m_norm += window[i];
+    }
+}
+
+void ZoomFFTProcessor::make_lowpass(std::vector<float> &dest, uint32_t decimation)
+{
+    // windowed sinc with the cutoff at the edge of the decimated band
+    const uint32_t n = TAPS_PER_PHASE * decimation;
+    dest.resize(n);
+    FFTProcessor::make_window(dest);
+    const double cutoff = 0.5 / decimation;
+    const double center = (n - 1) / 2.;
+    double sum = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        const double x = 2 * cutoff * (i - center);
+        const double sinc = x == 0 ? 1. : std::sin(M_PI * x) / (M_PI * x);
+        dest[i] *= sinc;
+        sum += dest[i];
+    }
+    for (float &tap: dest) {
+        tap /= sum;
+    }
+}
+
+void ZoomFFTProcessor::reset(const SampleBlock &block)
+{
+    m_sample_rate = block.sample_rate;
+    m_nco_step = 2 * M_PI * m_band.center_hz / m_sample_rate;
+    m_input_samples = 0;
+    m_decimation_phase = 0;
+    m_outputs = 0;
+    m_fill = 0;
+    m_shift_remaining = 0;
+
+    const std::vector<float> zeros(m_taps.size(), 0.f);
+    m_history_re.append(zeros.begin(), zeros.end());
+    m_history_im.append(zeros.begin(), zeros.end());
+}
+
+void ZoomFFTProcessor::process_samples(std::shared_ptr<const SampleBlock> input_block)
+{
+    const SampleBlock &data = *input_block;
+    m_queue_delay.record_since(data.published);
+
+    const float *samples = data.samples(SampleBlock::DOWNMIX);
+    if (samples == nullptr) {
+        return;
+    }
+
+    if (m_sample_rate != data.sample_rate) {
+        reset(data);
+    }
+    m_t = data.t;
+    m_t_sample = m_input_samples;
+
+    const global_clock::time_point compute_start = global_clock::now();
+    const std::size_t n = data.frames;
+    m_mix_re.resize(n);
+    m_mix_im.resize(n);
+    mix_down(samples, m_mix_re.data(), m_mix_im.data(), n,
+             std::fmod(m_input_samples * m_nco_step, 2 * M_PI), m_nco_step);
+    m_input_samples += n;
+
+    const std::size_t taps = m_taps.size();
+    std::size_t pos = 0;
+    while (pos < n) {
+        const std::size_t take = std::min<std::size_t>(
+                    n - pos, m_band.decimation - m_decimation_phase);
+        m_history_re.append(&m_mix_re[pos], &m_mix_re[pos] + take);
+        m_history_im.append(&m_mix_im[pos], &m_mix_im[pos] + take);
+        m_decimation_phase += take;
+        pos += take;
+        if (m_decimation_phase < m_band.decimation) {
+            break;
+        }
+        m_decimation_phase = 0;
+        push_baseband(dot_product(m_history_re.window(), m_taps.data(), taps),
+                      dot_product(m_history_im.window(), m_taps.data(), taps));
+    }
+    m_compute_time.record_since(compute_start);
+}
+
+void ZoomFFTProcessor::push_baseband(float re, float im)
+{
+    ++m_outputs;
+    if (m_shift_remaining > 0) {
+        --m_shift_remaining;
+        return;
+    }
+
+    const float pair[2] = {re, im};
+    m_in_buffer.append(pair, pair + 2);
+    ++m_fill;
+    if (m_fill < m_band.size) {
+        return;
+    }
+
+    emit_frame();
+
+    const uint32_t shift = std::max<uint64_t>(
+                1, (uint64_t)m_band.period_msec * m_sample_rate / 1000 / m_band.decimation);
+    if (shift >= m_band.size) {
+        m_shift_remaining = shift - m_band.size;
+        m_fill = 0;
+    } else {
+        m_fill = m_band.size - shift;
+    }
+}
+
+void ZoomFFTProcessor::emit_frame()
+{
+    const uint32_t size = m_band.size;
+    multiply(m_in_buffer.window(), m_window.data(), m_plan.input(), 2 * size);
+    m_plan.execute();
+
+    std::shared_ptr<RealFFTBlock> block = m_pool.acquire();
+    // the input sample the first output of the frame was taken at, less the
+    // group delay of the filter
+    const int64_t first_output = m_outputs - size;
+    const int64_t input_sample = (first_output + 1) * m_band.decimation - 1 -
+            (int64_t)(m_taps.size() - 1) / 2;
+    block->t = m_t + std::chrono::microseconds(
+                (input_sample - (int64_t)m_t_sample) * 1000000 / (int64_t)m_sample_rate);
+
+    const float rate = (float)m_sample_rate / m_band.decimation;
+    block->channel = SampleBlock::DOWNMIX;
+    block->fmin = m_band.center_hz - rate / 2;
+    block->fmax = m_band.center_hz + rate / 2 - rate / size;
+    block->fft.resize(size);
+    // negative frequencies first
+    complex_magnitudes(m_plan.output() + size, block->fft.data(),
+                       size / 2, 1.f / m_norm);
+    complex_magnitudes(m_plan.output(), block->fft.data() + size / 2,
+                       size / 2, 1.f / m_norm);
+
+    block->published = global_clock::now();
+    emit result_available(std::move(block));
+}
+
+
+/* ZoomFFT */
+
+ZoomFFT::ZoomFFT(const SampleStream &source,
+                 const ZoomBand &band,
+                 FFTPlannerRigor rigor):
+    m_processor(source, band, rigor)
+{
+    setObjectName(QString("ZoomFFT:%1Hz/%2:%3").arg(band.center_hz)
+                  .arg(band.decimation).arg(band.size));
+    ThreadPolicies::global().attach(*this);
+    start();
+    m_processor.moveToThread(this);
+}
+
+ZoomFFT::~ZoomFFT()
+{
+    exit();
+    wait();
+}
+
+void ZoomFFT::drain()
+{
+    QMetaObject::invokeMethod(&m_processor, [](){}, Qt::BlockingQueuedConnection);
+}
+
+
+bool parse_zoom_band(const QString &text, uint32_t default_period_msec,
+                     ZoomBand &band)
+{
+    const QStringList parts = text.split(":");
+    if (parts.size() != 3 && parts.size() != 4) {
+        return false;
+    }
+
+    bool ok;
+    band.center_hz = parts[0].toFloat(&ok);
+    if (!ok || band.center_hz < 0) {
+        return false;
+    }
+    band.decimation = parts[1].toUInt(&ok);
+    if (!ok || band.decimation == 0) {
+        return false;
+    }
+    band.size = parts[2].toUInt(&ok);
+    if (!ok || band.size < 2 || band.size % 2 != 0) {
+        return false;
+    }
+    band.period_msec = default_period_msec;
+    if (parts.size() == 4) {
+        band.period_msec = parts[3].toUInt(&ok);
+        if (!ok || band.period_msec == 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,134 @@
+#ifndef ZOOMFFT_H
+#define ZOOMFFT_H
+
+#include "engine.h"
+
+
+// The band center_hz +- sample_rate / (2 * decimation) around a center
+// frequency, analysed with a size point transform. The resolution is
+// sample_rate / (decimation * size), so a narrow band can be resolved finely
+// with a small FFT.
+struct ZoomBand
+{
+    float center_hz;
+    uint32_t decimation;
+    uint32_t size;
+    uint32_t period_msec;
+};
+
+
+// Zoom FFT: the samples are mixed down so that center_hz ends up at DC,
+// low-pass filtered and decimated to complex baseband, and transformed there.
+// The decimating FIR only evaluates the outputs that are kept, so it costs
+// TAPS_PER_PHASE complex multiply-adds per input sample regardless of the
+// decimation (the polyphase form of the filter). The frames have size bins
+// from fmin to fmax; the outer ends of the band lie in the transition band
+// of the filter and are attenuated.
+class ZoomFFTProcessor: public QObject
+{
+    Q_OBJECT
+public:
+    static constexpr uint32_t TAPS_PER_PHASE = 16;
+
+public:
+    ZoomFFTProcessor() = delete;
+    explicit ZoomFFTProcessor(const SampleStream &source,
+                              const ZoomBand &band,
+                              FFTPlannerRigor rigor = FFTPlannerRigor::MEASURE);
+    ZoomFFTProcessor(const ZoomFFTProcessor &other) = delete;
+    ZoomFFTProcessor(ZoomFFTProcessor &&src) = delete;
+    ZoomFFTProcessor &operator=(const ZoomFFTProcessor &other) = delete;
+    ZoomFFTProcessor &operator=(ZoomFFTProcessor &&src) = delete;
+
+private:
+    const ZoomBand m_band;
+    ComplexFFTPlan m_plan;
+    uint32_t m_sample_rate;
+
+    // stream time of input sample m_t_sample, taken from the latest block
+    global_clock::time_point m_t;
+    uint64_t m_t_sample;
+    uint64_t m_input_samples;
+    double m_nco_step;
+
+    std::vector<float> m_mix_re;
+    std::vector<float> m_mix_im;
+    // linear phase, so symmetric and applied as is to the filter history
+    std::vector<float> m_taps;
+    MirroredRingBuffer<float> m_history_re;
+    MirroredRingBuffer<float> m_history_im;
+    uint32_t m_decimation_phase;
+
+    // decimated samples as interleaved (re, im) pairs
+    MirroredRingBuffer<float> m_in_buffer;
+    uint64_t m_outputs;
+    uint32_t m_fill;
+    uint32_t m_shift_remaining;
+    // the window repeated for re and im of each sample
+    std::vector<float> m_window;
+    float m_norm;
+
+    BlockPool<RealFFTBlock> m_pool;
+
+    LatencyHistogram &m_queue_delay;
+    LatencyHistogram &m_compute_time;
+
+private:
+    void reset(const SampleBlock &block);
+    void push_baseband(float re, float im);
+    void emit_frame();
+
+private slots:
+    void process_samples(std::shared_ptr<const SampleBlock> input_block);
+
+public:
+    inline const ZoomBand &band() const
+    {
+        return m_band;
+    }
+
+    static void make_lowpass(std::vector<float> &dest, uint32_t decimation);
+
+signals:
+    void result_available(std::shared_ptr<const RealFFTBlock> data);
+
+};
+
+
+class ZoomFFT: public QThread
+{
+    Q_OBJECT
+
+public:
+    ZoomFFT() = delete;
+    explicit ZoomFFT(const SampleStream &source,
+                     const ZoomBand &band,
+                     FFTPlannerRigor rigor = FFTPlannerRigor::MEASURE);
+    ZoomFFT(const ZoomFFT &other) = delete;
+    ZoomFFT(ZoomFFT &&src) = delete;
+    ZoomFFT &operator=(const ZoomFFT &other) = delete;
+    ZoomFFT &operator=(ZoomFFT &&src) = delete;
+    ~ZoomFFT() override;
+
+private:
+    ZoomFFTProcessor m_processor;
+
+public:
+    inline const ZoomFFTProcessor &processor() const
+    {
+        return m_processor;
+    }
+
+    // block until everything queued to the processor so far is processed
+    void drain();
+
+};
+
+
+// center_hz:decimation:size[:msecs], e.g. 1000:64:1024:50; without msecs the
+// period is default_period_msec
+bool parse_zoom_band(const QString &text, uint32_t default_period_msec,
+                     ZoomBand &band);
+
+
+#endif // ZOOMFFT_H